@@ -0,0 +1,133 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Linux host demo with simulated NOR Flash.
+ * Created on: 2026-10-15
+ */
+
+#include "flash.h"
+#include "flash_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Env demo.
+ */
+void test_env(void) {
+    uint32_t i_boot_times = 0;
+    char *c_old_boot_times, c_new_boot_times[11] = {0};
+
+    /* get the boot count number from Env */
+    c_old_boot_times = flash_get_env("boot_times");
+    FLASH_ASSERT(c_old_boot_times);
+    i_boot_times = atol(c_old_boot_times);
+    /* boot count +1 */
+    i_boot_times ++;
+    printf("The system now boot %u times\n", i_boot_times);
+    /* interger to string */
+    sprintf(c_new_boot_times,"%u", i_boot_times);
+    /* set and store the boot count number to Env */
+    flash_set_env("boot_times", c_new_boot_times);
+    flash_save_env();
+}
+
+/**
+ * Print the simulated Flash operations statistics.
+ */
+static void print_sim_stats(void) {
+    flash_sim_stats stats;
+
+    flash_sim_get_stats(&stats);
+    printf("Flash read: %u times, %llu bytes\n", stats.read_cnt,
+            (unsigned long long) stats.read_bytes);
+    printf("Flash program: %u times, %llu bytes\n", stats.program_cnt,
+            (unsigned long long) stats.program_bytes);
+    printf("Flash erase: %u pages\n", stats.erase_cnt);
+    printf("Flash busy time: %llu.%03llu ms\n", (unsigned long long) stats.elapsed_ns / 1000000,
+            (unsigned long long) stats.elapsed_ns / 1000 % 1000);
+}
+
+/**
+ * Print the usage.
+ *
+ * @param name program name
+ */
+static void usage(const char *name) {
+    printf("Usage: %s [-f image] [-t typ|max|none] [-r]\n", name);
+    printf("  -f  Flash image file, the Flash is a RAM buffer when it's not set\n");
+    printf("  -t  Flash timing model of STM32F10x datasheet, default is typ\n");
+    printf("  -r  sleep for the Flash operations time\n");
+}
+
+int main(int argc, char **argv) {
+    const char *image_path = NULL;
+    const flash_sim_timing *timing = &flash_sim_timing_typ;
+    int realtime = 0, opt;
+
+    while ((opt = getopt(argc, argv, "f:t:rh")) != -1) {
+        switch (opt) {
+        case 'f':
+            image_path = optarg;
+            break;
+        case 't':
+            if (!strcmp(optarg, "typ")) {
+                timing = &flash_sim_timing_typ;
+            } else if (!strcmp(optarg, "max")) {
+                timing = &flash_sim_timing_max;
+            } else if (!strcmp(optarg, "none")) {
+                timing = NULL;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            realtime = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (flash_sim_init(image_path) != 0) {
+        printf("Simulated Flash initialize failed.\n");
+        return 1;
+    }
+    flash_sim_set_timing(timing, realtime);
+
+    /* EasyFlash initialization */
+    if (flash_init() == FLASH_NO_ERR) {
+        /* test Env demo */
+        test_env();
+    } else {
+        printf("EasyFlash initialize failed.\n");
+        flash_sim_deinit();
+        return 1;
+    }
+
+    print_sim_stats();
+#ifdef FLASH_USING_STATS
+    flash_print_stats();
+#endif
+    flash_sim_deinit();
+
+    return 0;
+}
@@ -0,0 +1,421 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Environment variables benchmark on simulated NOR Flash.
+ *           Every configuration (keys number, key size and value size) runs in a new process on
+ *           an erased Flash, and every operation phase outputs one JSON line, e.g.
+ *           {"version":"1.03.10","mode":"normal","keys":100,"key_size":8,"value_size":8,
+ *            "op":"get","hit_ratio":0.50,"ops":10000,...}
+ *           The CPU time is measured on host, the Flash time is charged by the simulated Flash
+ *           cost model, so only the Flash time is comparable with the target.
+ * Created on: 2026-10-16
+ */
+
+#include "flash.h"
+#include "flash_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* the maximum key or value size */
+#define BENCH_STR_MAX                   128
+/* get operations number for every hit ratio */
+#define BENCH_GET_OPS                   10000
+/* the maximum update and save rounds */
+#define BENCH_UPDATE_ROUNDS             100
+/* load operations number */
+#define BENCH_LOAD_OPS                  10
+
+#if defined(FLASH_ENV_USING_WEAR_LEVELING_MODE)
+#define BENCH_MODE                      "wl"
+#elif defined(FLASH_ENV_USING_LOG_MODE)
+#define BENCH_MODE                      "log"
+#else
+#define BENCH_MODE                      "normal"
+#endif
+
+/* keys number of every configuration */
+static const size_t bench_keys[] = { 10, 100, 1000, 10000 };
+/* key and value size of every configuration */
+static const size_t bench_sizes[][2] = { { 8, 8 }, { 16, 64 } };
+/* hit ratio of get operations */
+static const double bench_hit_ratios[] = { 1.0, 0.5, 0.0 };
+
+/* operation phase result */
+typedef struct {
+    const char *op;
+    double hit_ratio;          /* it's negative when the operation is not get */
+    size_t ops;
+    uint64_t *cpu_ns;          /* host CPU time of every operation */
+    uint64_t *flash_ns;        /* simulated Flash time of every operation */
+    size_t updates;            /* logical updates number for write amplification */
+    flash_sim_stats start;     /* Flash statistics at the phase start */
+} bench_phase;
+
+/* output file, the library logs are not mixed in it */
+static FILE *out;
+/* current configuration */
+static size_t cur_keys, cur_key_size, cur_value_size;
+
+/**
+ * Get the host monotonic time.
+ *
+ * @return time (ns)
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Make the key string.
+ *
+ * @param buf key buffer
+ * @param prefix 'k' for existing keys, 'm' for missing keys
+ * @param index key index
+ */
+static void make_key(char *buf, char prefix, size_t index) {
+    buf[0] = prefix;
+    snprintf(buf + 1, cur_key_size, "%0*lu", (int) cur_key_size - 1, (unsigned long) index);
+}
+
+/**
+ * Make the value string, it has the same size for every round, so the update is in place.
+ *
+ * @param buf value buffer
+ * @param round update round
+ */
+static void make_value(char *buf, size_t round) {
+    memset(buf, 'a' + round % 26, cur_value_size);
+    buf[cur_value_size] = '\0';
+}
+
+/**
+ * Start a phase.
+ *
+ * @param phase phase
+ * @param op operation name
+ * @param ops operations number
+ */
+static void phase_start(bench_phase *phase, const char *op, size_t ops) {
+    memset(phase, 0, sizeof(bench_phase));
+    phase->op = op;
+    phase->hit_ratio = -1;
+    phase->cpu_ns = calloc(ops, sizeof(uint64_t));
+    phase->flash_ns = calloc(ops, sizeof(uint64_t));
+    flash_sim_get_stats(&phase->start);
+}
+
+/**
+ * Get the simulated Flash time since the statistics snapshot.
+ *
+ * @param before statistics snapshot
+ *
+ * @return time (ns)
+ */
+static uint64_t flash_elapsed_ns(const flash_sim_stats *before) {
+    flash_sim_stats stats;
+
+    flash_sim_get_stats(&stats);
+    return stats.elapsed_ns - before->elapsed_ns;
+}
+
+/* run the operation expression and record its host CPU time and simulated Flash time */
+#define PHASE_RUN(phase, expr)                                                \
+do {                                                                          \
+    flash_sim_stats _before;                                                  \
+    uint64_t _start;                                                          \
+    flash_sim_get_stats(&_before);                                            \
+    _start = now_ns();                                                        \
+    expr;                                                                     \
+    (phase)->cpu_ns[(phase)->ops] = now_ns() - _start;                        \
+    (phase)->flash_ns[(phase)->ops] = flash_elapsed_ns(&_before);             \
+    (phase)->ops++;                                                           \
+} while (0)
+
+/**
+ * Compare two samples for qsort.
+ */
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Get the percentile of the sorted samples.
+ *
+ * @param samples sorted samples
+ * @param num samples number
+ * @param pct percentile
+ *
+ * @return sample value
+ */
+static uint64_t percentile(const uint64_t *samples, size_t num, double pct) {
+    size_t i = (size_t) (pct / 100.0 * num);
+
+    if (!num) {
+        return 0;
+    }
+    return samples[i < num ? i : num - 1];
+}
+
+/**
+ * Print the JSON line head of current configuration.
+ *
+ * @param op operation name
+ */
+static void print_head(const char *op) {
+    fprintf(out, "{\"version\":\"%s\",\"mode\":\"%s\",\"keys\":%lu,\"key_size\":%lu,"
+            "\"value_size\":%lu,\"op\":\"%s\"", FLASH_SW_VERSION, BENCH_MODE,
+            (unsigned long) cur_keys, (unsigned long) cur_key_size,
+            (unsigned long) cur_value_size, op);
+}
+
+/**
+ * Finish a phase and output its result.
+ *
+ * @param phase phase
+ */
+static void phase_end(bench_phase *phase) {
+    flash_sim_stats stats;
+    uint64_t cpu_total = 0, flash_total = 0;
+    size_t i;
+
+    flash_sim_get_stats(&stats);
+    for (i = 0; i < phase->ops; i++) {
+        cpu_total += phase->cpu_ns[i];
+        flash_total += phase->flash_ns[i];
+    }
+    qsort(phase->cpu_ns, phase->ops, sizeof(uint64_t), cmp_u64);
+    qsort(phase->flash_ns, phase->ops, sizeof(uint64_t), cmp_u64);
+
+    print_head(phase->op);
+    if (phase->hit_ratio >= 0) {
+        fprintf(out, ",\"hit_ratio\":%.2f", phase->hit_ratio);
+    }
+    fprintf(out, ",\"ops\":%lu,\"ops_per_sec\":%.0f", (unsigned long) phase->ops,
+            cpu_total ? phase->ops * 1e9 / cpu_total : 0.0);
+    fprintf(out, ",\"cpu_p50_ns\":%llu,\"cpu_p90_ns\":%llu,\"cpu_p99_ns\":%llu,\"cpu_max_ns\":%llu",
+            (unsigned long long) percentile(phase->cpu_ns, phase->ops, 50),
+            (unsigned long long) percentile(phase->cpu_ns, phase->ops, 90),
+            (unsigned long long) percentile(phase->cpu_ns, phase->ops, 99),
+            (unsigned long long) percentile(phase->cpu_ns, phase->ops, 100));
+    fprintf(out, ",\"flash_p50_ns\":%llu,\"flash_p90_ns\":%llu,\"flash_p99_ns\":%llu,"
+            "\"flash_max_ns\":%llu,\"flash_total_ns\":%llu",
+            (unsigned long long) percentile(phase->flash_ns, phase->ops, 50),
+            (unsigned long long) percentile(phase->flash_ns, phase->ops, 90),
+            (unsigned long long) percentile(phase->flash_ns, phase->ops, 99),
+            (unsigned long long) percentile(phase->flash_ns, phase->ops, 100),
+            (unsigned long long) flash_total);
+    fprintf(out, ",\"erases\":%u,\"program_bytes\":%llu,\"read_bytes\":%llu",
+            stats.erase_cnt - phase->start.erase_cnt,
+            (unsigned long long) (stats.program_bytes - phase->start.program_bytes),
+            (unsigned long long) (stats.read_bytes - phase->start.read_bytes));
+    if (phase->updates) {
+        /* write amplification: Flash erases and programmed bytes for every logical update */
+        fprintf(out, ",\"erases_per_update\":%.3f,\"program_bytes_per_update\":%.1f,"
+                "\"write_amplification\":%.2f",
+                (double) (stats.erase_cnt - phase->start.erase_cnt) / phase->updates,
+                (double) (stats.program_bytes - phase->start.program_bytes) / phase->updates,
+                (double) (stats.program_bytes - phase->start.program_bytes) / phase->updates
+                        / (cur_key_size + cur_value_size));
+    }
+    fprintf(out, ",\"heap_peak\":%lu}\n", (unsigned long) stats.heap_peak);
+
+    free(phase->cpu_ns);
+    free(phase->flash_ns);
+}
+
+/**
+ * Output a failed configuration.
+ *
+ * @param op failed operation name
+ * @param result failed result
+ * @param done the operations number before failed
+ */
+static void print_fail(const char *op, const char *result, size_t done) {
+    print_head(op);
+    fprintf(out, ",\"result\":\"%s\",\"done\":%lu}\n", result, (unsigned long) done);
+}
+
+/**
+ * Run the benchmark of current configuration on an erased Flash.
+ *
+ * @return 0: success, 1: environment variables are full
+ */
+static int bench_run(void) {
+    char key[BENCH_STR_MAX + 1], value[BENCH_STR_MAX + 1];
+    bench_phase phase;
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t i, j, rounds;
+
+    srand(1);
+    if (flash_sim_init(NULL) != 0 || flash_init() != FLASH_NO_ERR) {
+        print_fail("init", "error", 0);
+        return 1;
+    }
+
+    /* add all keys to RAM */
+    make_value(value, 0);
+    phase_start(&phase, "set_new", cur_keys);
+    for (i = 0; i < cur_keys && result == FLASH_NO_ERR; i++) {
+        make_key(key, 'k', i);
+        PHASE_RUN(&phase, result = flash_set_env(key, value));
+    }
+    if (result != FLASH_NO_ERR) {
+        free(phase.cpu_ns);
+        free(phase.flash_ns);
+        print_fail("set_new", "full", i - 1);
+        return 1;
+    }
+    phase_end(&phase);
+
+    phase_start(&phase, "save_all", 1);
+    PHASE_RUN(&phase, result = flash_save_env());
+    phase.updates = cur_keys;
+    phase_end(&phase);
+    if (result != FLASH_NO_ERR) {
+        print_fail("save_all", "full", 0);
+        return 1;
+    }
+
+    /* lookup with different hit ratio */
+    for (j = 0; j < sizeof(bench_hit_ratios) / sizeof(bench_hit_ratios[0]); j++) {
+        phase_start(&phase, "get", BENCH_GET_OPS);
+        phase.hit_ratio = bench_hit_ratios[j];
+        for (i = 0; i < BENCH_GET_OPS; i++) {
+            make_key(key, rand() < bench_hit_ratios[j] * ((double) RAND_MAX + 1) ? 'k' : 'm',
+                    rand() % cur_keys);
+            PHASE_RUN(&phase, flash_get_env(key));
+        }
+        phase_end(&phase);
+    }
+
+    /* update one key and save it every round */
+    rounds = cur_keys < BENCH_UPDATE_ROUNDS ? cur_keys : BENCH_UPDATE_ROUNDS;
+    phase_start(&phase, "update_save", rounds);
+    phase.updates = rounds;
+    for (i = 0; i < rounds; i++) {
+        make_key(key, 'k', rand() % cur_keys);
+        make_value(value, i + 1);
+        PHASE_RUN(&phase, flash_set_env(key, value); result = flash_save_env());
+        if (result != FLASH_NO_ERR) {
+            break;
+        }
+    }
+    phase_end(&phase);
+
+    /* delete 10% keys and save them once */
+    rounds = cur_keys / 10 ? cur_keys / 10 : 1;
+    phase_start(&phase, "del", rounds);
+    for (i = 0; i < rounds; i++) {
+        make_key(key, 'k', i * 10);
+        PHASE_RUN(&phase, flash_set_env(key, ""));
+    }
+    phase_end(&phase);
+
+    phase_start(&phase, "save_del", 1);
+    PHASE_RUN(&phase, flash_save_env());
+    phase.updates = rounds;
+    phase_end(&phase);
+
+    phase_start(&phase, "load", BENCH_LOAD_OPS);
+    for (i = 0; i < BENCH_LOAD_OPS; i++) {
+        PHASE_RUN(&phase, flash_load_env());
+    }
+    phase_end(&phase);
+
+    return 0;
+}
+
+/**
+ * Print the usage.
+ *
+ * @param name program name
+ */
+static void usage(const char *name) {
+    printf("Usage: %s [-k keys] [-t typ|max] [-v]\n", name);
+    printf("  -k  only run the configurations with the keys number\n");
+    printf("  -t  Flash timing model of STM32F10x datasheet, default is typ\n");
+    printf("  -v  print the library logs to stderr\n");
+}
+
+int main(int argc, char **argv) {
+    const flash_sim_timing *timing = &flash_sim_timing_typ;
+    size_t only_keys = 0, i, j;
+    int verbose = 0, opt, status;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "k:t:vh")) != -1) {
+        switch (opt) {
+        case 'k':
+            only_keys = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            timing = strcmp(optarg, "max") ? &flash_sim_timing_typ : &flash_sim_timing_max;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    /* the results are output to stdout, the library logs are dropped or output to stderr */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || !freopen(verbose ? "/dev/stderr" : "/dev/null", "w", stdout)) {
+        return 1;
+    }
+    /* the assert logs must be output before the library hangs */
+    setvbuf(stdout, NULL, _IONBF, 0);
+    flash_sim_set_timing(timing, 0);
+
+    for (i = 0; i < sizeof(bench_keys) / sizeof(bench_keys[0]); i++) {
+        if (only_keys && bench_keys[i] != only_keys) {
+            continue;
+        }
+        for (j = 0; j < sizeof(bench_sizes) / sizeof(bench_sizes[0]); j++) {
+            cur_keys = bench_keys[i];
+            cur_key_size = bench_sizes[j][0];
+            cur_value_size = bench_sizes[j][1];
+            fflush(out);
+            fflush(stdout);
+            /* every configuration runs in a new process, so the library starts from scratch */
+            pid = fork();
+            if (pid == 0) {
+                bench_run();
+                fflush(out);
+                fflush(stdout);
+                _exit(0);
+            }
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+                print_fail("run", "crash", 0);
+            }
+        }
+    }
+
+    return 0;
+}
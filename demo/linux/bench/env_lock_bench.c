@@ -0,0 +1,419 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Environment variables lock contention benchmark on simulated NOR Flash.
+ *           Several reader threads get the environment variables while one writer thread sets
+ *           and saves them. The Flash operations sleep for the cost model, so the saving holds
+ *           the write lock as long as on the target. Every locking scheme runs in a new process
+ *           and outputs one JSON line, e.g.
+ *           {"version":"1.03.10","mode":"normal","save":"locked","lock":"rwlock","readers":4,...}
+ *           The "mutex" scheme serializes all calls by a global mutex for comparison. The "save"
+ *           is "snapshot" when it's built with FLASH_ENV_USING_SNAPSHOT_SAVE.
+ * Created on: 2026-10-16
+ */
+
+#include "flash.h"
+#include "flash_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#ifndef FLASH_ENV_USING_LOCK
+#error "The lock benchmark must be built with FLASH_ENV_USING_LOCK."
+#endif
+
+/* environment variables number */
+#define BENCH_KEYS                      32
+/* the maximum value size, the value size is changed on every setting, so the data is moved */
+#define BENCH_VALUE_MAX                 48
+/* the maximum readers number */
+#define BENCH_READERS_MAX               16
+/* log-linear latency histogram, every power of 2 is divided into 16 buckets */
+#define BENCH_HIST_SUB                  16
+#define BENCH_HIST_SIZE                 (64 * BENCH_HIST_SUB)
+
+#if defined(FLASH_ENV_USING_WEAR_LEVELING_MODE)
+#define BENCH_MODE                      "wl"
+#elif defined(FLASH_ENV_USING_LOG_MODE)
+#define BENCH_MODE                      "log"
+#else
+#define BENCH_MODE                      "normal"
+#endif
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+#define BENCH_SAVE                      "snapshot"
+#else
+#define BENCH_SAVE                      "locked"
+#endif
+
+/* latency histogram */
+typedef struct {
+    uint64_t cnt[BENCH_HIST_SIZE];
+    uint64_t ops;
+    uint64_t max;
+} bench_hist;
+
+/* the locking schemes */
+static const char * const bench_locks[] = { "rwlock", "mutex" };
+
+/* output file, the library logs are not mixed in it */
+static FILE *out;
+/* current configuration */
+static size_t cur_readers = 4, cur_save_interval = 8, cur_duration_ms = 2000;
+static int cur_global_mutex;
+/* the global mutex of "mutex" scheme */
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* all threads will stop when it's set */
+static volatile int bench_stop;
+/* the reader threads latency and torn values number */
+static bench_hist reader_hist[BENCH_READERS_MAX];
+static size_t reader_torn[BENCH_READERS_MAX];
+
+/**
+ * Get the host monotonic time.
+ *
+ * @return time (ns)
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Add a sample to histogram.
+ *
+ * @param hist histogram
+ * @param ns sample
+ */
+static void hist_add(bench_hist *hist, uint64_t ns) {
+    size_t msb, index;
+
+    if (ns < BENCH_HIST_SUB) {
+        index = ns;
+    } else {
+        msb = 63 - __builtin_clzll(ns);
+        index = (msb - 3) * BENCH_HIST_SUB + ((ns >> (msb - 4)) & (BENCH_HIST_SUB - 1));
+    }
+    hist->cnt[index]++;
+    hist->ops++;
+    if (ns > hist->max) {
+        hist->max = ns;
+    }
+}
+
+/**
+ * Merge the source histogram to destination.
+ *
+ * @param dst destination histogram
+ * @param src source histogram
+ */
+static void hist_merge(bench_hist *dst, const bench_hist *src) {
+    size_t i;
+
+    for (i = 0; i < BENCH_HIST_SIZE; i++) {
+        dst->cnt[i] += src->cnt[i];
+    }
+    dst->ops += src->ops;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * Get the percentile of histogram, it's the lower bound of the bucket.
+ *
+ * @param hist histogram
+ * @param pct percentile
+ *
+ * @return sample value
+ */
+static uint64_t hist_percentile(const bench_hist *hist, double pct) {
+    uint64_t rank = (uint64_t) (pct / 100.0 * hist->ops), sum = 0;
+    size_t i;
+
+    for (i = 0; i < BENCH_HIST_SIZE; i++) {
+        sum += hist->cnt[i];
+        if (sum > rank) {
+            break;
+        }
+    }
+    if (i < BENCH_HIST_SUB) {
+        return i;
+    } else if (i == BENCH_HIST_SIZE) {
+        return hist->max;
+    }
+    return (uint64_t) (BENCH_HIST_SUB + i % BENCH_HIST_SUB) << (i / BENCH_HIST_SUB - 1);
+}
+
+/**
+ * Print the histogram fields.
+ *
+ * @param name operation name
+ * @param hist histogram
+ */
+static void print_hist(const char *name, const bench_hist *hist) {
+    fprintf(out, ",\"%s_ops\":%llu,\"%s_ops_per_sec\":%.0f", name, (unsigned long long) hist->ops,
+            name, hist->ops * 1000.0 / cur_duration_ms);
+    fprintf(out, ",\"%s_p50_ns\":%llu,\"%s_p99_ns\":%llu,\"%s_p999_ns\":%llu,\"%s_max_ns\":%llu",
+            name, (unsigned long long) hist_percentile(hist, 50),
+            name, (unsigned long long) hist_percentile(hist, 99),
+            name, (unsigned long long) hist_percentile(hist, 99.9),
+            name, (unsigned long long) hist->max);
+}
+
+/**
+ * Make the key string.
+ *
+ * @param buf key buffer
+ * @param index key index
+ */
+static void make_key(char *buf, size_t index) {
+    snprintf(buf, 8, "k%03lu", (unsigned long) index);
+}
+
+/**
+ * Take the global mutex on "mutex" scheme.
+ */
+static void global_lock(void) {
+    if (cur_global_mutex) {
+        pthread_mutex_lock(&global_mutex);
+    }
+}
+
+/**
+ * Release the global mutex on "mutex" scheme.
+ */
+static void global_unlock(void) {
+    if (cur_global_mutex) {
+        pthread_mutex_unlock(&global_mutex);
+    }
+}
+
+/**
+ * Reader thread. The value is all the same character, so a torn value can be found.
+ *
+ * @param arg reader index
+ *
+ * @return NULL
+ */
+static void *reader_entry(void *arg) {
+    size_t index = (size_t) arg, saved_len, i;
+    char key[8], value[BENCH_VALUE_MAX];
+    unsigned int seed = (unsigned int) index + 1;
+    uint64_t start;
+
+    while (!bench_stop) {
+        make_key(key, rand_r(&seed) % BENCH_KEYS);
+        start = now_ns();
+        global_lock();
+        flash_get_env_blob(key, value, sizeof(value), &saved_len);
+        global_unlock();
+        hist_add(&reader_hist[index], now_ns() - start);
+        for (i = 1; i < saved_len; i++) {
+            if (value[i] != value[0]) {
+                reader_torn[index]++;
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Run the benchmark of current locking scheme.
+ *
+ * @param lock locking scheme name
+ *
+ * @return 0: success, 1: error
+ */
+static int bench_run(const char *lock) {
+    pthread_t readers[BENCH_READERS_MAX];
+    char key[8], value[BENCH_VALUE_MAX + 1];
+    bench_hist *get_hist = calloc(1, sizeof(bench_hist)),
+            *set_hist = calloc(1, sizeof(bench_hist)), *save_hist = calloc(1, sizeof(bench_hist));
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t i, round, value_len, torn = 0;
+    uint64_t start, end;
+    unsigned int seed = 1;
+
+    if (!get_hist || !set_hist || !save_hist || flash_sim_init(NULL) != 0
+            || flash_init() != FLASH_NO_ERR) {
+        return 1;
+    }
+    /* all keys are saved before the readers start */
+    for (i = 0; i < BENCH_KEYS && result == FLASH_NO_ERR; i++) {
+        make_key(key, i);
+        memset(value, 'a', BENCH_VALUE_MAX / 2);
+        value[BENCH_VALUE_MAX / 2] = '\0';
+        result = flash_set_env(key, value);
+    }
+    if (result != FLASH_NO_ERR || flash_save_env() != FLASH_NO_ERR) {
+        return 1;
+    }
+
+    for (i = 0; i < cur_readers; i++) {
+        pthread_create(&readers[i], NULL, reader_entry, (void *) i);
+    }
+    /* the writer runs in main thread */
+    end = now_ns() + (uint64_t) cur_duration_ms * 1000000;
+    for (round = 1; now_ns() < end; round++) {
+        make_key(key, rand_r(&seed) % BENCH_KEYS);
+        value_len = 1 + rand_r(&seed) % BENCH_VALUE_MAX;
+        memset(value, 'a' + round % 26, value_len);
+        value[value_len] = '\0';
+        start = now_ns();
+        global_lock();
+        flash_set_env(key, value);
+        global_unlock();
+        hist_add(set_hist, now_ns() - start);
+        if (round % cur_save_interval == 0) {
+            start = now_ns();
+            global_lock();
+            flash_save_env();
+            global_unlock();
+            hist_add(save_hist, now_ns() - start);
+        }
+    }
+    bench_stop = 1;
+    for (i = 0; i < cur_readers; i++) {
+        pthread_join(readers[i], NULL);
+        hist_merge(get_hist, &reader_hist[i]);
+        torn += reader_torn[i];
+    }
+
+    fprintf(out, "{\"version\":\"%s\",\"mode\":\"%s\",\"save\":\"%s\",\"lock\":\"%s\","
+            "\"readers\":%lu,\"save_interval\":%lu,\"duration_ms\":%lu", FLASH_SW_VERSION,
+            BENCH_MODE, BENCH_SAVE, lock,
+            (unsigned long) cur_readers, (unsigned long) cur_save_interval,
+            (unsigned long) cur_duration_ms);
+    print_hist("get", get_hist);
+    print_hist("set", set_hist);
+    print_hist("save", save_hist);
+    fprintf(out, ",\"torn\":%lu}\n", (unsigned long) torn);
+
+    free(get_hist);
+    free(set_hist);
+    free(save_hist);
+
+    return 0;
+}
+
+/**
+ * Print the usage.
+ *
+ * @param name program name
+ */
+static void usage(const char *name) {
+    printf("Usage: %s [-l rwlock|mutex] [-r readers] [-s interval] [-d ms] [-t typ|max|none] "
+            "[-v]\n", name);
+    printf("  -l  only run the locking scheme\n");
+    printf("  -r  reader threads number, default is 4\n");
+    printf("  -s  save after every interval settings, default is 8\n");
+    printf("  -d  duration of every locking scheme (ms), default is 2000\n");
+    printf("  -t  Flash timing model of STM32F10x datasheet, default is typ\n");
+    printf("  -v  print the library logs to stderr\n");
+}
+
+int main(int argc, char **argv) {
+    const flash_sim_timing *timing = &flash_sim_timing_typ;
+    const char *only_lock = NULL;
+    int verbose = 0, opt, status;
+    size_t i;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "l:r:s:d:t:vh")) != -1) {
+        switch (opt) {
+        case 'l':
+            only_lock = optarg;
+            break;
+        case 'r':
+            cur_readers = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            cur_save_interval = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            cur_duration_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            if (!strcmp(optarg, "typ")) {
+                timing = &flash_sim_timing_typ;
+            } else if (!strcmp(optarg, "max")) {
+                timing = &flash_sim_timing_max;
+            } else if (!strcmp(optarg, "none")) {
+                timing = NULL;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cur_readers > BENCH_READERS_MAX || !cur_save_interval || !cur_duration_ms) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* the results are output to stdout, the library logs are dropped or output to stderr */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || !freopen(verbose ? "/dev/stderr" : "/dev/null", "w", stdout)) {
+        return 1;
+    }
+    /* the assert logs must be output before the library hangs */
+    setvbuf(stdout, NULL, _IONBF, 0);
+    /* the Flash operations sleep, so the saving holds the write lock as long as on the target */
+    flash_sim_set_timing(timing, 1);
+
+    for (i = 0; i < sizeof(bench_locks) / sizeof(bench_locks[0]); i++) {
+        if (only_lock && strcmp(only_lock, bench_locks[i])) {
+            continue;
+        }
+        cur_global_mutex = !strcmp(bench_locks[i], "mutex");
+        fflush(out);
+        fflush(stdout);
+        /* every locking scheme runs in a new process, so the library starts from scratch */
+        pid = fork();
+        if (pid == 0) {
+            status = bench_run(bench_locks[i]);
+            fflush(out);
+            fflush(stdout);
+            _exit(status);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+                || WEXITSTATUS(status)) {
+            fprintf(out, "{\"version\":\"%s\",\"mode\":\"%s\",\"save\":\"%s\","
+                    "\"lock\":\"%s\",\"result\":\"error\"}\n", FLASH_SW_VERSION, BENCH_MODE,
+                    BENCH_SAVE, bench_locks[i]);
+        }
+    }
+
+    return 0;
+}
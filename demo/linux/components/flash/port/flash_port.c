@@ -0,0 +1,466 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Portable interface for Linux host with simulated NOR Flash.
+ * Created on: 2026-10-15
+ */
+
+/* SCHED_IDLE for the asynchronous saving thread */
+#define _GNU_SOURCE
+
+#include "flash.h"
+#include "flash_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef FLASH_ENV_USING_LOCK
+#include <pthread.h>
+#endif
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+#include <sched.h>
+#endif
+
+/* page size for simulated flash */
+#define PAGE_SIZE     FLASH_SIM_PAGE_SIZE
+
+/* The environment variables area can be changed by compiler flags, e.g. the benchmark uses a
+ * bigger area for more environment variables. */
+#ifndef FLASH_ENV_START_ADDR
+/* Environment variables start address, from the chip position: 100KB */
+#define FLASH_ENV_START_ADDR            (FLASH_SIM_BASE + 100 * 1024)
+#endif
+#ifndef FLASH_ERASE_MIN_SIZE
+/* the minimum size of flash erasure */
+#define FLASH_ERASE_MIN_SIZE             PAGE_SIZE                /* it is one page for STM32 */
+#endif
+#ifndef FLASH_ENV_SECTION_SIZE
+/* Environment variables bytes size */
+#define FLASH_ENV_SECTION_SIZE          (4*PAGE_SIZE)             /* 4 pages */
+#endif
+/* print debug information of flash */
+#define FLASH_PRINT_DEBUG
+
+/* default environment variables set for user */
+static const flash_env default_env_set[] = {
+        {"iap_need_copy_app","0"},
+        {"iap_copy_app_size","0"},
+        {"stop_in_bootloader","0"},
+        {"device_id","1"},
+        {"boot_times","0"},
+};
+
+#ifdef FLASH_ENV_USING_LOCK
+/* environment variables reader-writer lock, it's initialized once for every process */
+static pthread_rwlock_t env_lock;
+static pthread_once_t env_lock_once = PTHREAD_ONCE_INIT;
+
+static void env_lock_init(void);
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/* the saving and loading are serialized by mutex */
+static pthread_mutex_t env_save_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/* the asynchronous saving thread waits for the requests by condition */
+static pthread_mutex_t env_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t env_async_cond = PTHREAD_COND_INITIALIZER;
+static bool_t env_async_requested = FALSE;
+static pthread_once_t env_async_once = PTHREAD_ONCE_INIT;
+
+static void env_async_thread_init(void);
+#endif
+
+/**
+ * Flash port for hardware initialize.
+ *
+ * @param env_addr environment variables start address
+ * @param env_size environment variables bytes size (@note must be word alignment)
+ * @param erase_min_size the minimum size of Flash erasure
+ * @param default_env default environment variables set for user
+ * @param default_env_size default environment variables size
+ *
+ * @return result
+ */
+FlashErrCode flash_port_init(uint32_t *env_addr, size_t *env_size, size_t *erase_min_size,
+        flash_env const **default_env, size_t *default_env_size) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(FLASH_ENV_SECTION_SIZE % 4 == 0);
+
+    *env_addr = FLASH_ENV_START_ADDR;
+    *env_size = FLASH_ENV_SECTION_SIZE;
+    *erase_min_size = FLASH_ERASE_MIN_SIZE;
+    *default_env = default_env_set;
+    *default_env_size = sizeof(default_env_set)/sizeof(default_env_set[0]);
+
+#ifdef FLASH_ENV_USING_LOCK
+    pthread_once(&env_lock_once, env_lock_init);
+#endif
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+    pthread_once(&env_async_once, env_async_thread_init);
+#endif
+
+    return result;
+}
+
+/**
+ * Read data from flash.
+ * @note This operation's units is word.
+ *
+ * @param addr flash address
+ * @param buf buffer to store read data
+ * @param size read bytes size
+ *
+ * @return result
+ */
+FlashErrCode flash_read(uint32_t addr, uint32_t *buf, size_t size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FlashSimStatus sim_result;
+
+    FLASH_ASSERT(size >= 4);
+    FLASH_ASSERT(size % 4 == 0);
+    /* the reading is not in the assertion expression, it must be done in any case */
+    sim_result = flash_sim_read(addr, buf, size);
+    FLASH_ASSERT(sim_result == FLASH_SIM_OK);
+
+    return result;
+}
+
+/**
+ * Erase data on flash.
+ * @note This operation is irreversible.
+ * @note This operation's units is different which on many chips.
+ *
+ * @param addr flash address
+ * @param size erase bytes size
+ *
+ * @return result
+ */
+FlashErrCode flash_erase(uint32_t addr, size_t size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t erase_pages, i;
+
+    /* calculate pages */
+    erase_pages = size / PAGE_SIZE;
+    if (size % PAGE_SIZE != 0) {
+        erase_pages++;
+    }
+
+    /* start erase */
+    for (i = 0; i < erase_pages; i++) {
+        if (flash_sim_erase_page(addr + (PAGE_SIZE * i)) != FLASH_SIM_OK) {
+            result = FLASH_ERASE_ERR;
+            break;
+        }
+    }
+
+    return result;
+}
+/**
+ * Write data to flash.
+ * @note This operation's units is word.
+ * @note This operation must after erase. @see flash_erase.
+ *
+ * @param addr flash address
+ * @param buf the write data buffer
+ * @param size write bytes size
+ *
+ * @return result
+ */
+FlashErrCode flash_write(uint32_t addr, const uint32_t *buf, size_t size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t i;
+
+    for (i = 0; i < size; i += 4, buf++, addr += 4) {
+        /* write data, it will fail when the data is not same as the written data */
+        if (flash_sim_program_word(addr, *buf) != FLASH_SIM_OK) {
+            result = FLASH_WRITE_ERR;
+            break;
+        }
+    }
+
+    return result;
+}
+
+#ifdef FLASH_CRC32_USING_PORT
+/**
+ * Calculate the CRC32 value. There is no hardware CRC unit on host, so it's calculated bit by bit.
+ *
+ * @param crc accumulated CRC32 value, it's 0 on first call
+ * @param buf buffer to calculate CRC32 value for
+ * @param size bytes in buffer
+ *
+ * @return calculated CRC32 value
+ */
+uint32_t flash_crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+    uint8_t i;
+
+    crc = crc ^ ~0U;
+    while (size--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return crc ^ ~0U;
+}
+#endif
+
+/**
+ * Allocate a block of memory with a minimum of 'size' bytes.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return pointer to allocated memory or NULL if no free memory was found.
+ */
+void *flash_malloc(size_t size) {
+    return flash_sim_malloc(size);
+}
+
+/**
+ * This function will release the previously allocated memory block by
+ * flash_malloc. The released memory block is taken back to system heap.
+ *
+ * @param p the pointer to allocated memory which will be released
+ */
+void flash_free(void *p) {
+    flash_sim_free(p);
+}
+
+#ifdef FLASH_USING_STATS
+/**
+ * Get the host monotonic clock in nanosecond as cycle counter for the API latency statistics.
+ * It can wrap around.
+ *
+ * @return current cycles
+ */
+uint32_t flash_get_cycles(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/**
+ * Get the host monotonic clock in second for the erase budget.
+ *
+ * @return current time (second)
+ */
+uint32_t flash_get_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t) ts.tv_sec;
+}
+#endif
+
+#ifdef FLASH_ENV_USING_LOCK
+/**
+ * Initialize the environment variables lock. The glibc rwlock prefers readers by default, then a
+ * writer may wait forever when the readers are busy, so the writer is preferred.
+ */
+static void env_lock_init(void) {
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&env_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+/**
+ * Lock the environment variables for reading.
+ */
+void flash_env_lock_read(void) {
+    pthread_rwlock_rdlock(&env_lock);
+}
+
+/**
+ * Unlock the environment variables read lock.
+ */
+void flash_env_unlock_read(void) {
+    pthread_rwlock_unlock(&env_lock);
+}
+
+/**
+ * Lock the environment variables for writing.
+ */
+void flash_env_lock_write(void) {
+    pthread_rwlock_wrlock(&env_lock);
+}
+
+/**
+ * Unlock the environment variables write lock.
+ */
+void flash_env_unlock_write(void) {
+    pthread_rwlock_unlock(&env_lock);
+}
+#endif
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/**
+ * Lock the environment variables saving.
+ */
+void flash_env_lock_save(void) {
+    pthread_mutex_lock(&env_save_mutex);
+}
+
+/**
+ * Unlock the environment variables saving.
+ */
+void flash_env_unlock_save(void) {
+    pthread_mutex_unlock(&env_save_mutex);
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/**
+ * The asynchronous saving thread. All requests in the debounce window are merged into one saving.
+ *
+ * @param arg unused
+ *
+ * @return unused
+ */
+static void *env_async_thread_entry(void *arg) {
+    const struct timespec window = { FLASH_ENV_ASYNC_SAVE_DEBOUNCE / 1000,
+            FLASH_ENV_ASYNC_SAVE_DEBOUNCE % 1000 * 1000000L };
+    struct timespec retry = { 0, 0 };
+
+    for (;;) {
+        pthread_mutex_lock(&env_async_mutex);
+        while (!env_async_requested) {
+            pthread_cond_wait(&env_async_cond, &env_async_mutex);
+        }
+        pthread_mutex_unlock(&env_async_mutex);
+
+        nanosleep(&window, NULL);
+
+        pthread_mutex_lock(&env_async_mutex);
+        env_async_requested = FALSE;
+        pthread_mutex_unlock(&env_async_mutex);
+
+        retry.tv_sec = flash_save_env_async_handler();
+        /* the deferred saving is requested again after the erase budget is refilled */
+        if (retry.tv_sec) {
+            nanosleep(&retry, NULL);
+            flash_env_async_notify();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Create the asynchronous saving thread. It's SCHED_IDLE, so it only runs when the other threads
+ * are idle. It uses the default scheduling when SCHED_IDLE is not permitted.
+ */
+static void env_async_thread_init(void) {
+    pthread_attr_t attr;
+    struct sched_param param = { 0 };
+    pthread_t thread;
+    int result;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+    pthread_attr_setschedparam(&attr, &param);
+    result = pthread_create(&thread, &attr, env_async_thread_entry, NULL);
+    if (result != 0) {
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        result = pthread_create(&thread, &attr, env_async_thread_entry, NULL);
+    }
+    FLASH_ASSERT(result == 0);
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Wake up the asynchronous saving thread.
+ */
+void flash_env_async_notify(void) {
+    pthread_mutex_lock(&env_async_mutex);
+    env_async_requested = TRUE;
+    pthread_cond_signal(&env_async_cond);
+    pthread_mutex_unlock(&env_async_mutex);
+}
+#endif
+
+/**
+ * This function is print flash debug info.
+ *
+ * @param file the file which has call this function
+ * @param line the line number which has call this function
+ * @param format output format
+ * @param ... args
+ *
+ */
+void flash_log_debug(const char *file, const long line, const char *format, ...) {
+
+#ifdef FLASH_PRINT_DEBUG
+
+    va_list args;
+
+    /* args point to the first variable parameter */
+    va_start(args, format);
+    flash_print("[Flash](%s:%ld) ", file, line);
+    /* must use vprintf to print */
+    vprintf(format, args);
+    va_end(args);
+
+#endif
+
+}
+
+/**
+ * This function is print flash routine info.
+ *
+ * @param format output format
+ * @param ... args
+ */
+void flash_log_info(const char *format, ...) {
+    va_list args;
+
+    /* args point to the first variable parameter */
+    va_start(args, format);
+    flash_print("[Flash]");
+    /* must use vprintf to print */
+    vprintf(format, args);
+    va_end(args);
+}
+/**
+ * This function is print flash non-package info.
+ *
+ * @param format output format
+ * @param ... args
+ */
+void flash_print(const char *format, ...) {
+    va_list args;
+
+    /* args point to the first variable parameter */
+    va_start(args, format);
+    /* must use vprintf to print */
+    vprintf(format, args);
+    va_end(args);
+}
@@ -0,0 +1,402 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Simulated NOR Flash on host for benchmark and regression test.
+ *           The Flash is a RAM buffer or a mmap'ed image file. It follows the NOR Flash rules:
+ *           1. erase sets all bytes of a page to 0xFF
+ *           2. program only changes bits from 1 to 0, change a bit from 0 to 1 must erase first
+ *           Every operation is charged by the cost model, so the Flash busy time of the library
+ *           can be measured on a workstation. The power can be cut at any program or erase
+ *           operation, the operation will be torn: only a part of bits are programmed or only a
+ *           part of the page is erased.
+ * Created on: 2026-10-15
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "flash_sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* STM32F10x datasheet: tPROG 16-bit is 52.5us typical and 70us maximum, tERASE page is 20ms
+ * minimum and 40ms maximum, the read is 3 SYSCLK cycles at 72MHz with 2 wait states */
+const flash_sim_timing flash_sim_timing_typ = { 42, 2 * 52500, 20000000 };
+const flash_sim_timing flash_sim_timing_max = { 42, 2 * 70000, 40000000 };
+
+/* simulated Flash memory */
+static uint8_t *flash_mem = NULL;
+/* image file descriptor, it's -1 when the Flash is a RAM buffer */
+static int image_fd = -1;
+/* current cost model */
+static flash_sim_timing cur_timing = { 0, 0, 0 };
+/* sleep for the cost of every operation */
+static int is_realtime = 0;
+/* operations statistics */
+static flash_sim_stats sim_stats;
+/* erase count of every page */
+static uint32_t page_erase_cnt[FLASH_SIM_SIZE / FLASH_SIM_PAGE_SIZE];
+/* the remaining program and erase operations before power cut, 0 is never */
+static uint32_t power_cut_ops = 0;
+/* the random state for tearing operation */
+static uint32_t power_cut_rand = 0;
+/* power cut callback */
+static flash_sim_power_cut_cb power_cut_cb = NULL;
+
+/* heap block header, the block size is saved in front of the block, it keeps the max alignment */
+typedef union {
+    size_t size;
+    long double align_ld;
+    long long align_ll;
+    void *align_p;
+} heap_header;
+
+static void charge(uint64_t cost_ns);
+static int addr_is_valid(uint32_t addr, size_t size);
+static int power_is_cut(void);
+static uint32_t tear_rand(void);
+
+/**
+ * Initialize the simulated Flash.
+ *
+ * @param image_path Flash image file path, the Flash will be a RAM buffer when it's NULL.
+ *        The image file will be created and erased when it doesn't exist or its size is wrong,
+ *        otherwise the data in it will be kept, so the environment variables can be loaded on
+ *        next running.
+ *
+ * @return 0: success, -1: failed
+ */
+int flash_sim_init(const char *image_path) {
+    struct stat image_stat;
+    void *mem;
+
+    flash_sim_deinit();
+
+    if (image_path) {
+        image_fd = open(image_path, O_RDWR | O_CREAT, 0644);
+        if (image_fd < 0 || fstat(image_fd, &image_stat) < 0) {
+            goto _fail;
+        }
+        if (image_stat.st_size != FLASH_SIM_SIZE && ftruncate(image_fd, FLASH_SIM_SIZE) < 0) {
+            goto _fail;
+        }
+        mem = mmap(NULL, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+        if (mem == MAP_FAILED) {
+            goto _fail;
+        }
+        flash_mem = mem;
+        /* the new or resized image is an erased Flash */
+        if (image_stat.st_size != FLASH_SIM_SIZE) {
+            memset(flash_mem, 0xFF, FLASH_SIM_SIZE);
+        }
+    } else {
+        flash_mem = malloc(FLASH_SIM_SIZE);
+        if (!flash_mem) {
+            return -1;
+        }
+        memset(flash_mem, 0xFF, FLASH_SIM_SIZE);
+    }
+    flash_sim_reset_stats();
+
+    return 0;
+
+_fail:
+    if (image_fd >= 0) {
+        close(image_fd);
+        image_fd = -1;
+    }
+    return -1;
+}
+
+/**
+ * Release the simulated Flash. The image file will be synchronized.
+ */
+void flash_sim_deinit(void) {
+    if (!flash_mem) {
+        return;
+    }
+    if (image_fd >= 0) {
+        msync(flash_mem, FLASH_SIM_SIZE, MS_SYNC);
+        munmap(flash_mem, FLASH_SIM_SIZE);
+        close(image_fd);
+        image_fd = -1;
+    } else {
+        free(flash_mem);
+    }
+    flash_mem = NULL;
+}
+
+/**
+ * Set the cost model of Flash operations.
+ *
+ * @param timing cost model, NULL is no cost
+ * @param realtime 1: sleep for the cost of every operation, 0: only accumulate the cost
+ */
+void flash_sim_set_timing(const flash_sim_timing *timing, int realtime) {
+    if (timing) {
+        cur_timing = *timing;
+    } else {
+        memset(&cur_timing, 0, sizeof(cur_timing));
+    }
+    is_realtime = realtime;
+}
+
+/**
+ * Charge the cost of an operation.
+ *
+ * @param cost_ns cost time (ns)
+ */
+static void charge(uint64_t cost_ns) {
+    struct timespec ts;
+
+    sim_stats.elapsed_ns += cost_ns;
+    if (is_realtime && cost_ns) {
+        ts.tv_sec = cost_ns / 1000000000;
+        ts.tv_nsec = cost_ns % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * Check the address range is in the simulated Flash and word alignment.
+ *
+ * @param addr Flash address
+ * @param size bytes size
+ *
+ * @return 1: valid, 0: invalid
+ */
+static int addr_is_valid(uint32_t addr, size_t size) {
+    return flash_mem && addr >= FLASH_SIM_BASE && addr % 4 == 0 && size % 4 == 0
+            && size <= FLASH_SIM_SIZE && addr - FLASH_SIM_BASE <= FLASH_SIM_SIZE - size;
+}
+
+/**
+ * Read data from the simulated Flash.
+ *
+ * @param addr Flash address
+ * @param buf buffer to store read data
+ * @param size read bytes size, it must be word alignment
+ *
+ * @return status
+ */
+FlashSimStatus flash_sim_read(uint32_t addr, uint32_t *buf, size_t size) {
+    if (!addr_is_valid(addr, size)) {
+        return FLASH_SIM_ADDR_ERR;
+    }
+
+    memcpy(buf, flash_mem + addr - FLASH_SIM_BASE, size);
+    sim_stats.read_cnt++;
+    sim_stats.read_bytes += size;
+    charge((uint64_t) cur_timing.read_word * (size / 4));
+
+    return FLASH_SIM_OK;
+}
+
+/**
+ * Erase the page which is containing the address.
+ *
+ * @param addr Flash address
+ *
+ * @return status
+ */
+FlashSimStatus flash_sim_erase_page(uint32_t addr) {
+    uint32_t page;
+
+    if (!addr_is_valid(addr & ~3, 4)) {
+        return FLASH_SIM_ADDR_ERR;
+    }
+
+    page = (addr - FLASH_SIM_BASE) / FLASH_SIM_PAGE_SIZE;
+    page_erase_cnt[page]++;
+    sim_stats.erase_cnt++;
+    charge(cur_timing.erase_page);
+    if (power_is_cut()) {
+        /* torn erase: only the front part of the page is erased */
+        memset(flash_mem + page * FLASH_SIM_PAGE_SIZE, 0xFF, tear_rand() % FLASH_SIM_PAGE_SIZE);
+        power_cut_cb();
+        return FLASH_SIM_POWER_CUT;
+    }
+    memset(flash_mem + page * FLASH_SIM_PAGE_SIZE, 0xFF, FLASH_SIM_PAGE_SIZE);
+
+    return FLASH_SIM_OK;
+}
+
+/**
+ * Program a word to the simulated Flash. The bits which are 0 in Flash will be kept 0.
+ *
+ * @param addr Flash address, it must be word alignment
+ * @param data program data
+ *
+ * @return status, it's FLASH_SIM_PROGRAM_ERR when a bit needs change from 0 to 1
+ */
+FlashSimStatus flash_sim_program_word(uint32_t addr, uint32_t data) {
+    uint32_t old_data;
+
+    if (!addr_is_valid(addr, 4)) {
+        return FLASH_SIM_ADDR_ERR;
+    }
+
+    memcpy(&old_data, flash_mem + addr - FLASH_SIM_BASE, 4);
+    sim_stats.program_cnt++;
+    sim_stats.program_bytes += 4;
+    charge(cur_timing.program_word);
+    if (power_is_cut()) {
+        /* torn program: only a part of the bits which need be programmed are cleared */
+        old_data &= ~(old_data & ~data & tear_rand());
+        memcpy(flash_mem + addr - FLASH_SIM_BASE, &old_data, 4);
+        power_cut_cb();
+        return FLASH_SIM_POWER_CUT;
+    }
+    old_data &= data;
+    memcpy(flash_mem + addr - FLASH_SIM_BASE, &old_data, 4);
+
+    return old_data == data ? FLASH_SIM_OK : FLASH_SIM_PROGRAM_ERR;
+}
+
+/**
+ * Cut the power at a later program or erase operation. The operation will be torn, then the
+ * callback is called, it should stop the program like a real power cut. The Flash keeps working
+ * when the callback returns, and the torn operation returns FLASH_SIM_POWER_CUT.
+ *
+ * @param ops the power is cut at the Nth program or erase operation from now, 0 is never
+ * @param seed random seed for tearing the operation
+ * @param cb power cut callback
+ */
+void flash_sim_set_power_cut(uint32_t ops, uint32_t seed, flash_sim_power_cut_cb cb) {
+    power_cut_ops = cb ? ops : 0;
+    /* xorshift can't work with zero state */
+    power_cut_rand = seed ? seed : 1;
+    power_cut_cb = cb;
+}
+
+/**
+ * Check the power is cut at current program or erase operation.
+ *
+ * @return 1: cut, 0: not cut
+ */
+static int power_is_cut(void) {
+    return power_cut_ops && --power_cut_ops == 0;
+}
+
+/**
+ * Get a random number for tearing operation, it's xorshift32.
+ *
+ * @return random number
+ */
+static uint32_t tear_rand(void) {
+    power_cut_rand ^= power_cut_rand << 13;
+    power_cut_rand ^= power_cut_rand >> 17;
+    power_cut_rand ^= power_cut_rand << 5;
+
+    return power_cut_rand;
+}
+
+/**
+ * Copy all data of the simulated Flash to a buffer.
+ *
+ * @param buf buffer, it must be FLASH_SIM_SIZE bytes
+ */
+void flash_sim_dump(void *buf) {
+    memcpy(buf, flash_mem, FLASH_SIM_SIZE);
+}
+
+/**
+ * Restore all data of the simulated Flash from a buffer which is dumped by flash_sim_dump.
+ *
+ * @param buf buffer, it must be FLASH_SIM_SIZE bytes
+ */
+void flash_sim_load(const void *buf) {
+    memcpy(flash_mem, buf, FLASH_SIM_SIZE);
+}
+
+/**
+ * Get the operations statistics.
+ *
+ * @param stats statistics
+ */
+void flash_sim_get_stats(flash_sim_stats *stats) {
+    *stats = sim_stats;
+}
+
+/**
+ * Reset the operations statistics. The pages erase count and the current heap bytes will not be
+ * reset, the peak heap bytes will be reset to the current heap bytes.
+ */
+void flash_sim_reset_stats(void) {
+    size_t heap_cur = sim_stats.heap_cur;
+
+    memset(&sim_stats, 0, sizeof(sim_stats));
+    sim_stats.heap_cur = sim_stats.heap_peak = heap_cur;
+}
+
+/**
+ * Get the erase count of the page since the simulated Flash is running.
+ *
+ * @param addr Flash address in the page
+ *
+ * @return erase count
+ */
+uint32_t flash_sim_get_page_erase_cnt(uint32_t addr) {
+    if (addr < FLASH_SIM_BASE || addr - FLASH_SIM_BASE >= FLASH_SIM_SIZE) {
+        return 0;
+    }
+    return page_erase_cnt[(addr - FLASH_SIM_BASE) / FLASH_SIM_PAGE_SIZE];
+}
+
+/**
+ * Allocate memory for the library and account the heap bytes, so the heap usage of the library
+ * can be measured.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ *
+ * @return pointer to allocated memory or NULL if no free memory was found.
+ */
+void *flash_sim_malloc(size_t size) {
+    heap_header *block = malloc(sizeof(heap_header) + size);
+
+    if (!block) {
+        return NULL;
+    }
+    block->size = size;
+    sim_stats.heap_cur += size;
+    if (sim_stats.heap_cur > sim_stats.heap_peak) {
+        sim_stats.heap_peak = sim_stats.heap_cur;
+    }
+
+    return block + 1;
+}
+
+/**
+ * Release the memory which is allocated by flash_sim_malloc.
+ *
+ * @param p the pointer to allocated memory which will be released
+ */
+void flash_sim_free(void *p) {
+    heap_header *block = p;
+
+    if (!block) {
+        return;
+    }
+    block--;
+    sim_stats.heap_cur -= block->size;
+    free(block);
+}
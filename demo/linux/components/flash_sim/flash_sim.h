@@ -0,0 +1,88 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Simulated NOR Flash on host for benchmark and regression test.
+ * Created on: 2026-10-15
+ */
+
+#ifndef FLASH_SIM_H_
+#define FLASH_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* simulated Flash base address, it's same as STM32F10x */
+#define FLASH_SIM_BASE                  0x08000000
+/* simulated Flash page size, it's the minimum erase unit of STM32F10x high-density devices */
+#define FLASH_SIM_PAGE_SIZE             2048
+/* simulated Flash bytes size, it's 512KB as STM32F103xE */
+#ifndef FLASH_SIM_SIZE
+#define FLASH_SIM_SIZE                  (512 * 1024)
+#endif
+
+/* simulated Flash operation status */
+typedef enum {
+    FLASH_SIM_OK,
+    FLASH_SIM_ADDR_ERR,      /* address is out of range or not aligned */
+    FLASH_SIM_PROGRAM_ERR,   /* programming a bit from 0 to 1, the bit needs erase first */
+    FLASH_SIM_POWER_CUT,     /* the power is cut during the operation, it's torn */
+} FlashSimStatus;
+
+/* Flash operations cost model, the units is nanosecond */
+typedef struct _flash_sim_timing {
+    uint32_t read_word;      /* read one word (4 bytes) */
+    uint32_t program_word;   /* program one word (4 bytes) */
+    uint32_t erase_page;     /* erase one page */
+} flash_sim_timing;
+
+/* Flash operations statistics */
+typedef struct _flash_sim_stats {
+    uint32_t read_cnt;       /* read operations count */
+    uint32_t program_cnt;    /* program operations count */
+    uint32_t erase_cnt;      /* erased pages count */
+    uint64_t read_bytes;     /* read bytes */
+    uint64_t program_bytes;  /* programmed bytes */
+    uint64_t elapsed_ns;     /* simulated Flash busy time by the cost model */
+    size_t heap_cur;         /* current heap bytes allocated by flash_sim_malloc */
+    size_t heap_peak;        /* peak heap bytes allocated by flash_sim_malloc */
+} flash_sim_stats;
+
+/* power cut callback, it should stop the program like a real power cut */
+typedef void (*flash_sim_power_cut_cb)(void);
+
+/* STM32F10x datasheet typical timing, 72MHz with 2 wait states, 2 half-words per word */
+extern const flash_sim_timing flash_sim_timing_typ;
+/* STM32F10x datasheet maximum timing */
+extern const flash_sim_timing flash_sim_timing_max;
+
+int flash_sim_init(const char *image_path);
+void flash_sim_deinit(void);
+void flash_sim_set_timing(const flash_sim_timing *timing, int realtime);
+FlashSimStatus flash_sim_read(uint32_t addr, uint32_t *buf, size_t size);
+FlashSimStatus flash_sim_erase_page(uint32_t addr);
+FlashSimStatus flash_sim_program_word(uint32_t addr, uint32_t data);
+void flash_sim_get_stats(flash_sim_stats *stats);
+void flash_sim_reset_stats(void);
+uint32_t flash_sim_get_page_erase_cnt(uint32_t addr);
+void flash_sim_set_power_cut(uint32_t ops, uint32_t seed, flash_sim_power_cut_cb cb);
+void flash_sim_dump(void *buf);
+void flash_sim_load(const void *buf);
+void *flash_sim_malloc(size_t size);
+void flash_sim_free(void *p);
+
+#endif /* FLASH_SIM_H_ */
@@ -0,0 +1,137 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: CRC32 engines test.
+ *           The engine of calc_crc32 is selected by a copy of flash.h. Every length and alignment
+ *           of a random buffer is calculated by the engine in one call and in three chained calls,
+ *           then compared with the bit-at-a-time CRC32 of IEEE 802.3. The summary of the engine
+ *           is output as one JSON line, e.g.
+ *           {"version":"1.03.10","engine":"slicing8","cases":18561,"failed":0}
+ * Created on: 2026-10-16
+ */
+
+#include "flash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the buffer size, every length from 0 is tested until CRC_FULL_LEN, then by CRC_LONG_STEP */
+#define CRC_BUF_SIZE                    4096
+#define CRC_FULL_LEN                    520
+#define CRC_LONG_STEP                   61
+/* the start address is moved by every alignment in the 16 bytes PCLMUL block */
+#define CRC_ALIGN_NUM                   16
+/* the print limit of failed cases */
+#define CRC_PRINT_MAX                   10
+
+#if defined(FLASH_CRC32_USING_PCLMUL)
+#define CRC_ENGINE                      "pclmul"
+#elif defined(FLASH_CRC32_USING_SLICING) && FLASH_CRC32_SLICING_SIZE == 4
+#define CRC_ENGINE                      "slicing4"
+#elif defined(FLASH_CRC32_USING_SLICING)
+#define CRC_ENGINE                      "slicing8"
+#else
+#define CRC_ENGINE                      "table"
+#endif
+
+extern void calc_crc32_init(void);
+extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
+
+/* the buffer has the space for every alignment */
+static uint8_t crc_buf[CRC_BUF_SIZE + CRC_ALIGN_NUM];
+
+/**
+ * Calculate the CRC32 by bits, it's the reference of all engines.
+ *
+ * @param buf buffer
+ * @param size bytes in buffer
+ *
+ * @return CRC32 value
+ */
+static uint32_t crc32_ref(const uint8_t *buf, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < size; i++) {
+        crc ^= buf[i];
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * Check a length and alignment by one call and chained calls.
+ *
+ * @param align the buffer start offset
+ * @param len bytes in buffer
+ * @param failed failed cases count
+ *
+ * @return checked cases count
+ */
+static size_t check_crc32(size_t align, size_t len, size_t *failed) {
+    const uint8_t *p = crc_buf + align;
+    uint32_t ref = crc32_ref(p, len), crc;
+    size_t split1 = len ? (size_t) rand() % (len + 1) : 0, split2;
+
+    split2 = split1 + (len - split1 ? (size_t) rand() % (len - split1 + 1) : 0);
+    crc = calc_crc32(0, p, len);
+    if (crc != ref && (*failed)++ < CRC_PRINT_MAX) {
+        fprintf(stderr, "align %zu len %zu: 0x%08X != 0x%08X\n", align, len, crc, ref);
+    }
+    crc = calc_crc32(0, p, split1);
+    crc = calc_crc32(crc, p + split1, split2 - split1);
+    crc = calc_crc32(crc, p + split2, len - split2);
+    if (crc != ref && (*failed)++ < CRC_PRINT_MAX) {
+        fprintf(stderr, "align %zu len %zu split %zu %zu: 0x%08X != 0x%08X\n", align, len,
+                split1, split2, crc, ref);
+    }
+
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    size_t i, align, len, cases = 0, failed = 0;
+
+    srand(1);
+    for (i = 0; i < sizeof(crc_buf); i++) {
+        crc_buf[i] = (uint8_t) rand();
+    }
+    calc_crc32_init();
+
+    for (align = 0; align < CRC_ALIGN_NUM; align++) {
+        for (len = 0; len <= CRC_BUF_SIZE; len += len < CRC_FULL_LEN ? 1 : CRC_LONG_STEP) {
+            cases += check_crc32(align, len, &failed);
+        }
+        cases += check_crc32(align, CRC_BUF_SIZE, &failed);
+    }
+    /* the known check value of "123456789" */
+    cases++;
+    if (calc_crc32(0, "123456789", 9) != 0xCBF43926) {
+        failed++;
+        fprintf(stderr, "check value: 0x%08X != 0xCBF43926\n", calc_crc32(0, "123456789", 9));
+    }
+
+    printf("{\"version\":\"%s\",\"engine\":\"%s\",\"cases\":%zu,\"failed\":%zu}\n",
+            FLASH_SW_VERSION, CRC_ENGINE, cases, failed);
+
+    return failed ? 1 : 0;
+}
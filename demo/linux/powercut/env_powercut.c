@@ -0,0 +1,645 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Power cut test on the simulated Flash.
+ *           Every scenario is run once to count its program and erase operations, then it's
+ *           run again from the same Flash data for every operation, and the power is cut at the
+ *           operation. The operation is torn by the simulated Flash. After every cut, a new
+ *           process boots the library like a reset device, measures the recovery time and
+ *           checks the data. The summary of every scenario is output as one JSON line, e.g.
+ *           {"version":"1.03.10","mode":"normal","scenario":"save","cuts":366,"survived":366,...}
+ *           Every run and every recovery is a new process, so the library state in RAM is lost
+ *           like a real power cut. The Flash is a shared mapping, so it's kept between them.
+ * Created on: 2026-10-16
+ */
+
+#include "flash.h"
+#include "flash_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* the maximum keys number */
+#define PC_KEYS_MAX                     256
+/* the key and value buffer size */
+#define PC_STR_MAX                      32
+/* the user application entry address and size for IAP scenario, it's in front of the Env */
+#define PC_USER_APP_ADDR                (FLASH_SIM_BASE + 16 * 1024)
+#define PC_APP_SIZE                     (8 * 1024)
+/* the bytes size of every downloaded application part */
+#define PC_APP_PART_SIZE                128
+/* the recovery is treated as hang when it's longer than this, the library asserts will hang */
+#define PC_RECOVER_TIMEOUT              10
+
+#if defined(FLASH_ENV_USING_WEAR_LEVELING_MODE)
+#define PC_MODE                         "wl"
+#elif defined(FLASH_ENV_USING_LOG_MODE) && defined(FLASH_ENV_USING_PAGED_CACHE)
+#define PC_MODE                         "paged"
+#elif defined(FLASH_ENV_USING_LOG_MODE)
+#define PC_MODE                         "log"
+#else
+#define PC_MODE                         "normal"
+#endif
+
+/* the result of a power cut */
+typedef enum {
+    PC_OUTCOME_OLD,            /* all data are same as before the operation */
+    PC_OUTCOME_NEW,            /* all data are same as after the operation */
+    PC_OUTCOME_MIXED,          /* no data is lost, but a part of data is new */
+    PC_OUTCOME_LOST,           /* some data are lost or damaged */
+    PC_OUTCOME_HANG,           /* the recovery is not finished in PC_RECOVER_TIMEOUT */
+    PC_OUTCOME_CRASH,          /* the recovery process is crashed */
+    PC_OUTCOME_NUM,
+} pc_outcome;
+
+static const char * const pc_outcome_name[] = { "old", "new", "mixed", "lost", "hang", "crash" };
+
+/* the recovery result of a power cut, it's written by the recovery process */
+typedef struct {
+    uint32_t outcome;
+    uint32_t lost;             /* lost keys number, or 1 when the application is damaged */
+    uint32_t resave_ok;        /* the environment variables can be saved after recovery */
+    uint32_t erases;           /* erased pages in recovery */
+    uint64_t cpu_ns;           /* host CPU time of recovery */
+    uint64_t flash_ns;         /* simulated Flash time of recovery */
+} pc_result;
+
+/* power cut scenario */
+typedef struct {
+    const char *name;
+    /* make the data before the operation on an erased Flash */
+    void (*prepare)(void);
+    /* the operation which is cut, it's called after booting the library */
+    void (*operation)(void);
+    /* boot the library after power cut, recover the data and check it */
+    void (*recover)(pc_result *result);
+    /* the data number for data loss rate */
+    size_t data_num;
+} pc_scenario;
+
+/* output file, the library logs are not mixed in it */
+static FILE *out;
+/* keys number and the updated keys number of save scenario */
+static size_t cur_keys = 32, cur_updates = 8;
+/* the Flash operations number between two cuts */
+static uint32_t cur_stride = 1;
+/* random seed for tearing operation */
+static uint32_t cur_seed = 1;
+/* output every cut */
+static int print_cuts = 0;
+/* shared with the child processes */
+static uint32_t *shared_ops;
+static pc_result *shared_result;
+
+/**
+ * Get the host monotonic time.
+ *
+ * @return time (ns)
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * The power cut callback, it stops the process immediately like a real power cut.
+ */
+static void power_off(void) {
+    _exit(0);
+}
+
+/**
+ * Boot the library, the power cut test can't continue when it's failed.
+ */
+static void boot(void) {
+    if (flash_init() != FLASH_NO_ERR) {
+        _exit(1);
+    }
+}
+
+/**
+ * Make the key string.
+ *
+ * @param buf key buffer
+ * @param index key index
+ */
+static void make_key(char *buf, size_t index) {
+    snprintf(buf, PC_STR_MAX, "pc%03lu", (unsigned long) index);
+}
+
+/**
+ * Make the value string before or after the operation. The key cur_keys is only existed after
+ * the operation, and the last key is deleted by the operation.
+ *
+ * @param buf value buffer
+ * @param index key index
+ * @param is_new the value is after the operation
+ *
+ * @return the value, NULL is not existed
+ */
+static const char *make_value(char *buf, size_t index, bool_t is_new) {
+    if ((!is_new && index == cur_keys) || (is_new && index == cur_keys - 1)) {
+        return NULL;
+    }
+    snprintf(buf, PC_STR_MAX, "%s_value_%03lu", is_new && (index < cur_updates
+            || index == cur_keys) ? "new" : "old", (unsigned long) index);
+    return buf;
+}
+
+/**
+ * Save scenario: make all keys with the old values.
+ */
+static void save_prepare(void) {
+    char key[PC_STR_MAX], value[PC_STR_MAX];
+    size_t i;
+
+    boot();
+    for (i = 0; i < cur_keys; i++) {
+        make_key(key, i);
+        flash_set_env(key, make_value(value, i, FALSE));
+    }
+    flash_save_env();
+}
+
+/**
+ * Save scenario: update, add and delete keys, then save them.
+ */
+static void save_operation(void) {
+    char key[PC_STR_MAX], value[PC_STR_MAX];
+    const char *new_value;
+    size_t i;
+
+    for (i = 0; i <= cur_keys; i++) {
+        /* only the updated, deleted and added keys are set */
+        if (i >= cur_updates && i < cur_keys - 1) {
+            continue;
+        }
+        make_key(key, i);
+        new_value = make_value(value, i, TRUE);
+        flash_set_env(key, new_value ? new_value : "");
+    }
+    flash_save_env();
+}
+
+/**
+ * Save scenario: boot and check every key is old or new.
+ *
+ * @param result recovery result
+ */
+static void save_recover(pc_result *result) {
+    char key[PC_STR_MAX], old_buf[PC_STR_MAX], new_buf[PC_STR_MAX];
+    const char *value, *old_value, *new_value;
+    size_t i, old_num = 0, new_num = 0;
+    flash_sim_stats start, stats;
+    uint64_t start_ns;
+
+    flash_sim_get_stats(&start);
+    start_ns = now_ns();
+    boot();
+    result->cpu_ns = now_ns() - start_ns;
+    flash_sim_get_stats(&stats);
+    result->flash_ns = stats.elapsed_ns - start.elapsed_ns;
+    result->erases = stats.erase_cnt - start.erase_cnt;
+
+    for (i = 0; i <= cur_keys; i++) {
+        make_key(key, i);
+        value = flash_get_env(key);
+        old_value = make_value(old_buf, i, FALSE);
+        new_value = make_value(new_buf, i, TRUE);
+        if (value ? old_value && !strcmp(value, old_value) : !old_value) {
+            old_num++;
+        }
+        if (value ? new_value && !strcmp(value, new_value) : !new_value) {
+            new_num++;
+        }
+        if (value ? (!old_value || strcmp(value, old_value)) && (!new_value
+                || strcmp(value, new_value)) : old_value && new_value) {
+            result->lost++;
+        }
+    }
+    if (result->lost) {
+        result->outcome = PC_OUTCOME_LOST;
+    } else if (old_num == cur_keys + 1) {
+        result->outcome = PC_OUTCOME_OLD;
+    } else if (new_num == cur_keys + 1) {
+        result->outcome = PC_OUTCOME_NEW;
+    } else {
+        result->outcome = PC_OUTCOME_MIXED;
+    }
+
+    /* the environment variables must be saved and loaded again after recovery */
+    flash_set_env("pc_resave", "1");
+    if (flash_save_env() == FLASH_NO_ERR) {
+        flash_load_env();
+        value = flash_get_env("pc_resave");
+        result->resave_ok = value && !strcmp(value, "1");
+    }
+}
+
+/**
+ * Get the data of the application.
+ *
+ * @param index word index
+ *
+ * @return data
+ */
+static uint32_t app_data(size_t index) {
+    return 0xA5000000 | (uint32_t) index;
+}
+
+/**
+ * IAP scenario: download an application to backup area and request the bootloader to copy it.
+ */
+static void iap_prepare(void) {
+    uint32_t part[PC_APP_PART_SIZE / 4];
+    size_t cur_size = 0, i;
+    char size_str[11];
+
+    boot();
+    flash_erase_bak_app(PC_APP_SIZE);
+    while (cur_size < PC_APP_SIZE) {
+        for (i = 0; i < PC_APP_PART_SIZE / 4; i++) {
+            part[i] = app_data(cur_size / 4 + i);
+        }
+        flash_write_data_to_bak((uint8_t *) part, PC_APP_PART_SIZE, &cur_size, PC_APP_SIZE);
+    }
+    snprintf(size_str, sizeof(size_str), "%lu", (unsigned long) PC_APP_SIZE);
+    flash_set_env("iap_copy_app_size", size_str);
+    flash_set_env("iap_need_copy_app", "1");
+    flash_save_env();
+}
+
+/**
+ * IAP scenario: the bootloader copies the application when it's requested.
+ */
+static void iap_operation(void) {
+    const char *need_copy = flash_get_env("iap_need_copy_app");
+    const char *app_size = flash_get_env("iap_copy_app_size");
+    size_t size;
+
+    if (!need_copy || strcmp(need_copy, "1") || !app_size) {
+        return;
+    }
+    size = strtoul(app_size, NULL, 0);
+    if (flash_erase_user_app(PC_USER_APP_ADDR, size) == FLASH_NO_ERR
+            && flash_copy_app_from_bak(PC_USER_APP_ADDR, size) == FLASH_NO_ERR) {
+        flash_set_env("iap_need_copy_app", "0");
+        flash_save_env();
+    }
+}
+
+/**
+ * IAP scenario: boot the bootloader again and check the application.
+ *
+ * @param result recovery result
+ */
+static void iap_recover(pc_result *result) {
+    const char *need_copy;
+    flash_sim_stats start, stats;
+    uint64_t start_ns;
+    uint32_t data;
+    size_t i;
+
+    /* the recovery time includes copying the application again */
+    flash_sim_get_stats(&start);
+    start_ns = now_ns();
+    boot();
+    iap_operation();
+    result->cpu_ns = now_ns() - start_ns;
+    flash_sim_get_stats(&stats);
+    result->flash_ns = stats.elapsed_ns - start.elapsed_ns;
+    result->erases = stats.erase_cnt - start.erase_cnt;
+
+    for (i = 0; i < PC_APP_SIZE / 4; i++) {
+        flash_sim_read(PC_USER_APP_ADDR + i * 4, &data, 4);
+        if (data != app_data(i)) {
+            result->lost = 1;
+            break;
+        }
+    }
+    need_copy = flash_get_env("iap_need_copy_app");
+    result->outcome = result->lost || !need_copy || strcmp(need_copy, "0") ? PC_OUTCOME_LOST
+            : PC_OUTCOME_NEW;
+    result->resave_ok = TRUE;
+}
+
+/* all scenarios, the data number of save scenario is set at running */
+static pc_scenario scenarios[] = {
+    { "save", save_prepare, save_operation, save_recover, 0 },
+    { "iap_copy", iap_prepare, iap_operation, iap_recover, 1 },
+};
+
+/**
+ * Run the function in a new process and wait it.
+ *
+ * @param func function, the process exits when it's returned
+ * @param timeout timeout (s), 0 is no timeout
+ *
+ * @return the process exit status
+ */
+static int run_process(void (*func)(void), unsigned int timeout) {
+    pid_t pid;
+    int status;
+
+    fflush(out);
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        alarm(timeout);
+        func();
+        _exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        return -1;
+    }
+    return status;
+}
+
+/* current scenario and cut for the child processes */
+static pc_scenario *cur_scenario;
+static uint32_t cur_cut;
+
+/**
+ * Run the operation of current scenario, the power is cut at cur_cut operation.
+ */
+static void run_operation(void) {
+    flash_sim_stats start, stats;
+
+    boot();
+    flash_sim_get_stats(&start);
+    flash_sim_set_power_cut(cur_cut, cur_seed ^ cur_cut, power_off);
+    cur_scenario->operation();
+    flash_sim_get_stats(&stats);
+    *shared_ops = stats.program_cnt + stats.erase_cnt - start.program_cnt - start.erase_cnt;
+}
+
+/**
+ * Recover the data of current scenario after power cut.
+ */
+static void run_recover(void) {
+    memset(shared_result, 0, sizeof(pc_result));
+    cur_scenario->recover(shared_result);
+}
+
+/**
+ * Compare two samples for qsort.
+ */
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Get the percentile of the sorted samples.
+ *
+ * @param samples sorted samples
+ * @param num samples number
+ * @param pct percentile
+ *
+ * @return sample value
+ */
+static uint64_t percentile(const uint64_t *samples, size_t num, double pct) {
+    size_t i = (size_t) (pct / 100.0 * num);
+
+    if (!num) {
+        return 0;
+    }
+    return samples[i < num ? i : num - 1];
+}
+
+/**
+ * Print the JSON line head of the scenario.
+ *
+ * @param scenario scenario
+ */
+static void print_head(const pc_scenario *scenario) {
+    fprintf(out, "{\"version\":\"%s\",\"mode\":\"%s\",\"scenario\":\"%s\"", FLASH_SW_VERSION,
+            PC_MODE, scenario->name);
+}
+
+/**
+ * Cut the power at every operation of the scenario and output the summary.
+ *
+ * @param scenario scenario
+ * @param base the Flash data before the operation
+ */
+static void scenario_run(pc_scenario *scenario, uint8_t *base) {
+    uint32_t ops, cut, outcome_num[PC_OUTCOME_NUM] = { 0 }, resave_fail = 0, erases_max = 0;
+    uint64_t lost = 0, *cpu_ns, *flash_ns;
+    size_t cuts = 0, recovered = 0, i;
+    int status;
+
+    cur_scenario = scenario;
+    memset(base, 0xFF, FLASH_SIM_SIZE);
+    flash_sim_load(base);
+    if (run_process(scenario->prepare, 0) != 0) {
+        print_head(scenario);
+        fprintf(out, ",\"result\":\"error\"}\n");
+        return;
+    }
+    flash_sim_dump(base);
+
+    /* count the operations without power cut */
+    cur_cut = 0;
+    *shared_ops = 0;
+    if (run_process(run_operation, 0) != 0 || !*shared_ops) {
+        print_head(scenario);
+        fprintf(out, ",\"result\":\"error\"}\n");
+        return;
+    }
+    ops = *shared_ops;
+    cpu_ns = calloc(ops, sizeof(uint64_t));
+    flash_ns = calloc(ops, sizeof(uint64_t));
+
+    for (cut = 1; cut <= ops; cut += cur_stride) {
+        cur_cut = cut;
+        flash_sim_load(base);
+        if (run_process(run_operation, 0) != 0) {
+            print_head(scenario);
+            fprintf(out, ",\"cut\":%u,\"result\":\"error\"}\n", cut);
+            continue;
+        }
+        status = run_process(run_recover, PC_RECOVER_TIMEOUT);
+        if (status == 0) {
+            cpu_ns[recovered] = shared_result->cpu_ns;
+            flash_ns[recovered] = shared_result->flash_ns;
+            recovered++;
+            lost += shared_result->lost;
+            if (!shared_result->resave_ok) {
+                resave_fail++;
+            }
+            if (shared_result->erases > erases_max) {
+                erases_max = shared_result->erases;
+            }
+        } else {
+            memset(shared_result, 0, sizeof(pc_result));
+            shared_result->outcome = WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM
+                    ? PC_OUTCOME_HANG : PC_OUTCOME_CRASH;
+            /* all data are treated as lost */
+            lost += scenario->data_num;
+        }
+        outcome_num[shared_result->outcome]++;
+        cuts++;
+        if (print_cuts) {
+            print_head(scenario);
+            fprintf(out, ",\"cut\":%u,\"outcome\":\"%s\",\"lost\":%u,\"resave_ok\":%u,"
+                    "\"recover_cpu_ns\":%llu,\"recover_flash_ns\":%llu,\"recover_erases\":%u}\n",
+                    cut, pc_outcome_name[shared_result->outcome], shared_result->lost,
+                    shared_result->resave_ok, (unsigned long long) shared_result->cpu_ns,
+                    (unsigned long long) shared_result->flash_ns, shared_result->erases);
+        }
+    }
+
+    qsort(cpu_ns, recovered, sizeof(uint64_t), cmp_u64);
+    qsort(flash_ns, recovered, sizeof(uint64_t), cmp_u64);
+    print_head(scenario);
+    fprintf(out, ",\"ops\":%u,\"cuts\":%lu,\"survived\":%lu,\"survival_rate\":%.4f",
+            ops, (unsigned long) cuts, (unsigned long) (cuts - outcome_num[PC_OUTCOME_LOST]
+            - outcome_num[PC_OUTCOME_HANG] - outcome_num[PC_OUTCOME_CRASH]),
+            cuts ? 1.0 - (double) (outcome_num[PC_OUTCOME_LOST] + outcome_num[PC_OUTCOME_HANG]
+            + outcome_num[PC_OUTCOME_CRASH]) / cuts : 0.0);
+    for (i = 0; i < PC_OUTCOME_NUM; i++) {
+        fprintf(out, ",\"%s\":%u", pc_outcome_name[i], outcome_num[i]);
+    }
+    fprintf(out, ",\"data_num\":%lu,\"data_loss_rate\":%.4f,\"resave_fail\":%u",
+            (unsigned long) scenario->data_num, cuts ? (double) lost / scenario->data_num / cuts
+            : 0.0, resave_fail);
+    fprintf(out, ",\"recover_cpu_p50_ns\":%llu,\"recover_cpu_p99_ns\":%llu,"
+            "\"recover_cpu_max_ns\":%llu",
+            (unsigned long long) percentile(cpu_ns, recovered, 50),
+            (unsigned long long) percentile(cpu_ns, recovered, 99),
+            (unsigned long long) percentile(cpu_ns, recovered, 100));
+    fprintf(out, ",\"recover_flash_p50_ns\":%llu,\"recover_flash_p99_ns\":%llu,"
+            "\"recover_flash_max_ns\":%llu,\"recover_erases_max\":%u}\n",
+            (unsigned long long) percentile(flash_ns, recovered, 50),
+            (unsigned long long) percentile(flash_ns, recovered, 99),
+            (unsigned long long) percentile(flash_ns, recovered, 100), erases_max);
+
+    free(cpu_ns);
+    free(flash_ns);
+}
+
+/**
+ * Print the usage.
+ *
+ * @param name program name
+ */
+static void usage(const char *name) {
+    printf("Usage: %s [-o scenario] [-k keys] [-u updates] [-s stride] [-S seed] [-t typ|max]"
+            " [-c] [-v]\n", name);
+    printf("  -o  only run the scenario: save or iap_copy\n");
+    printf("  -k  keys number of save scenario, default is 32\n");
+    printf("  -u  updated keys number of save scenario, default is 8\n");
+    printf("  -s  cut the power every N Flash operations, default is 1\n");
+    printf("  -S  random seed for tearing the Flash operation, default is 1\n");
+    printf("  -t  Flash timing model of STM32F10x datasheet, default is typ\n");
+    printf("  -c  output the result of every cut\n");
+    printf("  -v  print the library logs to stderr\n");
+}
+
+int main(int argc, char **argv) {
+    const flash_sim_timing *timing = &flash_sim_timing_typ;
+    const char *only_scenario = NULL;
+    char image_path[] = "/tmp/env_powercut_XXXXXX";
+    uint8_t *base;
+    void *shared;
+    int verbose = 0, opt, fd;
+    size_t i;
+
+    while ((opt = getopt(argc, argv, "o:k:u:s:S:t:cvh")) != -1) {
+        switch (opt) {
+        case 'o':
+            only_scenario = optarg;
+            break;
+        case 'k':
+            cur_keys = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            cur_updates = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            cur_stride = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            cur_seed = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            timing = strcmp(optarg, "max") ? &flash_sim_timing_typ : &flash_sim_timing_max;
+            break;
+        case 'c':
+            print_cuts = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cur_keys < 2 || cur_keys > PC_KEYS_MAX || cur_updates >= cur_keys || !cur_stride) {
+        usage(argv[0]);
+        return 1;
+    }
+    scenarios[0].data_num = cur_keys + 1;
+
+    /* the results are output to stdout, the library logs are dropped or output to stderr */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || !freopen(verbose ? "/dev/stderr" : "/dev/null", "w", stdout)) {
+        return 1;
+    }
+    /* the assert logs must be output before the library hangs */
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    /* the Flash image is shared by all processes, it's removed when the test is finished */
+    fd = mkstemp(image_path);
+    if (fd < 0 || flash_sim_init(image_path) != 0) {
+        fprintf(stderr, "Simulated Flash initialize failed.\n");
+        return 1;
+    }
+    close(fd);
+    unlink(image_path);
+    flash_sim_set_timing(timing, 0);
+    shared = mmap(NULL, sizeof(pc_result) + sizeof(uint32_t), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    base = malloc(FLASH_SIM_SIZE);
+    if (shared == MAP_FAILED || !base) {
+        return 1;
+    }
+    shared_result = shared;
+    shared_ops = (uint32_t *) (shared_result + 1);
+
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (!only_scenario || !strcmp(only_scenario, scenarios[i].name)) {
+            scenario_run(&scenarios[i], base);
+        }
+    }
+
+    free(base);
+    flash_sim_deinit();
+
+    return 0;
+}
@@ -51,6 +51,22 @@ void saveenv(uint8_t argc, char **argv) {
 }
 MSH_CMD_EXPORT(saveenv, Save all envrionment variables to flash.);
 
+void wearstat(uint8_t argc, char **argv) {
+    flash_print_wear_stats();
+}
+MSH_CMD_EXPORT(wearstat, Print flash erase units wear statistics.);
+
+#ifdef FLASH_USING_STATS
+void flashstat(uint8_t argc, char **argv) {
+    if (argc > 1 && !rt_strcmp(argv[1], "reset")) {
+        flash_reset_stats();
+    } else {
+        flash_print_stats();
+    }
+}
+MSH_CMD_EXPORT(flashstat, Print or reset flash operations statistics.);
+#endif
+
 void getvalue(uint8_t argc, char **argv) {
     char *value = NULL;
     value = flash_get_env(argv[1]);
@@ -41,6 +41,21 @@
 /* print debug information of flash */
 #define FLASH_PRINT_DEBUG
 
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/* the asynchronous saving thread priority, it's lower than all application threads */
+#define FLASH_ENV_ASYNC_THREAD_PRIO     (RT_THREAD_PRIORITY_MAX - 3)
+/* the asynchronous saving request event */
+#define FLASH_ENV_ASYNC_EVENT           (1 << 0)
+#endif
+
+#ifdef FLASH_USING_STATS
+/* Cortex-M3 DWT cycle counter registers, the CMSIS of some toolchains has no DWT definition */
+#define DWT_CTRL                        (*(volatile uint32_t *) 0xE0001000)
+#define DWT_CYCCNT                      (*(volatile uint32_t *) 0xE0001004)
+#define DWT_CTRL_CYCCNTENA              (1UL << 0)
+#define DEMCR_TRCENA                    (1UL << 24)
+#endif
+
 /* default environment variables set for user */
 static const flash_env default_env_set[] = {
         {"iap_need_copy_app","0"},
@@ -52,6 +67,26 @@ static const flash_env default_env_set[] = {
 
 static char log_buf[RT_CONSOLEBUF_SIZE];
 
+#ifdef FLASH_ENV_USING_LOCK
+/* the readers number is protected by mutex, the first reader and the writer take the semaphore */
+static struct rt_mutex env_read_mutex;
+static struct rt_semaphore env_write_sem;
+static rt_uint16_t env_readers = 0;
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/* the saving and loading are serialized by mutex */
+static struct rt_mutex env_save_mutex;
+#endif
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/* the asynchronous saving thread waits for the request event */
+static struct rt_event env_async_event;
+static struct rt_thread env_async_thread;
+ALIGN(RT_ALIGN_SIZE)
+static rt_uint8_t env_async_thread_stack[512];
+
+static void env_async_thread_entry(void *parameter);
+#endif
+
 /**
  * Flash port for hardware initialize.
  *
@@ -75,6 +110,20 @@ FlashErrCode flash_port_init(uint32_t *env_addr, size_t *env_size, size_t *erase
     *default_env = default_env_set;
     *default_env_size = sizeof(default_env_set)/sizeof(default_env_set[0]);
 
+#ifdef FLASH_ENV_USING_LOCK
+    rt_mutex_init(&env_read_mutex, "env_rd", RT_IPC_FLAG_FIFO);
+    rt_sem_init(&env_write_sem, "env_wr", 1, RT_IPC_FLAG_FIFO);
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+    rt_mutex_init(&env_save_mutex, "env_sv", RT_IPC_FLAG_FIFO);
+#endif
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+    rt_event_init(&env_async_event, "env_as", RT_IPC_FLAG_FIFO);
+    rt_thread_init(&env_async_thread, "env_save", env_async_thread_entry, RT_NULL,
+            env_async_thread_stack, sizeof(env_async_thread_stack), FLASH_ENV_ASYNC_THREAD_PRIO, 5);
+    rt_thread_startup(&env_async_thread);
+#endif
+
     return result;
 }
 
@@ -191,6 +240,139 @@ void flash_free(void *p) {
     rt_free(p);
 }
 
+#ifdef FLASH_USING_STATS
+/**
+ * Get the Cortex-M3 DWT cycle counter for the API latency statistics. It can wrap around.
+ *
+ * @return current cycles
+ */
+uint32_t flash_get_cycles(void) {
+    /* enable the DWT cycle counter on first call */
+    if (!(DWT_CTRL & DWT_CTRL_CYCCNTENA)) {
+        CoreDebug->DEMCR |= DEMCR_TRCENA;
+        DWT_CYCCNT = 0;
+        DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    }
+
+    return DWT_CYCCNT;
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/**
+ * Get the time in second for the erase budget. The RT-Thread tick wraps around before the second
+ * does, so the elapsed ticks are accumulated.
+ *
+ * @return current time (second)
+ */
+uint32_t flash_get_time(void) {
+    static rt_tick_t last_tick = 0, remain_tick = 0;
+    static uint32_t sec = 0;
+    rt_base_t level;
+    rt_tick_t now;
+    uint32_t cur_sec;
+
+    level = rt_hw_interrupt_disable();
+    now = rt_tick_get();
+    remain_tick += now - last_tick;
+    last_tick = now;
+    sec += remain_tick / RT_TICK_PER_SECOND;
+    remain_tick %= RT_TICK_PER_SECOND;
+    cur_sec = sec;
+    rt_hw_interrupt_enable(level);
+
+    return cur_sec;
+}
+#endif
+
+#ifdef FLASH_ENV_USING_LOCK
+/**
+ * Lock the environment variables for reading. Only the first reader waits for the writer, so the
+ * readers don't block each other.
+ */
+void flash_env_lock_read(void) {
+    rt_mutex_take(&env_read_mutex, RT_WAITING_FOREVER);
+    if (++env_readers == 1) {
+        rt_sem_take(&env_write_sem, RT_WAITING_FOREVER);
+    }
+    rt_mutex_release(&env_read_mutex);
+}
+
+/**
+ * Unlock the environment variables read lock. The last reader releases the writer.
+ */
+void flash_env_unlock_read(void) {
+    rt_mutex_take(&env_read_mutex, RT_WAITING_FOREVER);
+    if (--env_readers == 0) {
+        rt_sem_release(&env_write_sem);
+    }
+    rt_mutex_release(&env_read_mutex);
+}
+
+/**
+ * Lock the environment variables for writing.
+ */
+void flash_env_lock_write(void) {
+    rt_sem_take(&env_write_sem, RT_WAITING_FOREVER);
+}
+
+/**
+ * Unlock the environment variables write lock.
+ */
+void flash_env_unlock_write(void) {
+    rt_sem_release(&env_write_sem);
+}
+#endif
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/**
+ * Lock the environment variables saving.
+ */
+void flash_env_lock_save(void) {
+    rt_mutex_take(&env_save_mutex, RT_WAITING_FOREVER);
+}
+
+/**
+ * Unlock the environment variables saving.
+ */
+void flash_env_unlock_save(void) {
+    rt_mutex_release(&env_save_mutex);
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/**
+ * The asynchronous saving thread. All requests in the debounce window are merged into one saving.
+ *
+ * @param parameter parameter
+ */
+static void env_async_thread_entry(void *parameter) {
+    rt_uint32_t recved, retry_sec;
+
+    while (1) {
+        rt_event_recv(&env_async_event, FLASH_ENV_ASYNC_EVENT,
+                RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, RT_WAITING_FOREVER, &recved);
+        rt_thread_delay(FLASH_ENV_ASYNC_SAVE_DEBOUNCE * RT_TICK_PER_SECOND / 1000);
+        /* clear the requests in debounce window */
+        rt_event_recv(&env_async_event, FLASH_ENV_ASYNC_EVENT,
+                RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR, RT_WAITING_NO, &recved);
+        retry_sec = flash_save_env_async_handler();
+        /* the deferred saving is requested again after the erase budget is refilled */
+        if (retry_sec) {
+            rt_thread_delay(retry_sec * RT_TICK_PER_SECOND);
+            flash_env_async_notify();
+        }
+    }
+}
+
+/**
+ * Wake up the asynchronous saving thread.
+ */
+void flash_env_async_notify(void) {
+    rt_event_send(&env_async_event, FLASH_ENV_ASYNC_EVENT);
+}
+#endif
+
 /**
  * This function is print flash debug info.
  *
@@ -28,9 +28,75 @@
 
 /* using CRC32 check when load environment variable from Flash */
 #define FLASH_ENV_USING_CRC_CHECK
-/* using wear leveling mode or normal mode */
+/* using slicing-by-4 or slicing-by-8 CRC32, it needs (SLICING_SIZE - 1) KB RAM for tables, they
+ * are made by flash_init */
+/* #define FLASH_CRC32_USING_SLICING */
+#define FLASH_CRC32_SLICING_SIZE        8
+/* using PCLMULQDQ folding CRC32 for x86 host (simulator and tools), it needs -mpclmul -msse4.1 */
+/* #define FLASH_CRC32_USING_PCLMUL */
+/* using hardware CRC32 unit by flash_crc32() in port, it must be same as the IEEE 802.3 CRC32 */
+/* #define FLASH_CRC32_USING_PORT */
+/* using wear leveling mode, log mode or normal mode */
 /* #define FLASH_ENV_USING_WEAR_LEVELING_MODE */
+/* #define FLASH_ENV_USING_LOG_MODE */
 #define FLASH_ENV_USING_NORMAL_MODE
+/* the copies number of environment variables for normal mode, the newest valid copy is loaded */
+#define FLASH_ENV_NORMAL_COPY_NUM       2
+/* environment variables RAM hash index initial buckets number, must be power of 2. It's doubled
+ * when 3/4 buckets are used. The paged cache sizes it by the environment variables area size */
+#define FLASH_ENV_HASH_INDEX_SIZE       256
+/* using sorted index instead of hash index, environment variables can be iterated by name order */
+/* #define FLASH_ENV_USING_SORTED_INDEX */
+/* environment variables RAM sorted index initial items number, it's doubled when it's full */
+#define FLASH_ENV_SORTED_INDEX_SIZE     128
+/* the bytes size of changed environment variables names journal for log mode, every name uses
+ * (name length + 1) bytes. When it's full, the next saving will compact instead of appending */
+#define FLASH_ENV_LOG_JOURNAL_SIZE      128
+/* using paged cache for log mode, only FLASH_ENV_PAGED_CACHE_NUM erase units are cached in RAM with
+ * LRU replacement, so the RAM size is independent of environment variables area size. The hash
+ * index is the only index, so the environment variables number is up to 3/4 of its buckets */
+/* #define FLASH_ENV_USING_PAGED_CACHE */
+/* the cached erase units number of paged cache, it's 2 at least */
+#define FLASH_ENV_PAGED_CACHE_NUM       4
+/* the bytes size of unsaved changes buffer for paged cache, it's saved automatically when full, so
+ * the changes which are more than it are not saved atomically */
+#define FLASH_ENV_PAGED_DIRTY_SIZE      1024
+/* the maximum erase units number of environment variables area which have erase counters */
+#define FLASH_ENV_WEAR_SECTOR_NUM       16
+/* the maximum erase units number of backup area which have erase counters, 1 is the area header */
+#define FLASH_BAK_WEAR_SECTOR_NUM       64
+/* the erase cycles endurance of every erase unit, it's 10K for STM32F10x */
+#define FLASH_ERASE_ENDURANCE           10000
+/* using operations counters and API latency histograms, it needs flash_get_cycles() in port */
+/* #define FLASH_USING_STATS */
+/* the API latency histogram buckets number, the bucket N counts the calls which take [2^N, 2^(N+1))
+ * cycles, the last bucket counts all longer calls */
+#define FLASH_STATS_HIST_SIZE           32
+/* using reader-writer lock for environment variables API when there are multiple threads, it needs
+ * flash_env_lock_read(), flash_env_unlock_read(), flash_env_lock_write() and
+ * flash_env_unlock_write() in port */
+/* #define FLASH_ENV_USING_LOCK */
+/* save a snapshot of environment variables, so the other threads are not blocked by the flash
+ * programming in saving, it needs FLASH_ENV_USING_LOCK, flash_env_lock_save() and
+ * flash_env_unlock_save() in port, and one more RAM cache */
+/* #define FLASH_ENV_USING_SNAPSHOT_SAVE */
+/* save environment variables asynchronously by a low priority thread in port, the requests in the
+ * debounce window are merged into one saving, it needs FLASH_ENV_USING_LOCK and
+ * flash_env_async_notify() in port */
+/* #define FLASH_ENV_USING_ASYNC_SAVE */
+/* the debounce window (ms) of asynchronous saving, it starts from the first request */
+#define FLASH_ENV_ASYNC_SAVE_DEBOUNCE   100
+/* limit the erase rate of every erase unit in environment variables area for the device lifetime,
+ * the saving is deferred when it's over budget, then the changes are merged into next saving, it
+ * needs flash_get_time() in port */
+/* #define FLASH_ENV_USING_ERASE_BUDGET */
+/* every erase unit gets FLASH_ENV_ERASE_BUDGET_NUM erases per FLASH_ENV_ERASE_BUDGET_PERIOD
+ * seconds, e.g. 10K cycles in 10 years is about 1 erase per 31536 seconds */
+#define FLASH_ENV_ERASE_BUDGET_NUM      1
+#define FLASH_ENV_ERASE_BUDGET_PERIOD   3600
+/* the maximum erases which can be saved up for bursts, every new erase unit has it. The budget is
+ * saved with the erase counters, so it's restored after power on */
+#define FLASH_ENV_ERASE_BUDGET_BURST    8
 
 /* Flash debug print function. Must be implement by user. */
 #define FLASH_DEBUG(...) flash_log_debug(__FILE__, __LINE__, __VA_ARGS__)
@@ -43,6 +109,53 @@ if (!(EXPR))                                                                  \
     FLASH_DEBUG("(%s) has assert failed at %s.\n", #EXPR, __FUNCTION__);     \
     while (1);                                                                \
 }
+#ifdef FLASH_USING_STATS
+/* the library calls the port Flash operations by the statistics wrappers */
+#define FLASH_READ                      flash_stats_read
+#define FLASH_ERASE                     flash_stats_erase
+#define FLASH_WRITE                     flash_stats_write
+/* record the public API latency, FLASH_STATS_START must be the last declaration in the API */
+#define FLASH_STATS_START()             uint32_t stats_start = flash_get_cycles()
+#define FLASH_STATS_END(api)            flash_stats_record(api, flash_get_cycles() - stats_start)
+#else
+#define FLASH_READ                      flash_read
+#define FLASH_ERASE                     flash_erase
+#define FLASH_WRITE                     flash_write
+#define FLASH_STATS_START()             do {} while (0)
+#define FLASH_STATS_END(api)
+#endif
+#ifdef FLASH_ENV_USING_LOCK
+/* the get and print API share the read lock, the mutation and save API hold the write lock */
+#define FLASH_ENV_READ_LOCK()           flash_env_lock_read()
+#define FLASH_ENV_READ_UNLOCK()         flash_env_unlock_read()
+#define FLASH_ENV_WRITE_LOCK()          flash_env_lock_write()
+#define FLASH_ENV_WRITE_UNLOCK()        flash_env_unlock_write()
+#else
+#define FLASH_ENV_READ_LOCK()
+#define FLASH_ENV_READ_UNLOCK()
+#define FLASH_ENV_WRITE_LOCK()
+#define FLASH_ENV_WRITE_UNLOCK()
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+#ifndef FLASH_ENV_USING_LOCK
+#error "FLASH_ENV_USING_SNAPSHOT_SAVE needs FLASH_ENV_USING_LOCK"
+#endif
+/* the saving and loading are serialized by the save lock, it must be locked before write lock */
+#define FLASH_ENV_SAVE_LOCK()           flash_env_lock_save()
+#define FLASH_ENV_SAVE_UNLOCK()         flash_env_unlock_save()
+#else
+#define FLASH_ENV_SAVE_LOCK()
+#define FLASH_ENV_SAVE_UNLOCK()
+#endif
+#if defined(FLASH_ENV_USING_ASYNC_SAVE) && !defined(FLASH_ENV_USING_LOCK)
+#error "FLASH_ENV_USING_ASYNC_SAVE needs FLASH_ENV_USING_LOCK"
+#endif
+#if defined(FLASH_ENV_USING_PAGED_CACHE) && !defined(FLASH_ENV_USING_LOG_MODE)
+#error "FLASH_ENV_USING_PAGED_CACHE needs FLASH_ENV_USING_LOG_MODE"
+#endif
+#if defined(FLASH_ENV_USING_PAGED_CACHE) && defined(FLASH_ENV_USING_SORTED_INDEX)
+#error "FLASH_ENV_USING_PAGED_CACHE doesn't support FLASH_ENV_USING_SORTED_INDEX"
+#endif
 /* EasyFlash software version number */
 #define FLASH_SW_VERSION                "1.03.10"
 
@@ -51,6 +164,83 @@ typedef struct _flash_env{
     char *value;
 }flash_env, *flash_env_t;
 
+/* environment variables iterator, the key is not end with '\0', return FALSE will stop iterating */
+typedef bool_t (*flash_env_iterator)(const char *key, size_t key_len, const char *value,
+        size_t value_len, bool_t is_blob, void *arg);
+
+/* the type of blob environment variable value, it's saved in the blob header word */
+typedef enum {
+    FLASH_ENV_TYPE_BLOB,    /* untyped blob, it's saved by flash_set_env_blob */
+    FLASH_ENV_TYPE_U32,
+    FLASH_ENV_TYPE_I32,
+    FLASH_ENV_TYPE_U64,
+    FLASH_ENV_TYPE_FLOAT,
+} flash_env_type;
+
+/* erase units wear statistics */
+typedef struct _flash_wear_stats {
+    size_t sector_num;      /* erase units number */
+    uint32_t min;           /* minimum erase count */
+    uint32_t max;           /* maximum erase count */
+    uint32_t mean;          /* mean erase count */
+    uint32_t remain_life;   /* estimated remaining erase cycles of the most worn erase unit */
+} flash_wear_stats;
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/* environment variables area erase budget */
+typedef struct _flash_erase_budget {
+    uint32_t remain;        /* the remaining erases of the erase unit which has the least budget */
+    uint32_t wait_sec;      /* the seconds to wait until every erase unit has one erase at least */
+    uint32_t deferred;      /* the deferred savings count */
+} flash_erase_budget;
+#endif
+
+#ifdef FLASH_USING_STATS
+/* the public API which has latency histogram. The blob API is recorded by the _n one, the typed
+ * value API in flash_utils.c is recorded by the typed one. The others only query or print the
+ * status, they are not recorded. */
+typedef enum {
+    FLASH_STATS_API_INIT,
+    FLASH_STATS_API_LOAD_ENV,
+    FLASH_STATS_API_SAVE_ENV,
+    FLASH_STATS_API_SET_ENV,
+    FLASH_STATS_API_GET_ENV,
+    FLASH_STATS_API_SET_ENV_BATCH,
+    FLASH_STATS_API_GET_ENV_BATCH,
+    FLASH_STATS_API_ITERATE_ENV,
+    FLASH_STATS_API_RESERVE_ENV,
+    FLASH_STATS_API_SET_ENV_BLOB,
+    FLASH_STATS_API_GET_ENV_BLOB,
+    FLASH_STATS_API_SET_ENV_TYPED,
+    FLASH_STATS_API_GET_ENV_TYPED,
+    FLASH_STATS_API_ERASE_BAK_APP,
+    FLASH_STATS_API_ERASE_USER_APP,
+    FLASH_STATS_API_ERASE_BL,
+    FLASH_STATS_API_WRITE_DATA_TO_BAK,
+    FLASH_STATS_API_COPY_APP_FROM_BAK,
+    FLASH_STATS_API_COPY_BL_FROM_BAK,
+    FLASH_STATS_API_NUM,
+} flash_stats_api;
+
+/* public API latency statistics, the units is port cycles */
+typedef struct _flash_api_stats {
+    uint32_t calls;                            /* calls count */
+    uint32_t max_cycles;                       /* the longest call */
+    uint32_t hist[FLASH_STATS_HIST_SIZE];      /* log2 latency histogram */
+} flash_api_stats;
+
+/* port Flash operations counters and public API latency statistics */
+typedef struct _flash_stats {
+    uint32_t read_cnt;                         /* flash_read calls count */
+    uint32_t read_bytes;                       /* flash_read bytes */
+    uint32_t erase_cnt;                        /* flash_erase calls count */
+    uint32_t erase_bytes;                      /* flash_erase bytes */
+    uint32_t write_cnt;                        /* flash_write calls count */
+    uint32_t write_bytes;                      /* flash_write bytes */
+    flash_api_stats api[FLASH_STATS_API_NUM];
+} flash_stats;
+#endif
+
 /* Flash error code */
 typedef enum {
     FLASH_NO_ERR,
@@ -59,8 +249,15 @@ typedef enum {
     FLASH_ENV_NAME_ERR,
     FLASH_ENV_NAME_EXIST,
     FLASH_ENV_FULL,
+    FLASH_ENV_SAVE_DEFERRED,
+    FLASH_ENV_TYPE_ERR,
 } FlashErrCode;
 
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/* the callback after every asynchronous saving, it's called in the saving thread of port */
+typedef void (*flash_env_save_cb)(FlashErrCode result, uint32_t saved_gen, void *arg);
+#endif
+
 /* flash.c */
 FlashErrCode flash_init(void);
 
@@ -69,10 +266,28 @@ void flash_load_env(void);
 void flash_print_env(void);
 char *flash_get_env(const char *key);
 FlashErrCode flash_set_env(const char *key, const char *value);
+FlashErrCode flash_set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save);
+size_t flash_get_env_batch(flash_env *env_set, size_t env_set_size);
+size_t flash_iterate_env(const char *prefix, flash_env_iterator iterator, void *arg);
+FlashErrCode flash_reserve_env(const char *key, size_t value_max_len);
+FlashErrCode flash_set_env_blob(const char *key, const void *value_buf, size_t buf_len);
+FlashErrCode flash_set_env_blob_n(const char *key, size_t key_len, const void *value_buf,
+        size_t buf_len);
+size_t flash_get_env_blob(const char *key, void *value_buf, size_t buf_len,
+        size_t *saved_value_len);
+size_t flash_get_env_blob_n(const char *key, size_t key_len, void *value_buf, size_t buf_len,
+        size_t *saved_value_len);
+FlashErrCode flash_set_env_typed(const char *key, const void *value, size_t size,
+        flash_env_type type);
+FlashErrCode flash_get_env_typed(const char *key, void *value, size_t size, flash_env_type type);
 FlashErrCode flash_save_env(void);
+FlashErrCode flash_save_env_gen(uint32_t *saved_gen, bool_t *written);
 FlashErrCode flash_env_set_default(void);
 uint32_t flash_get_env_total_size(void);
 uint32_t flash_get_env_used_size(void);
+uint32_t flash_get_env_gen(void);
+uint32_t flash_get_env_saved_gen(void);
+size_t flash_get_env_erase_cnt(uint32_t *erase_cnt, size_t num);
 
 /* flash_iap.c */
 FlashErrCode flash_erase_bak_app(size_t app_size);
@@ -82,6 +297,41 @@ FlashErrCode flash_write_data_to_bak(uint8_t *data, size_t size, size_t *cur_siz
         size_t total_size);
 FlashErrCode flash_copy_app_from_bak(uint32_t user_app_addr, size_t app_size);
 FlashErrCode flash_copy_bl_from_bak(uint32_t bl_addr, size_t bl_size);
+size_t flash_get_bak_erase_cnt(uint32_t *erase_cnt, size_t num);
+
+/* flash_utils.c */
+FlashErrCode flash_set_env_u32(const char *key, uint32_t value);
+FlashErrCode flash_get_env_u32(const char *key, uint32_t *value);
+FlashErrCode flash_set_env_i32(const char *key, int32_t value);
+FlashErrCode flash_get_env_i32(const char *key, int32_t *value);
+FlashErrCode flash_set_env_u64(const char *key, uint64_t value);
+FlashErrCode flash_get_env_u64(const char *key, uint64_t *value);
+FlashErrCode flash_set_env_float(const char *key, float value);
+FlashErrCode flash_get_env_float(const char *key, float *value);
+void flash_calc_wear_stats(const uint32_t *erase_cnt, size_t num, flash_wear_stats *stats);
+void flash_print_wear_stats(void);
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+uint32_t flash_save_env_async(void);
+void flash_set_env_save_cb(flash_env_save_cb cb, void *arg);
+uint32_t flash_save_env_async_handler(void);
+#endif
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+FlashErrCode flash_erase_budget_init(size_t sector_num);
+bool_t flash_erase_budget_check(size_t sector, size_t num);
+uint32_t flash_erase_budget_get(size_t sector);
+void flash_erase_budget_set(size_t sector, uint32_t budget);
+uint32_t flash_erase_budget_charge(uint32_t budget);
+void flash_get_env_erase_budget(flash_erase_budget *budget);
+#endif
+#ifdef FLASH_USING_STATS
+FlashErrCode flash_stats_read(uint32_t addr, uint32_t *buf, size_t size);
+FlashErrCode flash_stats_erase(uint32_t addr, size_t size);
+FlashErrCode flash_stats_write(uint32_t addr, const uint32_t *buf, size_t size);
+void flash_stats_record(flash_stats_api api, uint32_t cycles);
+void flash_get_stats(flash_stats *stats);
+void flash_reset_stats(void);
+void flash_print_stats(void);
+#endif
 
 /* flash_port.c */
 FlashErrCode flash_read(uint32_t addr, uint32_t *buf, size_t size);
@@ -92,5 +342,24 @@ void flash_free(void *p);
 void flash_log_debug(const char *file, const long line, const char *format, ...);
 void flash_log_info(const char *format, ...);
 void flash_print(const char *format, ...);
+#ifdef FLASH_USING_STATS
+uint32_t flash_get_cycles(void);
+#endif
+#ifdef FLASH_ENV_USING_LOCK
+void flash_env_lock_read(void);
+void flash_env_unlock_read(void);
+void flash_env_lock_write(void);
+void flash_env_unlock_write(void);
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+void flash_env_lock_save(void);
+void flash_env_unlock_save(void);
+#endif
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+void flash_env_async_notify(void);
+#endif
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+uint32_t flash_get_time(void);
+#endif
 
 #endif /* FLASH_H_ */
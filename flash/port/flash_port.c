@@ -116,6 +116,25 @@ FlashErrCode flash_write(uint32_t addr, const uint32_t *buf, size_t size) {
     return result;
 }
 
+#ifdef FLASH_CRC32_USING_PORT
+/**
+ * Calculate the CRC32 value by hardware CRC unit. It must be the IEEE 802.3 CRC32 (reflected,
+ * polynomial 0xEDB88320), same as the software calc_crc32.
+ *
+ * @param crc accumulated CRC32 value, it's 0 on first call
+ * @param buf buffer to calculate CRC32 value for
+ * @param size bytes in buffer
+ *
+ * @return calculated CRC32 value
+ */
+uint32_t flash_crc32(uint32_t crc, const void *buf, size_t size) {
+
+    /* You can add your code under here. */
+
+    return crc;
+}
+#endif
+
 /**
  * Allocate a block of memory with a minimum of 'size' bytes.
  *
@@ -139,6 +158,110 @@ void flash_free(void *p) {
 	
 }
 
+#ifdef FLASH_USING_STATS
+/**
+ * Get the free running cycle counter for the API latency statistics. It can wrap around.
+ *
+ * @return current cycles
+ */
+uint32_t flash_get_cycles(void) {
+
+    /* You can add your code under here. */
+
+    return 0;
+}
+#endif
+
+#ifdef FLASH_ENV_USING_LOCK
+/**
+ * Lock the environment variables for reading. The read lock can be held by multiple threads at
+ * the same time, but it's exclusive with the write lock.
+ */
+void flash_env_lock_read(void) {
+
+    /* You can add your code under here. */
+
+}
+
+/**
+ * Unlock the environment variables read lock.
+ */
+void flash_env_unlock_read(void) {
+
+    /* You can add your code under here. */
+
+}
+
+/**
+ * Lock the environment variables for writing. The write lock is exclusive with all locks.
+ */
+void flash_env_lock_write(void) {
+
+    /* You can add your code under here. */
+
+}
+
+/**
+ * Unlock the environment variables write lock.
+ */
+void flash_env_unlock_write(void) {
+
+    /* You can add your code under here. */
+
+}
+#endif
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/**
+ * Lock the environment variables saving. It serializes the saving and loading, it's a mutex.
+ */
+void flash_env_lock_save(void) {
+
+    /* You can add your code under here. */
+
+}
+
+/**
+ * Unlock the environment variables saving.
+ */
+void flash_env_unlock_save(void) {
+
+    /* You can add your code under here. */
+
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/**
+ * Wake up the asynchronous saving thread. The thread should be a low priority thread which is
+ * created in flash_port_init(), it waits for this notification, then delays the debounce window
+ * FLASH_ENV_ASYNC_SAVE_DEBOUNCE (ms), clears the notifications in window and calls
+ * flash_save_env_async_handler(). When the handler returns non-zero seconds, the saving is deferred
+ * by erase budget, the thread waits for the seconds then calls this function again. It may be
+ * called before the thread handles the last one.
+ */
+void flash_env_async_notify(void) {
+
+    /* You can add your code under here. */
+
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/**
+ * Get the monotonic time in second for the erase budget. It can wrap around, and it may be called
+ * by multiple threads.
+ *
+ * @return current time (second)
+ */
+uint32_t flash_get_time(void) {
+
+    /* You can add your code under here. */
+
+    return 0;
+}
+#endif
+
 /**
  * This function is print flash debug info.
  *
@@ -27,6 +27,8 @@
  * |      1.system section      |   FLASH_ENV_SYSTEM_SIZE
  * |      2:data section        |   FLASH_ENV_SECTION_SIZE - FLASH_ENV_SYSTEM_SIZE
  * |----------------------------|
+ * |(IAP)Backup area header     |   FLASH_ERASE_MIN_SIZE, storage backup area erase counters
+ * |----------------------------|
  * |(IAP)Downloaded application |   IAP already downloaded application size
  * |----------------------------|
  * |       Remain flash         |   All remaining
@@ -34,8 +36,9 @@
  *
  * Backup area storage index
  * 1.Environment variables area: @see FLASH_ENV_SECTION_SIZE
- * 2.Already downloaded application area for IAP function: unfixed size
- * 3.Remain
+ * 2.Backup area header for IAP function: @see FLASH_ERASE_MIN_SIZE
+ * 3.Already downloaded application area for IAP function: unfixed size
+ * 4.Remain
  *
  * Environment variables area has 2 section
  * 1.system section.(unit: 4 bytes, storage Environment variables's parameter)
@@ -54,12 +57,17 @@ FlashErrCode flash_init(void) {
             size_t *erase_min_size, flash_env const **default_env, size_t *default_env_size);
     extern FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size,
             size_t erase_min_size, flash_env const *default_env, size_t default_env_size);
-    extern FlashErrCode flash_iap_init(uint32_t start_addr);
+    extern FlashErrCode flash_iap_init(uint32_t start_addr, size_t erase_min_size);
+    extern void calc_crc32_init(void);
 
     uint32_t env_start_addr;
     size_t env_total_size, erase_min_size, default_env_set_size;
     const flash_env *default_env_set;
     FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    /* the CRC32 is used for loading environment variables */
+    calc_crc32_init();
 
     result = flash_port_init(&env_start_addr, &env_total_size, &erase_min_size, &default_env_set,
             &default_env_set_size);
@@ -70,7 +78,7 @@ FlashErrCode flash_init(void) {
     }
 
     if (result == FLASH_NO_ERR) {
-        result = flash_iap_init(env_start_addr + flash_get_env_total_size());
+        result = flash_iap_init(env_start_addr + flash_get_env_total_size(), erase_min_size);
     }
 
     if (result == FLASH_NO_ERR) {
@@ -79,5 +87,6 @@ FlashErrCode flash_init(void) {
         FLASH_DEBUG("EasyFlash V%s is initialize fail.\n", FLASH_SW_VERSION);
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_INIT);
     return result;
 }
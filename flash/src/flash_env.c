@@ -20,23 +20,40 @@
  * Created on: 2014-10-06
  */
 
-#include "flash.h"
+#include "flash_env_cache.h"
 #include <string.h>
 #include <stdlib.h>
 
 #ifdef FLASH_ENV_USING_NORMAL_MODE
 
 /**
- * Environment variables area has 2 sections
+ * Environment variables area is divided into FLASH_ENV_NORMAL_COPY_NUM copies. Every copy size is
+ * a multiple of FLASH_ERASE_MIN_SIZE. The saving always writes the next copy, so the last saved
+ * copy is still valid when power down in saving. The newest valid copy will be loaded.
+ *
+ * Every copy has 2 sections
  * 1. System section
- *    It storage environment variables parameters. (Units: Word)
+ *    It storage environment variables parameters and the erase counters of all erase units in
+ *    environment variables area. When FLASH_ENV_USING_ERASE_BUDGET is enabled, the erase budget of
+ *    every erase unit is behind the erase counters. (Units: Word)
+ *    The sequence number is written at last, it means the copy has been saved completely.
  * 2. Data section
  *    It storage all environment variables. Storage format is key=value\0.
+ *    The blob value storage format is key=\0 + blob header word + blob data.
+ *    When FLASH_ENV_USING_CRC_CHECK is enabled, every environment variable has a CRC32 word behind
+ *    its value. The system section CRC32 only checks the XOR of them, it's updated incrementally.
  *    All environment variables must be 4 bytes alignment. The remaining part must fill '\0'.
  *
  * @note Word = 4 Bytes in this file
  */
 
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/* the erase budget words number in system section, every erase unit has one */
+#define ENV_ERASE_BUDGET_WORD_NUM                FLASH_ENV_WEAR_SECTOR_NUM
+#else
+#define ENV_ERASE_BUDGET_WORD_NUM                0
+#endif
+
 /* flash ENV system section index and size */
 enum {
     /* data section environment variables end address index in system section */
@@ -47,6 +64,18 @@ enum {
     FLASH_ENV_SYSTEM_INDEX_DATA_CRC,
 #endif
 
+    /* erase counters index in system section, every erase unit in environment variables area has
+     * one, the number is FLASH_ENV_WEAR_SECTOR_NUM */
+    FLASH_ENV_SYSTEM_INDEX_ERASE_CNT,
+
+    /* erase budget index in system section, it's behind the erase counters, the number is
+     * ENV_ERASE_BUDGET_WORD_NUM */
+    FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET = FLASH_ENV_SYSTEM_INDEX_ERASE_CNT
+            + FLASH_ENV_WEAR_SECTOR_NUM,
+
+    /* copy saved sequence number index in system section, it's the last one for commit */
+    FLASH_ENV_SYSTEM_INDEX_SEQ = FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET + ENV_ERASE_BUDGET_WORD_NUM,
+
     /* flash environment variables system section word size */
     FLASH_ENV_SYSTEM_WORD_SIZE,
     /* flash environment variables system section byte size */
@@ -56,28 +85,81 @@ enum {
 /* default environment variables set, must be initialized by user */
 static flash_env const *default_env_set = NULL;
 /* default environment variables set size, must be initialized by user */
-static size_t default_env_set_size = NULL;
+static size_t default_env_set_size = 0;
 /* flash environment variables all section total size */
-static size_t env_total_size = NULL;
+static size_t env_total_size = 0;
+/* flash environment variables every copy size */
+static size_t env_copy_size = 0;
+/* the current using copy index, it's the last saved or loaded copy */
+static size_t env_copy_index = 0;
+/* the minimum size of flash erasure */
+static size_t flash_erase_min_size = 0;
 /* environment variables RAM cache */
 static uint32_t *env_cache = NULL;
 /* environment variables start address in flash */
-static uint32_t env_start_addr = NULL;
+static uint32_t env_start_addr = 0;
+/* environment variables RAM cache generation, it will increase when the cache has changed */
+static uint32_t env_cache_gen = 0;
+/* the environment variables RAM cache generation which has been saved to flash */
+static uint32_t env_saved_gen = 0;
+/* environment variables are being set by batch, the deleted ones will be removed by one pass */
+static bool_t env_is_batching = FALSE;
+/* the bytes size of environment variables which are marked as deleted in batch */
+static size_t env_marked_size = 0;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+/* the XOR of all environment variables CRC32, it's updated when an environment variable changed */
+static uint32_t env_crc_sum = 0;
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/* environment variables snapshot for saving, it's same size as RAM cache */
+static uint32_t *env_snapshot = NULL;
+#endif
 
-static uint32_t get_env_system_addr(void);
+static uint32_t get_env_copy_addr(size_t index);
 static uint32_t get_env_data_addr(void);
 static uint32_t get_env_end_addr(void);
 static void set_env_end_addr(uint32_t end_addr);
-static FlashErrCode write_env(const char *key, const char *value);
-static uint32_t *find_env(const char *key);
+static FlashErrCode write_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
 static size_t get_env_data_size(void);
-static FlashErrCode create_env(const char *key, const char *value);
+static void update_env_crc_sum(const char *env);
+static void del_env(char *env);
+static void del_marked_env(void);
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save);
+static FlashErrCode env_set_default(void);
+static void load_env(void);
+static FlashErrCode save_env(void);
+static FlashErrCode write_env_copy(uint32_t *cache, size_t used_size, uint32_t crc_sum,
+        size_t copy_index);
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+static FlashErrCode save_env_snapshot(uint32_t *saved_gen, bool_t *written);
+#endif
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
+static bool_t read_env_copy_header(size_t index, uint32_t *header);
+static bool_t env_cache_is_same(const uint32_t *cache, uint32_t copy_addr, size_t offset,
+        size_t size);
+static void inc_env_erase_cnt(uint32_t *cache, uint32_t addr, size_t size);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+static bool_t env_erase_budget_check(const uint32_t *cache, size_t used_size, size_t copy_index);
+static void get_env_erase_budget(uint32_t *cache);
+static void set_env_erase_budget(const uint32_t *cache);
+#endif
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
-static uint32_t calc_env_crc(void);
+static uint32_t calc_env_crc(const uint32_t *cache, uint32_t crc_sum);
 static bool_t env_crc_is_ok(void);
+static size_t check_env(const char *env, const char *env_end);
+static void salvage_env(void);
 #endif
 
+/* the operations of environment variables data in RAM cache, @see flash_env_cache.c */
+static const env_data_ops env_cache_data_ops = {
+    get_env_data_size,
+    set_env,
+    set_env_batch,
+};
+
 /**
  * Flash environment variables initialize.
  *
@@ -95,23 +177,43 @@ FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase
 
     FLASH_ASSERT(start_addr);
     FLASH_ASSERT(total_size);
+    FLASH_ASSERT(erase_min_size);
     FLASH_ASSERT(default_env);
     FLASH_ASSERT(default_env_size < total_size);
     /* must be word alignment for environment variables */
     FLASH_ASSERT(total_size % 4 == 0);
+    /* hash index storage word offset by 16 bits */
+    FLASH_ASSERT(total_size / 4 < 0xFFFF);
+    /* the copies are checked by a 32 bits mask when loading */
+    FLASH_ASSERT(FLASH_ENV_NORMAL_COPY_NUM >= 1 && FLASH_ENV_NORMAL_COPY_NUM <= 32);
+    /* every copy must have one erase unit at least */
+    FLASH_ASSERT(total_size >= FLASH_ENV_NORMAL_COPY_NUM * erase_min_size);
+    /* every erase unit has an erase counter in system section */
+    FLASH_ASSERT(total_size / erase_min_size <= FLASH_ENV_WEAR_SECTOR_NUM);
     /* make true only be initialized once */
     FLASH_ASSERT(!env_cache);
 
     env_start_addr = start_addr;
     env_total_size = total_size;
+    env_copy_size = total_size / FLASH_ENV_NORMAL_COPY_NUM / erase_min_size * erase_min_size;
+    flash_erase_min_size = erase_min_size;
     default_env_set = default_env;
     default_env_set_size = default_env_size;
 
-    FLASH_DEBUG("Env start address is 0x%08X, size is %d bytes.\n", start_addr, total_size);
+    FLASH_DEBUG("Env start address is 0x%08X, size is %d bytes, %d copies.\n", start_addr,
+            total_size, FLASH_ENV_NORMAL_COPY_NUM);
 
-    /* create environment variables ram cache */
-    env_cache = (uint32_t *) flash_malloc(sizeof(uint8_t) * total_size);
+    /* create environment variables ram cache, it's same size as one copy */
+    env_cache = (uint32_t *) flash_malloc(sizeof(uint8_t) * env_copy_size);
     FLASH_ASSERT(env_cache);
+    env_cache_init((char *) env_cache + FLASH_ENV_SYSTEM_BYTE_SIZE, &env_cache_data_ops);
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+    env_snapshot = (uint32_t *) flash_malloc(sizeof(uint8_t) * env_copy_size);
+    FLASH_ASSERT(env_snapshot);
+#endif
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    flash_erase_budget_init(total_size / erase_min_size);
+#endif
 
     flash_load_env();
 
@@ -119,13 +221,13 @@ FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase
 }
 
 /**
- * Environment variables set default.
+ * Environment variables set default without lock.
+ * @see flash_env_set_default
  *
  * @return result
  */
-FlashErrCode flash_env_set_default(void){
+static FlashErrCode env_set_default(void) {
     FlashErrCode result = FLASH_NO_ERR;
-    size_t i;
 
     FLASH_ASSERT(env_cache);
     FLASH_ASSERT(default_env_set);
@@ -133,29 +235,51 @@ FlashErrCode flash_env_set_default(void){
 
     /* set environment end address is at data section start address */
     set_env_end_addr(get_env_data_addr());
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    env_crc_sum = 0;
+#endif
+    /* clean the hash index */
+    env_index_build();
 
-    /* create default environment variables */
-    for (i = 0; i < default_env_set_size; i++) {
-        create_env(default_env_set[i].key, default_env_set[i].value);
-    }
+    /* create default environment variables and save them */
+    result = set_env_batch(default_env_set, default_env_set_size, TRUE);
 
-    flash_save_env();
+    return result;
+}
+
+/**
+ * Environment variables set default.
+ *
+ * @return result
+ */
+FlashErrCode flash_env_set_default(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    result = env_set_default();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
 
     return result;
 }
 
 /**
- * Get environment variables system section start address.
+ * Get environment variables copy start address. The system section is at the start of copy.
  *
- * @return system section start address
+ * @param index copy index
+ *
+ * @return copy start address
  */
-static uint32_t get_env_system_addr(void) {
+static uint32_t get_env_copy_addr(size_t index) {
     FLASH_ASSERT(env_start_addr);
-    return env_start_addr;
+    FLASH_ASSERT(index < FLASH_ENV_NORMAL_COPY_NUM);
+    return env_start_addr + index * env_copy_size;
 }
 
 /**
  * Get environment variables data section start address.
+ * @note The end address in system section is always based on the first copy address.
  *
  * @return data section start address
  */
@@ -199,7 +323,7 @@ static size_t get_env_data_size(void) {
  *
  * @return size
  */
-size_t flash_get_env_total_size(void) {
+uint32_t flash_get_env_total_size(void) {
     /* must be initialized */
     FLASH_ASSERT(env_total_size);
 
@@ -215,358 +339,917 @@ uint32_t flash_get_env_used_size(void) {
     return FLASH_ENV_SYSTEM_BYTE_SIZE + get_env_data_size();
 }
 
+/**
+ * Get environment variables RAM cache generation. It will increase when the cache has changed.
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_gen(void) {
+    return env_cache_gen;
+}
+
+/**
+ * Get the environment variables RAM cache generation which has been saved to flash.
+ * If it's not equal to flash_get_env_gen(), the cache has changed after last saved. So the saving
+ * has written flash when this generation changed after called flash_save_env().
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_saved_gen(void) {
+    return env_saved_gen;
+}
+
+/**
+ * Get the erase counters of all erase units in environment variables area. The counters are
+ * saved in the system section of every copy, so they are kept after power down.
+ *
+ * @param erase_cnt erase counters buffer, the first one is the erase unit at start address
+ * @param num erase counters buffer number
+ *
+ * @return erase units number of environment variables area
+ */
+size_t flash_get_env_erase_cnt(uint32_t *erase_cnt, size_t num) {
+    size_t sector_num = env_total_size / flash_erase_min_size, i;
+
+    FLASH_ASSERT(env_cache);
+
+    FLASH_ENV_READ_LOCK();
+    for (i = 0; i < num && i < sector_num; i++) {
+        erase_cnt[i] = env_cache[FLASH_ENV_SYSTEM_INDEX_ERASE_CNT + i];
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    return sector_num;
+}
+
 /**
  * Write an environment variable at the end of cache.
  *
- * @param key environment variable name
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
  * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
  *
  * @return result
  */
-static FlashErrCode write_env(const char *key, const char *value) {
+static FlashErrCode write_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
     FlashErrCode result = FLASH_NO_ERR;
-    uint16_t env_str_index = 0, env_str_length, i;
-    char *env_str;
+    size_t env_len = calc_env_len(key_len, value_len, is_blob);
+    char *env = (char *) env_cache + flash_get_env_used_size();
 
-    /* calculate environment variables storage length, contain '=' and '\0'. */
-    env_str_length = strlen(key) + strlen(value) + 2;
-    if (env_str_length % 4 != 0) {
-        env_str_length = (env_str_length / 4 + 1) * 4;
+    /* remove the environment variables which are deleted in batch for more space */
+    if (env_marked_size && env_len + flash_get_env_used_size() > env_copy_size) {
+        del_marked_env();
+        env = (char *) env_cache + flash_get_env_used_size();
     }
     /* check capacity of environment variables  */
-    if (env_str_length + get_env_data_size() >= flash_get_env_total_size()) {
+    if (env_len + flash_get_env_used_size() > env_copy_size) {
         return FLASH_ENV_FULL;
     }
-    /* use ram to process string key=value\0 */
-    env_str = flash_malloc(env_str_length * sizeof(char));
-    FLASH_ASSERT(env_str);
-    memset(env_str, 0, env_str_length * sizeof(char));
-    /* copy key name */
-    for (env_str_index = 0; env_str_index < strlen(key); env_str_index++) {
-        env_str[env_str_index] = key[env_str_index];
-    }
-    /* copy equal sign */
-    env_str[env_str_index] = '=';
-    env_str_index++;
-    /* copy value */
-    for (i = 0; i < strlen(value); env_str_index++, i++) {
-        env_str[env_str_index] = value[i];
+    /* it will be made in ram cache directly */
+    make_env(env, env_len, key, key_len, value, value_len, is_blob, blob_type);
+    /* add it to hash index, there is no memory for the index when it can't grow */
+    if (!env_index_add(env)) {
+        return FLASH_ENV_FULL;
     }
-
-    //TODO ǿɷŻ
-    memcpy((char *) env_cache + flash_get_env_used_size(), (uint32_t *) env_str,
-            env_str_length);
-    set_env_end_addr(get_env_end_addr() + env_str_length);
-
-    /* free ram */
-    flash_free(env_str);
-    env_str = NULL;
+    set_env_end_addr(get_env_end_addr() + env_len);
+    update_env_crc_sum(env);
+    env_cache_gen++;
 
     return result;
 }
 
 /**
- * Find environment variables.
+ * Update the XOR of all environment variables CRC32 by an environment variable CRC32. It must be
+ * called when the environment variable is added and removed.
  *
- * @param key environment variables name
- *
- * @return index of environment variables in ram cache
+ * @param env environment variable in ram cache
  */
-static uint32_t *find_env(const char *key) {
-    uint32_t *env_cache_addr = NULL;
-    char *env_start, *env_end, *env, *env_bak;
-
-    FLASH_ASSERT(env_start_addr);
+static void update_env_crc_sum(const char *env) {
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    env_crc_sum ^= *(uint32_t *) (env + get_env_body_len(env));
+#endif
+}
 
-    if (*key == NULL) {
-        FLASH_INFO("Flash environment variables name must be not empty!\n");
-        return NULL;
+/**
+ * Delete an environment variable which is found in ram cache.
+ *
+ * @param env environment variable in ram cache
+ */
+static void del_env(char *env) {
+    size_t del_env_length = get_env_len(env), remain_env_length;
+
+    update_env_crc_sum(env);
+    /* it will be removed after all environment variables in batch are set */
+    if (env_is_batching) {
+        /* remove it from index before marked, the marked name can't be compared */
+        env_index_del(env, 0);
+        env_marked_size += del_env_length;
+        *env = ENV_DELETED_MARK;
+        env_cache_gen++;
+        return;
     }
 
-    /* from data section start to data section end */
-    env_start = (char *) ((char *) env_cache + FLASH_ENV_SYSTEM_BYTE_SIZE);
-    env_end = (char *) ((char *) env_cache + flash_get_env_used_size());
-
-    /* environment variables is null */
-    if (env_start == env_end) {
-        return NULL;
-    }
+    /* calculate remain environment variables length */
+    remain_env_length = (char *) env_cache + flash_get_env_used_size() - (env + del_env_length);
+    /* remove it from hash index */
+    env_index_del(env, del_env_length);
+    /* remain environment variables move forward */
+    memmove(env, env + del_env_length, remain_env_length);
+    /* reset environment variables end address */
+    set_env_end_addr(get_env_end_addr() - del_env_length);
+    env_cache_gen++;
+}
 
-    env = env_start;
-    while (env < env_end) {
-        /* storage model is key=value\0 */
-        env_bak = strstr(env, key);
-        /* the key name length must be equal */
-        if (env_bak && (env_bak[strlen(key)] == '=')) {
-            env_cache_addr = (uint32_t *) env;
-            break;
-        } else {
-            /* next environment variables */
-            env += strlen(env) + 1;
+/**
+ * Remove all environment variables which are marked as deleted in batch by one pass.
+ */
+static void del_marked_env(void) {
+    char *env = (char *) env_cache + FLASH_ENV_SYSTEM_BYTE_SIZE;
+    char *env_end = (char *) env_cache + flash_get_env_used_size();
+    char *dst = env;
+    size_t env_len;
+
+    for (; env < env_end; env += env_len) {
+        env_len = get_env_len(env);
+        if (*env != ENV_DELETED_MARK) {
+            memmove(dst, env, env_len);
+            dst += env_len;
         }
     }
-    return env_cache_addr;
+    set_env_end_addr(get_env_end_addr() - (env_end - dst));
+    env_marked_size = 0;
+    env_index_build();
 }
 
 /**
- * If the environment variable is not exist, create it.
- * @see flash_write_env
+ * Delete an environment variable in cache.
  *
  * @param key environment variable name
- * @param value environment variable value
  *
  * @return result
  */
-static FlashErrCode create_env(const char *key, const char *value) {
+FlashErrCode flash_del_env(const char *key){
     FlashErrCode result = FLASH_NO_ERR;
+    char *del_env_str = NULL;
 
     FLASH_ASSERT(key);
-    FLASH_ASSERT(value);
+    FLASH_ASSERT(env_cache);
 
-    if (*key == NULL) {
-        FLASH_INFO("Flash environment variables name must be not empty!\n");
+    if (*key == '\0') {
+        FLASH_INFO("Flash environment variables name must be not NULL!\n");
         return FLASH_ENV_NAME_ERR;
     }
 
     if (strstr(key, "=")) {
-        FLASH_INFO("Flash environment variables name can't contain '='.\n");
+        FLASH_INFO("Flash environment variables name or value can't contain '='.\n");
         return FLASH_ENV_NAME_ERR;
     }
 
     /* find environment variables */
-    if (find_env(key)) {
-        FLASH_INFO("The name of \"%s\" is already exist.\n", key);
-        return FLASH_ENV_NAME_EXIST;
+    del_env_str = find_env(key, strlen(key));
+    if (!del_env_str) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        return FLASH_ENV_NAME_ERR;
     }
-    /* write environment variables to flash */
-    result = write_env(key, value);
+    del_env(del_env_str);
 
     return result;
 }
 
 /**
- * Delete an environment variable in cache.
+ * Set an environment variable which value is not empty. If not find it, then create it.
+ * When the new value fits in the old storage, it will be overwrote in place. Otherwise the old one
+ * will be deleted and the new one will be written at the end of cache.
  *
- * @param key environment variable name
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
  *
  * @return result
  */
-FlashErrCode flash_del_env(const char *key){
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
     FlashErrCode result = FLASH_NO_ERR;
-    char *del_env_str = NULL;
-    uint32_t del_env_length, remain_env_length;
-
-    FLASH_ASSERT(key);
-    FLASH_ASSERT(env_cache);
+    char *old_env, *old_value;
+    size_t env_len, old_env_len, old_value_len;
+    bool_t old_is_blob;
 
-    if (*key == NULL) {
-        FLASH_INFO("Flash environment variables name must be not NULL!\n");
+    if (key_len == 0 || memchr(key, '\0', key_len)) {
+        FLASH_INFO("Flash environment variables name must be not empty!\n");
         return FLASH_ENV_NAME_ERR;
     }
 
-    if (strstr(key, "=")) {
-        FLASH_INFO("Flash environment variables name or value can't contain '='.\n");
+    if (memchr(key, '=', key_len)) {
+        FLASH_INFO("Flash environment variables name can't contain '='.\n");
         return FLASH_ENV_NAME_ERR;
     }
 
-    /* find environment variables */
-    del_env_str = (char *) find_env(key);
-    if (!del_env_str) {
-        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
-        return FLASH_ENV_NAME_ERR;
+    /* if not find this variables, then create it */
+    old_env = find_env(key, key_len);
+    if (!old_env) {
+        return write_env(key, key_len, value, value_len, is_blob, blob_type);
     }
-    del_env_length = strlen(del_env_str);
-    /* '\0' also must be as environment variable length */
-    del_env_length ++;
-    /* the address must multiple of 4 */
-    if (del_env_length % 4 != 0) {
-        del_env_length = (del_env_length / 4 + 1) * 4;
+
+    /* the value has no change, so the cache will not change */
+    old_value = get_env_value(old_env, key_len, &old_value_len, &old_is_blob);
+    if (old_is_blob == is_blob && old_value_len == value_len
+            && (!is_blob || get_env_blob_type(old_value) == blob_type)
+            && !memcmp(old_value, value, value_len)) {
+        return result;
+    }
+
+    env_len = calc_env_len(key_len, value_len, is_blob);
+    old_env_len = get_env_len(old_env);
+    if (env_len <= old_env_len) {
+        /* the new value fits in the old storage, overwrite it and fill '\0' to remaining part */
+        update_env_crc_sum(old_env);
+        make_env(old_env, old_env_len, key, key_len, value, value_len, is_blob, blob_type);
+        update_env_crc_sum(old_env);
+        env_cache_gen++;
+    } else {
+        /* check capacity before delete the old one, make sure the old value is kept when full */
+        if (env_len + flash_get_env_used_size() - env_marked_size - old_env_len
+                > env_copy_size) {
+            return FLASH_ENV_FULL;
+        }
+        /* delete it and write the new one at the end of cache */
+        del_env(old_env);
+        result = write_env(key, key_len, value, value_len, is_blob, blob_type);
     }
-    /* calculate remain environment variables length */
-    remain_env_length =
-            get_env_data_size() - ((uint32_t) del_env_str - (uint32_t) env_cache);
-    /* remain environment variables move forward */
-    memcpy(del_env_str, del_env_str + del_env_length, remain_env_length);
-    /* reset environment variables end address */
-    set_env_end_addr(get_env_end_addr() - del_env_length);
 
     return result;
 }
 
 /**
- * Set an environment variable. If it value is empty, delete it.
- * If not find it in environment variables table, then create it.
+ * Set environment variables by batch without lock.
+ * @see flash_set_env_batch
  *
- * @param key environment variable name
- * @param value environment variable value
+ * @param env_set environment variables set
+ * @param env_set_size environment variables set size
+ * @param save save environment variables to flash after set
  *
  * @return result
  */
-FlashErrCode flash_set_env(const char *key, const char *value) {
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save) {
     FlashErrCode result = FLASH_NO_ERR;
+    size_t i, key_len;
+    char *env;
 
+    FLASH_ASSERT(env_set || !env_set_size);
     FLASH_ASSERT(env_cache);
 
-    /* if ENV value is empty, delete it */
-    if (*value == NULL) {
-        result = flash_del_env(key);
-    } else {
-        /* if find this variables, then delete it and recreate it  */
-        if (find_env(key)) {
-            result = flash_del_env(key);
-        }
-        if (result == FLASH_NO_ERR) {
-            result = create_env(key, value);
+    env_is_batching = TRUE;
+    for (i = 0; i < env_set_size && result == FLASH_NO_ERR; i++) {
+        FLASH_ASSERT(env_set[i].key);
+        FLASH_ASSERT(env_set[i].value);
+
+        key_len = strlen(env_set[i].key);
+        if (*env_set[i].value != '\0') {
+            result = set_env(env_set[i].key, key_len, env_set[i].value, strlen(env_set[i].value),
+                    FALSE, 0);
+        } else if (memchr(env_set[i].key, '=', key_len)) {
+            FLASH_INFO("Flash environment variables name can't contain '='.\n");
+            result = FLASH_ENV_NAME_ERR;
+        } else if ((env = find_env(env_set[i].key, key_len)) != NULL) {
+            /* if ENV value is empty, delete it */
+            del_env(env);
         }
     }
+    env_is_batching = FALSE;
+    /* remove all deleted environment variables */
+    if (env_marked_size) {
+        del_marked_env();
+    }
+
+    if (result == FLASH_NO_ERR && save) {
+        result = save_env();
+    }
+
     return result;
 }
 
 /**
- * Get an environment variable value by key name.
+ * Reserve the storage space of an environment variable value in ram cache.
+ * After reserved, the environment variable which value length is not more than the reserved size
+ * will be overwrote in its storage, the other environment variables will not be moved.
+ * @note The environment variable must be exist. The reserved space will be saved to flash.
  *
  * @param key environment variable name
+ * @param value_max_len the maximum length of environment variable value
  *
- * @return value
+ * @return result
  */
-char *flash_get_env(const char *key) {
-    uint32_t *env_cache_addr = NULL;
-    char *value = NULL;
+FlashErrCode flash_reserve_env(const char *key, size_t value_max_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *env, *next_env;
+    size_t key_len, value_len, env_len, need_len;
+    bool_t is_blob;
+    FLASH_STATS_START();
 
+    FLASH_ASSERT(key);
     FLASH_ASSERT(env_cache);
 
+    FLASH_ENV_WRITE_LOCK();
     /* find environment variables */
-    env_cache_addr = find_env(key);
-    if (env_cache_addr == NULL) {
-        return NULL;
+    key_len = strlen(key);
+    env = find_env(key, key_len);
+    if (!env) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    env_len = get_env_len(env);
+    get_env_value(env, key_len, &value_len, &is_blob);
+    need_len = calc_env_len(key_len, value_max_len, is_blob);
+    /* the storage space is already enough */
+    if (need_len <= env_len) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return result;
     }
-    /* get value address */
-    value = strstr((char *) env_cache_addr, "=");
-    if (value != NULL) {
-        /* the equal sign next character is value */
-        value++;
+    /* check capacity of environment variables  */
+    if (need_len - env_len + flash_get_env_used_size() > env_copy_size) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_FULL;
     }
-    return value;
+    /* the environment variables behind it move backward, then fill '\0' to the reserved space */
+    next_env = env + env_len;
+    memmove(next_env + need_len - env_len, next_env,
+            (char *) env_cache + flash_get_env_used_size() - next_env);
+    memset(next_env, 0, need_len - env_len);
+    env_index_move(next_env, need_len - env_len);
+    set_env_end_addr(get_env_end_addr() + (need_len - env_len));
+    env_cache_gen++;
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+    return result;
 }
+
 /**
  * Print environment variables.
  */
 void flash_print_env(void) {
-    uint32_t *env_cache_data_addr = env_cache + FLASH_ENV_SYSTEM_WORD_SIZE,
-            *env_cache_end_addr =
-            (uint32_t *) (env_cache + FLASH_ENV_SYSTEM_WORD_SIZE + get_env_data_size() / 4);
-    uint8_t j;
-    char c;
+    char *env = (char *) env_cache + FLASH_ENV_SYSTEM_BYTE_SIZE, *env_end, *value;
+    size_t value_len, i;
+    bool_t is_blob;
 
     FLASH_ASSERT(env_cache);
 
-    for (; env_cache_data_addr < env_cache_end_addr; env_cache_data_addr += 1) {
-        for (j = 0; j < 4; j++) {
-            c = (*env_cache_data_addr) >> (8 * j);
-            flash_print("%c", c);
-            if (c == NULL) {
-                flash_print("\n");
-                break;
-            }
+    FLASH_ENV_READ_LOCK();
+    env_end = (char *) env_cache + flash_get_env_used_size();
+    for (; env < env_end; env += get_env_len(env)) {
+        if (*env == '\0') {
+            continue;
+        }
+        /* the blob value will be printed by hex */
+        flash_print("%s", env);
+        value = get_env_value(env, strchr(env, '=') - env, &value_len, &is_blob);
+        for (i = 0; is_blob && i < value_len; i++) {
+            flash_print("%02X", (uint8_t) value[i]);
         }
+        flash_print("\n");
     }
-    flash_print("\nEnvironment variables size: %ld/%ld bytes, mode: normal.\n, ",
-            flash_get_env_used_size(), flash_get_env_total_size());
+    flash_print("\nEnvironment variables size: %ld/%ld bytes, mode: normal, copy: %d/%d.\n",
+            flash_get_env_used_size(), env_copy_size, env_copy_index + 1,
+            FLASH_ENV_NORMAL_COPY_NUM);
+    FLASH_ENV_READ_UNLOCK();
 }
 
 /**
- * Load flash environment variables to ram.
+ * Load flash environment variables to ram without lock.
+ * @see flash_load_env
  */
-void flash_load_env(void) {
-    uint32_t *env_cache_bak, env_end_addr;
+static void load_env(void) {
+    uint32_t header[FLASH_ENV_SYSTEM_WORD_SIZE], newest_seq = 0, max_seq = 0, checked_mask = 0;
+    size_t i, newest_index;
+    bool_t is_loaded = FALSE;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    size_t salvage_index = FLASH_ENV_NORMAL_COPY_NUM;
+    bool_t is_salvaged = FALSE;
+#endif
 
     FLASH_ASSERT(env_cache);
 
-    /* read environment variables end address from flash */
-    flash_read(get_env_system_addr() + FLASH_ENV_SYSTEM_INDEX_END_ADDR * 4, &env_end_addr, 4);
-    /* if environment variables is not initialize or flash has dirty data, set default for it */
-    if ((env_end_addr == 0xFFFFFFFF) || (env_end_addr > env_start_addr + env_total_size)) {
-        flash_env_set_default();
-    } else {
-        /* set environment variables end address */
-        set_env_end_addr(env_end_addr);
+    /* find the newest copy in unchecked copies, only read the system section of every copy */
+    while (!is_loaded) {
+        newest_index = FLASH_ENV_NORMAL_COPY_NUM;
+        for (i = 0; i < FLASH_ENV_NORMAL_COPY_NUM; i++) {
+            if ((checked_mask & (1UL << i)) || !read_env_copy_header(i, header)) {
+                continue;
+            }
+            /* the sequence number maybe overflow, so compare it by difference */
+            if (newest_index == FLASH_ENV_NORMAL_COPY_NUM
+                    || (int32_t) (header[FLASH_ENV_SYSTEM_INDEX_SEQ] - newest_seq) > 0) {
+                newest_index = i;
+                newest_seq = header[FLASH_ENV_SYSTEM_INDEX_SEQ];
+            }
+        }
+        /* all copies are not initialize or damaged */
+        if (newest_index == FLASH_ENV_NORMAL_COPY_NUM) {
+            break;
+        }
+        /* the first found copy is the newest in all copies */
+        if (!checked_mask) {
+            max_seq = newest_seq;
+        }
+        checked_mask |= 1UL << newest_index;
 
-        env_cache_bak = env_cache + FLASH_ENV_SYSTEM_WORD_SIZE;
-        /* read all environment variables from flash */
-        flash_read(get_env_data_addr(), env_cache_bak, get_env_data_size());
+        /* read system section and all environment variables from flash */
+        read_env_copy_header(newest_index, env_cache);
+        FLASH_READ(get_env_copy_addr(newest_index) + FLASH_ENV_SYSTEM_BYTE_SIZE,
+                env_cache + FLASH_ENV_SYSTEM_WORD_SIZE, get_env_data_size());
+        env_copy_index = newest_index;
+        is_loaded = TRUE;
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
-        /* read environment variables CRC code from flash */
-        flash_read(get_env_system_addr() + FLASH_ENV_SYSTEM_INDEX_DATA_CRC * 4,
-                &env_cache[FLASH_ENV_SYSTEM_INDEX_DATA_CRC] , 4);
-
-        /* if environment variables CRC32 check is fault, set default for it */
+        /* if environment variables CRC32 check is fault, try the older copy */
         if (!env_crc_is_ok()) {
-            FLASH_INFO("Warning: Environment variables CRC check failed. Set it to default.\n");
-            flash_env_set_default();
+            FLASH_INFO("Warning: Environment variables copy %d CRC check failed.\n", newest_index);
+            is_loaded = FALSE;
+            /* the first failed copy is the newest one */
+            if (salvage_index == FLASH_ENV_NORMAL_COPY_NUM) {
+                salvage_index = newest_index;
+            }
+        }
+#endif
+
+    }
+
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    /* all copies are damaged, salvage the intact environment variables in the newest copy */
+    if (!is_loaded && salvage_index != FLASH_ENV_NORMAL_COPY_NUM) {
+        read_env_copy_header(salvage_index, env_cache);
+        FLASH_READ(get_env_copy_addr(salvage_index) + FLASH_ENV_SYSTEM_BYTE_SIZE,
+                env_cache + FLASH_ENV_SYSTEM_WORD_SIZE, get_env_data_size());
+        env_copy_index = salvage_index;
+        salvage_env();
+        is_loaded = TRUE;
+        is_salvaged = TRUE;
+    }
+#endif
+
+    if (is_loaded) {
+        /* rebuild the hash index */
+        env_index_build();
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+#ifdef FLASH_ENV_USING_CRC_CHECK
+        /* the erase budget in the damaged copy is not trusted */
+        if (!is_salvaged)
+#endif
+        {
+            set_env_erase_budget(env_cache);
         }
 #endif
+        FLASH_DEBUG("Loaded environment variables copy %d, sequence is %d.\n", env_copy_index,
+                env_cache[FLASH_ENV_SYSTEM_INDEX_SEQ]);
+        /* the environment variables in ram cache is same as flash */
+        env_saved_gen = env_cache_gen;
+    } else {
+        FLASH_INFO("Warning: Not find valid environment variables copy. Set it to default.\n");
+        /* the next saving will be newer than any damaged copy */
+        env_cache[FLASH_ENV_SYSTEM_INDEX_SEQ] = max_seq;
+        memset(&env_cache[FLASH_ENV_SYSTEM_INDEX_ERASE_CNT], 0, FLASH_ENV_WEAR_SECTOR_NUM * 4);
+        /* the saved generation is only updated when the default ones are saved successfully, so
+         * the failed or deferred saving will be retried by next saving */
+        env_set_default();
+    }
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    /* the salvaged environment variables are different from flash, they will be saved again */
+    if (is_salvaged) {
+        env_cache_gen++;
+    }
+#endif
+}
+
+/**
+ * Load flash environment variables to ram. The newest valid copy will be loaded.
+ */
+void flash_load_env(void) {
+    FLASH_STATS_START();
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    load_env();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
 
+    FLASH_STATS_END(FLASH_STATS_API_LOAD_ENV);
+}
+
+/**
+ * Read the system section of environment variables copy and check it.
+ *
+ * @param index copy index
+ * @param header the system section words
+ *
+ * @return true is the copy has been saved completely and the end address is valid
+ */
+static bool_t read_env_copy_header(size_t index, uint32_t *header) {
+    uint32_t env_end_addr;
+
+    FLASH_READ(get_env_copy_addr(index), header, FLASH_ENV_SYSTEM_BYTE_SIZE);
+    env_end_addr = header[FLASH_ENV_SYSTEM_INDEX_END_ADDR];
+    /* the sequence number has not been written, so the copy is not saved completely */
+    if (header[FLASH_ENV_SYSTEM_INDEX_SEQ] == 0xFFFFFFFF) {
+        return FALSE;
+    }
+    /* flash has dirty data */
+    if ((env_end_addr < get_env_data_addr()) || (env_end_addr > env_start_addr + env_copy_size)) {
+        return FALSE;
     }
+
+    return TRUE;
 }
 
 /**
- * Save environment variables to flash.
+ * Save environment variables to flash without lock.
+ * @see flash_save_env
+ *
+ * @return result
  */
-FlashErrCode flash_save_env(void) {
+static FlashErrCode save_env(void) {
     FlashErrCode result = FLASH_NO_ERR;
+    size_t copy_index = (env_copy_index + 1) % FLASH_ENV_NORMAL_COPY_NUM;
+    uint32_t crc_sum = 0;
 
     FLASH_ASSERT(env_cache);
 
-#ifdef FLASH_ENV_USING_CRC_CHECK
-    /* calculate and cache CRC32 code */
-    env_cache[FLASH_ENV_SYSTEM_INDEX_DATA_CRC] = calc_env_crc();
+    /* the environment variables has no change after last saved */
+    if (env_cache_gen == env_saved_gen) {
+        FLASH_DEBUG("Environment variables has no change, skip saving.\n");
+        return result;
+    }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the changes will be saved by next saving when it's over budget */
+    if (!env_erase_budget_check(env_cache, flash_get_env_used_size(), copy_index)) {
+        return FLASH_ENV_SAVE_DEFERRED;
+    }
+    get_env_erase_budget(env_cache);
 #endif
 
-    /* erase environment variables */
-    result = flash_erase(get_env_system_addr(), flash_get_env_used_size());
-    switch (result) {
-    case FLASH_NO_ERR: {
-        FLASH_INFO("Erased environment variables OK.\n");
-        break;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    crc_sum = env_crc_sum;
+#endif
+    result = write_env_copy(env_cache, flash_get_env_used_size(), crc_sum, copy_index);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the erases of this saving have been charged to the cached erase budget */
+    set_env_erase_budget(env_cache);
+#endif
+    if (result == FLASH_NO_ERR) {
+        env_copy_index = copy_index;
+        env_saved_gen = env_cache_gen;
     }
-    case FLASH_ERASE_ERR: {
-        FLASH_INFO("Warning: Erased environment variables fault!\n");
-        /* will return when erase fault */
+
+    return result;
+}
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/**
+ * Save a snapshot of environment variables to flash. The snapshot is copied in the write lock,
+ * then it's written to flash without the write lock, so the other threads can get and even set
+ * environment variables when the flash is programming. The saving is serialized by the save lock.
+ *
+ * @param saved_gen the generation which has been saved to flash, it can be NULL
+ * @param written it will be TRUE when the snapshot has been written to flash, it's not changed
+ *        when there is no change or the saving is failed or deferred
+ *
+ * @return result
+ */
+static FlashErrCode save_env_snapshot(uint32_t *saved_gen, bool_t *written) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t used_size, copy_index;
+    uint32_t snapshot_gen, crc_sum = 0;
+
+    FLASH_ASSERT(env_snapshot);
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    /* the environment variables has no change after last saved */
+    if (env_cache_gen == env_saved_gen) {
+        FLASH_DEBUG("Environment variables has no change, skip saving.\n");
+        if (saved_gen) {
+            *saved_gen = env_saved_gen;
+        }
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_ENV_SAVE_UNLOCK();
         return result;
     }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the changes will be saved by next saving when it's over budget, the copy index is only
+     * changed in the save lock */
+    if (!env_erase_budget_check(env_cache, flash_get_env_used_size(),
+            (env_copy_index + 1) % FLASH_ENV_NORMAL_COPY_NUM)) {
+        if (saved_gen) {
+            *saved_gen = env_saved_gen;
+        }
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_ENV_SAVE_UNLOCK();
+        return FLASH_ENV_SAVE_DEFERRED;
+    }
+    get_env_erase_budget(env_cache);
+#endif
+    used_size = flash_get_env_used_size();
+    memcpy(env_snapshot, env_cache, used_size);
+    snapshot_gen = env_cache_gen;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    crc_sum = env_crc_sum;
+#endif
+    FLASH_ENV_WRITE_UNLOCK();
+
+    /* the copy index is only changed in the save lock */
+    copy_index = (env_copy_index + 1) % FLASH_ENV_NORMAL_COPY_NUM;
+    result = write_env_copy(env_snapshot, used_size, crc_sum, copy_index);
+
+    FLASH_ENV_WRITE_LOCK();
+    /* the sequence number and erase counters are updated in snapshot whether it success or not */
+    env_cache[FLASH_ENV_SYSTEM_INDEX_SEQ] = env_snapshot[FLASH_ENV_SYSTEM_INDEX_SEQ];
+    memcpy(&env_cache[FLASH_ENV_SYSTEM_INDEX_ERASE_CNT],
+            &env_snapshot[FLASH_ENV_SYSTEM_INDEX_ERASE_CNT], FLASH_ENV_WEAR_SECTOR_NUM * 4);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the erase budget is only changed in the write lock, the erases of this saving have been
+     * charged to the snapshot */
+    memcpy(&env_cache[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET],
+            &env_snapshot[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET], ENV_ERASE_BUDGET_WORD_NUM * 4);
+    set_env_erase_budget(env_cache);
+#endif
+    if (result == FLASH_NO_ERR) {
+        env_copy_index = copy_index;
+        env_saved_gen = snapshot_gen;
+        *written = TRUE;
+    }
+    if (saved_gen) {
+        *saved_gen = env_saved_gen;
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    return result;
+}
+#endif
+
+/**
+ * Write environment variables to a copy in flash. Only the pages which are different from the copy
+ * will be erased and written, and the system section will be written at last.
+ *
+ * @param cache environment variables RAM cache or its snapshot, the sequence number, erase
+ *        counters, erase budget and CRC32 in its system section will be updated
+ * @param used_size environment variables used bytes size
+ * @param crc_sum the XOR of all environment variables CRC32
+ * @param copy_index the copy index which will be written
+ *
+ * @return result
+ */
+static FlashErrCode write_env_copy(uint32_t *cache, size_t used_size, uint32_t crc_sum,
+        size_t copy_index) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t page_offset, page_size, write_offset;
+    uint32_t copy_addr = get_env_copy_addr(copy_index);
+
+    cache[FLASH_ENV_SYSTEM_INDEX_SEQ]++;
+    /* the erased value is used for not saved copy */
+    if (cache[FLASH_ENV_SYSTEM_INDEX_SEQ] == 0xFFFFFFFF) {
+        cache[FLASH_ENV_SYSTEM_INDEX_SEQ] = 0;
     }
 
-    /* write environment variables to flash */
-    result = flash_write(get_env_system_addr(), env_cache, flash_get_env_used_size());
-    switch (result) {
-    case FLASH_NO_ERR: {
-        FLASH_INFO("Saved environment variables OK.\n");
-        break;
+    /* Only erase and write the pages which are different from the next copy, the page size is
+     * FLASH_ERASE_MIN_SIZE. The first page has new system section, so it always be erased first. */
+    for (page_offset = 0; page_offset < used_size; page_offset += flash_erase_min_size) {
+        page_size = flash_erase_min_size;
+        if (page_offset + page_size > used_size) {
+            page_size = used_size - page_offset;
+        }
+        if (page_offset && env_cache_is_same(cache, copy_addr, page_offset, page_size)) {
+            continue;
+        }
+        /* erase environment variables page */
+        inc_env_erase_cnt(cache, copy_addr + page_offset, page_size);
+        result = FLASH_ERASE(copy_addr + page_offset, page_size);
+        if (result != FLASH_NO_ERR) {
+            FLASH_INFO("Warning: Erased environment variables fault!\n");
+            /* will return when erase fault */
+            return result;
+        }
+        /* write environment variables page to flash except system section */
+        write_offset = page_offset ? page_offset : FLASH_ENV_SYSTEM_BYTE_SIZE;
+        if (write_offset < page_offset + page_size) {
+            result = FLASH_WRITE(copy_addr + write_offset,
+                    (uint32_t *) ((char *) cache + write_offset),
+                    page_offset + page_size - write_offset);
+            if (result != FLASH_NO_ERR) {
+                FLASH_INFO("Warning: Saved environment variables fault!\n");
+                return result;
+            }
+        }
+        FLASH_DEBUG("Saved environment variables page at 0x%08X.\n", copy_addr + page_offset);
     }
-    case FLASH_WRITE_ERR: {
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    /* calculate and cache CRC32 code, the erase counters have been updated */
+    cache[FLASH_ENV_SYSTEM_INDEX_DATA_CRC] = calc_env_crc(cache, crc_sum);
+#endif
+    /* write system section at last, the sequence number is the last word in it */
+    result = FLASH_WRITE(copy_addr, cache, FLASH_ENV_SYSTEM_BYTE_SIZE);
+    if (result != FLASH_NO_ERR) {
         FLASH_INFO("Warning: Saved environment variables fault!\n");
-        break;
+        return result;
+    }
+    FLASH_INFO("Saved environment variables copy %d OK.\n", copy_index);
+
+    return result;
+}
+
+/**
+ * Save environment variables to the next copy in flash. The system section will be written at
+ * last, so the current copy is still valid until the saving has been finished.
+ */
+FlashErrCode flash_save_env(void) {
+    return flash_save_env_gen(NULL, NULL);
+}
+
+/**
+ * Save environment variables to flash and get the generation which has been saved. The
+ * environment variables which are set by other threads in saving maybe not saved, so the saved
+ * generation can be less than the current generation. @see flash_save_env
+ *
+ * @param saved_gen the generation which has been saved to flash, it can be NULL
+ * @param written it's TRUE when this saving has written flash, FALSE when there is no change or
+ *        the saving is failed or deferred, it can be NULL
+ *
+ * @return result
+ */
+FlashErrCode flash_save_env_gen(uint32_t *saved_gen, bool_t *written) {
+    FlashErrCode result = FLASH_NO_ERR;
+#ifndef FLASH_ENV_USING_SNAPSHOT_SAVE
+    uint32_t last_saved_gen;
+#endif
+    bool_t is_written = FALSE;
+    FLASH_STATS_START();
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+    result = save_env_snapshot(saved_gen, &is_written);
+#else
+    FLASH_ENV_WRITE_LOCK();
+    last_saved_gen = env_saved_gen;
+    result = save_env();
+    if (saved_gen) {
+        *saved_gen = env_saved_gen;
     }
+    /* the saved generation is only changed by writing flash */
+    is_written = (env_saved_gen != last_saved_gen);
+    FLASH_ENV_WRITE_UNLOCK();
+#endif
+    if (written) {
+        *written = is_written;
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_SAVE_ENV);
     return result;
 }
 
+/**
+ * Check the environment variables in ram cache is same as flash copy.
+ *
+ * @param cache environment variables RAM cache or its snapshot
+ * @param copy_addr environment variables copy start address
+ * @param offset the offset from environment variables copy start address
+ * @param size check bytes size
+ *
+ * @return true is same
+ */
+static bool_t env_cache_is_same(const uint32_t *cache, uint32_t copy_addr, size_t offset,
+        size_t size) {
+    uint32_t buff[32];
+    size_t read_size;
+
+    for (; size; offset += read_size, size -= read_size) {
+        read_size = size < sizeof(buff) ? size : sizeof(buff);
+        FLASH_READ(copy_addr + offset, buff, read_size);
+        if (memcmp(buff, (const char *) cache + offset, read_size)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Increase the erase counters of the erase units in environment variables area. The counters are
+ * cached in system section, so they will be saved in next saving. The erase budget in system
+ * section is charged too.
+ *
+ * @param cache environment variables RAM cache or its snapshot
+ * @param addr erase start address
+ * @param size erase bytes size
+ */
+static void inc_env_erase_cnt(uint32_t *cache, uint32_t addr, size_t size) {
+    size_t sector = (addr - env_start_addr) / flash_erase_min_size;
+
+    for (; size && sector < env_total_size / flash_erase_min_size; sector++) {
+        cache[FLASH_ENV_SYSTEM_INDEX_ERASE_CNT + sector]++;
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+        cache[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET + sector] = flash_erase_budget_charge(
+                cache[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET + sector]);
+#endif
+        size = size > flash_erase_min_size ? size - flash_erase_min_size : 0;
+    }
+}
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/**
+ * Check the erase budget of the pages which will be erased by writing the copy. They are the first
+ * page and the pages which are different from the copy. @see write_env_copy
+ *
+ * @param cache environment variables RAM cache
+ * @param used_size environment variables used bytes size
+ * @param copy_index the copy index which will be written
+ *
+ * @return TRUE: the saving can erase flash
+ */
+static bool_t env_erase_budget_check(const uint32_t *cache, size_t used_size, size_t copy_index) {
+    uint32_t copy_addr = get_env_copy_addr(copy_index);
+    size_t page_offset, page_size;
+
+    for (page_offset = 0; page_offset < used_size; page_offset += flash_erase_min_size) {
+        page_size = flash_erase_min_size;
+        if (page_offset + page_size > used_size) {
+            page_size = used_size - page_offset;
+        }
+        if (page_offset && env_cache_is_same(cache, copy_addr, page_offset, page_size)) {
+            continue;
+        }
+        if (!flash_erase_budget_check((copy_addr + page_offset - env_start_addr)
+                / flash_erase_min_size, 1)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Copy the erase budget of all erase units to system section, then the saving charges its erases
+ * to it. It must be called in the write lock.
+ *
+ * @param cache environment variables RAM cache
+ */
+static void get_env_erase_budget(uint32_t *cache) {
+    size_t sector;
+
+    for (sector = 0; sector < env_total_size / flash_erase_min_size; sector++) {
+        cache[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET + sector] = flash_erase_budget_get(sector);
+    }
+}
+
+/**
+ * Set the erase budget of all erase units by system section. It restores the saved budget after
+ * loading, and updates the budget after saving. It must be called in the write lock.
+ *
+ * @param cache environment variables RAM cache
+ */
+static void set_env_erase_budget(const uint32_t *cache) {
+    size_t sector;
+
+    for (sector = 0; sector < env_total_size / flash_erase_min_size; sector++) {
+        flash_erase_budget_set(sector, cache[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET + sector]);
+    }
+}
+#endif
+
 #ifdef FLASH_ENV_USING_CRC_CHECK
 /**
  * Calculate the cached environment variables CRC32 value.
  *
+ * @param cache environment variables RAM cache or its snapshot
+ * @param crc_sum the XOR of all environment variables CRC32
+ *
  * @return CRC32 value
  */
-static uint32_t calc_env_crc(void) {
+static uint32_t calc_env_crc(const uint32_t *cache, uint32_t crc_sum) {
     uint32_t crc32 = 0;
 
     extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
-    /* Calculate the environment variables end address and all environment variables data CRC32.
-     * The 4 is environment variables end address bytes size. */
-    crc32 = calc_crc32(crc32, &env_cache[FLASH_ENV_SYSTEM_INDEX_END_ADDR], 4);
-    crc32 = calc_crc32(crc32, &env_cache[FLASH_ENV_SYSTEM_WORD_SIZE], get_env_data_size());
+    /* Calculate the environment variables end address, erase counters, erase budget, sequence
+     * number and the XOR of all environment variables CRC32. Every environment variable is checked
+     * by its own CRC32. */
+    crc32 = calc_crc32(crc32, &cache[FLASH_ENV_SYSTEM_INDEX_END_ADDR], 4);
+    crc32 = calc_crc32(crc32, &cache[FLASH_ENV_SYSTEM_INDEX_ERASE_CNT],
+            FLASH_ENV_WEAR_SECTOR_NUM * 4);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    crc32 = calc_crc32(crc32, &cache[FLASH_ENV_SYSTEM_INDEX_ERASE_BUDGET],
+            ENV_ERASE_BUDGET_WORD_NUM * 4);
+#endif
+    crc32 = calc_crc32(crc32, &cache[FLASH_ENV_SYSTEM_INDEX_SEQ], 4);
+    crc32 = calc_crc32(crc32, &crc_sum, 4);
     FLASH_DEBUG("Calculate Env CRC32 number is 0x%08X.\n", crc32);
 
     return crc32;
@@ -575,18 +1258,108 @@ static uint32_t calc_env_crc(void) {
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
 /**
- * Check the environment variables CRC32
+ * Check the environment variables CRC32. Every environment variable CRC32 is checked, then the XOR
+ * of them is recalculated for checking the system section CRC32.
  *
  * @return true is ok
  */
 static bool_t env_crc_is_ok(void) {
-    if (calc_env_crc() == env_cache[FLASH_ENV_SYSTEM_INDEX_DATA_CRC]) {
+    char *env = (char *) env_cache + FLASH_ENV_SYSTEM_BYTE_SIZE;
+    char *env_end = (char *) env_cache + flash_get_env_used_size();
+    size_t env_len;
+
+    env_crc_sum = 0;
+    for (; env < env_end; env += env_len) {
+        env_len = check_env(env, env_end);
+        if (!env_len) {
+            return FALSE;
+        }
+        update_env_crc_sum(env);
+    }
+
+    if (calc_env_crc(env_cache, env_crc_sum) == env_cache[FLASH_ENV_SYSTEM_INDEX_DATA_CRC]) {
         FLASH_DEBUG("Verify Env CRC32 result is OK.\n");
         return TRUE;
     } else {
         return FALSE;
     }
 }
+
+/**
+ * Check the storage format and CRC32 of an environment variable in ram cache.
+ *
+ * @param env environment variable in ram cache
+ * @param env_end the end of environment variables in ram cache
+ *
+ * @return storage length, 0 is broken
+ */
+static size_t check_env(const char *env, const char *env_end) {
+    const char *str_end = memchr(env, '\0', env_end - env), *key_end = NULL;
+    size_t len, max_len = env_end - env;
+    uint32_t blob_header;
+
+    extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
+
+    /* storage model is key=value\0, the name must be not empty */
+    if (str_end) {
+        key_end = memchr(env, '=', str_end - env);
+    }
+    if (!key_end || key_end == env) {
+        return 0;
+    }
+    len = (str_end - env + 1 + 3) / 4 * 4;
+    /* the empty value is blob, storage model is key=\0 + blob header word + blob data */
+    if (key_end + 1 == str_end) {
+        if (len + 4 > max_len) {
+            return 0;
+        }
+        blob_header = *(uint32_t *) (env + len);
+        if ((blob_header & ENV_BLOB_FLAG_MASK) != ENV_BLOB_FLAG) {
+            return 0;
+        }
+        len += 4 + ((blob_header & ENV_BLOB_LEN_MASK) + 3) / 4 * 4;
+    }
+    if (len + ENV_CRC_BYTE_SIZE > max_len
+            || calc_crc32(0, env, len) != *(uint32_t *) (env + len)) {
+        return 0;
+    }
+    len += ENV_CRC_BYTE_SIZE;
+    /* the '\0' padding words are the reserved space */
+    while (len < max_len && *(uint32_t *) (env + len) == 0) {
+        len += 4;
+    }
+
+    return len;
+}
+
+/**
+ * Salvage the intact environment variables in ram cache when CRC32 check is failed. The broken data
+ * will be removed, so only the broken environment variables are lost.
+ */
+static void salvage_env(void) {
+    char *env = (char *) env_cache + FLASH_ENV_SYSTEM_BYTE_SIZE;
+    char *env_end = (char *) env_cache + flash_get_env_used_size();
+    char *dst = env;
+    size_t env_len, broken_size = 0;
+
+    env_crc_sum = 0;
+    while (env < env_end) {
+        env_len = check_env(env, env_end);
+        if (env_len) {
+            memmove(dst, env, env_len);
+            update_env_crc_sum(dst);
+            dst += env_len;
+            env += env_len;
+        } else {
+            /* skip a word, then try to find the next intact environment variable */
+            env += 4;
+            broken_size += 4;
+        }
+    }
+    set_env_end_addr(get_env_end_addr() - (env_end - dst));
+    FLASH_INFO("Warning: Environment variables CRC check failed. Removed %d bytes broken data.\n",
+            broken_size);
+}
 #endif
 
 #endif
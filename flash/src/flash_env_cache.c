@@ -0,0 +1,901 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: The environment variables RAM cache and its index, it's shared by the normal mode,
+ *           wear leveling mode and log mode.
+ * Created on: 2026-10-16
+ */
+
+#include "flash_env_cache.h"
+#include <string.h>
+
+#if defined(FLASH_ENV_USING_NORMAL_MODE) || defined(FLASH_ENV_USING_WEAR_LEVELING_MODE) \
+        || (defined(FLASH_ENV_USING_LOG_MODE) && !defined(FLASH_ENV_USING_PAGED_CACHE))
+
+/**
+ * All environment variables are cached in RAM by the mode, storage model is key=value\0.
+ * The blob value storage format is key=\0 + blob header word + blob data.
+ * When ENV_USING_CRC_WORD is defined, every environment variable has a CRC32 word behind its value.
+ * All environment variables must be 4 bytes alignment. The remaining part must fill '\0'.
+ *
+ * This file finds the environment variables by the hash or sorted index, and implements the
+ * getting, blob, typed and batch APIs. The data size and the setting are implemented by the mode.
+ * @see env_data_ops
+ *
+ * @note Word = 4 Bytes in this file
+ */
+
+/* environment variables data start in RAM cache, it's set by the mode */
+static char *env_data = NULL;
+/* the operations of environment variables data in RAM cache */
+static const env_data_ops *data_ops = NULL;
+/* environment variables sorted index or hash index, each item storage the env (word offset + 1) in
+ * data by name order or by hash bucket. It grows when it's full. @see env_index_grow */
+static uint16_t *env_index = NULL;
+/* the items number of sorted index or the buckets number of hash index */
+static size_t env_index_size = 0;
+/* environment variables number in index */
+static size_t env_index_count = 0;
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+static int env_key_cmp(const char *env, const char *key, size_t key_len);
+static size_t env_index_search(const char *key, size_t key_len);
+#else
+static uint32_t calc_env_key_hash(const char *key, size_t key_len);
+#endif
+static bool_t env_index_grow(void);
+
+/**
+ * Initialize the environment variables RAM cache, it must be called before loading.
+ *
+ * @param data environment variables data start in RAM cache
+ * @param ops the operations of environment variables data
+ */
+void env_cache_init(char *data, const env_data_ops *ops) {
+    FLASH_ASSERT(data);
+    FLASH_ASSERT(ops);
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+    FLASH_ASSERT(FLASH_ENV_SORTED_INDEX_SIZE > 0);
+#else
+    /* hash index buckets number must be power of 2 */
+    FLASH_ASSERT((FLASH_ENV_HASH_INDEX_SIZE & (FLASH_ENV_HASH_INDEX_SIZE - 1)) == 0);
+#endif
+    /* make true only be initialized once */
+    FLASH_ASSERT(!env_index);
+
+    env_data = data;
+    data_ops = ops;
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+    env_index_size = FLASH_ENV_SORTED_INDEX_SIZE;
+#else
+    env_index_size = FLASH_ENV_HASH_INDEX_SIZE;
+#endif
+    env_index = (uint16_t *) flash_malloc(sizeof(uint16_t) * env_index_size);
+    FLASH_ASSERT(env_index);
+}
+
+/**
+ * Calculate environment variable storage length in ram cache.
+ *
+ * @param key_len environment variable name length
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ *
+ * @return storage length, it's 4 bytes alignment and contains the CRC32 word
+ */
+size_t calc_env_len(size_t key_len, size_t value_len, bool_t is_blob) {
+    if (is_blob) {
+        /* storage model is key=\0 + blob header word + blob data */
+        return (key_len + 2 + 3) / 4 * 4 + 4 + (value_len + 3) / 4 * 4 + ENV_CRC_BYTE_SIZE;
+    } else {
+        /* storage model is key=value\0 */
+        return (key_len + value_len + 2 + 3) / 4 * 4 + ENV_CRC_BYTE_SIZE;
+    }
+}
+
+/**
+ * Make an environment variable in its storage. The remaining part of storage will fill '\0'.
+ *
+ * @param env environment variable storage in ram cache
+ * @param env_len storage length
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ */
+void make_env(char *env, size_t env_len, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type) {
+    size_t value_offset = key_len + 1;
+#ifdef ENV_USING_CRC_WORD
+    size_t crc_offset = calc_env_len(key_len, value_len, is_blob) - ENV_CRC_BYTE_SIZE;
+
+    extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
+#endif
+
+    /* the value maybe in this storage, so it must be moved first */
+    if (is_blob) {
+        value_offset = (key_len + 2 + 3) / 4 * 4 + 4;
+    }
+    memmove(env + value_offset, value, value_len);
+    memmove(env, key, key_len);
+    env[key_len] = '=';
+    if (is_blob) {
+        memset(env + key_len + 1, 0, value_offset - 4 - key_len - 1);
+        *(uint32_t *) (env + value_offset - 4) = ENV_BLOB_FLAG
+                | (uint32_t) blob_type << ENV_BLOB_TYPE_SHIFT | value_len;
+    }
+    memset(env + value_offset + value_len, 0, env_len - value_offset - value_len);
+#ifdef ENV_USING_CRC_WORD
+    /* the CRC32 word is behind the value, it checks the name, value and their padding */
+    *(uint32_t *) (env + crc_offset) = calc_crc32(0, env, crc_offset);
+#endif
+}
+
+/**
+ * Get the value of an environment variable in ram cache.
+ *
+ * @param env environment variable in ram cache
+ * @param key_len environment variable name length
+ * @param value_len the value length
+ * @param is_blob the value is blob
+ *
+ * @return value
+ */
+char *get_env_value(const char *env, size_t key_len, size_t *value_len, bool_t *is_blob) {
+    const char *value = env + key_len + 1;
+
+    /* the string value must be not empty, so the empty one is blob value */
+    if (*value == '\0') {
+        value = env + (key_len + 2 + 3) / 4 * 4;
+        *value_len = *(uint32_t *) value & ENV_BLOB_LEN_MASK;
+        *is_blob = TRUE;
+        return (char *) value + 4;
+    }
+    *value_len = strlen(value);
+    *is_blob = FALSE;
+
+    return (char *) value;
+}
+
+/**
+ * Get the type of a blob value in ram cache.
+ *
+ * @param value the blob value which is got by get_env_value
+ *
+ * @return blob type
+ */
+uint8_t get_env_blob_type(const char *value) {
+    return (*(uint32_t *) (value - 4) & ENV_BLOB_TYPE_MASK) >> ENV_BLOB_TYPE_SHIFT;
+}
+
+/**
+ * Get the storage length of an environment variable in ram cache. It contains the CRC32 word and
+ * the '\0' padding words behind the value, these padding words are the reserved space.
+ *
+ * @param env environment variable in ram cache
+ *
+ * @return storage length
+ */
+size_t get_env_len(const char *env) {
+    const char *env_end = env_data + data_ops->get_size();
+    size_t len = get_env_body_len(env) + ENV_CRC_BYTE_SIZE;
+
+    while (env + len < env_end && *(uint32_t *) (env + len) == 0) {
+        len += 4;
+    }
+
+    return len;
+}
+
+/**
+ * Get the storage length of an environment variable name and value in ram cache. It doesn't
+ * contain the CRC32 word and the reserved space.
+ *
+ * @param env environment variable in ram cache
+ *
+ * @return storage length
+ */
+size_t get_env_body_len(const char *env) {
+    const char *env_end = env_data + data_ops->get_size();
+    size_t str_len = strlen(env), len;
+
+    /* '\0' also must be as environment variable length, and the length must multiple of 4 */
+    len = (str_len + 1 + 3) / 4 * 4;
+    /* blob value storage model is key=\0 + blob header word + blob data, the name is not empty.
+     * The first character maybe ENV_DELETED_MARK, so the '=' is found after it. */
+    if (str_len > 1 && strchr(env + 1, '=') == env + str_len - 1 && env + len < env_end
+            && (*(uint32_t *) (env + len) & ENV_BLOB_FLAG_MASK) == ENV_BLOB_FLAG) {
+        len += 4 + ((*(uint32_t *) (env + len) & ENV_BLOB_LEN_MASK) + 3) / 4 * 4;
+    }
+
+    return len;
+}
+
+/**
+ * Find environment variables by the hash or sorted index. The name must be exactly equal.
+ *
+ * @param key environment variables name, it maybe not end with '\0'
+ * @param key_len environment variables name length
+ *
+ * @return environment variables in ram cache, NULL when not find
+ */
+char *find_env(const char *key, size_t key_len) {
+    char *env;
+    size_t i;
+
+    FLASH_ASSERT(env_data);
+
+    if (key_len == 0) {
+        FLASH_INFO("Flash environment variables name must be not empty!\n");
+        return NULL;
+    }
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+    /* binary search in the sorted index */
+    i = env_index_search(key, key_len);
+    if (i < env_index_count) {
+        env = env_data + (env_index[i] - 1) * 4;
+        if (!env_key_cmp(env, key, key_len)) {
+            return env;
+        }
+    }
+#else
+    /* linear probing from the hash bucket until an empty bucket */
+    for (i = calc_env_key_hash(key, key_len) & (env_index_size - 1); env_index[i];
+            i = (i + 1) & (env_index_size - 1)) {
+        env = env_data + (env_index[i] - 1) * 4;
+        /* storage model is key=value\0, the key name length must be equal */
+        if (!strncmp(env, key, key_len) && (env[key_len] == '=')) {
+            return env;
+        }
+    }
+#endif
+
+    return NULL;
+}
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+/**
+ * Compare environment variable name with the key.
+ *
+ * @param env environment variable in ram cache, storage model is key=value\0
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ *
+ * @return less than, equal to or greater than 0 when the name is less than, equal to or greater
+ *         than the key
+ */
+static int env_key_cmp(const char *env, const char *key, size_t key_len) {
+    size_t env_key_len = strchr(env, '=') - env;
+    int result = memcmp(env, key, env_key_len < key_len ? env_key_len : key_len);
+
+    if (result == 0) {
+        result = (env_key_len > key_len) - (env_key_len < key_len);
+    }
+
+    return result;
+}
+
+/**
+ * Binary search the environment variable name in sorted index.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ *
+ * @return the position of first environment variable which name is not less than the key
+ */
+static size_t env_index_search(const char *key, size_t key_len) {
+    char *env_start = env_data;
+    size_t low = 0, high = env_index_count, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (env_key_cmp(env_start + (env_index[mid] - 1) * 4, key, key_len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+#else
+/**
+ * Calculate environment variable name hash code. (FNV-1a)
+ *
+ * @param key environment variable name
+ * @param key_len environment variable name length
+ *
+ * @return hash code
+ */
+static uint32_t calc_env_key_hash(const char *key, size_t key_len) {
+    uint32_t hash = 2166136261UL;
+
+    while (key_len--) {
+        hash ^= (uint8_t) *key++;
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+#endif
+
+/**
+ * Rebuild the hash or sorted index by all environment variables in ram cache.
+ */
+void env_index_build(void) {
+    char *env = env_data, *env_end = env_data + data_ops->get_size();
+    bool_t is_added;
+
+    memset(env_index, 0, sizeof(uint16_t) * env_index_size);
+    env_index_count = 0;
+
+    for (; env < env_end; env += get_env_len(env)) {
+        if (*env != '\0') {
+            is_added = env_index_add(env);
+            /* every environment variable must be found, it's same as creating the RAM cache */
+            FLASH_ASSERT(is_added);
+        }
+    }
+}
+
+/**
+ * Double the hash or sorted index size. The hash index is rebuilt by the new buckets number.
+ *
+ * @return FALSE when there is no memory for the new index, the old index is kept
+ */
+static bool_t env_index_grow(void) {
+    uint16_t *old_index = env_index;
+    size_t old_size = env_index_size;
+#ifndef FLASH_ENV_USING_SORTED_INDEX
+    size_t i;
+#endif
+
+    env_index = (uint16_t *) flash_malloc(sizeof(uint16_t) * old_size * 2);
+    if (!env_index) {
+        FLASH_INFO("Error: No memory for %d items environment variables index.\n", old_size * 2);
+        env_index = old_index;
+        return FALSE;
+    }
+    env_index_size = old_size * 2;
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+    memcpy(env_index, old_index, sizeof(uint16_t) * env_index_count);
+#else
+    memset(env_index, 0, sizeof(uint16_t) * env_index_size);
+    env_index_count = 0;
+    for (i = 0; i < old_size; i++) {
+        if (old_index[i]) {
+            env_index_add(env_data + (old_index[i] - 1) * 4);
+        }
+    }
+#endif
+    flash_free(old_index);
+
+    return TRUE;
+}
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+/**
+ * Add an environment variable to sorted index. The index grows when it's full.
+ *
+ * @param env environment variable in ram cache, storage model is key=value\0
+ *
+ * @return FALSE when there is no memory for growing the index
+ */
+bool_t env_index_add(const char *env) {
+    size_t i;
+
+    if (env_index_count >= env_index_size && !env_index_grow()) {
+        return FALSE;
+    }
+
+    i = env_index_search(env, strchr(env, '=') - env);
+    memmove(&env_index[i + 1], &env_index[i], (env_index_count - i) * sizeof(uint16_t));
+    env_index[i] = (env - env_data) / 4 + 1;
+    env_index_count++;
+
+    return TRUE;
+}
+
+/**
+ * Delete an environment variable from sorted index.
+ * @note It must be called before the environment variable is removed from ram cache.
+ *
+ * @param env environment variable in ram cache
+ * @param env_len environment variable storage length in ram cache
+ */
+void env_index_del(const char *env, size_t env_len) {
+    char *env_start = env_data;
+    size_t i;
+
+    i = env_index_search(env, strchr(env, '=') - env);
+    FLASH_ASSERT(i < env_index_count && env_index[i] == (env - env_start) / 4 + 1);
+    memmove(&env_index[i], &env_index[i + 1], (env_index_count - i - 1) * sizeof(uint16_t));
+    env_index_count--;
+
+    /* the environment variables after deleted one will move forward */
+    env_index_move(env + env_len, -(long) env_len);
+}
+
+/**
+ * Move the sorted index of environment variables which are behind the position in ram cache.
+ *
+ * @param env_pos the position in ram cache
+ * @param size moved bytes size, it's negative when environment variables move forward
+ */
+void env_index_move(const char *env_pos, long size) {
+    uint16_t offset = (env_pos - env_data) / 4 + 1;
+    size_t i;
+
+    for (i = 0; i < env_index_count; i++) {
+        if (env_index[i] >= offset) {
+            env_index[i] = (uint16_t) (env_index[i] + size / 4);
+        }
+    }
+}
+#else
+/**
+ * Add an environment variable to hash index. The index grows when it's 3/4 full.
+ *
+ * @param env environment variable in ram cache, storage model is key=value\0
+ *
+ * @return FALSE when there is no memory for growing the index
+ */
+bool_t env_index_add(const char *env) {
+    size_t i;
+
+    /* keep some empty buckets, so the probing will not be too long */
+    if (env_index_count >= env_index_size / 4 * 3 && !env_index_grow()) {
+        return FALSE;
+    }
+
+    for (i = calc_env_key_hash(env, strchr(env, '=') - env) & (env_index_size - 1);
+            env_index[i]; i = (i + 1) & (env_index_size - 1));
+    env_index[i] = (env - env_data) / 4 + 1;
+    env_index_count++;
+
+    return TRUE;
+}
+
+/**
+ * Delete an environment variable from hash index.
+ * @note It must be called before the environment variable is removed from ram cache.
+ *
+ * @param env environment variable in ram cache
+ * @param env_len environment variable storage length in ram cache
+ */
+void env_index_del(const char *env, size_t env_len) {
+    char *env_start = env_data, *moved_env;
+    uint16_t del_offset = (env - env_start) / 4 + 1;
+    size_t i, j, home;
+
+    for (i = calc_env_key_hash(env, strchr(env, '=') - env) & (env_index_size - 1);
+            env_index[i] != del_offset; i = (i + 1) & (env_index_size - 1)) {
+        FLASH_ASSERT(env_index[i]);
+    }
+    env_index[i] = 0;
+    env_index_count--;
+
+    /* move the following buckets in same probing sequence backward, make no hole in sequence */
+    for (j = (i + 1) & (env_index_size - 1); env_index[j];
+            j = (j + 1) & (env_index_size - 1)) {
+        moved_env = env_start + (env_index[j] - 1) * 4;
+        home = calc_env_key_hash(moved_env, strchr(moved_env, '=') - moved_env)
+                & (env_index_size - 1);
+        /* the home bucket is not cyclically in (i, j], so it can move to i */
+        if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+            env_index[i] = env_index[j];
+            env_index[j] = 0;
+            i = j;
+        }
+    }
+
+    /* the environment variables after deleted one will move forward */
+    env_index_move(env + env_len, -(long) env_len);
+}
+
+/**
+ * Move the hash index of environment variables which are behind the position in ram cache.
+ *
+ * @param env_pos the position in ram cache
+ * @param size moved bytes size, it's negative when environment variables move forward
+ */
+void env_index_move(const char *env_pos, long size) {
+    uint16_t offset = (env_pos - env_data) / 4 + 1;
+    size_t i;
+
+    for (i = 0; i < env_index_size; i++) {
+        if (env_index[i] >= offset) {
+            env_index[i] = (uint16_t) (env_index[i] + size / 4);
+        }
+    }
+}
+#endif
+
+/**
+ * Set an environment variable. If it value is empty, delete it.
+ * If not find it in environment variables table, then create it.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env(const char *key, const char *value) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value);
+    FLASH_ASSERT(env_data);
+
+    FLASH_ENV_WRITE_LOCK();
+    /* if ENV value is empty, delete it */
+    if (*value == '\0') {
+        result = flash_del_env(key);
+    } else {
+        result = data_ops->set(key, strlen(key), value, strlen(value), FALSE, 0);
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV);
+    return result;
+}
+
+/**
+ * Set environment variables by batch. Deleting (the value is empty), modifying and creating will
+ * be done in order. The deleted and moved environment variables will be removed by one pass
+ * after all environment variables are set.
+ *
+ * @param env_set environment variables set
+ * @param env_set_size environment variables set size
+ * @param save save environment variables to flash after set
+ *
+ * @return result, the following environment variables will not be set when an error has occurred
+ */
+FlashErrCode flash_set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    result = data_ops->set_batch(env_set, env_set_size, save);
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV_BATCH);
+    return result;
+}
+
+/**
+ * Get environment variables by batch. The value will be NULL when not find it.
+ *
+ * @param env_set environment variables set, the value will be got by key
+ * @param env_set_size environment variables set size
+ *
+ * @return the number of found environment variables
+ */
+size_t flash_get_env_batch(flash_env *env_set, size_t env_set_size) {
+    size_t i, key_len, found_num = 0;
+    char *env;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(env_set || !env_set_size);
+    FLASH_ASSERT(env_data);
+
+    /* all environment variables are got in one lock, so they are consistent */
+    FLASH_ENV_READ_LOCK();
+    for (i = 0; i < env_set_size; i++) {
+        key_len = strlen(env_set[i].key);
+        env = find_env(env_set[i].key, key_len);
+        /* the equal sign next character is value */
+        env_set[i].value = env ? env + key_len + 1 : NULL;
+        if (env_set[i].value) {
+            found_num++;
+        }
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV_BATCH);
+    return found_num;
+}
+
+/**
+ * Iterate the environment variables which name starts with the prefix. They are iterated by name
+ * order when FLASH_ENV_USING_SORTED_INDEX is enabled, otherwise by storage order.
+ * @note The environment variables can't be changed in iterator, it's called in the read lock.
+ *
+ * @param prefix environment variable name prefix, "" is all environment variables
+ * @param iterator it will be called for every environment variable, return FALSE will stop
+ * @param arg iterator argument
+ *
+ * @return the number of iterated environment variables
+ */
+size_t flash_iterate_env(const char *prefix, flash_env_iterator iterator, void *arg) {
+    char *env, *value;
+    size_t prefix_len, key_len, value_len, count = 0;
+    bool_t is_blob;
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+    size_t i;
+#else
+    char *env_end;
+#endif
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(prefix);
+    FLASH_ASSERT(iterator);
+    FLASH_ASSERT(env_data);
+
+    FLASH_ENV_READ_LOCK();
+    prefix_len = strlen(prefix);
+    if (strchr(prefix, '=')) {
+        FLASH_ENV_READ_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_ITERATE_ENV);
+        return count;
+    }
+
+#ifdef FLASH_ENV_USING_SORTED_INDEX
+    /* the names which start with prefix are continuous in sorted index */
+    for (i = env_index_search(prefix, prefix_len); i < env_index_count; i++) {
+        env = env_data + (env_index[i] - 1) * 4;
+        if (strncmp(env, prefix, prefix_len)) {
+            break;
+        }
+        key_len = strchr(env, '=') - env;
+        value = get_env_value(env, key_len, &value_len, &is_blob);
+        count++;
+        if (!iterator(env, key_len, value, value_len, is_blob, arg)) {
+            break;
+        }
+    }
+#else
+    env_end = env_data + data_ops->get_size();
+    for (env = env_data; env < env_end; env += get_env_len(env)) {
+        if (*env == '\0' || *env == ENV_DELETED_MARK || strncmp(env, prefix, prefix_len)) {
+            continue;
+        }
+        key_len = strchr(env, '=') - env;
+        value = get_env_value(env, key_len, &value_len, &is_blob);
+        count++;
+        if (!iterator(env, key_len, value, value_len, is_blob, arg)) {
+            break;
+        }
+    }
+#endif
+    FLASH_ENV_READ_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_ITERATE_ENV);
+    return count;
+}
+
+/**
+ * Set an environment variable by blob value. If not find it in environment variables table,
+ * then create it.
+ *
+ * @param key environment variable name
+ * @param value_buf blob value buffer
+ * @param buf_len blob value length
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_blob(const char *key, const void *value_buf, size_t buf_len) {
+    FLASH_ASSERT(key);
+
+    return flash_set_env_blob_n(key, strlen(key), value_buf, buf_len);
+}
+
+/**
+ * Set an environment variable by blob value and name length.
+ * @see flash_set_env_blob
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value_buf blob value buffer
+ * @param buf_len blob value length
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_blob_n(const char *key, size_t key_len, const void *value_buf,
+        size_t buf_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value_buf || !buf_len);
+    FLASH_ASSERT(env_data);
+
+    if (buf_len > ENV_BLOB_LEN_MASK) {
+        FLASH_STATS_END(FLASH_STATS_API_SET_ENV_BLOB);
+        return FLASH_ENV_FULL;
+    }
+
+    FLASH_ENV_WRITE_LOCK();
+    result = data_ops->set(key, key_len, value_buf, buf_len, TRUE, FLASH_ENV_TYPE_BLOB);
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV_BLOB);
+    return result;
+}
+
+/**
+ * Get an environment variable value by key name.
+ * @note The value of blob environment variable is empty. @see flash_get_env_blob
+ * @note The value is in ram cache, it may be changed by other threads after returned, so use
+ *       flash_get_env_blob to copy it when there are multiple threads.
+ *
+ * @param key environment variable name
+ *
+ * @return value
+ */
+char *flash_get_env(const char *key) {
+    char *env = NULL;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(env_data);
+
+    FLASH_ENV_READ_LOCK();
+    /* find environment variables */
+    env = find_env(key, strlen(key));
+    if (env != NULL) {
+        /* the equal sign next character is value */
+        env += strlen(key) + 1;
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV);
+    return env;
+}
+
+/**
+ * Get a blob environment variable value by key name. The string value also can be got by it.
+ *
+ * @param key environment variable name
+ * @param value_buf the buffer for saving value
+ * @param buf_len buffer length
+ * @param saved_value_len the value length which saved in environment variables, it can be NULL.
+ *        It's 0 when not find the environment variable.
+ *
+ * @return the value length which is copied to buffer
+ */
+size_t flash_get_env_blob(const char *key, void *value_buf, size_t buf_len,
+        size_t *saved_value_len) {
+    FLASH_ASSERT(key);
+
+    return flash_get_env_blob_n(key, strlen(key), value_buf, buf_len, saved_value_len);
+}
+
+/**
+ * Get a blob environment variable value by key name and name length.
+ * @see flash_get_env_blob
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value_buf the buffer for saving value
+ * @param buf_len buffer length
+ * @param saved_value_len the value length which saved in environment variables, it can be NULL
+ *
+ * @return the value length which is copied to buffer
+ */
+size_t flash_get_env_blob_n(const char *key, size_t key_len, void *value_buf, size_t buf_len,
+        size_t *saved_value_len) {
+    char *env, *value;
+    size_t value_len = 0;
+    bool_t is_blob;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value_buf || !buf_len);
+    FLASH_ASSERT(env_data);
+
+    FLASH_ENV_READ_LOCK();
+    /* find environment variables */
+    env = find_env(key, key_len);
+    if (env) {
+        value = get_env_value(env, key_len, &value_len, &is_blob);
+        if (buf_len > value_len) {
+            buf_len = value_len;
+        }
+        memcpy(value_buf, value, buf_len);
+    } else {
+        buf_len = 0;
+    }
+    if (saved_value_len) {
+        *saved_value_len = value_len;
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV_BLOB);
+    return buf_len;
+}
+
+/**
+ * Set a typed environment variable. It's stored as fixed width blob which type is saved in the
+ * blob header word. If not find it in environment variables table, then create it.
+ *
+ * @param key environment variable name
+ * @param value the value buffer
+ * @param size the value width
+ * @param type the value type, it must not be FLASH_ENV_TYPE_BLOB
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_typed(const char *key, const void *value, size_t size,
+        flash_env_type type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value);
+    FLASH_ASSERT(type != FLASH_ENV_TYPE_BLOB);
+    FLASH_ASSERT(env_data);
+
+    FLASH_ENV_WRITE_LOCK();
+    result = data_ops->set(key, strlen(key), value, size, TRUE, type);
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV_TYPED);
+    return result;
+}
+
+/**
+ * Get a typed environment variable. It's found and copied in one lookup.
+ *
+ * @param key environment variable name
+ * @param value the value buffer
+ * @param size the value width
+ * @param type the value type
+ *
+ * @return result, FLASH_ENV_NAME_ERR when not find, FLASH_ENV_TYPE_ERR when the saved value is not
+ *         this type or its width is not equal
+ */
+FlashErrCode flash_get_env_typed(const char *key, void *value, size_t size, flash_env_type type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *env, *env_value;
+    size_t key_len, value_len;
+    bool_t is_blob;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value);
+    FLASH_ASSERT(env_data);
+
+    FLASH_ENV_READ_LOCK();
+    key_len = strlen(key);
+    env = find_env(key, key_len);
+    if (!env) {
+        result = FLASH_ENV_NAME_ERR;
+    } else {
+        env_value = get_env_value(env, key_len, &value_len, &is_blob);
+        if (!is_blob || get_env_blob_type(env_value) != type || value_len != size) {
+            result = FLASH_ENV_TYPE_ERR;
+        } else {
+            memcpy(value, env_value, size);
+        }
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV_TYPED);
+    return result;
+}
+
+#endif
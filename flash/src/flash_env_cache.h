@@ -0,0 +1,81 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: The environment variables RAM cache and its index, it's shared by the normal mode,
+ *           wear leveling mode and log mode.
+ * Created on: 2026-10-16
+ */
+
+#ifndef FLASH_ENV_CACHE_H_
+#define FLASH_ENV_CACHE_H_
+
+#include "flash.h"
+
+/* blob value header word, the high 8 bits is blob flag, the next 4 bits is blob type
+ * (@see flash_env_type) and the low 20 bits is blob length */
+#define ENV_BLOB_FLAG                  0xB1000000
+#define ENV_BLOB_FLAG_MASK             0xFF000000
+#define ENV_BLOB_TYPE_MASK             0x00F00000
+#define ENV_BLOB_TYPE_SHIFT            20
+#define ENV_BLOB_LEN_MASK              0x000FFFFF
+
+#if defined(FLASH_ENV_USING_NORMAL_MODE) || defined(FLASH_ENV_USING_WEAR_LEVELING_MODE) \
+        || (defined(FLASH_ENV_USING_LOG_MODE) && !defined(FLASH_ENV_USING_PAGED_CACHE))
+
+/* the first character of environment variable which is marked as deleted in batch */
+#define ENV_DELETED_MARK               '='
+#if defined(FLASH_ENV_USING_CRC_CHECK) && !defined(FLASH_ENV_USING_LOG_MODE)
+/* every environment variable has a CRC32 word behind its value, the log mode checks the records */
+#define ENV_USING_CRC_WORD
+/* the CRC32 word bytes size behind every environment variable value */
+#define ENV_CRC_BYTE_SIZE              4
+#else
+#define ENV_CRC_BYTE_SIZE              0
+#endif
+
+/* the operations of environment variables data in RAM cache, they are implemented by the mode */
+typedef struct _env_data_ops {
+    /* get the bytes size of environment variables data */
+    size_t (*get_size)(void);
+    /* set an environment variable which value is not empty without lock */
+    FlashErrCode (*set)(const char *key, size_t key_len, const void *value, size_t value_len,
+            bool_t is_blob, uint8_t blob_type);
+    /* set environment variables by batch without lock, @see flash_set_env_batch */
+    FlashErrCode (*set_batch)(const flash_env *env_set, size_t env_set_size, bool_t save);
+} env_data_ops;
+
+/* flash_env_cache.c */
+void env_cache_init(char *data, const env_data_ops *ops);
+size_t calc_env_len(size_t key_len, size_t value_len, bool_t is_blob);
+void make_env(char *env, size_t env_len, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type);
+char *get_env_value(const char *env, size_t key_len, size_t *value_len, bool_t *is_blob);
+uint8_t get_env_blob_type(const char *value);
+size_t get_env_len(const char *env);
+size_t get_env_body_len(const char *env);
+char *find_env(const char *key, size_t key_len);
+void env_index_build(void);
+bool_t env_index_add(const char *env);
+void env_index_del(const char *env, size_t env_len);
+void env_index_move(const char *env_pos, long size);
+/* the mode source file */
+FlashErrCode flash_del_env(const char *key);
+
+#endif
+
+#endif /* FLASH_ENV_CACHE_H_ */
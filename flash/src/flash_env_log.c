@@ -0,0 +1,944 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Environment variables operating interface. (log mode)
+ * Created on: 2026-10-15
+ */
+
+#include "flash_env_log_fmt.h"
+#include "flash_env_cache.h"
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(FLASH_ENV_USING_LOG_MODE) && !defined(FLASH_ENV_USING_PAGED_CACHE)
+
+/**
+ * The storage format in flash is log. @see flash_env_log_fmt.c
+ * All environment variables are cached in RAM, storage model is key=value\0. It's same as the
+ * records payload in flash, so the records are made from and replayed to the RAM cache directly.
+ *
+ * @note Word = 4 Bytes in this file
+ */
+
+/* default environment variables set, must be initialized by user */
+static flash_env const *default_env_set = NULL;
+/* default environment variables set size, must be initialized by user */
+static size_t default_env_set_size = 0;
+/* flash environment variables all section total size */
+static size_t env_total_size = 0;
+/* environment variables RAM cache, storage model is key=value\0 */
+static uint32_t *env_cache = NULL;
+/* environment variables data bytes size in RAM cache */
+static size_t env_data_size = 0;
+/* environment variables number in RAM cache */
+static size_t env_count = 0;
+/* environment variables start address in flash */
+static uint32_t env_start_addr = 0;
+/* the names of environment variables which changed after last saved */
+static char env_log_journal[FLASH_ENV_LOG_JOURNAL_SIZE];
+/* journal used bytes size */
+static size_t env_log_journal_len = 0;
+/* journal has no space, the next saving must compact */
+static bool_t env_log_journal_is_full = FALSE;
+/* environment variables RAM cache generation, it will increase when the cache has changed */
+static uint32_t env_cache_gen = 0;
+/* the environment variables RAM cache generation which has been saved to flash */
+static uint32_t env_saved_gen = 0;
+/* environment variables are being set by batch, the deleted ones will be removed by one pass */
+static bool_t env_is_batching = FALSE;
+/* the bytes size of environment variables which are marked as deleted in batch */
+static size_t env_marked_size = 0;
+
+static FlashErrCode write_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
+static void del_env(char *env);
+static void del_marked_env(void);
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save);
+static FlashErrCode env_set_default(void);
+static size_t get_env_data_size(void);
+static void load_env(void);
+static FlashErrCode save_env(void);
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
+static bool_t env_is_fit(const char *change_env, size_t change_len, size_t env_len);
+static bool_t env_fit_len_iter(size_t *pos, size_t *len, void *arg);
+static void env_log_journal_add(const char *key, size_t key_len);
+static const uint32_t *env_log_read(uint32_t offset, size_t size);
+static FlashErrCode env_log_write(uint32_t offset, const uint32_t *buf, size_t size);
+static void env_log_replay(uint32_t offset, const uint32_t *rec);
+static FlashErrCode env_log_snapshot(void);
+static FlashErrCode env_log_changes(void);
+static bool_t env_log_changes_len(size_t *pos, size_t *len, void *arg);
+
+/* the operations of RAM cache for the log storage */
+static const env_log_ops env_cache_ops = {
+    env_log_read,
+    env_log_write,
+    NULL,
+    env_log_replay,
+    env_log_snapshot,
+    env_log_changes,
+    env_log_changes_len,
+};
+
+/* the operations of environment variables data in RAM cache, @see flash_env_cache.c */
+static const env_data_ops env_cache_data_ops = {
+    get_env_data_size,
+    set_env,
+    set_env_batch,
+};
+
+/* the changed environment variable for checking the capacity, @see env_fit_len_iter */
+typedef struct _env_fit_change {
+    /* the environment variable which storage length will be changed, NULL is none */
+    const char *env;
+    /* the new storage length of env, 0 is deleted */
+    size_t len;
+    /* the new environment variable storage length, 0 is none */
+    size_t env_len;
+} env_fit_change;
+
+/**
+ * Flash environment variables initialize.
+ *
+ * @param start_addr environment variables start address in flash
+ * @param total_size environment variables section total size (@note must be word alignment)
+ * @param erase_min_size the minimum size of flash erasure
+ * @param default_env default environment variables set for user
+ * @param default_env_size default environment variables set size
+ *
+ * @return result
+ */
+FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase_min_size,
+        flash_env const *default_env, size_t default_env_size) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(start_addr);
+    FLASH_ASSERT(total_size);
+    FLASH_ASSERT(erase_min_size);
+    FLASH_ASSERT(default_env);
+    FLASH_ASSERT(default_env_size < total_size);
+    /* must be word alignment for environment variables */
+    FLASH_ASSERT(total_size % 4 == 0);
+    /* hash index storage word offset by 16 bits */
+    FLASH_ASSERT(total_size / 4 < 0xFFFF);
+    /* make true only be initialized once */
+    FLASH_ASSERT(!env_cache);
+
+    env_start_addr = start_addr;
+    env_total_size = total_size;
+    default_env_set = default_env;
+    default_env_set_size = default_env_size;
+
+    FLASH_DEBUG("Env start address is 0x%08X, size is %d bytes.\n", start_addr, total_size);
+
+    /* create environment variables ram cache, the space after environment variables is used to
+     * read records when loading */
+    env_cache = (uint32_t *) flash_malloc(sizeof(uint8_t) * total_size);
+    FLASH_ASSERT(env_cache);
+    env_cache_init((char *) env_cache, &env_cache_data_ops);
+    env_log_init(start_addr, total_size, erase_min_size, &env_cache_ops);
+
+    flash_load_env();
+
+    return result;
+}
+
+/**
+ * Environment variables set default without lock.
+ * @see flash_env_set_default
+ *
+ * @return result
+ */
+static FlashErrCode env_set_default(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(env_cache);
+    FLASH_ASSERT(default_env_set);
+    FLASH_ASSERT(default_env_set_size);
+
+    /* clean all environment variables and the hash index */
+    env_data_size = 0;
+    env_count = 0;
+    env_index_build();
+
+    /* all old records are useless, so compact it */
+    env_log_journal_len = 0;
+    env_log_journal_is_full = FALSE;
+    env_log_request_compact();
+
+    /* create default environment variables and save them */
+    result = set_env_batch(default_env_set, default_env_set_size, TRUE);
+
+    return result;
+}
+
+/**
+ * Environment variables set default.
+ *
+ * @return result
+ */
+FlashErrCode flash_env_set_default(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    result = env_set_default();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    return result;
+}
+
+/**
+ * Get current environment variables section total size.
+ *
+ * @return size
+ */
+uint32_t flash_get_env_total_size(void) {
+    /* must be initialized */
+    FLASH_ASSERT(env_total_size);
+
+    return env_total_size;
+}
+
+/**
+ * Get current environment variables used byte size.
+ * It's the bytes size of all environment variables records in a snapshot.
+ *
+ * @return size
+ */
+uint32_t flash_get_env_used_size(void) {
+    return env_data_size + env_count * ENV_LOG_REC_BYTE_SIZE;
+}
+
+/**
+ * Get environment variables data bytes size in RAM cache.
+ *
+ * @return size
+ */
+static size_t get_env_data_size(void) {
+    return env_data_size;
+}
+
+/**
+ * Get environment variables RAM cache generation. It will increase when the cache has changed.
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_gen(void) {
+    return env_cache_gen;
+}
+
+/**
+ * Get the environment variables RAM cache generation which has been saved to flash.
+ * If it's not equal to flash_get_env_gen(), the cache has changed after last saved. So the saving
+ * has written flash when this generation changed after called flash_save_env().
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_saved_gen(void) {
+    return env_saved_gen;
+}
+
+/**
+ * Write an environment variable at the end of cache.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ *
+ * @return result
+ */
+static FlashErrCode write_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t env_len = calc_env_len(key_len, value_len, is_blob);
+    char *env = (char *) env_cache + env_data_size;
+
+    /* check capacity of environment variables  */
+    if (!env_is_fit(NULL, 0, env_len)) {
+        return FLASH_ENV_FULL;
+    }
+    /* remove the environment variables which are deleted in batch for more ram cache space */
+    if (env_marked_size && env_data_size + env_len > env_total_size) {
+        del_marked_env();
+        env = (char *) env_cache + env_data_size;
+    }
+    /* it will be made in ram cache directly */
+    make_env(env, env_len, key, key_len, value, value_len, is_blob, blob_type);
+    /* add it to hash index, there is no memory for the index when it can't grow */
+    if (!env_index_add(env)) {
+        return FLASH_ENV_FULL;
+    }
+    env_data_size += env_len;
+    env_count++;
+    env_cache_gen++;
+
+    return result;
+}
+
+/**
+ * Delete an environment variable from ram cache.
+ *
+ * @param env environment variable in ram cache
+ */
+static void del_env(char *env) {
+    size_t env_len = get_env_len(env);
+
+    /* it will be removed after all environment variables in batch are set */
+    if (env_is_batching) {
+        /* remove it from index before marked, the marked name can't be compared */
+        env_index_del(env, 0);
+        env_marked_size += env_len;
+        *env = ENV_DELETED_MARK;
+        env_count--;
+        env_cache_gen++;
+        return;
+    }
+
+    /* remove it from hash index */
+    env_index_del(env, env_len);
+    /* remain environment variables move forward */
+    memmove(env, env + env_len, (char *) env_cache + env_data_size - (env + env_len));
+    env_data_size -= env_len;
+    env_count--;
+    env_cache_gen++;
+}
+
+/**
+ * Remove all environment variables which are marked as deleted in batch by one pass.
+ */
+static void del_marked_env(void) {
+    char *env = (char *) env_cache, *env_end = (char *) env_cache + env_data_size, *dst = env;
+    size_t env_len;
+
+    for (; env < env_end; env += env_len) {
+        env_len = get_env_len(env);
+        if (*env != ENV_DELETED_MARK) {
+            memmove(dst, env, env_len);
+            dst += env_len;
+        }
+    }
+    env_data_size = dst - (char *) env_cache;
+    env_marked_size = 0;
+    env_index_build();
+}
+
+/**
+ * Delete an environment variable in cache.
+ *
+ * @param key environment variable name
+ *
+ * @return result
+ */
+FlashErrCode flash_del_env(const char *key){
+    FlashErrCode result = FLASH_NO_ERR;
+    char *del_env_str = NULL;
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(env_cache);
+
+    if (*key == '\0') {
+        FLASH_INFO("Flash environment variables name must be not NULL!\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    if (strstr(key, "=")) {
+        FLASH_INFO("Flash environment variables name or value can't contain '='.\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    /* find environment variables */
+    del_env_str = find_env(key, strlen(key));
+    if (!del_env_str) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        return FLASH_ENV_NAME_ERR;
+    }
+    del_env(del_env_str);
+    env_log_journal_add(key, strlen(key));
+
+    return result;
+}
+
+/**
+ * Set an environment variable which value is not empty. If not find it, then create it.
+ * When the new value fits in the old storage, it will be overwrote in place. Otherwise the old one
+ * will be deleted and the new one will be written at the end of cache.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ *
+ * @return result
+ */
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *old_env, *old_value;
+    size_t env_len, old_env_len, old_value_len;
+    bool_t old_is_blob;
+
+    if (key_len == 0 || memchr(key, '\0', key_len)) {
+        FLASH_INFO("Flash environment variables name must be not empty!\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    if (memchr(key, '=', key_len)) {
+        FLASH_INFO("Flash environment variables name can't contain '='.\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    if (key_len > 0xFF) {
+        FLASH_INFO("Flash environment variables name is too long.\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    /* if not find this variables, then create it */
+    old_env = find_env(key, key_len);
+    if (!old_env) {
+        result = write_env(key, key_len, value, value_len, is_blob, blob_type);
+        if (result == FLASH_NO_ERR) {
+            env_log_journal_add(key, key_len);
+        }
+        return result;
+    }
+
+    /* the value has no change, so the cache will not change */
+    old_value = get_env_value(old_env, key_len, &old_value_len, &old_is_blob);
+    if (old_is_blob == is_blob && old_value_len == value_len
+            && (!is_blob || get_env_blob_type(old_value) == blob_type)
+            && !memcmp(old_value, value, value_len)) {
+        return result;
+    }
+
+    env_len = calc_env_len(key_len, value_len, is_blob);
+    old_env_len = get_env_len(old_env);
+    if (env_len <= old_env_len) {
+        /* the new value fits in the old storage, overwrite it and fill '\0' to remaining part */
+        make_env(old_env, old_env_len, key, key_len, value, value_len, is_blob, blob_type);
+        env_cache_gen++;
+    } else {
+        /* check capacity before delete the old one, make sure the old value is kept when full */
+        if (!env_is_fit(old_env, 0, env_len)) {
+            return FLASH_ENV_FULL;
+        }
+        /* delete it and write the new one at the end of cache */
+        del_env(old_env);
+        result = write_env(key, key_len, value, value_len, is_blob, blob_type);
+    }
+    env_log_journal_add(key, key_len);
+
+    return result;
+}
+
+/**
+ * Set environment variables by batch without lock.
+ * @see flash_set_env_batch
+ *
+ * @param env_set environment variables set
+ * @param env_set_size environment variables set size
+ * @param save save environment variables to flash after set
+ *
+ * @return result
+ */
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t i, key_len;
+    char *env;
+
+    FLASH_ASSERT(env_set || !env_set_size);
+    FLASH_ASSERT(env_cache);
+
+    env_is_batching = TRUE;
+    for (i = 0; i < env_set_size && result == FLASH_NO_ERR; i++) {
+        FLASH_ASSERT(env_set[i].key);
+        FLASH_ASSERT(env_set[i].value);
+
+        key_len = strlen(env_set[i].key);
+        if (*env_set[i].value != '\0') {
+            result = set_env(env_set[i].key, key_len, env_set[i].value, strlen(env_set[i].value),
+                    FALSE, 0);
+        } else if (memchr(env_set[i].key, '=', key_len)) {
+            FLASH_INFO("Flash environment variables name can't contain '='.\n");
+            result = FLASH_ENV_NAME_ERR;
+        } else if ((env = find_env(env_set[i].key, key_len)) != NULL) {
+            /* if ENV value is empty, delete it */
+            del_env(env);
+            env_log_journal_add(env_set[i].key, key_len);
+        }
+    }
+    env_is_batching = FALSE;
+    /* remove all deleted environment variables */
+    if (env_marked_size) {
+        del_marked_env();
+    }
+
+    if (result == FLASH_NO_ERR && save) {
+        result = save_env();
+    }
+
+    return result;
+}
+
+/**
+ * Reserve the storage space of an environment variable value in ram cache.
+ * After reserved, the environment variable which value length is not more than the reserved size
+ * will be overwrote in its storage, the other environment variables will not be moved.
+ * @note The environment variable must be exist. The reserved space will be saved to flash.
+ *
+ * @param key environment variable name
+ * @param value_max_len the maximum length of environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_reserve_env(const char *key, size_t value_max_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *env, *next_env;
+    size_t key_len, value_len, env_len, need_len;
+    bool_t is_blob;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(env_cache);
+
+    FLASH_ENV_WRITE_LOCK();
+    /* find environment variables */
+    key_len = strlen(key);
+    env = find_env(key, key_len);
+    if (!env) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    env_len = get_env_len(env);
+    get_env_value(env, key_len, &value_len, &is_blob);
+    need_len = calc_env_len(key_len, value_max_len, is_blob);
+    /* the storage space is already enough */
+    if (need_len <= env_len) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return result;
+    }
+    /* check capacity of environment variables  */
+    if (!env_is_fit(env, need_len, 0)) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_FULL;
+    }
+    /* the environment variables behind it move backward, then fill '\0' to the reserved space */
+    next_env = env + env_len;
+    memmove(next_env + need_len - env_len, next_env, (char *) env_cache + env_data_size - next_env);
+    memset(next_env, 0, need_len - env_len);
+    env_index_move(next_env, need_len - env_len);
+    env_data_size += need_len - env_len;
+    env_cache_gen++;
+    env_log_journal_add(key, key_len);
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+    return result;
+}
+
+/**
+ * Print environment variables.
+ */
+void flash_print_env(void) {
+    char *env = (char *) env_cache, *env_end, *value;
+    size_t value_len, i;
+    bool_t is_blob;
+
+    FLASH_ASSERT(env_cache);
+
+    FLASH_ENV_READ_LOCK();
+    env_end = (char *) env_cache + env_data_size;
+    for (; env < env_end; env += get_env_len(env)) {
+        if (*env == '\0') {
+            continue;
+        }
+        /* the blob value will be printed by hex */
+        flash_print("%s", env);
+        value = get_env_value(env, strchr(env, '=') - env, &value_len, &is_blob);
+        for (i = 0; is_blob && i < value_len; i++) {
+            flash_print("%02X", (uint8_t) value[i]);
+        }
+        flash_print("\n");
+    }
+    flash_print("\nEnvironment variables size: %ld/%ld bytes, mode: log.\n",
+            flash_get_env_used_size(), flash_get_env_total_size());
+    FLASH_ENV_READ_UNLOCK();
+}
+
+/**
+ * Load flash environment variables to ram without lock.
+ * @see flash_load_env
+ */
+static void load_env(void) {
+    FLASH_ASSERT(env_cache);
+
+    env_data_size = 0;
+    env_count = 0;
+    env_index_build();
+    env_log_journal_len = 0;
+    env_log_journal_is_full = FALSE;
+
+    if (!env_log_load()) {
+        env_set_default();
+        return;
+    }
+    /* the environment variables in ram cache is same as flash */
+    env_saved_gen = env_cache_gen;
+}
+
+/**
+ * Load flash environment variables to ram.
+ */
+void flash_load_env(void) {
+    FLASH_STATS_START();
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    load_env();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_LOAD_ENV);
+}
+
+/**
+ * Save environment variables to flash without lock.
+ * @see flash_save_env
+ *
+ * @return result
+ */
+static FlashErrCode save_env(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(env_cache);
+
+    /* the environment variables has no change after last saved */
+    if (env_cache_gen == env_saved_gen) {
+        FLASH_DEBUG("Environment variables has no change, skip saving.\n");
+        return result;
+    }
+
+    if (env_log_journal_is_full) {
+        env_log_request_compact();
+    }
+    result = env_log_save();
+
+    switch (result) {
+    case FLASH_NO_ERR: {
+        env_log_journal_len = 0;
+        env_log_journal_is_full = FALSE;
+        env_saved_gen = env_cache_gen;
+        FLASH_INFO("Saved environment variables OK.\n");
+        break;
+    }
+    default: {
+        FLASH_INFO("Warning: Saved environment variables fault!\n");
+        break;
+    }
+    }
+
+    return result;
+}
+
+/**
+ * Save environment variables to flash.
+ */
+FlashErrCode flash_save_env(void) {
+    return flash_save_env_gen(NULL, NULL);
+}
+
+/**
+ * Save environment variables to flash and get the generation which has been saved.
+ * @note The log mode only appends the changed environment variables in saving, so it doesn't use
+ *       the snapshot and the saving is always in the write lock. @see flash_save_env
+ *
+ * @param saved_gen the generation which has been saved to flash, it can be NULL
+ * @param written it's TRUE when this saving has written flash, FALSE when there is no change or
+ *        the saving is failed or deferred, it can be NULL
+ *
+ * @return result
+ */
+FlashErrCode flash_save_env_gen(uint32_t *saved_gen, bool_t *written) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t last_saved_gen;
+    bool_t is_written = FALSE;
+    FLASH_STATS_START();
+
+    FLASH_ENV_WRITE_LOCK();
+    last_saved_gen = env_saved_gen;
+    result = save_env();
+    if (saved_gen) {
+        *saved_gen = env_saved_gen;
+    }
+    /* the saved generation is only changed by writing flash */
+    is_written = (env_saved_gen != last_saved_gen);
+    FLASH_ENV_WRITE_UNLOCK();
+    if (written) {
+        *written = is_written;
+    }
+
+    FLASH_STATS_END(FLASH_STATS_API_SAVE_ENV);
+    return result;
+}
+
+/**
+ * Check all environment variables can be compacted into reserved sectors after they are changed.
+ * @see env_log_is_fit
+ *
+ * @param change_env the environment variable which storage length will be changed, NULL is none
+ * @param change_len the new storage length of change_env, 0 is deleted
+ * @param env_len the new environment variable storage length, 0 is none
+ *
+ * @return true is fit
+ */
+static bool_t env_is_fit(const char *change_env, size_t change_len, size_t env_len) {
+    size_t data_size = env_data_size - env_marked_size, rec_num = env_count;
+    env_fit_change change = { change_env, change_len, env_len };
+
+    if (change_env) {
+        data_size = data_size - get_env_len(change_env) + change_len;
+        if (change_len == 0) {
+            rec_num--;
+        }
+    }
+    if (env_len) {
+        data_size += env_len;
+        rec_num++;
+    }
+
+    return env_log_is_fit(data_size, rec_num, change_len > env_len ? change_len : env_len,
+            env_fit_len_iter, &change);
+}
+
+/**
+ * Iterate the storage length of all environment variables after they are changed.
+ * @see env_log_len_iter
+ *
+ * @param pos bytes offset in ram cache, the new environment variable is after all of them
+ * @param len environment variable storage length, 0 is deleted
+ * @param arg the changed environment variable, @see env_fit_change
+ *
+ * @return false is no more environment variable
+ */
+static bool_t env_fit_len_iter(size_t *pos, size_t *len, void *arg) {
+    env_fit_change *change = (env_fit_change *) arg;
+    char *env = (char *) env_cache + *pos;
+
+    if (*pos > env_data_size) {
+        return FALSE;
+    } else if (*pos == env_data_size) {
+        *len = change->env_len;
+        *pos += 4;
+        return TRUE;
+    }
+    *len = get_env_len(env);
+    *pos += *len;
+    if (env == change->env) {
+        *len = change->len;
+    } else if (*env == ENV_DELETED_MARK) {
+        /* this environment variable will be deleted */
+        *len = 0;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Add a changed environment variable name to journal.
+ * When the journal has no space, the next saving will compact all environment variables.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ */
+static void env_log_journal_add(const char *key, size_t key_len) {
+    char *name;
+
+    if (env_log_journal_is_full) {
+        return;
+    }
+    for (name = env_log_journal; name < env_log_journal + env_log_journal_len;
+            name += strlen(name) + 1) {
+        if (!strncmp(name, key, key_len) && name[key_len] == '\0') {
+            return;
+        }
+    }
+    if (env_log_journal_len + key_len + 1 > FLASH_ENV_LOG_JOURNAL_SIZE) {
+        FLASH_DEBUG("Environment variables journal is full, the next saving will compact.\n");
+        env_log_journal_is_full = TRUE;
+        return;
+    }
+    memcpy(env_log_journal + env_log_journal_len, key, key_len);
+    env_log_journal[env_log_journal_len + key_len] = '\0';
+    env_log_journal_len += key_len + 1;
+}
+
+/**
+ * Read flash data to the space after environment variables in ram cache. @see env_log_ops
+ *
+ * @param offset bytes offset in environment variables area
+ * @param size read bytes size
+ *
+ * @return the data in ram cache, NULL when ram cache has no space
+ */
+static const uint32_t *env_log_read(uint32_t offset, size_t size) {
+    uint32_t *buf = env_cache + env_data_size / 4;
+
+    if (size > env_total_size - env_data_size) {
+        return NULL;
+    }
+    FLASH_READ(env_start_addr + offset, buf, size);
+
+    return buf;
+}
+
+/**
+ * Write data to flash. @see env_log_ops
+ *
+ * @param offset bytes offset in environment variables area
+ * @param buf the write data buffer
+ * @param size write bytes size
+ *
+ * @return result
+ */
+static FlashErrCode env_log_write(uint32_t offset, const uint32_t *buf, size_t size) {
+    return FLASH_WRITE(env_start_addr + offset, buf, size);
+}
+
+/**
+ * Replay the record which has been read after environment variables in ram cache.
+ * @see env_log_ops
+ *
+ * @param offset record bytes offset in environment variables area
+ * @param rec the record in ram cache
+ */
+static void env_log_replay(uint32_t offset, const uint32_t *rec) {
+    uint32_t info = rec[ENV_LOG_REC_INDEX_INFO];
+    const char *payload = (const char *) (rec + ENV_LOG_REC_WORD_SIZE);
+    size_t key_len = (info >> 16) & 0xFF, payload_len = (info & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE;
+    char *env;
+    bool_t is_added;
+
+    env = find_env(payload, key_len);
+    if (env) {
+        del_env(env);
+    }
+    if ((info >> 24) == ENV_LOG_REC_SET) {
+        /* the record is after environment variables, so its payload is moved to the end of them */
+        env = (char *) env_cache + env_data_size;
+        memmove(env, payload, payload_len);
+        is_added = env_index_add(env);
+        /* the saved environment variable can't be dropped, it's same as creating the RAM cache */
+        FLASH_ASSERT(is_added);
+        env_data_size += payload_len;
+        env_count++;
+    }
+}
+
+/**
+ * Append all environment variables to the new snapshot. @see env_log_ops
+ *
+ * @return result
+ */
+static FlashErrCode env_log_snapshot(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *env, *env_end = (char *) env_cache + env_data_size;
+    size_t env_len;
+
+    for (env = (char *) env_cache; result == FLASH_NO_ERR && env < env_end; env += env_len) {
+        env_len = get_env_len(env);
+        result = env_log_append(ENV_LOG_REC_SET, (uint32_t *) env, env_len, strchr(env, '=') - env,
+                NULL);
+    }
+
+    return result;
+}
+
+/**
+ * Append a record for every changed environment variable in journal. @see env_log_ops
+ *
+ * @return result
+ */
+static FlashErrCode env_log_changes(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *name, *env, *del_env_str;
+    size_t name_len;
+
+    for (name = env_log_journal; result == FLASH_NO_ERR
+            && name < env_log_journal + env_log_journal_len; name += name_len + 1) {
+        name_len = strlen(name);
+        env = find_env(name, name_len);
+        if (env) {
+            result = env_log_append(ENV_LOG_REC_SET, (uint32_t *) env, get_env_len(env), name_len,
+                    NULL);
+        } else {
+            /* use the space after environment variables to make delete record key=\0 */
+            del_env_str = (char *) env_cache + env_data_size;
+            memset(del_env_str, 0, name_len + 5);
+            memcpy(del_env_str, name, name_len);
+            del_env_str[name_len] = '=';
+            result = env_log_append(ENV_LOG_REC_DEL, (uint32_t *) del_env_str,
+                    get_env_len(del_env_str), name_len, NULL);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Iterate the records payload length of all changed environment variables in journal.
+ * @see env_log_len_iter
+ *
+ * @param pos bytes offset in journal
+ * @param len record payload length
+ * @param arg not used
+ *
+ * @return false is no more changed environment variable
+ */
+static bool_t env_log_changes_len(size_t *pos, size_t *len, void *arg) {
+    char *name = env_log_journal + *pos, *env;
+    size_t name_len;
+
+    if (*pos >= env_log_journal_len) {
+        return FALSE;
+    }
+    name_len = strlen(name);
+    env = find_env(name, name_len);
+    if (env) {
+        *len = get_env_len(env);
+    } else {
+        /* storage model is key=\0 */
+        *len = (name_len + 2 + 3) / 4 * 4;
+    }
+    *pos += name_len + 1;
+
+    return TRUE;
+}
+
+#endif
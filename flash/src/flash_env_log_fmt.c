@@ -0,0 +1,749 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: The storage format of log mode, it's shared by the RAM cache and the paged cache.
+ * Created on: 2026-10-16
+ */
+
+#include "flash_env_log_fmt.h"
+
+#ifdef FLASH_ENV_USING_LOG_MODE
+
+/**
+ * Environment variables area is divided into sectors by FLASH_ERASE_MIN_SIZE.
+ * All sectors are used as a ring. The sectors which storage environment variables are continuous
+ * in the ring, from the oldest (tail) to the newest (head). The others are free and already erased.
+ *
+ * 1. Sector header
+ *    It storage the sector magic, sequence number, flag, erase counter and erase budget.
+ *    (Units: Word)
+ *    When the sector flag is ENV_LOG_SECTOR_SNAPSHOT, the sector is the first sector of a
+ *    snapshot which storage all environment variables.
+ *    The erase counter is written after the sector erased, so the free sector also has it. So is
+ *    the erase budget when FLASH_ENV_USING_ERASE_BUDGET is enabled, otherwise it keeps erased.
+ * 2. Records
+ *    Every set or delete of environment variable will be appended as a record when saved.
+ *    Record storage format is record header + key=value\0. (delete record's value is empty)
+ *    The blob value storage format is key=\0 + blob header word + blob data.
+ *    All records must be 4 bytes alignment. The remaining part must fill '\0'.
+ *    The record can not cross the sector.
+ * 3. Commit
+ *    Every saving and snapshot ends with a commit record. When loading, the records after the last
+ *    commit are not replayed, so the saving is atomic after power down. The uncompleted saving
+ *    will be dropped by compacting in next saving.
+ *
+ * When there is no enough free sector to append records, the garbage collection will compact all
+ * environment variables into free sectors as a new snapshot, then erase all old sectors.
+ * Half of sectors are reserved for the snapshot, so the snapshot always has enough space.
+ *
+ * @note Word = 4 Bytes in this file
+ */
+
+/* flash ENV sector header index and size */
+enum {
+    /* sector magic index */
+    ENV_LOG_SECTOR_INDEX_MAGIC = 0,
+    /* sector sequence number index */
+    ENV_LOG_SECTOR_INDEX_SEQ,
+    /* sector flag index */
+    ENV_LOG_SECTOR_INDEX_FLAG,
+    /* sector erase counter index, it's written after erased */
+    ENV_LOG_SECTOR_INDEX_ERASE_CNT,
+    /* sector erase budget index, it's written after erased */
+    ENV_LOG_SECTOR_INDEX_ERASE_BUDGET,
+
+    /* sector header word size */
+    ENV_LOG_SECTOR_WORD_SIZE,
+    /* sector header byte size */
+    ENV_LOG_SECTOR_BYTE_SIZE = ENV_LOG_SECTOR_WORD_SIZE * 4,
+};
+
+/* sector magic word */
+#define ENV_LOG_SECTOR_MAGIC           0x45464C32
+/* the first sector of a snapshot */
+#define ENV_LOG_SECTOR_SNAPSHOT        0x534E4150
+/* the sector only storage appended records */
+#define ENV_LOG_SECTOR_NORMAL          0xFFFFFFFF
+/* the number of largest records which are found for checking the capacity */
+#define ENV_LOG_FIT_TOP_NUM            8
+
+/* environment variables start address in flash */
+static uint32_t env_start_addr = 0;
+/* sector size, it's the minimum size of flash erasure */
+static size_t env_sector_size = 0;
+/* sector total number */
+static size_t env_sector_num = 0;
+/* all sectors erase counters */
+static uint32_t *env_erase_cnt = NULL;
+/* the oldest and newest using sector index */
+static size_t env_log_tail = 0, env_log_head = 0;
+/* using sector number */
+static size_t env_log_used_num = 0;
+/* the next record write offset in newest sector */
+static size_t env_log_head_offset = 0;
+/* the next sequence number */
+static uint32_t env_log_seq = 0;
+/* the compacting is requested or failed, the next saving must compact */
+static bool_t env_log_need_compact = FALSE;
+/* the operations of environment variables cache */
+static const env_log_ops *env_ops = NULL;
+
+static uint32_t get_sector_addr(size_t sector);
+static size_t get_env_reserve_sector_num(void);
+static void env_log_fit_top_add(size_t *top_len, size_t rec_len);
+static bool_t env_log_has_space(void);
+static FlashErrCode env_log_new_sector(uint32_t flag);
+static FlashErrCode env_log_compact(void);
+static uint8_t env_log_read_rec(size_t sector, size_t offset, const uint32_t **rec);
+static size_t env_log_find_commit(size_t sector);
+static void env_log_format(void);
+static void env_log_erase_dirty_sector(void);
+static FlashErrCode env_log_erase_sector(size_t sector);
+
+/**
+ * Initialize the log storage of environment variables area.
+ *
+ * @param start_addr environment variables start address in flash
+ * @param total_size environment variables section total size
+ * @param erase_min_size the minimum size of flash erasure
+ * @param ops the operations of environment variables cache
+ */
+void env_log_init(uint32_t start_addr, size_t total_size, size_t erase_min_size,
+        const env_log_ops *ops) {
+    FLASH_ASSERT(ops);
+    /* must be sector alignment and has 2 sectors at least */
+    FLASH_ASSERT(total_size % erase_min_size == 0);
+    FLASH_ASSERT(total_size / erase_min_size >= 2);
+    /* record length storage by 16 bits */
+    FLASH_ASSERT(erase_min_size <= 0xFFFF);
+    /* make true only be initialized once */
+    FLASH_ASSERT(!env_erase_cnt);
+
+    env_start_addr = start_addr;
+    env_sector_size = erase_min_size;
+    env_sector_num = total_size / erase_min_size;
+    env_ops = ops;
+
+    /* create all sectors erase counters ram cache */
+    env_erase_cnt = (uint32_t *) flash_malloc(sizeof(uint32_t) * env_sector_num);
+    FLASH_ASSERT(env_erase_cnt);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    flash_erase_budget_init(env_sector_num);
+#endif
+}
+
+/**
+ * Get sector start address in flash.
+ *
+ * @param sector sector index
+ *
+ * @return sector start address
+ */
+static uint32_t get_sector_addr(size_t sector) {
+    FLASH_ASSERT(env_start_addr);
+    return env_start_addr + sector * env_sector_size;
+}
+
+/**
+ * Get the sector number which reserved for compacting snapshot.
+ *
+ * @return sector number
+ */
+static size_t get_env_reserve_sector_num(void) {
+    return env_sector_num / 2;
+}
+
+/**
+ * Get the using sector by order, from the oldest to the newest.
+ *
+ * @param i the order of using sector
+ *
+ * @return sector index, the sectors number when it's not using
+ */
+size_t env_log_used_sector(size_t i) {
+    if (i >= env_log_used_num) {
+        return env_sector_num;
+    }
+    return (env_log_tail + i) % env_sector_num;
+}
+
+/**
+ * Get the erase counters of all erase units in environment variables area. The counters are
+ * saved in sector header, so they are kept after power down.
+ *
+ * @param erase_cnt erase counters buffer, the first one is the erase unit at start address
+ * @param num erase counters buffer number
+ *
+ * @return erase units number of environment variables area
+ */
+size_t flash_get_env_erase_cnt(uint32_t *erase_cnt, size_t num) {
+    size_t i;
+
+    FLASH_ASSERT(env_erase_cnt);
+
+    FLASH_ENV_READ_LOCK();
+    for (i = 0; i < num && i < env_sector_num; i++) {
+        erase_cnt[i] = env_erase_cnt[i];
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    return env_sector_num;
+}
+
+/**
+ * The next saving will compact all environment variables, all old records will be useless.
+ */
+void env_log_request_compact(void) {
+    env_log_need_compact = TRUE;
+}
+
+/**
+ * Check all environment variables can be compacted into reserved sectors after they are changed.
+ * The records order is not cared, so it's same for every cache.
+ * When a record can't be appended, the sector is closed, so every closed sector and the record
+ * after it are more than a sector. So the snapshot fits when all records and the largest
+ * (reserved sectors number) records are not more than the reserved space.
+ *
+ * @param data_size all records payload size after changed
+ * @param rec_num all records number after changed
+ * @param max_len the changed record payload length, it's also checked with a sector
+ * @param iter iterate all records payload length after changed, it's only used when the space is
+ *        nearly full
+ * @param arg iterator argument
+ *
+ * @return true is fit
+ */
+bool_t env_log_is_fit(size_t data_size, size_t rec_num, size_t max_len, env_log_len_iter iter,
+        void *arg) {
+    size_t rec_space = env_sector_size - ENV_LOG_SECTOR_BYTE_SIZE, reserve_space, total_len,
+            pos = 0, len, i;
+    size_t top_len[ENV_LOG_FIT_TOP_NUM] = { 0 };
+
+    /* all records and the commit record in snapshot */
+    total_len = data_size + (rec_num + 1) * ENV_LOG_REC_BYTE_SIZE;
+    reserve_space = get_env_reserve_sector_num() * rec_space;
+    if (max_len + ENV_LOG_REC_BYTE_SIZE > rec_space || total_len > reserve_space) {
+        return FALSE;
+    }
+    /* the records don't cross sector, so every 2 sectors at least storage a sector size records */
+    if (total_len * 2 + rec_space <= reserve_space) {
+        return TRUE;
+    }
+    /* find the largest records and the commit record */
+    while (iter(&pos, &len, arg)) {
+        if (len) {
+            env_log_fit_top_add(top_len, len + ENV_LOG_REC_BYTE_SIZE);
+        }
+    }
+    env_log_fit_top_add(top_len, ENV_LOG_REC_BYTE_SIZE);
+    /* the records after the largest ones are not more than the last largest one */
+    for (i = 0; i < get_env_reserve_sector_num(); i++) {
+        total_len += top_len[i < ENV_LOG_FIT_TOP_NUM ? i : ENV_LOG_FIT_TOP_NUM - 1];
+    }
+    return total_len <= reserve_space;
+}
+
+/**
+ * Add a record length to the largest records lengths. @see env_log_is_fit
+ *
+ * @param top_len the largest records lengths by descending order
+ * @param rec_len record length
+ */
+static void env_log_fit_top_add(size_t *top_len, size_t rec_len) {
+    size_t i;
+
+    for (i = ENV_LOG_FIT_TOP_NUM; i > 0 && top_len[i - 1] < rec_len; i--) {
+        if (i < ENV_LOG_FIT_TOP_NUM) {
+            top_len[i] = top_len[i - 1];
+        }
+    }
+    if (i < ENV_LOG_FIT_TOP_NUM) {
+        top_len[i] = rec_len;
+    }
+}
+
+/**
+ * Check all changed environment variables records and the commit record can be appended without
+ * compacting. The reserved sectors will not be used.
+ *
+ * @return true is has space
+ */
+static bool_t env_log_has_space(void) {
+    size_t offset = env_log_head_offset, rec_len, len, free_num, pos = 0;
+    bool_t is_commit = FALSE;
+
+    free_num = env_sector_num - env_log_used_num - get_env_reserve_sector_num();
+    while (!is_commit) {
+        if (!env_ops->changes_len(&pos, &len, NULL)) {
+            is_commit = TRUE;
+            len = 0;
+        }
+        rec_len = len + ENV_LOG_REC_BYTE_SIZE;
+        if (offset + rec_len > env_sector_size) {
+            if (free_num == 0 || env_sector_size < rec_len + ENV_LOG_SECTOR_BYTE_SIZE) {
+                return FALSE;
+            }
+            free_num--;
+            offset = ENV_LOG_SECTOR_BYTE_SIZE;
+        }
+        offset += rec_len;
+    }
+    return TRUE;
+}
+
+/**
+ * Use next free sector as the newest sector.
+ *
+ * @param flag sector flag, ENV_LOG_SECTOR_NORMAL or ENV_LOG_SECTOR_SNAPSHOT
+ *
+ * @return result
+ */
+static FlashErrCode env_log_new_sector(uint32_t flag) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t header[ENV_LOG_SECTOR_WORD_SIZE];
+    size_t sector = env_log_used_num ? (env_log_head + 1) % env_sector_num : env_log_tail;
+
+    FLASH_ASSERT(env_log_used_num < env_sector_num);
+
+    header[ENV_LOG_SECTOR_INDEX_MAGIC] = ENV_LOG_SECTOR_MAGIC;
+    header[ENV_LOG_SECTOR_INDEX_SEQ] = env_log_seq++;
+    header[ENV_LOG_SECTOR_INDEX_FLAG] = flag;
+    /* the free sector is already erased, the erase counter has been written after erased */
+    result = env_ops->write(sector * env_sector_size, header, ENV_LOG_SECTOR_INDEX_ERASE_CNT * 4);
+    if (result == FLASH_NO_ERR) {
+        env_log_head = sector;
+        env_log_head_offset = ENV_LOG_SECTOR_BYTE_SIZE;
+        env_log_used_num++;
+    }
+
+    return result;
+}
+
+/**
+ * Append a record to the newest sector. It will use next free sector when the newest sector has
+ * no space.
+ *
+ * @param type record type
+ * @param payload record payload, storage model is key=value\0
+ * @param payload_len payload length, it's 4 bytes alignment
+ * @param key_len environment variable name length
+ * @param rec_offset the record bytes offset in flash area, it can be NULL
+ *
+ * @return result
+ */
+FlashErrCode env_log_append(uint8_t type, const uint32_t *payload, size_t payload_len,
+        size_t key_len, uint32_t *rec_offset) {
+    extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
+
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t header[ENV_LOG_REC_WORD_SIZE], offset;
+    size_t rec_len = ENV_LOG_REC_BYTE_SIZE + payload_len;
+
+    if (env_log_head_offset + rec_len > env_sector_size) {
+        result = env_log_new_sector(ENV_LOG_SECTOR_NORMAL);
+        if (result != FLASH_NO_ERR) {
+            return result;
+        }
+    }
+    offset = env_log_head * env_sector_size + env_log_head_offset;
+
+    header[ENV_LOG_REC_INDEX_INFO] = rec_len | (key_len << 16) | ((uint32_t) type << 24);
+    header[ENV_LOG_REC_INDEX_SEQ] = env_log_seq++;
+    header[ENV_LOG_REC_INDEX_CRC] = calc_crc32(0, header, ENV_LOG_REC_INDEX_CRC * 4);
+    header[ENV_LOG_REC_INDEX_CRC] = calc_crc32(header[ENV_LOG_REC_INDEX_CRC], payload, payload_len);
+
+    /* the header must be written first, then the broken payload can be found by CRC32 */
+    result = env_ops->write(offset, header, ENV_LOG_REC_BYTE_SIZE);
+    if (result == FLASH_NO_ERR && payload_len) {
+        result = env_ops->write(offset + ENV_LOG_REC_BYTE_SIZE, payload, payload_len);
+    }
+    if (rec_offset) {
+        *rec_offset = offset;
+    }
+    /* the written part can't be used again whether it success or not */
+    env_log_head_offset += rec_len;
+
+    return result;
+}
+
+/**
+ * Save environment variables. The changed records and a commit record are appended, all
+ * environment variables will be compacted when there is no enough space or compacting is
+ * requested.
+ *
+ * @return result
+ */
+FlashErrCode env_log_save(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(env_ops);
+
+    if (!env_log_need_compact && !env_log_has_space()) {
+        env_log_need_compact = TRUE;
+    }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* only the compaction erases flash, it erases all using sectors. The changes will be saved by
+     * next saving when it's over budget */
+    if (env_log_need_compact && !flash_erase_budget_check(env_log_tail, env_log_used_num)) {
+        return FLASH_ENV_SAVE_DEFERRED;
+    }
+#endif
+
+    if (env_log_need_compact) {
+        result = env_log_compact();
+    } else {
+        result = env_ops->changes();
+        if (result == FLASH_NO_ERR) {
+            result = env_log_append(ENV_LOG_REC_COMMIT, NULL, 0, 0, NULL);
+        }
+    }
+    /* the uncompleted saving must be dropped by compacting, it can't be committed by next saving */
+    env_log_need_compact = (result != FLASH_NO_ERR);
+
+    return result;
+}
+
+/**
+ * Compact all environment variables into free sectors as a new snapshot, then erase all old
+ * sectors.
+ *
+ * @return result
+ */
+static FlashErrCode env_log_compact(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t old_used_num = env_log_used_num;
+
+    FLASH_INFO("Compacting environment variables.\n");
+
+    result = env_log_new_sector(ENV_LOG_SECTOR_SNAPSHOT);
+    if (result == FLASH_NO_ERR) {
+        result = env_ops->snapshot();
+    }
+    if (result == FLASH_NO_ERR) {
+        result = env_log_append(ENV_LOG_REC_COMMIT, NULL, 0, 0, NULL);
+    }
+    if (result != FLASH_NO_ERR) {
+        return result;
+    }
+
+    /* erase old sectors from the oldest, so the deleted environment variables will not recover */
+    for (; old_used_num; old_used_num--) {
+        env_log_erase_sector(env_log_tail);
+        env_log_tail = (env_log_tail + 1) % env_sector_num;
+        env_log_used_num--;
+    }
+
+    return result;
+}
+
+/**
+ * Read a record by the cache operations, and check it.
+ *
+ * @param sector sector index
+ * @param offset record bytes offset in sector
+ * @param rec the record which is read
+ *
+ * @return record type, ENV_LOG_REC_BLANK or ENV_LOG_REC_BROKEN when record is not available
+ */
+static uint8_t env_log_read_rec(size_t sector, size_t offset, const uint32_t **rec) {
+    extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
+
+    const uint32_t *payload;
+    uint32_t info, crc32;
+    size_t rec_len, key_len, payload_len, blob_offset;
+    const char *env;
+    uint8_t type;
+
+    if (env_sector_size - offset < ENV_LOG_REC_BYTE_SIZE) {
+        return ENV_LOG_REC_BLANK;
+    }
+    *rec = env_ops->read(sector * env_sector_size + offset, ENV_LOG_REC_BYTE_SIZE);
+    if (!*rec) {
+        return ENV_LOG_REC_BROKEN;
+    }
+    info = (*rec)[ENV_LOG_REC_INDEX_INFO];
+    if (info == 0xFFFFFFFF) {
+        return ENV_LOG_REC_BLANK;
+    }
+    rec_len = info & 0xFFFF;
+    key_len = (info >> 16) & 0xFF;
+    type = info >> 24;
+    payload_len = rec_len - ENV_LOG_REC_BYTE_SIZE;
+    /* check the record length before read it */
+    if (rec_len % 4 != 0 || rec_len < ENV_LOG_REC_BYTE_SIZE || rec_len > env_sector_size - offset) {
+        return ENV_LOG_REC_BROKEN;
+    }
+    *rec = env_ops->read(sector * env_sector_size + offset, rec_len);
+    if (!*rec) {
+        return ENV_LOG_REC_BROKEN;
+    }
+    payload = *rec + ENV_LOG_REC_WORD_SIZE;
+    crc32 = calc_crc32(0, *rec, ENV_LOG_REC_INDEX_CRC * 4);
+    crc32 = calc_crc32(crc32, payload, payload_len);
+    if (crc32 != (*rec)[ENV_LOG_REC_INDEX_CRC]) {
+        return ENV_LOG_REC_BROKEN;
+    }
+    /* storage model is key=value\0 or key=\0 + blob header word + blob data */
+    if (type == ENV_LOG_REC_SET || type == ENV_LOG_REC_DEL) {
+        env = (const char *) payload;
+        blob_offset = (key_len + 2 + 3) / 4 * 4;
+        if (key_len == 0 || key_len + 2 > payload_len || env[key_len] != '=') {
+            return ENV_LOG_REC_BROKEN;
+        }
+        if (type == ENV_LOG_REC_SET && env[key_len + 1] == '\0') {
+            /* the blob data must be in the payload */
+            if (blob_offset + 4 > payload_len
+                    || (payload[blob_offset / 4] & ENV_BLOB_FLAG_MASK) != ENV_BLOB_FLAG
+                    || blob_offset + 4 + (payload[blob_offset / 4] & ENV_BLOB_LEN_MASK)
+                            > payload_len) {
+                return ENV_LOG_REC_BROKEN;
+            }
+        } else if (env[payload_len - 1] != '\0') {
+            return ENV_LOG_REC_BROKEN;
+        }
+    }
+    return type;
+}
+
+/**
+ * Find the last commit record in a sector.
+ *
+ * @param sector sector index
+ *
+ * @return the bytes offset after the last commit record in sector, 0 is not found
+ */
+static size_t env_log_find_commit(size_t sector) {
+    const uint32_t *rec;
+    size_t offset, commit_end = 0;
+    uint8_t type;
+
+    for (offset = ENV_LOG_SECTOR_BYTE_SIZE; offset < env_sector_size;
+            offset += rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF) {
+        type = env_log_read_rec(sector, offset, &rec);
+        if (type == ENV_LOG_REC_BLANK || type == ENV_LOG_REC_BROKEN) {
+            break;
+        } else if (type == ENV_LOG_REC_COMMIT) {
+            commit_end = offset + ENV_LOG_REC_BYTE_SIZE;
+        }
+    }
+
+    return commit_end;
+}
+
+/**
+ * Load the log storage, the records are replayed by the cache operations from the newest
+ * snapshot to the last commit.
+ * It will erase all sectors when there is no completed snapshot, then the environment variables
+ * must be set default.
+ *
+ * @return false is formatted
+ */
+bool_t env_log_load(void) {
+    uint32_t header[ENV_LOG_SECTOR_WORD_SIZE], seq = 0;
+    const uint32_t *rec;
+    size_t i, j, sector, offset, rec_len, commit_end = 0, commit_num = 0;
+    uint8_t type;
+
+    FLASH_ASSERT(env_ops);
+
+    env_log_need_compact = FALSE;
+    env_log_used_num = 0;
+
+    /* find the newest sector */
+    for (i = 0; i < env_sector_num; i++) {
+        FLASH_READ(get_sector_addr(i), header, ENV_LOG_SECTOR_BYTE_SIZE);
+        /* the sector has not been erased by EasyFlash */
+        if (header[ENV_LOG_SECTOR_INDEX_ERASE_CNT] == 0xFFFFFFFF) {
+            env_erase_cnt[i] = 0;
+        } else {
+            env_erase_cnt[i] = header[ENV_LOG_SECTOR_INDEX_ERASE_CNT];
+        }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+        /* restore the erase budget, the erased one is not saved */
+        if (header[ENV_LOG_SECTOR_INDEX_ERASE_BUDGET] != 0xFFFFFFFF) {
+            flash_erase_budget_set(i, header[ENV_LOG_SECTOR_INDEX_ERASE_BUDGET]);
+        }
+#endif
+        /* compare by the difference, the sequence number maybe wraparound */
+        if (header[ENV_LOG_SECTOR_INDEX_MAGIC] == ENV_LOG_SECTOR_MAGIC
+                && (!env_log_used_num || (int32_t)(header[ENV_LOG_SECTOR_INDEX_SEQ] - seq) > 0)) {
+            env_log_head = i;
+            seq = header[ENV_LOG_SECTOR_INDEX_SEQ];
+            env_log_used_num = 1;
+        }
+    }
+    if (!env_log_used_num) {
+        FLASH_INFO("Warning: Environment variables is not initialize. Set it to default.\n");
+        env_log_format();
+        return FALSE;
+    }
+    env_log_seq = seq + 1;
+    /* find the oldest sector, the sequence number must be increasing from it to the newest */
+    env_log_tail = env_log_head;
+    while (env_log_used_num < env_sector_num) {
+        sector = (env_log_tail + env_sector_num - 1) % env_sector_num;
+        FLASH_READ(get_sector_addr(sector), header, ENV_LOG_SECTOR_BYTE_SIZE);
+        if (header[ENV_LOG_SECTOR_INDEX_MAGIC] != ENV_LOG_SECTOR_MAGIC
+                || (int32_t)(header[ENV_LOG_SECTOR_INDEX_SEQ] - seq) >= 0) {
+            break;
+        }
+        seq = header[ENV_LOG_SECTOR_INDEX_SEQ];
+        env_log_tail = sector;
+        env_log_used_num++;
+    }
+
+    /* find the last commit, the records after it are the uncompleted saving or snapshot */
+    for (i = env_log_used_num; i > 0 && !commit_end; i--) {
+        commit_end = env_log_find_commit((env_log_tail + i - 1) % env_sector_num);
+        commit_num = i;
+    }
+    /* find the newest snapshot before the last commit, the older sectors are dirty */
+    for (i = commit_end ? commit_num : 0; i > 0; i--) {
+        sector = (env_log_tail + i - 1) % env_sector_num;
+        FLASH_READ(get_sector_addr(sector), header, ENV_LOG_SECTOR_BYTE_SIZE);
+        if (header[ENV_LOG_SECTOR_INDEX_FLAG] == ENV_LOG_SECTOR_SNAPSHOT) {
+            break;
+        }
+    }
+    if (i == 0) {
+        FLASH_INFO("Warning: Environment variables has no completed snapshot. "
+                "Set it to default.\n");
+        env_log_format();
+        return FALSE;
+    }
+    if (commit_num < env_log_used_num) {
+        FLASH_INFO("Warning: Found the uncompleted saving or snapshot. Drop it.\n");
+    }
+    env_log_tail = (env_log_tail + i - 1) % env_sector_num;
+    env_log_used_num = commit_num - i + 1;
+    env_log_head = (env_log_tail + env_log_used_num - 1) % env_sector_num;
+    /* erase all sectors which is not using */
+    env_log_erase_dirty_sector();
+
+    /* replay all records from the oldest sector to the last commit */
+    for (j = 0; j < env_log_used_num; j++) {
+        sector = (env_log_tail + j) % env_sector_num;
+        for (offset = ENV_LOG_SECTOR_BYTE_SIZE; offset < env_sector_size;
+                offset += rec_len) {
+            if (sector == env_log_head && offset >= commit_end) {
+                break;
+            }
+            type = env_log_read_rec(sector, offset, &rec);
+            if (type == ENV_LOG_REC_BLANK) {
+                break;
+            } else if (type == ENV_LOG_REC_BROKEN) {
+                FLASH_INFO("Warning: Found a broken record at 0x%08X.\n",
+                        get_sector_addr(sector) + offset);
+                /* the sector can't append record anymore */
+                offset = env_sector_size;
+                break;
+            }
+            /* the record maybe overwrote by replaying */
+            rec_len = rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF;
+            if (type == ENV_LOG_REC_SET || type == ENV_LOG_REC_DEL) {
+                env_ops->replay(sector * env_sector_size + offset, rec);
+            }
+        }
+        env_log_head_offset = offset;
+    }
+    /* the uncompleted saving after the last commit can't be committed by next saving */
+    if (env_log_head_offset < env_sector_size
+            && env_log_read_rec(env_log_head, env_log_head_offset, &rec) != ENV_LOG_REC_BLANK) {
+        FLASH_INFO("Warning: Found the uncompleted saving. Drop it.\n");
+        env_log_head_offset = env_sector_size;
+        env_log_need_compact = TRUE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Erase all sectors.
+ */
+static void env_log_format(void) {
+    size_t i;
+
+    for (i = 0; i < env_sector_num; i++) {
+        env_log_erase_sector(i);
+    }
+    env_log_tail = 0;
+    env_log_used_num = 0;
+}
+
+/**
+ * Erase all sectors which is not using and not blank.
+ */
+static void env_log_erase_dirty_sector(void) {
+    uint32_t buff[32];
+    size_t i, sector, offset, read_size, j;
+
+    for (i = env_log_used_num; i < env_sector_num; i++) {
+        sector = (env_log_tail + i) % env_sector_num;
+        for (offset = 0; offset < env_sector_size; offset += read_size) {
+            read_size = env_sector_size - offset < sizeof(buff) ? env_sector_size - offset
+                    : sizeof(buff);
+            FLASH_READ(get_sector_addr(sector) + offset, buff, read_size);
+            /* the erase counter and erase budget in free sector are not dirty */
+            if (!offset) {
+                buff[ENV_LOG_SECTOR_INDEX_ERASE_CNT] = 0xFFFFFFFF;
+                buff[ENV_LOG_SECTOR_INDEX_ERASE_BUDGET] = 0xFFFFFFFF;
+            }
+            for (j = 0; j < read_size / 4 && buff[j] == 0xFFFFFFFF; j++);
+            if (j < read_size / 4) {
+                env_log_erase_sector(sector);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Erase a sector, then write its erase counter and erase budget to the sector header.
+ *
+ * @param sector sector index
+ *
+ * @return result
+ */
+static FlashErrCode env_log_erase_sector(size_t sector) {
+    FlashErrCode result = FLASH_NO_ERR;
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    uint32_t budget = flash_erase_budget_charge(flash_erase_budget_get(sector));
+
+    flash_erase_budget_set(sector, budget);
+#endif
+
+    if (env_ops->drop) {
+        env_ops->drop(sector);
+    }
+    env_erase_cnt[sector]++;
+    result = FLASH_ERASE(get_sector_addr(sector), env_sector_size);
+    if (result == FLASH_NO_ERR) {
+        result = FLASH_WRITE(get_sector_addr(sector) + ENV_LOG_SECTOR_INDEX_ERASE_CNT * 4,
+                &env_erase_cnt[sector], 4);
+    }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    if (result == FLASH_NO_ERR) {
+        result = FLASH_WRITE(get_sector_addr(sector) + ENV_LOG_SECTOR_INDEX_ERASE_BUDGET * 4,
+                &budget, 4);
+    }
+#endif
+
+    return result;
+}
+
+#endif
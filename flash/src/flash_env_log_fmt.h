@@ -0,0 +1,95 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: The storage format of log mode, it's shared by the RAM cache and the paged cache.
+ * Created on: 2026-10-16
+ */
+
+#ifndef FLASH_ENV_LOG_FMT_H_
+#define FLASH_ENV_LOG_FMT_H_
+
+#include "flash_env_cache.h"
+
+#ifdef FLASH_ENV_USING_LOG_MODE
+
+/* flash ENV record header index and size */
+enum {
+    /* record information index. record length(bit0-15), key length(bit16-23), type(bit24-31) */
+    ENV_LOG_REC_INDEX_INFO = 0,
+    /* record sequence number index */
+    ENV_LOG_REC_INDEX_SEQ,
+    /* record CRC32 code index */
+    ENV_LOG_REC_INDEX_CRC,
+
+    /* record header word size */
+    ENV_LOG_REC_WORD_SIZE,
+    /* record header byte size */
+    ENV_LOG_REC_BYTE_SIZE = ENV_LOG_REC_WORD_SIZE * 4,
+};
+
+/* flash ENV record type */
+enum {
+    /* set an environment variable */
+    ENV_LOG_REC_SET = 0x01,
+    /* delete an environment variable (tombstone) */
+    ENV_LOG_REC_DEL = 0x02,
+    /* the snapshot or saving is completed */
+    ENV_LOG_REC_COMMIT = 0x03,
+    /* the remaining part of sector is not written */
+    ENV_LOG_REC_BLANK = 0xFF,
+    /* the record is broken, maybe power down when it writing */
+    ENV_LOG_REC_BROKEN = 0x00,
+};
+
+/* get the payload length of next record, pos is 0 at first, 0 length record is skipped, return
+ * FALSE when there is no more record */
+typedef bool_t (*env_log_len_iter)(size_t *pos, size_t *len, void *arg);
+
+/* the operations of environment variables cache for the log storage */
+typedef struct _env_log_ops {
+    /* get the data in flash area by bytes offset, the returned data is valid until next getting */
+    const uint32_t *(*read)(uint32_t offset, size_t size);
+    /* write data to flash area by bytes offset, the data can not cross the sector */
+    FlashErrCode (*write)(uint32_t offset, const uint32_t *buf, size_t size);
+    /* the sector will be erased, the cached data of it must be dropped, it can be NULL */
+    void (*drop)(size_t sector);
+    /* replay a set or delete record when loading, the offset is record bytes offset */
+    void (*replay)(uint32_t offset, const uint32_t *rec);
+    /* append all environment variables records to a new snapshot when compacting */
+    FlashErrCode (*snapshot)(void);
+    /* append all changed environment variables records when saving */
+    FlashErrCode (*changes)(void);
+    /* iterate the payload length of all changed environment variables records */
+    env_log_len_iter changes_len;
+} env_log_ops;
+
+/* flash_env_log_fmt.c */
+void env_log_init(uint32_t start_addr, size_t total_size, size_t erase_min_size,
+        const env_log_ops *ops);
+bool_t env_log_load(void);
+FlashErrCode env_log_save(void);
+void env_log_request_compact(void);
+FlashErrCode env_log_append(uint8_t type, const uint32_t *payload, size_t payload_len,
+        size_t key_len, uint32_t *rec_offset);
+bool_t env_log_is_fit(size_t data_size, size_t rec_num, size_t max_len, env_log_len_iter iter,
+        void *arg);
+size_t env_log_used_sector(size_t i);
+
+#endif /* FLASH_ENV_USING_LOG_MODE */
+
+#endif /* FLASH_ENV_LOG_FMT_H_ */
@@ -0,0 +1,1817 @@
+/*
+ * This file is part of the EasyFlash Library.
+ *
+ * Copyright (c) 2026, Armink, <armink.ztl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Function: Environment variables operating interface. (log mode with paged cache)
+ * Created on: 2026-10-16
+ */
+
+#include "flash_env_log_fmt.h"
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(FLASH_ENV_USING_LOG_MODE) && defined(FLASH_ENV_USING_PAGED_CACHE)
+
+/**
+ * The storage format in flash is same as log mode. @see flash_env_log_fmt.c
+ * The whole environment variables area is not cached in RAM, it only has:
+ *
+ * 1. Page cache
+ *    FLASH_ENV_PAGED_CACHE_NUM sectors are cached in RAM. When a record in other sector is needed,
+ *    the least recently used page which is not pinned will be replaced by it. The record can not
+ *    cross the sector, so it's always continuous in a page.
+ * 2. Hash index
+ *    Every bucket storage the (word offset + 1) of the newest record of an environment variable
+ *    and the 15 bits name hash code. So finding only reads the sectors which records have the same
+ *    hash code, and the index can be maintained without reading flash.
+ *    The record is in flash or in changes buffer. (ENV_INDEX_DIRTY)
+ * 3. Changes buffer
+ *    The set and delete records which are not saved, they are appended to flash when saving.
+ *    When it has no space, the changes will be saved automatically.
+ *
+ * The value which is got by flash_get_env is in page cache or changes buffer, so it's only valid
+ * until next environment variables API calling.
+ *
+ * @note Word = 4 Bytes in this file
+ */
+
+/* the hash index bucket flag, the record is in changes buffer */
+#define ENV_INDEX_DIRTY                0x8000
+/* the name hash code mask in hash index bucket */
+#define ENV_INDEX_HASH_MASK            0x7FFF
+/* not found in hash index */
+#define ENV_INDEX_NONE                 ((size_t) -1)
+
+/* default environment variables set, must be initialized by user */
+static flash_env const *default_env_set = NULL;
+/* default environment variables set size, must be initialized by user */
+static size_t default_env_set_size = 0;
+/* flash environment variables all section total size */
+static size_t env_total_size = 0;
+/* environment variables data bytes size, it's all records payload size in a snapshot */
+static size_t env_data_size = 0;
+/* environment variables number */
+static size_t env_count = 0;
+/* environment variables start address in flash */
+static uint32_t env_start_addr = 0;
+/* sector size, it's the minimum size of flash erasure */
+static size_t env_sector_size = 0;
+/* sector total number */
+static size_t env_sector_num = 0;
+/* the page cache, every page is a sector */
+static uint32_t *env_page = NULL;
+/* the sector index of every page, env_sector_num is not cached */
+static size_t env_page_sector[FLASH_ENV_PAGED_CACHE_NUM];
+/* the last used clock of every page, the least recently used one will be replaced */
+static uint32_t env_page_used[FLASH_ENV_PAGED_CACHE_NUM];
+/* the pinned page can't be replaced */
+static bool_t env_page_pinned[FLASH_ENV_PAGED_CACHE_NUM];
+/* the page cache used clock */
+static uint32_t env_page_clock = 0;
+/* the page cache hit and miss counters */
+static uint32_t env_page_hit = 0, env_page_miss = 0;
+/* the changes buffer, storage model is record header + key=value\0 */
+static uint32_t env_dirty[FLASH_ENV_PAGED_DIRTY_SIZE / 4];
+/* changes buffer used bytes size */
+static size_t env_dirty_len = 0;
+/* environment variables hash index, each bucket storage the record (word offset + 1) */
+static uint16_t *env_index = NULL;
+/* the name hash code and ENV_INDEX_DIRTY flag of each bucket */
+static uint16_t *env_index_hash = NULL;
+/* the hash index buckets number, it's sized by the environment variables area size */
+static size_t env_index_size = 0;
+/* environment variables number in hash index */
+static size_t env_index_count = 0;
+/* environment variables generation, it will increase when environment variables have changed */
+static uint32_t env_cache_gen = 0;
+/* the environment variables generation which has been saved to flash */
+static uint32_t env_saved_gen = 0;
+
+static uint32_t *get_index_rec(size_t i);
+static size_t get_index_env_len(size_t i);
+static void write_env(size_t i, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type, size_t env_len, size_t old_env_len);
+static size_t calc_env_len(size_t key_len, size_t value_len, bool_t is_blob);
+static void make_env(char *env, size_t env_len, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type);
+static char *get_env_value(const char *env, size_t key_len, size_t *value_len, bool_t *is_blob);
+static uint8_t get_env_blob_type(const char *value);
+static size_t find_env(const char *key, size_t key_len);
+static FlashErrCode del_env(size_t i, const char *key, size_t key_len);
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save);
+static FlashErrCode env_set_default(void);
+static void load_env(void);
+static FlashErrCode save_env(void);
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
+static size_t env_traverse(const char *prefix, size_t prefix_len, flash_env_iterator iterator,
+        void *arg);
+static bool_t print_env_iterator(const char *key, size_t key_len, const char *value,
+        size_t value_len, bool_t is_blob, void *arg);
+static uint16_t calc_env_key_hash(const char *key, size_t key_len);
+static void env_index_clear(void);
+static void env_index_add(uint16_t hash, size_t offset, uint16_t flag);
+static void env_index_del(size_t i);
+static size_t env_index_find_rec(const char *key, size_t key_len, size_t offset, uint16_t flag);
+static uint32_t *env_page_load(size_t sector);
+static uint32_t *env_page_get(size_t offset);
+static void env_page_pin(size_t sector);
+static void env_page_unpin(void);
+static void env_page_drop(size_t sector);
+static uint32_t *env_dirty_find(const char *key, size_t key_len);
+static size_t env_dirty_add(uint8_t type, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type, size_t env_len);
+static void env_dirty_remove(size_t offset, size_t len);
+static FlashErrCode env_dirty_alloc(size_t rec_len);
+static bool_t env_is_fit(size_t change_i, size_t change_len, size_t env_len);
+static bool_t env_fit_len_iter(size_t *pos, size_t *len, void *arg);
+static const uint32_t *env_log_read(uint32_t offset, size_t size);
+static FlashErrCode env_log_write(uint32_t offset, const uint32_t *buf, size_t size);
+static void env_log_replay(uint32_t offset, const uint32_t *rec);
+static FlashErrCode env_log_snapshot(void);
+static FlashErrCode env_log_changes(void);
+static bool_t env_log_changes_len(size_t *pos, size_t *len, void *arg);
+
+/* the operations of paged cache for the log storage */
+static const env_log_ops env_paged_ops = {
+    env_log_read,
+    env_log_write,
+    env_page_drop,
+    env_log_replay,
+    env_log_snapshot,
+    env_log_changes,
+    env_log_changes_len,
+};
+
+/* the changed environment variable for checking the capacity, @see env_fit_len_iter */
+typedef struct _env_fit_change {
+    /* the hash index bucket which storage length will be changed, ENV_INDEX_NONE is none */
+    size_t i;
+    /* the new storage length of bucket i, 0 is deleted */
+    size_t len;
+    /* the new environment variable storage length, 0 is none */
+    size_t env_len;
+} env_fit_change;
+
+/**
+ * Flash environment variables initialize.
+ *
+ * @param start_addr environment variables start address in flash
+ * @param total_size environment variables section total size (@note must be word alignment)
+ * @param erase_min_size the minimum size of flash erasure
+ * @param default_env default environment variables set for user
+ * @param default_env_size default environment variables set size
+ *
+ * @return result
+ */
+FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase_min_size,
+        flash_env const *default_env, size_t default_env_size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t max_env_num;
+
+    FLASH_ASSERT(start_addr);
+    FLASH_ASSERT(total_size);
+    FLASH_ASSERT(erase_min_size);
+    FLASH_ASSERT(default_env);
+    FLASH_ASSERT(default_env_size < total_size);
+    /* must be word alignment for environment variables */
+    FLASH_ASSERT(total_size % 4 == 0);
+    /* hash index storage word offset by 16 bits */
+    FLASH_ASSERT(total_size / 4 < 0xFFFF);
+    /* a page is pinned when loading, the others are used for finding */
+    FLASH_ASSERT(FLASH_ENV_PAGED_CACHE_NUM >= 2);
+    /* make true only be initialized once */
+    FLASH_ASSERT(!env_page);
+
+    env_start_addr = start_addr;
+    env_total_size = total_size;
+    env_sector_size = erase_min_size;
+    env_sector_num = total_size / erase_min_size;
+    default_env_set = default_env;
+    default_env_set_size = default_env_size;
+
+    FLASH_DEBUG("Env start address is 0x%08X, size is %d bytes.\n", start_addr, total_size);
+
+    /* create page cache, its size is independent of environment variables section size */
+    env_page = (uint32_t *) flash_malloc(sizeof(uint8_t) * erase_min_size
+            * FLASH_ENV_PAGED_CACHE_NUM);
+    FLASH_ASSERT(env_page);
+    /* a snapshot is in the reserved half area, and the shortest record is header + "k=v\0". The
+     * buckets number is power of 2 and keeps 1/4 empty buckets for all environment variables */
+    max_env_num = total_size / 2 / (ENV_LOG_REC_BYTE_SIZE + 4);
+    for (env_index_size = 4; env_index_size / 4 * 3 < max_env_num; env_index_size *= 2);
+    /* the home bucket is got by 15 bits hash code */
+    FLASH_ASSERT(env_index_size <= ENV_INDEX_HASH_MASK + 1);
+    /* create hash index, it's independent of environment variables data size */
+    env_index = (uint16_t *) flash_malloc(sizeof(uint16_t) * env_index_size);
+    FLASH_ASSERT(env_index);
+    env_index_hash = (uint16_t *) flash_malloc(sizeof(uint16_t) * env_index_size);
+    FLASH_ASSERT(env_index_hash);
+    FLASH_DEBUG("Env hash index has %d buckets.\n", env_index_size);
+    env_log_init(start_addr, total_size, erase_min_size, &env_paged_ops);
+
+    flash_load_env();
+
+    return result;
+}
+
+/**
+ * Environment variables set default without lock.
+ * @see flash_env_set_default
+ *
+ * @return result
+ */
+static FlashErrCode env_set_default(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(env_page);
+    FLASH_ASSERT(default_env_set);
+    FLASH_ASSERT(default_env_set_size);
+
+    /* clean all environment variables, the hash index and changes buffer */
+    env_data_size = 0;
+    env_count = 0;
+    env_index_clear();
+    env_dirty_len = 0;
+
+    /* all old records are useless, so compact it */
+    env_log_request_compact();
+
+    /* create default environment variables and save them */
+    result = set_env_batch(default_env_set, default_env_set_size, TRUE);
+
+    return result;
+}
+
+/**
+ * Environment variables set default.
+ *
+ * @return result
+ */
+FlashErrCode flash_env_set_default(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    result = env_set_default();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    return result;
+}
+
+/**
+ * Get current environment variables section total size.
+ *
+ * @return size
+ */
+uint32_t flash_get_env_total_size(void) {
+    /* must be initialized */
+    FLASH_ASSERT(env_total_size);
+
+    return env_total_size;
+}
+
+/**
+ * Get current environment variables used byte size.
+ * It's the bytes size of all environment variables records in a snapshot.
+ *
+ * @return size
+ */
+uint32_t flash_get_env_used_size(void) {
+    return env_data_size + env_count * ENV_LOG_REC_BYTE_SIZE;
+}
+
+/**
+ * Get environment variables generation. It will increase when environment variables have changed.
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_gen(void) {
+    return env_cache_gen;
+}
+
+/**
+ * Get the environment variables generation which has been saved to flash.
+ * If it's not equal to flash_get_env_gen(), environment variables have changed after last saved.
+ * So the saving has written flash when this generation changed after called flash_save_env().
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_saved_gen(void) {
+    return env_saved_gen;
+}
+
+/**
+ * Get the newest record of an environment variable in hash index.
+ *
+ * @param i hash index bucket
+ *
+ * @return record in page cache or changes buffer, NULL when all pages are pinned
+ */
+static uint32_t *get_index_rec(size_t i) {
+    if (env_index_hash[i] & ENV_INDEX_DIRTY) {
+        return env_dirty + env_index[i] - 1;
+    }
+    return env_page_get(env_index[i] - 1);
+}
+
+/**
+ * Get the storage length of an environment variable in hash index. The record header in flash is
+ * read directly, so the page cache will not be changed.
+ *
+ * @param i hash index bucket
+ *
+ * @return storage length
+ */
+static size_t get_index_env_len(size_t i) {
+    uint32_t info;
+
+    if (env_index_hash[i] & ENV_INDEX_DIRTY) {
+        info = env_dirty[env_index[i] - 1 + ENV_LOG_REC_INDEX_INFO];
+    } else {
+        FLASH_READ(env_start_addr + (env_index[i] - 1 + ENV_LOG_REC_INDEX_INFO) * 4, &info, 4);
+    }
+
+    return (info & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE;
+}
+
+/**
+ * Write an environment variable to changes buffer, then the hash index uses it.
+ * @note The changes buffer must have space for it. @see env_dirty_alloc
+ *
+ * @param i hash index bucket of the old one, ENV_INDEX_NONE is creating
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value, it can be in page cache or changes buffer
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ * @param env_len storage length
+ * @param old_env_len the old one storage length
+ */
+static void write_env(size_t i, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type, size_t env_len, size_t old_env_len) {
+    uint32_t *old_rec = env_dirty_find(key, key_len);
+    size_t offset;
+
+    /* the old record in changes buffer is removed after the new one is written, so the value can
+     * be in it */
+    offset = env_dirty_add(ENV_LOG_REC_SET, key, key_len, value, value_len, is_blob, blob_type,
+            env_len);
+    if (i == ENV_INDEX_NONE) {
+        env_index_add(calc_env_key_hash(key, key_len), offset, ENV_INDEX_DIRTY);
+        env_data_size += env_len;
+        env_count++;
+    } else {
+        env_index[i] = offset + 1;
+        env_index_hash[i] |= ENV_INDEX_DIRTY;
+        env_data_size = env_data_size - old_env_len + env_len;
+    }
+    if (old_rec) {
+        env_dirty_remove(old_rec - env_dirty, old_rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF);
+    }
+    env_cache_gen++;
+}
+
+/**
+ * Calculate environment variable storage length.
+ *
+ * @param key_len environment variable name length
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ *
+ * @return storage length, it's 4 bytes alignment
+ */
+static size_t calc_env_len(size_t key_len, size_t value_len, bool_t is_blob) {
+    if (is_blob) {
+        /* storage model is key=\0 + blob header word + blob data */
+        return (key_len + 2 + 3) / 4 * 4 + 4 + (value_len + 3) / 4 * 4;
+    } else {
+        /* storage model is key=value\0 */
+        return (key_len + value_len + 2 + 3) / 4 * 4;
+    }
+}
+
+/**
+ * Make an environment variable in its storage. The remaining part of storage will fill '\0'.
+ *
+ * @param env environment variable storage
+ * @param env_len storage length
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ */
+static void make_env(char *env, size_t env_len, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type) {
+    size_t value_offset = key_len + 1;
+
+    if (is_blob) {
+        value_offset = (key_len + 2 + 3) / 4 * 4 + 4;
+    }
+    memmove(env + value_offset, value, value_len);
+    memmove(env, key, key_len);
+    env[key_len] = '=';
+    if (is_blob) {
+        memset(env + key_len + 1, 0, value_offset - 4 - key_len - 1);
+        *(uint32_t *) (env + value_offset - 4) = ENV_BLOB_FLAG
+                | (uint32_t) blob_type << ENV_BLOB_TYPE_SHIFT | value_len;
+    }
+    memset(env + value_offset + value_len, 0, env_len - value_offset - value_len);
+}
+
+/**
+ * Get the value of an environment variable.
+ *
+ * @param env environment variable, storage model is key=value\0
+ * @param key_len environment variable name length
+ * @param value_len the value length
+ * @param is_blob the value is blob
+ *
+ * @return value
+ */
+static char *get_env_value(const char *env, size_t key_len, size_t *value_len, bool_t *is_blob) {
+    const char *value = env + key_len + 1;
+
+    /* the string value must be not empty, so the empty one is blob value */
+    if (*value == '\0') {
+        value = env + (key_len + 2 + 3) / 4 * 4;
+        *value_len = *(uint32_t *) value & ENV_BLOB_LEN_MASK;
+        *is_blob = TRUE;
+        return (char *) value + 4;
+    }
+    *value_len = strlen(value);
+    *is_blob = FALSE;
+
+    return (char *) value;
+}
+
+/**
+ * Get the type of a blob value.
+ *
+ * @param value the blob value which is got by get_env_value
+ *
+ * @return blob type
+ */
+static uint8_t get_env_blob_type(const char *value) {
+    return (*(uint32_t *) (value - 4) & ENV_BLOB_TYPE_MASK) >> ENV_BLOB_TYPE_SHIFT;
+}
+
+/**
+ * Find environment variables by hash index. Only the records which have the same name hash code
+ * are read. The name must be exactly equal.
+ *
+ * @param key environment variables name, it maybe not end with '\0'
+ * @param key_len environment variables name length
+ *
+ * @return hash index bucket, ENV_INDEX_NONE is not found
+ */
+static size_t find_env(const char *key, size_t key_len) {
+    uint32_t *rec;
+    uint16_t hash;
+    size_t i;
+
+    if (key_len == 0) {
+        FLASH_INFO("Flash environment variables name must be not empty!\n");
+        return ENV_INDEX_NONE;
+    }
+
+    hash = calc_env_key_hash(key, key_len);
+    /* linear probing from the hash bucket until an empty bucket */
+    for (i = hash & (env_index_size - 1); env_index[i];
+            i = (i + 1) & (env_index_size - 1)) {
+        if ((env_index_hash[i] & ENV_INDEX_HASH_MASK) != hash) {
+            continue;
+        }
+        rec = get_index_rec(i);
+        /* the record can't be compared when its page can't be loaded */
+        if (rec && ((rec[ENV_LOG_REC_INDEX_INFO] >> 16) & 0xFF) == key_len
+                && !memcmp(rec + ENV_LOG_REC_WORD_SIZE, key, key_len)) {
+            return i;
+        }
+    }
+    return ENV_INDEX_NONE;
+}
+
+/**
+ * Delete an environment variable. A delete record will be written to changes buffer.
+ *
+ * @param i hash index bucket
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ *
+ * @return result
+ */
+static FlashErrCode del_env(size_t i, const char *key, size_t key_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t del_len = calc_env_len(key_len, 0, FALSE), env_len;
+    uint32_t *old_rec;
+
+    result = env_dirty_alloc(ENV_LOG_REC_BYTE_SIZE + del_len);
+    if (result != FLASH_NO_ERR) {
+        return result;
+    }
+    env_len = get_index_env_len(i);
+    old_rec = env_dirty_find(key, key_len);
+    env_index_del(i);
+    /* storage model is key=\0 */
+    env_dirty_add(ENV_LOG_REC_DEL, key, key_len, "", 0, FALSE, 0, del_len);
+    if (old_rec) {
+        env_dirty_remove(old_rec - env_dirty, old_rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF);
+    }
+    env_data_size -= env_len;
+    env_count--;
+    env_cache_gen++;
+
+    return result;
+}
+
+/**
+ * Delete an environment variable.
+ *
+ * @param key environment variable name
+ *
+ * @return result
+ */
+FlashErrCode flash_del_env(const char *key){
+    size_t i;
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(env_page);
+
+    if (*key == '\0') {
+        FLASH_INFO("Flash environment variables name must be not NULL!\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    if (strstr(key, "=")) {
+        FLASH_INFO("Flash environment variables name or value can't contain '='.\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    /* find environment variables */
+    i = find_env(key, strlen(key));
+    if (i == ENV_INDEX_NONE) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    return del_env(i, key, strlen(key));
+}
+
+/**
+ * Set an environment variable which value is not empty. If not find it, then create it.
+ * The new one is written to changes buffer, it keeps the reserved space of the old one.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ *
+ * @return result
+ */
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t *old_rec;
+    char *old_value;
+    size_t i, env_len, old_env_len = 0, old_value_len;
+    bool_t old_is_blob;
+
+    if (key_len == 0 || memchr(key, '\0', key_len)) {
+        FLASH_INFO("Flash environment variables name must be not empty!\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    if (memchr(key, '=', key_len)) {
+        FLASH_INFO("Flash environment variables name can't contain '='.\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    if (key_len > 0xFF) {
+        FLASH_INFO("Flash environment variables name is too long.\n");
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    env_len = calc_env_len(key_len, value_len, is_blob);
+    i = find_env(key, key_len);
+    if (i != ENV_INDEX_NONE) {
+        /* the value has no change, so environment variables will not change */
+        old_rec = get_index_rec(i);
+        old_value = get_env_value((char *) (old_rec + ENV_LOG_REC_WORD_SIZE), key_len,
+                &old_value_len, &old_is_blob);
+        if (old_is_blob == is_blob && old_value_len == value_len
+                && (!is_blob || get_env_blob_type(old_value) == blob_type)
+                && !memcmp(old_value, value, value_len)) {
+            return result;
+        }
+        old_env_len = (old_rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE;
+        if (env_len < old_env_len) {
+            env_len = old_env_len;
+        }
+        /* check capacity before change it, make sure the old value is kept when full */
+        if (!env_is_fit(i, env_len, 0)) {
+            return FLASH_ENV_FULL;
+        }
+    } else {
+        /* keep some empty buckets, so the probing will not be too long */
+        if (env_index_count >= env_index_size / 4 * 3) {
+            FLASH_INFO("Flash environment variables hash index is full.\n");
+            return FLASH_ENV_FULL;
+        }
+        if (!env_is_fit(ENV_INDEX_NONE, 0, env_len)) {
+            return FLASH_ENV_FULL;
+        }
+    }
+
+    result = env_dirty_alloc(ENV_LOG_REC_BYTE_SIZE + env_len);
+    if (result == FLASH_NO_ERR) {
+        write_env(i, key, key_len, value, value_len, is_blob, blob_type, env_len, old_env_len);
+    }
+
+    return result;
+}
+
+/**
+ * Set an environment variable. If it value is empty, delete it.
+ * If not find it in environment variables table, then create it.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env(const char *key, const char *value) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value);
+    FLASH_ASSERT(env_page);
+
+    FLASH_ENV_WRITE_LOCK();
+    /* if ENV value is empty, delete it */
+    if (*value == '\0') {
+        result = flash_del_env(key);
+    } else {
+        result = set_env(key, strlen(key), value, strlen(value), FALSE, 0);
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV);
+    return result;
+}
+
+/**
+ * Set environment variables by batch without lock.
+ * @see flash_set_env_batch
+ *
+ * @param env_set environment variables set
+ * @param env_set_size environment variables set size
+ * @param save save environment variables to flash after set
+ *
+ * @return result
+ */
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t i, j, key_len;
+
+    FLASH_ASSERT(env_set || !env_set_size);
+    FLASH_ASSERT(env_page);
+
+    for (i = 0; i < env_set_size && result == FLASH_NO_ERR; i++) {
+        FLASH_ASSERT(env_set[i].key);
+        FLASH_ASSERT(env_set[i].value);
+
+        key_len = strlen(env_set[i].key);
+        if (*env_set[i].value != '\0') {
+            result = set_env(env_set[i].key, key_len, env_set[i].value, strlen(env_set[i].value),
+                    FALSE, 0);
+        } else if (memchr(env_set[i].key, '=', key_len)) {
+            FLASH_INFO("Flash environment variables name can't contain '='.\n");
+            result = FLASH_ENV_NAME_ERR;
+        } else if ((j = find_env(env_set[i].key, key_len)) != ENV_INDEX_NONE) {
+            /* if ENV value is empty, delete it */
+            result = del_env(j, env_set[i].key, key_len);
+        }
+    }
+
+    if (result == FLASH_NO_ERR && save) {
+        result = save_env();
+    }
+
+    return result;
+}
+
+/**
+ * Set environment variables by batch. Deleting (the value is empty), modifying and creating will
+ * be done in order. The changes may be saved in batch when the changes buffer is full.
+ *
+ * @param env_set environment variables set
+ * @param env_set_size environment variables set size
+ * @param save save environment variables to flash after set
+ *
+ * @return result, the following environment variables will not be set when an error has occurred
+ */
+FlashErrCode flash_set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    result = set_env_batch(env_set, env_set_size, save);
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV_BATCH);
+    return result;
+}
+
+/**
+ * Get environment variables by batch. The value will be NULL when not find it.
+ * The pages of found values are pinned in batch, so the value will be NULL when its page can't be
+ * loaded because all pages are pinned.
+ *
+ * @param env_set environment variables set, the value will be got by key
+ * @param env_set_size environment variables set size
+ *
+ * @return the number of found environment variables
+ */
+size_t flash_get_env_batch(flash_env *env_set, size_t env_set_size) {
+    size_t i, j, key_len, found_num = 0;
+    uint32_t *rec;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(env_set || !env_set_size);
+    FLASH_ASSERT(env_page);
+
+    /* finding changes the page cache, so it's in the write lock */
+    FLASH_ENV_WRITE_LOCK();
+    for (i = 0; i < env_set_size; i++) {
+        key_len = strlen(env_set[i].key);
+        j = find_env(env_set[i].key, key_len);
+        env_set[i].value = NULL;
+        if (j != ENV_INDEX_NONE) {
+            rec = get_index_rec(j);
+            if (!(env_index_hash[j] & ENV_INDEX_DIRTY)) {
+                env_page_pin((env_index[j] - 1) * 4 / env_sector_size);
+            }
+            /* the equal sign next character is value */
+            env_set[i].value = (char *) (rec + ENV_LOG_REC_WORD_SIZE) + key_len + 1;
+            found_num++;
+        }
+    }
+    env_page_unpin();
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV_BATCH);
+    return found_num;
+}
+
+/**
+ * Iterate the environment variables which name starts with the prefix. They are iterated by
+ * sectors order, the unsaved ones are iterated at last. So every sector is read once.
+ * @note The environment variables can't be changed in iterator.
+ *
+ * @param prefix environment variable name prefix, "" is all environment variables
+ * @param iterator it will be called for every environment variable, return FALSE will stop
+ * @param arg iterator argument
+ *
+ * @return the number of iterated environment variables
+ */
+size_t flash_iterate_env(const char *prefix, flash_env_iterator iterator, void *arg) {
+    size_t count = 0;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(prefix);
+    FLASH_ASSERT(iterator);
+    FLASH_ASSERT(env_page);
+
+    if (strchr(prefix, '=')) {
+        FLASH_STATS_END(FLASH_STATS_API_ITERATE_ENV);
+        return count;
+    }
+
+    /* iterating changes the page cache, so it's in the write lock */
+    FLASH_ENV_WRITE_LOCK();
+    count = env_traverse(prefix, strlen(prefix), iterator, arg);
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_ITERATE_ENV);
+    return count;
+}
+
+/**
+ * Traverse the environment variables which name starts with the prefix by sectors order.
+ * @see flash_iterate_env
+ *
+ * @param prefix environment variable name prefix
+ * @param prefix_len environment variable name prefix length
+ * @param iterator it will be called for every environment variable, return FALSE will stop
+ * @param arg iterator argument
+ *
+ * @return the number of iterated environment variables
+ */
+static size_t env_traverse(const char *prefix, size_t prefix_len, flash_env_iterator iterator,
+        void *arg) {
+    uint32_t *rec;
+    char *env, *value;
+    size_t i, j, sector, key_len, value_len, count = 0;
+    bool_t is_blob;
+
+    /* the last one is changes buffer, it's after all using sectors */
+    i = 0;
+    do {
+        sector = env_log_used_sector(i++);
+        for (j = 0; j < env_index_size; j++) {
+            if (!env_index[j]) {
+                continue;
+            }
+            if (env_index_hash[j] & ENV_INDEX_DIRTY) {
+                if (sector != env_sector_num) {
+                    continue;
+                }
+            } else if ((env_index[j] - 1) * 4 / env_sector_size != sector) {
+                continue;
+            }
+            rec = get_index_rec(j);
+            env = (char *) (rec + ENV_LOG_REC_WORD_SIZE);
+            if (strncmp(env, prefix, prefix_len)) {
+                continue;
+            }
+            key_len = (rec[ENV_LOG_REC_INDEX_INFO] >> 16) & 0xFF;
+            value = get_env_value(env, key_len, &value_len, &is_blob);
+            count++;
+            if (!iterator(env, key_len, value, value_len, is_blob, arg)) {
+                return count;
+            }
+        }
+    } while (sector != env_sector_num);
+
+    return count;
+}
+
+/**
+ * Set an environment variable by blob value. If not find it in environment variables table,
+ * then create it.
+ *
+ * @param key environment variable name
+ * @param value_buf blob value buffer
+ * @param buf_len blob value length
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_blob(const char *key, const void *value_buf, size_t buf_len) {
+    FLASH_ASSERT(key);
+
+    return flash_set_env_blob_n(key, strlen(key), value_buf, buf_len);
+}
+
+/**
+ * Set an environment variable by blob value and name length.
+ * @see flash_set_env_blob
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value_buf blob value buffer
+ * @param buf_len blob value length
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_blob_n(const char *key, size_t key_len, const void *value_buf,
+        size_t buf_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value_buf || !buf_len);
+    FLASH_ASSERT(env_page);
+
+    if (buf_len > ENV_BLOB_LEN_MASK) {
+        FLASH_STATS_END(FLASH_STATS_API_SET_ENV_BLOB);
+        return FLASH_ENV_FULL;
+    }
+
+    FLASH_ENV_WRITE_LOCK();
+    result = set_env(key, key_len, value_buf, buf_len, TRUE, FLASH_ENV_TYPE_BLOB);
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV_BLOB);
+    return result;
+}
+
+/**
+ * Reserve the storage space of an environment variable value.
+ * After reserved, the environment variable which value length is not more than the reserved size
+ * will keep the storage length, so the capacity will not change.
+ * @note The environment variable must be exist. The reserved space will be saved to flash.
+ *
+ * @param key environment variable name
+ * @param value_max_len the maximum length of environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_reserve_env(const char *key, size_t value_max_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t *rec;
+    char *value;
+    size_t i, key_len, value_len, env_len, need_len;
+    bool_t is_blob;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(env_page);
+
+    FLASH_ENV_WRITE_LOCK();
+    /* find environment variables */
+    key_len = strlen(key);
+    i = find_env(key, key_len);
+    if (i == ENV_INDEX_NONE) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_NAME_ERR;
+    }
+
+    rec = get_index_rec(i);
+    env_len = (rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE;
+    get_env_value((char *) (rec + ENV_LOG_REC_WORD_SIZE), key_len, &value_len, &is_blob);
+    need_len = calc_env_len(key_len, value_max_len, is_blob);
+    /* the storage space is already enough */
+    if (need_len <= env_len) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return result;
+    }
+    /* check capacity of environment variables  */
+    if (!env_is_fit(i, need_len, 0)) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_FULL;
+    }
+    /* the old value is got after allocated, the saving in allocating may replace its page */
+    result = env_dirty_alloc(ENV_LOG_REC_BYTE_SIZE + need_len);
+    if (result == FLASH_NO_ERR) {
+        rec = get_index_rec(i);
+        value = get_env_value((char *) (rec + ENV_LOG_REC_WORD_SIZE), key_len, &value_len,
+                &is_blob);
+        write_env(i, key, key_len, value, value_len, is_blob,
+                is_blob ? get_env_blob_type(value) : 0, need_len, env_len);
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+    return result;
+}
+
+/**
+ * Get an environment variable value by key name.
+ * @note The value of blob environment variable is empty. @see flash_get_env_blob
+ * @note The value is in page cache or changes buffer, it's only valid until next environment
+ *       variables API calling, so use flash_get_env_blob to copy it when there are multiple
+ *       threads.
+ *
+ * @param key environment variable name
+ *
+ * @return value
+ */
+char *flash_get_env(const char *key) {
+    char *value = NULL;
+    size_t i;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(env_page);
+
+    /* finding changes the page cache, so it's in the write lock */
+    FLASH_ENV_WRITE_LOCK();
+    /* find environment variables */
+    i = find_env(key, strlen(key));
+    if (i != ENV_INDEX_NONE) {
+        /* the equal sign next character is value */
+        value = (char *) (get_index_rec(i) + ENV_LOG_REC_WORD_SIZE) + strlen(key) + 1;
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV);
+    return value;
+}
+
+/**
+ * Get a blob environment variable value by key name. The string value also can be got by it.
+ *
+ * @param key environment variable name
+ * @param value_buf the buffer for saving value
+ * @param buf_len buffer length
+ * @param saved_value_len the value length which saved in environment variables, it can be NULL.
+ *        It's 0 when not find the environment variable.
+ *
+ * @return the value length which is copied to buffer
+ */
+size_t flash_get_env_blob(const char *key, void *value_buf, size_t buf_len,
+        size_t *saved_value_len) {
+    FLASH_ASSERT(key);
+
+    return flash_get_env_blob_n(key, strlen(key), value_buf, buf_len, saved_value_len);
+}
+
+/**
+ * Get a blob environment variable value by key name and name length.
+ * @see flash_get_env_blob
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value_buf the buffer for saving value
+ * @param buf_len buffer length
+ * @param saved_value_len the value length which saved in environment variables, it can be NULL
+ *
+ * @return the value length which is copied to buffer
+ */
+size_t flash_get_env_blob_n(const char *key, size_t key_len, void *value_buf, size_t buf_len,
+        size_t *saved_value_len) {
+    char *value;
+    size_t i, value_len = 0;
+    bool_t is_blob;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value_buf || !buf_len);
+    FLASH_ASSERT(env_page);
+
+    /* finding changes the page cache, so it's in the write lock */
+    FLASH_ENV_WRITE_LOCK();
+    /* find environment variables */
+    i = find_env(key, key_len);
+    if (i != ENV_INDEX_NONE) {
+        value = get_env_value((char *) (get_index_rec(i) + ENV_LOG_REC_WORD_SIZE), key_len,
+                &value_len, &is_blob);
+        if (buf_len > value_len) {
+            buf_len = value_len;
+        }
+        memcpy(value_buf, value, buf_len);
+    } else {
+        buf_len = 0;
+    }
+    if (saved_value_len) {
+        *saved_value_len = value_len;
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV_BLOB);
+    return buf_len;
+}
+
+/**
+ * Set a typed environment variable. It's stored as fixed width blob which type is saved in the
+ * blob header word. If not find it in environment variables table, then create it.
+ *
+ * @param key environment variable name
+ * @param value the value buffer
+ * @param size the value width
+ * @param type the value type, it must not be FLASH_ENV_TYPE_BLOB
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_typed(const char *key, const void *value, size_t size,
+        flash_env_type type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value);
+    FLASH_ASSERT(type != FLASH_ENV_TYPE_BLOB);
+    FLASH_ASSERT(env_page);
+
+    FLASH_ENV_WRITE_LOCK();
+    result = set_env(key, strlen(key), value, size, TRUE, type);
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_SET_ENV_TYPED);
+    return result;
+}
+
+/**
+ * Get a typed environment variable. It's found and copied in one lookup.
+ *
+ * @param key environment variable name
+ * @param value the value buffer
+ * @param size the value width
+ * @param type the value type
+ *
+ * @return result, FLASH_ENV_NAME_ERR when not find, FLASH_ENV_TYPE_ERR when the saved value is not
+ *         this type or its width is not equal
+ */
+FlashErrCode flash_get_env_typed(const char *key, void *value, size_t size, flash_env_type type) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *env_value;
+    size_t i, key_len, value_len;
+    bool_t is_blob;
+    FLASH_STATS_START();
+
+    FLASH_ASSERT(key);
+    FLASH_ASSERT(value);
+    FLASH_ASSERT(env_page);
+
+    /* finding changes the page cache, so it's in the write lock */
+    FLASH_ENV_WRITE_LOCK();
+    key_len = strlen(key);
+    i = find_env(key, key_len);
+    if (i == ENV_INDEX_NONE) {
+        result = FLASH_ENV_NAME_ERR;
+    } else {
+        env_value = get_env_value((char *) (get_index_rec(i) + ENV_LOG_REC_WORD_SIZE), key_len,
+                &value_len, &is_blob);
+        if (!is_blob || get_env_blob_type(env_value) != type || value_len != size) {
+            result = FLASH_ENV_TYPE_ERR;
+        } else {
+            memcpy(value, env_value, size);
+        }
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_GET_ENV_TYPED);
+    return result;
+}
+
+/**
+ * Print an environment variable, the blob value will be printed by hex.
+ * @see flash_env_iterator
+ */
+static bool_t print_env_iterator(const char *key, size_t key_len, const char *value,
+        size_t value_len, bool_t is_blob, void *arg) {
+    size_t i;
+
+    /* storage model is key=value\0 */
+    flash_print("%s", key);
+    for (i = 0; is_blob && i < value_len; i++) {
+        flash_print("%02X", (uint8_t) value[i]);
+    }
+    flash_print("\n");
+
+    return TRUE;
+}
+
+/**
+ * Print environment variables.
+ */
+void flash_print_env(void) {
+    FLASH_ASSERT(env_page);
+
+    FLASH_ENV_WRITE_LOCK();
+    env_traverse("", 0, print_env_iterator, NULL);
+    flash_print("\nEnvironment variables size: %ld/%ld bytes, mode: log, paged cache hits: "
+            "%ld/%ld.\n", flash_get_env_used_size(), flash_get_env_total_size(),
+            (long) env_page_hit, (long) (env_page_hit + env_page_miss));
+    FLASH_ENV_WRITE_UNLOCK();
+}
+
+/**
+ * Load flash environment variables without lock. Only the hash index is built, the records are
+ * read by page cache.
+ * @see flash_load_env
+ */
+static void load_env(void) {
+    bool_t is_loaded;
+
+    FLASH_ASSERT(env_page);
+
+    env_data_size = 0;
+    env_count = 0;
+    env_index_clear();
+    env_dirty_len = 0;
+    /* drop all pages, the flash maybe changed after last loaded */
+    env_page_drop(env_sector_num);
+
+    is_loaded = env_log_load();
+    env_page_unpin();
+    if (!is_loaded) {
+        env_set_default();
+        return;
+    }
+    /* the environment variables in ram is same as flash */
+    env_saved_gen = env_cache_gen;
+}
+
+/**
+ * Load flash environment variables to ram.
+ */
+void flash_load_env(void) {
+    FLASH_STATS_START();
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    load_env();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_LOAD_ENV);
+}
+
+/**
+ * Save environment variables to flash without lock.
+ * @see flash_save_env
+ *
+ * @return result
+ */
+static FlashErrCode save_env(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ASSERT(env_page);
+
+    /* the environment variables has no change after last saved */
+    if (env_cache_gen == env_saved_gen) {
+        FLASH_DEBUG("Environment variables has no change, skip saving.\n");
+        return result;
+    }
+
+    result = env_log_save();
+
+    switch (result) {
+    case FLASH_NO_ERR: {
+        env_dirty_len = 0;
+        env_saved_gen = env_cache_gen;
+        FLASH_INFO("Saved environment variables OK.\n");
+        break;
+    }
+    default: {
+        FLASH_INFO("Warning: Saved environment variables fault!\n");
+        break;
+    }
+    }
+
+    return result;
+}
+
+/**
+ * Save environment variables to flash.
+ */
+FlashErrCode flash_save_env(void) {
+    return flash_save_env_gen(NULL, NULL);
+}
+
+/**
+ * Save environment variables to flash and get the generation which has been saved.
+ * @note The log mode only appends the changed environment variables in saving, so it doesn't use
+ *       the snapshot and the saving is always in the write lock. @see flash_save_env
+ *
+ * @param saved_gen the generation which has been saved to flash, it can be NULL
+ * @param written it's TRUE when this saving has written flash, FALSE when there is no change or
+ *        the saving is failed or deferred, it can be NULL
+ *
+ * @return result
+ */
+FlashErrCode flash_save_env_gen(uint32_t *saved_gen, bool_t *written) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t last_saved_gen;
+    bool_t is_written = FALSE;
+    FLASH_STATS_START();
+
+    FLASH_ENV_WRITE_LOCK();
+    last_saved_gen = env_saved_gen;
+    result = save_env();
+    if (saved_gen) {
+        *saved_gen = env_saved_gen;
+    }
+    /* the saved generation is only changed by writing flash */
+    is_written = (env_saved_gen != last_saved_gen);
+    FLASH_ENV_WRITE_UNLOCK();
+    if (written) {
+        *written = is_written;
+    }
+
+    FLASH_STATS_END(FLASH_STATS_API_SAVE_ENV);
+    return result;
+}
+
+/**
+ * Calculate environment variable name 15 bits hash code. (FNV-1a)
+ *
+ * @param key environment variable name
+ * @param key_len environment variable name length
+ *
+ * @return hash code
+ */
+static uint16_t calc_env_key_hash(const char *key, size_t key_len) {
+    uint32_t hash = 2166136261UL;
+
+    while (key_len--) {
+        hash ^= (uint8_t) *key++;
+        hash *= 16777619UL;
+    }
+
+    return (uint16_t) ((hash ^ (hash >> 16)) & ENV_INDEX_HASH_MASK);
+}
+
+/**
+ * Clean the hash index.
+ */
+static void env_index_clear(void) {
+    memset(env_index, 0, sizeof(uint16_t) * env_index_size);
+    memset(env_index_hash, 0, sizeof(uint16_t) * env_index_size);
+    env_index_count = 0;
+}
+
+/**
+ * Add an environment variable record to hash index.
+ * @note The hash index must have empty bucket.
+ *
+ * @param hash environment variable name hash code
+ * @param offset record word offset in flash area or changes buffer
+ * @param flag ENV_INDEX_DIRTY is in changes buffer, 0 is in flash
+ */
+static void env_index_add(uint16_t hash, size_t offset, uint16_t flag) {
+    size_t i;
+
+    for (i = hash & (env_index_size - 1); env_index[i];
+            i = (i + 1) & (env_index_size - 1));
+    env_index[i] = (uint16_t) (offset + 1);
+    env_index_hash[i] = hash | flag;
+    env_index_count++;
+}
+
+/**
+ * Delete a bucket from hash index.
+ *
+ * @param i hash index bucket
+ */
+static void env_index_del(size_t i) {
+    size_t j, home;
+
+    env_index[i] = 0;
+    env_index_count--;
+
+    /* move the following buckets in same probing sequence backward, make no hole in sequence */
+    for (j = (i + 1) & (env_index_size - 1); env_index[j];
+            j = (j + 1) & (env_index_size - 1)) {
+        home = env_index_hash[j] & ENV_INDEX_HASH_MASK & (env_index_size - 1);
+        /* the home bucket is not cyclically in (i, j], so it can move to i */
+        if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+            env_index[i] = env_index[j];
+            env_index_hash[i] = env_index_hash[j];
+            env_index[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/**
+ * Find the hash index bucket which uses the record. It only compares the record position, so no
+ * record will be read.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param offset record word offset in flash area or changes buffer
+ * @param flag ENV_INDEX_DIRTY is in changes buffer, 0 is in flash
+ *
+ * @return hash index bucket, ENV_INDEX_NONE is not found
+ */
+static size_t env_index_find_rec(const char *key, size_t key_len, size_t offset, uint16_t flag) {
+    uint16_t hash = calc_env_key_hash(key, key_len);
+    size_t i;
+
+    for (i = hash & (env_index_size - 1); env_index[i];
+            i = (i + 1) & (env_index_size - 1)) {
+        if (env_index[i] == offset + 1 && env_index_hash[i] == (hash | flag)) {
+            return i;
+        }
+    }
+    return ENV_INDEX_NONE;
+}
+
+/**
+ * Load a sector to page cache. The least recently used page which is not pinned will be replaced.
+ *
+ * @param sector sector index
+ *
+ * @return page, NULL when all pages are pinned
+ */
+static uint32_t *env_page_load(size_t sector) {
+    size_t i, victim = FLASH_ENV_PAGED_CACHE_NUM;
+    uint32_t *page;
+
+    for (i = 0; i < FLASH_ENV_PAGED_CACHE_NUM; i++) {
+        if (env_page_sector[i] == sector) {
+            env_page_used[i] = ++env_page_clock;
+            env_page_hit++;
+            return env_page + i * env_sector_size / 4;
+        }
+        if (!env_page_pinned[i] && (victim == FLASH_ENV_PAGED_CACHE_NUM
+                || env_page_used[i] < env_page_used[victim])) {
+            victim = i;
+        }
+    }
+    if (victim == FLASH_ENV_PAGED_CACHE_NUM) {
+        FLASH_INFO("Warning: All pages of environment variables are pinned.\n");
+        return NULL;
+    }
+
+    page = env_page + victim * env_sector_size / 4;
+    FLASH_READ(env_start_addr + sector * env_sector_size, page, env_sector_size);
+    env_page_sector[victim] = sector;
+    env_page_used[victim] = ++env_page_clock;
+    env_page_miss++;
+
+    return page;
+}
+
+/**
+ * Get the data in flash area by page cache.
+ *
+ * @param offset word offset in flash area
+ *
+ * @return data in page, NULL when all pages are pinned
+ */
+static uint32_t *env_page_get(size_t offset) {
+    uint32_t *page = env_page_load(offset * 4 / env_sector_size);
+
+    if (!page) {
+        return NULL;
+    }
+    return page + offset % (env_sector_size / 4);
+}
+
+/**
+ * Pin the cached page of a sector, it can't be replaced until unpinned.
+ *
+ * @param sector sector index
+ */
+static void env_page_pin(size_t sector) {
+    size_t i;
+
+    for (i = 0; i < FLASH_ENV_PAGED_CACHE_NUM; i++) {
+        if (env_page_sector[i] == sector) {
+            env_page_pinned[i] = TRUE;
+        }
+    }
+}
+
+/**
+ * Unpin all pages.
+ */
+static void env_page_unpin(void) {
+    size_t i;
+
+    for (i = 0; i < FLASH_ENV_PAGED_CACHE_NUM; i++) {
+        env_page_pinned[i] = FALSE;
+    }
+}
+
+/**
+ * Drop the cached page of a sector, it's called when the sector in flash is changed.
+ * The empty page can also be dropped by env_sector_num.
+ *
+ * @param sector sector index
+ */
+static void env_page_drop(size_t sector) {
+    size_t i;
+
+    for (i = 0; i < FLASH_ENV_PAGED_CACHE_NUM; i++) {
+        if (env_page_sector[i] == sector || sector >= env_sector_num) {
+            env_page_sector[i] = env_sector_num;
+            env_page_used[i] = 0;
+            env_page_pinned[i] = FALSE;
+        }
+    }
+}
+
+/**
+ * Find the record of an environment variable in changes buffer.
+ *
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ *
+ * @return record, NULL is not found
+ */
+static uint32_t *env_dirty_find(const char *key, size_t key_len) {
+    uint32_t *rec, *dirty_end = env_dirty + env_dirty_len / 4;
+
+    for (rec = env_dirty; rec < dirty_end; rec += (rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF) / 4) {
+        if (((rec[ENV_LOG_REC_INDEX_INFO] >> 16) & 0xFF) == key_len
+                && !memcmp(rec + ENV_LOG_REC_WORD_SIZE, key, key_len)) {
+            return rec;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add a record at the end of changes buffer.
+ * @note The changes buffer must have space for it. @see env_dirty_alloc
+ *
+ * @param type record type
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
+ * @param env_len storage length
+ *
+ * @return record word offset in changes buffer
+ */
+static size_t env_dirty_add(uint8_t type, const char *key, size_t key_len, const void *value,
+        size_t value_len, bool_t is_blob, uint8_t blob_type, size_t env_len) {
+    uint32_t *rec = env_dirty + env_dirty_len / 4;
+
+    FLASH_ASSERT(env_dirty_len + ENV_LOG_REC_BYTE_SIZE + env_len <= FLASH_ENV_PAGED_DIRTY_SIZE);
+
+    /* the sequence number and CRC32 code are made when it's appended to flash */
+    rec[ENV_LOG_REC_INDEX_INFO] = (ENV_LOG_REC_BYTE_SIZE + env_len) | (key_len << 16)
+            | ((uint32_t) type << 24);
+    rec[ENV_LOG_REC_INDEX_SEQ] = 0;
+    rec[ENV_LOG_REC_INDEX_CRC] = 0;
+    make_env((char *) (rec + ENV_LOG_REC_WORD_SIZE), env_len, key, key_len, value, value_len,
+            is_blob, blob_type);
+    env_dirty_len += ENV_LOG_REC_BYTE_SIZE + env_len;
+
+    return rec - env_dirty;
+}
+
+/**
+ * Remove the records from changes buffer. The records behind them move forward.
+ * @note The removed records must be not used by hash index.
+ *
+ * @param offset the first removed record word offset in changes buffer
+ * @param len removed bytes size
+ */
+static void env_dirty_remove(size_t offset, size_t len) {
+    size_t i;
+
+    memmove(env_dirty + offset, env_dirty + offset + len / 4, env_dirty_len - offset * 4 - len);
+    env_dirty_len -= len;
+
+    for (i = 0; i < env_index_size; i++) {
+        if (env_index[i] && (env_index_hash[i] & ENV_INDEX_DIRTY)
+                && (size_t) (env_index[i] - 1) >= offset + len / 4) {
+            env_index[i] = (uint16_t) (env_index[i] - len / 4);
+        }
+    }
+}
+
+/**
+ * Make sure the changes buffer has space for a record. The changes will be saved when it has no
+ * space.
+ *
+ * @param rec_len record length
+ *
+ * @return result
+ */
+static FlashErrCode env_dirty_alloc(size_t rec_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    if (rec_len > FLASH_ENV_PAGED_DIRTY_SIZE) {
+        FLASH_INFO("Flash environment variable is larger than changes buffer.\n");
+        return FLASH_ENV_FULL;
+    }
+    if (env_dirty_len + rec_len > FLASH_ENV_PAGED_DIRTY_SIZE) {
+        result = save_env();
+        if (result == FLASH_NO_ERR && env_dirty_len + rec_len > FLASH_ENV_PAGED_DIRTY_SIZE) {
+            result = FLASH_ENV_FULL;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Check all environment variables can be compacted into reserved sectors after they are changed.
+ * @see env_log_is_fit
+ *
+ * @param change_i the hash index bucket which storage length will be changed, ENV_INDEX_NONE is
+ *        none
+ * @param change_len the new storage length of change_i, 0 is deleted
+ * @param env_len the new environment variable storage length, 0 is none
+ *
+ * @return true is fit
+ */
+static bool_t env_is_fit(size_t change_i, size_t change_len, size_t env_len) {
+    size_t data_size = env_data_size, rec_num = env_count;
+    env_fit_change change = { change_i, change_len, env_len };
+
+    if (change_i != ENV_INDEX_NONE) {
+        data_size = data_size - get_index_env_len(change_i) + change_len;
+        if (change_len == 0) {
+            rec_num--;
+        }
+    }
+    if (env_len) {
+        data_size += env_len;
+        rec_num++;
+    }
+
+    return env_log_is_fit(data_size, rec_num, change_len > env_len ? change_len : env_len,
+            env_fit_len_iter, &change);
+}
+
+/**
+ * Iterate the storage length of all environment variables after they are changed. The record
+ * header in flash is read directly, so the page cache will not be changed.
+ * @see env_log_len_iter
+ *
+ * @param pos hash index bucket, the new environment variable is after all buckets
+ * @param len environment variable storage length, 0 is deleted
+ * @param arg the changed environment variable, @see env_fit_change
+ *
+ * @return false is no more environment variable
+ */
+static bool_t env_fit_len_iter(size_t *pos, size_t *len, void *arg) {
+    env_fit_change *change = (env_fit_change *) arg;
+
+    for (; *pos < env_index_size && !env_index[*pos]; (*pos)++);
+    if (*pos > env_index_size) {
+        return FALSE;
+    } else if (*pos == env_index_size) {
+        *len = change->env_len;
+    } else if (*pos == change->i) {
+        *len = change->len;
+    } else {
+        *len = get_index_env_len(*pos);
+    }
+    (*pos)++;
+
+    return TRUE;
+}
+
+/**
+ * Get the data in flash area by page cache. The page is pinned until next reading, so the other
+ * pages are used for comparing names when replaying. @see env_log_ops
+ *
+ * @param offset bytes offset in flash area
+ * @param size read bytes size, it's in a sector
+ *
+ * @return data in page cache
+ */
+static const uint32_t *env_log_read(uint32_t offset, size_t size) {
+    size_t sector = offset / env_sector_size;
+    uint32_t *page;
+
+    FLASH_ASSERT(offset % env_sector_size + size <= env_sector_size);
+
+    env_page_unpin();
+    page = env_page_load(sector);
+    FLASH_ASSERT(page);
+    env_page_pin(sector);
+
+    return page + offset % env_sector_size / 4;
+}
+
+/**
+ * Write data to flash, the cached page of the sector is kept same as flash. @see env_log_ops
+ *
+ * @param offset bytes offset in flash area, the data can not cross the sector
+ * @param buf the write data buffer
+ * @param size write bytes size
+ *
+ * @return result
+ */
+static FlashErrCode env_log_write(uint32_t offset, const uint32_t *buf, size_t size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t sector = offset / env_sector_size, i;
+
+    result = FLASH_WRITE(env_start_addr + offset, buf, size);
+    for (i = 0; i < FLASH_ENV_PAGED_CACHE_NUM; i++) {
+        if (env_page_sector[i] != sector) {
+            continue;
+        }
+        if (result == FLASH_NO_ERR) {
+            memcpy((uint8_t *) (env_page + i * env_sector_size / 4) + offset % env_sector_size,
+                    buf, size);
+        } else {
+            env_page_drop(sector);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Replay the record in pinned page to hash index. @see env_log_ops
+ *
+ * @param offset record bytes offset in flash area
+ * @param rec record in pinned page
+ */
+static void env_log_replay(uint32_t offset, const uint32_t *rec) {
+    uint32_t info = rec[ENV_LOG_REC_INDEX_INFO];
+    const char *key = (const char *) (rec + ENV_LOG_REC_WORD_SIZE);
+    size_t key_len = (info >> 16) & 0xFF, env_len = (info & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE, i;
+
+    i = find_env(key, key_len);
+    if (i != ENV_INDEX_NONE) {
+        env_data_size -= get_index_env_len(i);
+        if ((info >> 24) == ENV_LOG_REC_SET) {
+            env_index[i] = (uint16_t) (offset / 4 + 1);
+            env_data_size += env_len;
+        } else {
+            env_index_del(i);
+            env_count--;
+        }
+    } else if ((info >> 24) == ENV_LOG_REC_SET) {
+        /* the saved environment variable can't be dropped, and the probing needs an empty bucket */
+        FLASH_ASSERT(env_index_count < env_index_size - 1);
+        env_index_add(calc_env_key_hash(key, key_len), offset / 4, 0);
+        env_data_size += env_len;
+        env_count++;
+    }
+}
+
+/**
+ * Append all environment variables to the new snapshot by hash index order. The hash index uses
+ * the new records after they are appended, so it's still available when compacting is failed.
+ * @see env_log_ops
+ *
+ * @return result
+ */
+static FlashErrCode env_log_snapshot(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t *rec, offset;
+    size_t i;
+
+    for (i = 0; result == FLASH_NO_ERR && i < env_index_size; i++) {
+        if (!env_index[i]) {
+            continue;
+        }
+        rec = get_index_rec(i);
+        result = env_log_append(ENV_LOG_REC_SET, rec + ENV_LOG_REC_WORD_SIZE,
+                (rec[ENV_LOG_REC_INDEX_INFO] & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE,
+                (rec[ENV_LOG_REC_INDEX_INFO] >> 16) & 0xFF, &offset);
+        if (result == FLASH_NO_ERR) {
+            env_index[i] = (uint16_t) (offset / 4 + 1);
+            env_index_hash[i] &= ~ENV_INDEX_DIRTY;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Append all records in changes buffer by order. The appended records are removed from changes
+ * buffer, the others will be appended by next saving. @see env_log_ops
+ *
+ * @return result
+ */
+static FlashErrCode env_log_changes(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t *rec = env_dirty, *dirty_end = env_dirty + env_dirty_len / 4, info, offset;
+    size_t i, key_len;
+
+    for (; rec < dirty_end; rec += (info & 0xFFFF) / 4) {
+        info = rec[ENV_LOG_REC_INDEX_INFO];
+        key_len = (info >> 16) & 0xFF;
+        result = env_log_append(info >> 24, rec + ENV_LOG_REC_WORD_SIZE,
+                (info & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE, key_len, &offset);
+        if (result != FLASH_NO_ERR) {
+            break;
+        }
+        /* the hash index uses the appended record instead of the one in changes buffer */
+        if ((info >> 24) == ENV_LOG_REC_SET) {
+            i = env_index_find_rec((char *) (rec + ENV_LOG_REC_WORD_SIZE), key_len,
+                    rec - env_dirty, ENV_INDEX_DIRTY);
+            FLASH_ASSERT(i != ENV_INDEX_NONE);
+            env_index[i] = (uint16_t) (offset / 4 + 1);
+            env_index_hash[i] &= ~ENV_INDEX_DIRTY;
+        }
+    }
+    env_dirty_remove(0, (rec - env_dirty) * 4);
+
+    return result;
+}
+
+/**
+ * Iterate the records payload length in changes buffer. @see env_log_len_iter
+ *
+ * @param pos bytes offset in changes buffer
+ * @param len record payload length
+ * @param arg not used
+ *
+ * @return false is no more record
+ */
+static bool_t env_log_changes_len(size_t *pos, size_t *len, void *arg) {
+    if (*pos >= env_dirty_len) {
+        return FALSE;
+    }
+    *len = (env_dirty[*pos / 4 + ENV_LOG_REC_INDEX_INFO] & 0xFFFF) - ENV_LOG_REC_BYTE_SIZE;
+    *pos += ENV_LOG_REC_BYTE_SIZE + *len;
+
+    return TRUE;
+}
+
+#endif
@@ -20,7 +20,7 @@
  * Created on: 2015-02-11
  */
 
-#include "flash.h"
+#include "flash_env_cache.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -29,21 +29,40 @@
 /**
  * Environment variables area has 2 sections
  * 1. System section
- *    Storage Environment variables current using data section address.
+ *    Storage Environment variables current using data section address. It's only a hint for
+ *    finding the newest saved environment variables in data section.
+ *    The addresses are appended to the erased words one by one, the last written one is used. The
+ *    system section will be erased only when all words have been written. The erase is counted in
+ *    the parameters part which is written by the same saving.
  *    Units: Word. Total size: @see FLASH_ERASE_MIN_SIZE.
  * 2. Data section
- *    The data section storage environment variables's parameters and detail.
- *    When an exception has occurred on flash erase or write. The current using data section
- *    address will move to next available position. This position depends on FLASH_MIN_ERASE_SIZE.
+ *    The data section storage environment variables's parameters and detail. It's used as a ring of
+ *    FLASH_ERASE_MIN_SIZE units. Every saving writes to the units behind the last saved ones, so
+ *    the erasure is spread over all units and the last saved ones are never erased in saving. The
+ *    size of environment variables must be not more than half of data section.
+ *    When an exception has occurred on flash erase or write. The saving will move to next unit.
  *    2.1 Environment variables parameters part
- *        It storage environment variables's parameters.
+ *        It storage environment variables's parameters and the erase counters of all erase units
+ *        in environment variables area. When FLASH_ENV_USING_ERASE_BUDGET is enabled, the erase
+ *        budget of every erase unit is behind the erase counters. The sequence number is written
+ *        at last, the newest saved environment variables has the biggest one.
  *    2.2 Environment variables detail part
  *        It storage all environment variables. Storage format is key=value\0.
+ *        The blob value storage format is key=\0 + blob header word + blob data.
+ *        When FLASH_ENV_USING_CRC_CHECK is enabled, every environment variable has a CRC32 word
+ *        behind its value. The parameters part CRC32 only checks the XOR of them.
  *        All environment variables must be 4 bytes alignment. The remaining part must fill '\0'.
  *
  * @note Word = 4 Bytes in this file
  */
 
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/* the erase budget words number in parameters part, every erase unit has one */
+#define ENV_ERASE_BUDGET_WORD_NUM                FLASH_ENV_WEAR_SECTOR_NUM
+#else
+#define ENV_ERASE_BUDGET_WORD_NUM                0
+#endif
+
 /* flash ENV parameters part index and size */
 enum {
     /* data section environment variables detail part end address index */
@@ -54,6 +73,17 @@ enum {
     ENV_PARAM_PART_INDEX_DATA_CRC,
 #endif
 
+    /* erase counters index, every erase unit in environment variables area has one, the number is
+     * FLASH_ENV_WEAR_SECTOR_NUM */
+    ENV_PARAM_PART_INDEX_ERASE_CNT,
+
+    /* erase budget index, it's behind the erase counters, the number is
+     * ENV_ERASE_BUDGET_WORD_NUM */
+    ENV_PARAM_PART_INDEX_ERASE_BUDGET = ENV_PARAM_PART_INDEX_ERASE_CNT + FLASH_ENV_WEAR_SECTOR_NUM,
+
+    /* saved sequence number index, it's the last one for commit */
+    ENV_PARAM_PART_INDEX_SEQ = ENV_PARAM_PART_INDEX_ERASE_BUDGET + ENV_ERASE_BUDGET_WORD_NUM,
+
     /* environment variables parameters part word size */
     ENV_PARAM_PART_WORD_SIZE,
     /* environment variables parameters part byte size */
@@ -63,35 +93,97 @@ enum {
 /* default environment variables set, must be initialized by user */
 static flash_env const *default_env_set = NULL;
 /* default environment variables set size, must be initialized by user */
-static size_t default_env_set_size = NULL;
+static size_t default_env_set_size = 0;
 /* flash environment variables all section total size */
-static size_t env_total_size = NULL;
+static size_t env_total_size = 0;
 /* the minimum size of flash erasure */
-static size_t flash_erase_min_size = NULL;
+static size_t flash_erase_min_size = 0;
 /* environment variables RAM cache */
 static uint32_t *env_cache = NULL;
 /* environment variables start address in flash */
-static uint32_t env_start_addr = NULL;
+static uint32_t env_start_addr = 0;
+/* environment variables RAM cache generation, it will increase when the cache has changed */
+static uint32_t env_cache_gen = 0;
+/* the environment variables RAM cache generation which has been saved to flash */
+static uint32_t env_saved_gen = 0;
+/* environment variables are being set by batch, the deleted ones will be removed by one pass */
+static bool_t env_is_batching = FALSE;
+/* the bytes size of environment variables which are marked as deleted in batch */
+static size_t env_marked_size = 0;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+/* the XOR of all environment variables CRC32, it's updated when an environment variable changed */
+static uint32_t env_crc_sum = 0;
+#endif
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/* environment variables snapshot for saving, it's same size as RAM cache */
+static uint32_t *env_snapshot = NULL;
+#endif
+/* environment variables data section size, it's a multiple of the minimum size of flash erasure */
+static size_t env_data_section_size = 0;
+/* the maximum size of environment variables parameters part and detail part in data section */
+static size_t env_copy_size = 0;
 /* current using data section address */
-static uint32_t cur_using_data_addr = NULL;
+static uint32_t cur_using_data_addr = 0;
+/* the environment variables size at current using data section address, 0 is not saved */
+static size_t cur_using_data_size = 0;
+/* the next erased word index in system section for appending current using data section address */
+static size_t cur_using_data_addr_index = 0;
 
 static uint32_t get_env_start_addr(void);
+static uint32_t get_env_data_section_addr(void);
 static uint32_t get_cur_using_data_addr(void);
 static uint32_t get_env_detail_addr(void);
 static uint32_t get_env_detail_end_addr(void);
 static void set_cur_using_data_addr(uint32_t using_data_addr);
 static void set_env_detail_end_addr(uint32_t end_addr);
-static FlashErrCode write_env(const char *key, const char *value);
-static uint32_t *find_env(const char *key);
+static FlashErrCode write_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
 static size_t get_env_detail_size(void);
-static FlashErrCode create_env(const char *key, const char *value);
-static FlashErrCode save_cur_using_data_addr(uint32_t cur_data_addr);
+static void update_env_crc_sum(const char *env);
+static void del_env(char *env);
+static void del_marked_env(void);
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save);
+static FlashErrCode env_set_default(void);
+static void load_env(void);
+static FlashErrCode save_env(void);
+static FlashErrCode save_env_data(uint32_t *cache, size_t data_size, uint32_t crc_sum,
+        uint32_t *data_addr);
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+static FlashErrCode save_env_snapshot(uint32_t *saved_gen, bool_t *written);
+#endif
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type);
+static uint32_t read_cur_using_data_addr(void);
+static bool_t sys_section_is_full(void);
+static FlashErrCode save_cur_using_data_addr(uint32_t cur_data_addr, bool_t is_full);
+static uint32_t get_next_data_addr(uint32_t data_addr, size_t data_size);
+static bool_t read_env_param(uint32_t data_addr, uint32_t *param);
+static uint32_t scan_env_data(uint32_t *param, bool_t is_older, uint32_t seq);
+static uint32_t follow_env_data(uint32_t data_addr, uint32_t *param);
+static void read_env_data(uint32_t addr, uint32_t *buf, size_t size);
+static FlashErrCode write_env_data(uint32_t addr, const uint32_t *buf, size_t size);
+static FlashErrCode erase_env_data(uint32_t *cache, uint32_t addr, size_t size);
+static void inc_env_erase_cnt(uint32_t *cache, uint32_t addr, size_t size);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+static bool_t env_erase_budget_check(size_t data_size);
+static void get_env_erase_budget(uint32_t *cache);
+static void set_env_erase_budget(const uint32_t *cache);
+#endif
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
-static uint32_t calc_env_crc(void);
+static uint32_t calc_env_crc(const uint32_t *cache, uint32_t crc_sum);
 static bool_t env_crc_is_ok(void);
+static size_t check_env(const char *env, const char *env_end);
+static void salvage_env(void);
 #endif
 
+/* the operations of environment variables data in RAM cache, @see flash_env_cache.c */
+static const env_data_ops env_cache_data_ops = {
+    get_env_detail_size,
+    set_env,
+    set_env_batch,
+};
+
 /**
  * Flash environment variables initialize.
  *
@@ -114,6 +206,12 @@ FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase
     FLASH_ASSERT(default_env_size < total_size);
     /* must be word alignment for environment variables */
     FLASH_ASSERT(total_size % 4 == 0);
+    /* hash index storage word offset by 16 bits */
+    FLASH_ASSERT(total_size / 4 < 0xFFFF);
+    /* system section has one erase unit and data section has two erase units at least */
+    FLASH_ASSERT(total_size >= 3 * erase_min_size);
+    /* every erase unit has an erase counter in parameters part */
+    FLASH_ASSERT(total_size / erase_min_size <= FLASH_ENV_WEAR_SECTOR_NUM);
     /* make true only be initialized once */
     FLASH_ASSERT(!env_cache);
 
@@ -122,12 +220,23 @@ FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase
     flash_erase_min_size = erase_min_size;
     default_env_set = default_env;
     default_env_set_size = default_env_size;
+    env_data_section_size = (total_size - erase_min_size) / erase_min_size * erase_min_size;
+    /* the last saved ones are not erased in saving, so it's half of data section */
+    env_copy_size = env_data_section_size / erase_min_size / 2 * erase_min_size;
 
     FLASH_DEBUG("Env start address is 0x%08X, size is %d bytes.\n", start_addr, total_size);
 
-    /* create environment variables ram cache */
-    env_cache = (uint32_t *) flash_malloc(sizeof(uint8_t) * total_size);
+    /* create environment variables ram cache, it's same size as the maximum size in data section */
+    env_cache = (uint32_t *) flash_malloc(sizeof(uint8_t) * env_copy_size);
     FLASH_ASSERT(env_cache);
+    env_cache_init((char *) env_cache + ENV_PARAM_PART_BYTE_SIZE, &env_cache_data_ops);
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+    env_snapshot = (uint32_t *) flash_malloc(sizeof(uint8_t) * env_copy_size);
+    FLASH_ASSERT(env_snapshot);
+#endif
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    flash_erase_budget_init(total_size / erase_min_size);
+#endif
 
     flash_load_env();
 
@@ -135,13 +244,13 @@ FlashErrCode flash_env_init(uint32_t start_addr, size_t total_size, size_t erase
 }
 
 /**
- * Environment variables set default.
+ * Environment variables set default without lock.
+ * @see flash_env_set_default
  *
  * @return result
  */
-FlashErrCode flash_env_set_default(void){
+static FlashErrCode env_set_default(void) {
     FlashErrCode result = FLASH_NO_ERR;
-    size_t i;
 
     FLASH_ASSERT(env_cache);
     FLASH_ASSERT(default_env_set);
@@ -149,13 +258,31 @@ FlashErrCode flash_env_set_default(void){
 
     /* set ENV detail part end address is at ENV detail part start address */
     set_env_detail_end_addr(get_env_detail_addr());
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    env_crc_sum = 0;
+#endif
+    /* clean the hash index */
+    env_index_build();
 
-    /* create default environment variables */
-    for (i = 0; i < default_env_set_size; i++) {
-        create_env(default_env_set[i].key, default_env_set[i].value);
-    }
+    /* create default environment variables and save them */
+    result = set_env_batch(default_env_set, default_env_set_size, TRUE);
 
-    flash_save_env();
+    return result;
+}
+
+/**
+ * Environment variables set default.
+ *
+ * @return result
+ */
+FlashErrCode flash_env_set_default(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    result = env_set_default();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
 
     return result;
 }
@@ -169,6 +296,16 @@ static uint32_t get_env_start_addr(void) {
     FLASH_ASSERT(env_start_addr);
     return env_start_addr;
 }
+
+/**
+ * Get environment variables data section start address. It's behind the system section.
+ *
+ * @return data section start address
+ */
+static uint32_t get_env_data_section_addr(void) {
+    return get_env_start_addr() + flash_erase_min_size;
+}
+
 /**
  * Get current using data section address.
  *
@@ -191,11 +328,13 @@ static void set_cur_using_data_addr(uint32_t using_data_addr) {
 /**
  * Get environment variables detail part start address.
  *
+ * @note The detail part addresses are always based on the data section start address, because
+ * the environment variables are saved to different units.
+ *
  * @return detail part start address
  */
 static uint32_t get_env_detail_addr(void) {
-    FLASH_ASSERT(cur_using_data_addr);
-    return cur_using_data_addr + ENV_PARAM_PART_BYTE_SIZE;
+    return get_env_data_section_addr() + ENV_PARAM_PART_BYTE_SIZE;
 }
 
 /**
@@ -233,7 +372,7 @@ static size_t get_env_detail_size(void) {
  *
  * @return size
  */
-size_t flash_get_env_total_size(void) {
+uint32_t flash_get_env_total_size(void) {
     /* must be initialized */
     FLASH_ASSERT(env_total_size);
 
@@ -246,410 +385,784 @@ size_t flash_get_env_total_size(void) {
  * @return size
  */
 uint32_t flash_get_env_used_size(void) {
-    return get_env_detail_end_addr() - get_env_start_addr();
+    return get_env_detail_end_addr() - get_env_data_section_addr();
+}
+
+/**
+ * Get environment variables RAM cache generation. It will increase when the cache has changed.
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_gen(void) {
+    return env_cache_gen;
+}
+
+/**
+ * Get the environment variables RAM cache generation which has been saved to flash.
+ * If it's not equal to flash_get_env_gen(), the cache has changed after last saved. So the saving
+ * has written flash when this generation changed after called flash_save_env().
+ *
+ * @return generation
+ */
+uint32_t flash_get_env_saved_gen(void) {
+    return env_saved_gen;
+}
+
+/**
+ * Get the erase counters of all erase units in environment variables area. The counters are
+ * saved in parameters part, so they are kept after power down.
+ *
+ * @param erase_cnt erase counters buffer, the first one is the erase unit at start address
+ * @param num erase counters buffer number
+ *
+ * @return erase units number of environment variables area
+ */
+size_t flash_get_env_erase_cnt(uint32_t *erase_cnt, size_t num) {
+    size_t sector_num = env_total_size / flash_erase_min_size, i;
+
+    FLASH_ASSERT(env_cache);
+
+    FLASH_ENV_READ_LOCK();
+    for (i = 0; i < num && i < sector_num; i++) {
+        erase_cnt[i] = env_cache[ENV_PARAM_PART_INDEX_ERASE_CNT + i];
+    }
+    FLASH_ENV_READ_UNLOCK();
+
+    return sector_num;
 }
 
 /**
  * Write an environment variable at the end of cache.
  *
- * @param key environment variable name
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
  * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
  *
  * @return result
  */
-static FlashErrCode write_env(const char *key, const char *value) {
+static FlashErrCode write_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
     FlashErrCode result = FLASH_NO_ERR;
-    uint16_t env_str_index = 0, env_str_length, i;
-    char *env_str;
+    size_t env_len = calc_env_len(key_len, value_len, is_blob);
+    char *env = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size();
 
-    /* calculate environment variables storage length, contain '=' and '\0'. */
-    env_str_length = strlen(key) + strlen(value) + 2;
-    if (env_str_length % 4 != 0) {
-        env_str_length = (env_str_length / 4 + 1) * 4;
+    /* remove the environment variables which are deleted in batch for more space */
+    if (env_marked_size && env_len + flash_get_env_used_size() > env_copy_size) {
+        del_marked_env();
+        env = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size();
     }
     /* check capacity of environment variables  */
-    if (env_str_length + get_env_detail_size() >= flash_get_env_total_size()) {
+    if (env_len + flash_get_env_used_size() > env_copy_size) {
         return FLASH_ENV_FULL;
     }
-    /* use ram to process string key=value\0 */
-    env_str = flash_malloc(env_str_length * sizeof(char));
-    FLASH_ASSERT(env_str);
-    memset(env_str, 0, env_str_length * sizeof(char));
-    /* copy key name */
-    for (env_str_index = 0; env_str_index < strlen(key); env_str_index++) {
-        env_str[env_str_index] = key[env_str_index];
-    }
-    /* copy equal sign */
-    env_str[env_str_index] = '=';
-    env_str_index++;
-    /* copy value */
-    for (i = 0; i < strlen(value); env_str_index++, i++) {
-        env_str[env_str_index] = value[i];
+    /* it will be made in ram cache directly */
+    make_env(env, env_len, key, key_len, value, value_len, is_blob, blob_type);
+    /* add it to hash index, there is no memory for the index when it can't grow */
+    if (!env_index_add(env)) {
+        return FLASH_ENV_FULL;
     }
-
-    //TODO ǿɷŻ
-    memcpy((char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size(),
-            (uint32_t *) env_str, env_str_length);
-    set_env_detail_end_addr(get_env_detail_end_addr() + env_str_length);
-
-    /* free ram */
-    flash_free(env_str);
-    env_str = NULL;
+    set_env_detail_end_addr(get_env_detail_end_addr() + env_len);
+    update_env_crc_sum(env);
+    env_cache_gen++;
 
     return result;
 }
 
 /**
- * Find environment variables.
- *
- * @param key environment variables name
+ * Update the XOR of all environment variables CRC32 by an environment variable CRC32. It must be
+ * called when the environment variable is added and removed.
  *
- * @return index of environment variables in ram cache
+ * @param env environment variable in ram cache
  */
-static uint32_t *find_env(const char *key) {
-    uint32_t *env_cache_addr = NULL;
-    char *env_start, *env_end, *env, *env_bak;
-
-    FLASH_ASSERT(cur_using_data_addr);
+static void update_env_crc_sum(const char *env) {
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    env_crc_sum ^= *(uint32_t *) (env + get_env_body_len(env));
+#endif
+}
 
-    if (*key == NULL) {
-        FLASH_INFO("Flash environment variables name must be not empty!\n");
-        return NULL;
+/**
+ * Delete an environment variable which is found in ram cache.
+ *
+ * @param env environment variable in ram cache
+ */
+static void del_env(char *env) {
+    size_t del_env_length = get_env_len(env), remain_env_length;
+
+    update_env_crc_sum(env);
+    /* it will be removed after all environment variables in batch are set */
+    if (env_is_batching) {
+        /* remove it from index before marked, the marked name can't be compared */
+        env_index_del(env, 0);
+        env_marked_size += del_env_length;
+        *env = ENV_DELETED_MARK;
+        env_cache_gen++;
+        return;
     }
 
-    /* from data section start to data section end */
-    env_start = (char *) ((char *) env_cache + ENV_PARAM_PART_BYTE_SIZE);
-    env_end = (char *) ((char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size());
-
-    /* environment variables is null */
-    if (env_start == env_end) {
-        return NULL;
-    }
+    /* calculate remain environment variables length */
+    remain_env_length = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size()
+            - (env + del_env_length);
+    /* remove it from hash index */
+    env_index_del(env, del_env_length);
+    /* remain environment variables move forward */
+    memmove(env, env + del_env_length, remain_env_length);
+    /* reset environment variables detail part end address */
+    set_env_detail_end_addr(get_env_detail_end_addr() - del_env_length);
+    env_cache_gen++;
+}
 
-    env = env_start;
-    while (env < env_end) {
-        /* storage model is key=value\0 */
-        env_bak = strstr(env, key);
-        /* the key name length must be equal */
-        if (env_bak && (env_bak[strlen(key)] == '=')) {
-            env_cache_addr = (uint32_t *) env;
-            break;
-        } else {
-            /* next environment variables */
-            env += strlen(env) + 1;
+/**
+ * Remove all environment variables which are marked as deleted in batch by one pass.
+ */
+static void del_marked_env(void) {
+    char *env = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE;
+    char *env_end = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size();
+    char *dst = env;
+    size_t env_len;
+
+    for (; env < env_end; env += env_len) {
+        env_len = get_env_len(env);
+        if (*env != ENV_DELETED_MARK) {
+            memmove(dst, env, env_len);
+            dst += env_len;
         }
     }
-    return env_cache_addr;
+    set_env_detail_end_addr(get_env_detail_end_addr() - (env_end - dst));
+    env_marked_size = 0;
+    env_index_build();
 }
 
 /**
- * If the environment variable is not exist, create it.
- * @see flash_write_env
+ * Delete an environment variable in cache.
  *
  * @param key environment variable name
- * @param value environment variable value
  *
  * @return result
  */
-static FlashErrCode create_env(const char *key, const char *value) {
+FlashErrCode flash_del_env(const char *key){
     FlashErrCode result = FLASH_NO_ERR;
+    char *del_env_str = NULL;
 
     FLASH_ASSERT(key);
-    FLASH_ASSERT(value);
+    FLASH_ASSERT(env_cache);
 
-    if (*key == NULL) {
-        FLASH_INFO("Flash environment variables name must be not empty!\n");
+    if (*key == '\0') {
+        FLASH_INFO("Flash environment variables name must be not NULL!\n");
         return FLASH_ENV_NAME_ERR;
     }
 
     if (strstr(key, "=")) {
-        FLASH_INFO("Flash environment variables name can't contain '='.\n");
+        FLASH_INFO("Flash environment variables name or value can't contain '='.\n");
         return FLASH_ENV_NAME_ERR;
     }
 
     /* find environment variables */
-    if (find_env(key)) {
-        FLASH_INFO("The name of \"%s\" is already exist.\n", key);
-        return FLASH_ENV_NAME_EXIST;
+    del_env_str = find_env(key, strlen(key));
+    if (!del_env_str) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        return FLASH_ENV_NAME_ERR;
     }
-    /* write environment variables to flash */
-    result = write_env(key, value);
+    del_env(del_env_str);
 
     return result;
 }
 
 /**
- * Delete an environment variable in cache.
+ * Set an environment variable which value is not empty. If not find it, then create it.
+ * When the new value fits in the old storage, it will be overwrote in place. Otherwise the old one
+ * will be deleted and the new one will be written at the end of cache.
  *
- * @param key environment variable name
+ * @param key environment variable name, it maybe not end with '\0'
+ * @param key_len environment variable name length
+ * @param value environment variable value
+ * @param value_len environment variable value length
+ * @param is_blob the value is blob
+ * @param blob_type the blob value type, it's saved in the blob header word
  *
  * @return result
  */
-FlashErrCode flash_del_env(const char *key){
+static FlashErrCode set_env(const char *key, size_t key_len, const void *value, size_t value_len,
+        bool_t is_blob, uint8_t blob_type) {
     FlashErrCode result = FLASH_NO_ERR;
-    char *del_env_str = NULL;
-    uint32_t del_env_length, remain_env_length;
-
-    FLASH_ASSERT(key);
-    FLASH_ASSERT(env_cache);
+    char *old_env, *old_value;
+    size_t env_len, old_env_len, old_value_len;
+    bool_t old_is_blob;
 
-    if (*key == NULL) {
-        FLASH_INFO("Flash environment variables name must be not NULL!\n");
+    if (key_len == 0 || memchr(key, '\0', key_len)) {
+        FLASH_INFO("Flash environment variables name must be not empty!\n");
         return FLASH_ENV_NAME_ERR;
     }
 
-    if (strstr(key, "=")) {
-        FLASH_INFO("Flash environment variables name or value can't contain '='.\n");
+    if (memchr(key, '=', key_len)) {
+        FLASH_INFO("Flash environment variables name can't contain '='.\n");
         return FLASH_ENV_NAME_ERR;
     }
 
-    /* find environment variables */
-    del_env_str = (char *) find_env(key);
-    if (!del_env_str) {
-        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
-        return FLASH_ENV_NAME_ERR;
+    /* if not find this variables, then create it */
+    old_env = find_env(key, key_len);
+    if (!old_env) {
+        return write_env(key, key_len, value, value_len, is_blob, blob_type);
     }
-    del_env_length = strlen(del_env_str);
-    /* '\0' also must be as environment variable length */
-    del_env_length ++;
-    /* the address must multiple of 4 */
-    if (del_env_length % 4 != 0) {
-        del_env_length = (del_env_length / 4 + 1) * 4;
+
+    /* the value has no change, so the cache will not change */
+    old_value = get_env_value(old_env, key_len, &old_value_len, &old_is_blob);
+    if (old_is_blob == is_blob && old_value_len == value_len
+            && (!is_blob || get_env_blob_type(old_value) == blob_type)
+            && !memcmp(old_value, value, value_len)) {
+        return result;
+    }
+
+    env_len = calc_env_len(key_len, value_len, is_blob);
+    old_env_len = get_env_len(old_env);
+    if (env_len <= old_env_len) {
+        /* the new value fits in the old storage, overwrite it and fill '\0' to remaining part */
+        update_env_crc_sum(old_env);
+        make_env(old_env, old_env_len, key, key_len, value, value_len, is_blob, blob_type);
+        update_env_crc_sum(old_env);
+        env_cache_gen++;
+    } else {
+        /* check capacity before delete the old one, make sure the old value is kept when full */
+        if (env_len + flash_get_env_used_size() - env_marked_size - old_env_len
+                > env_copy_size) {
+            return FLASH_ENV_FULL;
+        }
+        /* delete it and write the new one at the end of cache */
+        del_env(old_env);
+        result = write_env(key, key_len, value, value_len, is_blob, blob_type);
     }
-    /* calculate remain environment variables length */
-    remain_env_length = get_env_detail_size() - ((uint32_t) del_env_str - (uint32_t) env_cache);
-    /* remain environment variables move forward */
-    memcpy(del_env_str, del_env_str + del_env_length, remain_env_length);
-    /* reset environment variables detail part end address */
-    set_env_detail_end_addr(get_env_detail_end_addr() - del_env_length);
 
     return result;
 }
 
 /**
- * Set an environment variable. If it value is empty, delete it.
- * If not find it in environment variables table, then create it.
+ * Set environment variables by batch without lock.
+ * @see flash_set_env_batch
  *
- * @param key environment variable name
- * @param value environment variable value
+ * @param env_set environment variables set
+ * @param env_set_size environment variables set size
+ * @param save save environment variables to flash after set
  *
  * @return result
  */
-FlashErrCode flash_set_env(const char *key, const char *value) {
+static FlashErrCode set_env_batch(const flash_env *env_set, size_t env_set_size, bool_t save) {
     FlashErrCode result = FLASH_NO_ERR;
+    size_t i, key_len;
+    char *env;
 
+    FLASH_ASSERT(env_set || !env_set_size);
     FLASH_ASSERT(env_cache);
 
-    /* if ENV value is empty, delete it */
-    if (*value == NULL) {
-        result = flash_del_env(key);
-    } else {
-        /* if find this variables, then delete it and recreate it  */
-        if (find_env(key)) {
-            result = flash_del_env(key);
-        }
-        if (result == FLASH_NO_ERR) {
-            result = create_env(key, value);
+    env_is_batching = TRUE;
+    for (i = 0; i < env_set_size && result == FLASH_NO_ERR; i++) {
+        FLASH_ASSERT(env_set[i].key);
+        FLASH_ASSERT(env_set[i].value);
+
+        key_len = strlen(env_set[i].key);
+        if (*env_set[i].value != '\0') {
+            result = set_env(env_set[i].key, key_len, env_set[i].value, strlen(env_set[i].value),
+                    FALSE, 0);
+        } else if (memchr(env_set[i].key, '=', key_len)) {
+            FLASH_INFO("Flash environment variables name can't contain '='.\n");
+            result = FLASH_ENV_NAME_ERR;
+        } else if ((env = find_env(env_set[i].key, key_len)) != NULL) {
+            /* if ENV value is empty, delete it */
+            del_env(env);
         }
     }
+    env_is_batching = FALSE;
+    /* remove all deleted environment variables */
+    if (env_marked_size) {
+        del_marked_env();
+    }
+
+    if (result == FLASH_NO_ERR && save) {
+        result = save_env();
+    }
+
     return result;
 }
 
 /**
- * Get an environment variable value by key name.
+ * Reserve the storage space of an environment variable value in ram cache.
+ * After reserved, the environment variable which value length is not more than the reserved size
+ * will be overwrote in its storage, the other environment variables will not be moved.
+ * @note The environment variable must be exist. The reserved space will be saved to flash.
  *
  * @param key environment variable name
+ * @param value_max_len the maximum length of environment variable value
  *
- * @return value
+ * @return result
  */
-char *flash_get_env(const char *key) {
-    uint32_t *env_cache_addr = NULL;
-    char *value = NULL;
+FlashErrCode flash_reserve_env(const char *key, size_t value_max_len) {
+    FlashErrCode result = FLASH_NO_ERR;
+    char *env, *next_env;
+    size_t key_len, value_len, env_len, need_len;
+    bool_t is_blob;
+    FLASH_STATS_START();
 
+    FLASH_ASSERT(key);
     FLASH_ASSERT(env_cache);
 
+    FLASH_ENV_WRITE_LOCK();
     /* find environment variables */
-    env_cache_addr = find_env(key);
-    if (env_cache_addr == NULL) {
-        return NULL;
+    key_len = strlen(key);
+    env = find_env(key, key_len);
+    if (!env) {
+        FLASH_INFO("Not find \"%s\" in environment variables.\n", key);
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_NAME_ERR;
     }
-    /* get value address */
-    value = strstr((char *) env_cache_addr, "=");
-    if (value != NULL) {
-        /* the equal sign next character is value */
-        value++;
+
+    env_len = get_env_len(env);
+    get_env_value(env, key_len, &value_len, &is_blob);
+    need_len = calc_env_len(key_len, value_max_len, is_blob);
+    /* the storage space is already enough */
+    if (need_len <= env_len) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return result;
     }
-    return value;
+    /* check capacity of environment variables  */
+    if (need_len - env_len + flash_get_env_used_size() > env_copy_size) {
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+        return FLASH_ENV_FULL;
+    }
+    /* the environment variables behind it move backward, then fill '\0' to the reserved space */
+    next_env = env + env_len;
+    memmove(next_env + need_len - env_len, next_env,
+            (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size() - next_env);
+    memset(next_env, 0, need_len - env_len);
+    env_index_move(next_env, need_len - env_len);
+    set_env_detail_end_addr(get_env_detail_end_addr() + (need_len - env_len));
+    env_cache_gen++;
+    FLASH_ENV_WRITE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_RESERVE_ENV);
+    return result;
 }
+
 /**
  * Print environment variables.
  */
 void flash_print_env(void) {
-    uint32_t *env_cache_detail_addr = env_cache + ENV_PARAM_PART_WORD_SIZE,
-            *env_cache_end_addr =
-            (uint32_t *) (env_cache + ENV_PARAM_PART_WORD_SIZE + get_env_detail_size() / 4);
-    uint8_t j;
-    char c;
+    char *env = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE, *env_end, *value;
+    size_t value_len, i;
+    bool_t is_blob;
 
     FLASH_ASSERT(env_cache);
 
-    for (; env_cache_detail_addr < env_cache_end_addr; env_cache_detail_addr += 1) {
-        for (j = 0; j < 4; j++) {
-            c = (*env_cache_detail_addr) >> (8 * j);
-            flash_print("%c", c);
-            if (c == NULL) {
-                flash_print("\n");
-                break;
-            }
+    FLASH_ENV_READ_LOCK();
+    env_end = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size();
+    for (; env < env_end; env += get_env_len(env)) {
+        if (*env == '\0') {
+            continue;
+        }
+        /* the blob value will be printed by hex */
+        flash_print("%s", env);
+        value = get_env_value(env, strchr(env, '=') - env, &value_len, &is_blob);
+        for (i = 0; is_blob && i < value_len; i++) {
+            flash_print("%02X", (uint8_t) value[i]);
         }
+        flash_print("\n");
     }
-    flash_print("\nEnvironment variables size: %ld/%ld bytes, mode: wear leveling.\n",
-            flash_get_env_used_size(), flash_get_env_total_size());
+    flash_print("\nEnvironment variables size: %ld/%ld bytes, mode: wear leveling, "
+            "address: 0x%08X.\n",
+            flash_get_env_used_size(), env_copy_size, get_cur_using_data_addr());
+    FLASH_ENV_READ_UNLOCK();
 }
 
 /**
- * Load flash environment variables to ram.
+ * Load flash environment variables to ram without lock.
+ * @see flash_load_env
  */
-void flash_load_env(void) {
-    uint32_t *env_cache_bak, env_end_addr, using_data_addr;
+static void load_env(void) {
+    uint32_t param[ENV_PARAM_PART_WORD_SIZE], using_data_addr, max_seq = 0;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    uint32_t salvage_addr = 0;
+    bool_t is_salvaged = FALSE;
+#endif
 
     FLASH_ASSERT(env_cache);
 
-    /* read current using data section address */
-    flash_read(get_env_start_addr(), &using_data_addr, 4);
-    /* if environment variables is not initialize or flash has dirty data, set default for it */
-    if ((using_data_addr == 0xFFFFFFFF) || (using_data_addr > env_start_addr + env_total_size)) {
-        /* initialize current using data section address */
-        set_cur_using_data_addr(get_env_start_addr() + flash_erase_min_size);
-        /* save current using data section address to flash*/
-        save_cur_using_data_addr(get_cur_using_data_addr());
-        /* set default environment variables */
-        flash_env_set_default();
+    /* read current using data section address, it's the hint for finding the newest */
+    using_data_addr = read_cur_using_data_addr();
+    if (read_env_param(using_data_addr, param)) {
+        /* the address maybe not saved when power down after the environment variables saved */
+        using_data_addr = follow_env_data(using_data_addr, param);
     } else {
-        /* set current using data section address */
-        set_cur_using_data_addr(using_data_addr);
-        /* read environment variables detail part end address from flash */
-        flash_read(get_cur_using_data_addr() + ENV_PARAM_PART_INDEX_END_ADDR * 4, &env_end_addr, 4);
-        /* if environment variables end address has error, set default for environment variables */
-        if (env_end_addr > env_start_addr + env_total_size) {
-            flash_env_set_default();
-        } else {
-            /* set environment variables detail part end address */
-            set_env_detail_end_addr(env_end_addr);
-
-            env_cache_bak = env_cache + ENV_PARAM_PART_WORD_SIZE;
-            /* read all environment variables from flash */
-            flash_read(get_env_detail_addr(), env_cache_bak, get_env_detail_size());
+        using_data_addr = scan_env_data(param, FALSE, 0);
+    }
+    /* the first found is the newest in data section */
+    if (using_data_addr) {
+        max_seq = param[ENV_PARAM_PART_INDEX_SEQ];
+    }
+    while (using_data_addr) {
+        /* read environment variables parameters part and detail part from flash */
+        read_env_param(using_data_addr, env_cache);
+        read_env_data(using_data_addr + ENV_PARAM_PART_BYTE_SIZE,
+                env_cache + ENV_PARAM_PART_WORD_SIZE, get_env_detail_size());
+        cur_using_data_size = flash_get_env_used_size();
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
-            /* read environment variables CRC code from flash */
-            flash_read(get_cur_using_data_addr() + ENV_PARAM_PART_INDEX_DATA_CRC * 4,
-                    &env_cache[ENV_PARAM_PART_INDEX_DATA_CRC], 4);
-
-            /* if environment variables CRC32 check is fault, set default for it */
-            if (!env_crc_is_ok()) {
-                FLASH_INFO("Warning: Environment variables CRC check failed. Set it to default.\n");
-                flash_env_set_default();
+        /* if environment variables CRC32 check is fault, try the older one */
+        if (!env_crc_is_ok()) {
+            FLASH_INFO("Warning: Environment variables at 0x%08X CRC check failed.\n",
+                    using_data_addr);
+            /* the first failed one is the newest */
+            if (!salvage_addr) {
+                salvage_addr = using_data_addr;
             }
+            using_data_addr = scan_env_data(param, TRUE, env_cache[ENV_PARAM_PART_INDEX_SEQ]);
+            continue;
         }
 #endif
 
+        break;
+    }
+
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    /* all saved ones are damaged, salvage the intact environment variables in the newest one */
+    if (!using_data_addr && salvage_addr) {
+        read_env_param(salvage_addr, env_cache);
+        read_env_data(salvage_addr + ENV_PARAM_PART_BYTE_SIZE,
+                env_cache + ENV_PARAM_PART_WORD_SIZE, get_env_detail_size());
+        using_data_addr = salvage_addr;
+        cur_using_data_size = flash_get_env_used_size();
+        salvage_env();
+        is_salvaged = TRUE;
+    }
+#endif
+
+    if (using_data_addr) {
+        set_cur_using_data_addr(using_data_addr);
+        /* rebuild the hash index */
+        env_index_build();
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+#ifdef FLASH_ENV_USING_CRC_CHECK
+        /* the erase budget in the damaged one is not trusted */
+        if (!is_salvaged)
+#endif
+        {
+            set_env_erase_budget(env_cache);
+        }
+#endif
+        FLASH_DEBUG("Loaded environment variables at 0x%08X, sequence is %d.\n", using_data_addr,
+                env_cache[ENV_PARAM_PART_INDEX_SEQ]);
+        /* the environment variables in ram cache is same as flash */
+        env_saved_gen = env_cache_gen;
+    } else {
+        FLASH_INFO("Warning: Not find valid environment variables. Set it to default.\n");
+        set_cur_using_data_addr(get_env_data_section_addr());
+        cur_using_data_size = 0;
+        /* the next saving will be newer than any damaged one */
+        env_cache[ENV_PARAM_PART_INDEX_SEQ] = max_seq;
+        memset(&env_cache[ENV_PARAM_PART_INDEX_ERASE_CNT], 0, FLASH_ENV_WEAR_SECTOR_NUM * 4);
+        /* the saved generation is only updated when the default ones are saved successfully, so
+         * the failed or deferred saving will be retried by next saving */
+        env_set_default();
+    }
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    /* the salvaged environment variables are different from flash, they will be saved again */
+    if (is_salvaged) {
+        env_cache_gen++;
     }
+#endif
 }
 
 /**
- * Save environment variables to flash.
+ * Load flash environment variables to ram. The newest valid saved ones will be loaded.
  */
-FlashErrCode flash_save_env(void) {
+void flash_load_env(void) {
+    FLASH_STATS_START();
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    load_env();
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    FLASH_STATS_END(FLASH_STATS_API_LOAD_ENV);
+}
+
+/**
+ * Save environment variables to flash without lock.
+ * @see flash_save_env
+ *
+ * @return result
+ */
+static FlashErrCode save_env(void) {
     FlashErrCode result = FLASH_NO_ERR;
-    uint32_t cur_data_addr_bak = get_cur_using_data_addr(), move_offset_addr;
-    size_t env_detail_size = get_env_detail_size();
+    size_t data_size = flash_get_env_used_size();
+    uint32_t data_addr, crc_sum = 0;
 
     FLASH_ASSERT(env_cache);
 
-    /* wear leveling process, automatic move environment variables to next available position */
-    while (get_cur_using_data_addr() + env_detail_size
-            < get_env_start_addr() + flash_get_env_total_size()) {
+    /* the environment variables has no change after last saved */
+    if (env_cache_gen == env_saved_gen) {
+        FLASH_DEBUG("Environment variables has no change, skip saving.\n");
+        return result;
+    }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the changes will be saved by next saving when it's over budget */
+    if (!env_erase_budget_check(data_size)) {
+        return FLASH_ENV_SAVE_DEFERRED;
+    }
+    get_env_erase_budget(env_cache);
+#endif
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
-    /* calculate and cache CRC32 code */
-    env_cache[ENV_PARAM_PART_INDEX_DATA_CRC] = calc_env_crc();
+    crc_sum = env_crc_sum;
 #endif
-        /* erase environment variables */
-        result = flash_erase(get_cur_using_data_addr(), ENV_PARAM_PART_BYTE_SIZE + env_detail_size);
-        switch (result) {
-        case FLASH_NO_ERR: {
-            FLASH_INFO("Erased environment variables OK.\n");
-            break;
+    result = save_env_data(env_cache, data_size, crc_sum, &data_addr);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the erases of this saving have been charged to the cached erase budget */
+    set_env_erase_budget(env_cache);
+#endif
+    if (result == FLASH_NO_ERR) {
+        set_cur_using_data_addr(data_addr);
+        cur_using_data_size = data_size;
+        env_saved_gen = env_cache_gen;
+    }
+
+    return result;
+}
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+/**
+ * Save a snapshot of environment variables to flash. The snapshot is copied in the write lock,
+ * then it's written to flash without the write lock, so the other threads can get and even set
+ * environment variables when the flash is programming. The saving is serialized by the save lock.
+ *
+ * @param saved_gen the generation which has been saved to flash, it can be NULL
+ * @param written it will be TRUE when the snapshot has been written to flash, it's not changed
+ *        when there is no change or the saving is failed or deferred
+ *
+ * @return result
+ */
+static FlashErrCode save_env_snapshot(uint32_t *saved_gen, bool_t *written) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t data_size;
+    uint32_t snapshot_gen, data_addr, crc_sum = 0;
+
+    FLASH_ASSERT(env_snapshot);
+
+    FLASH_ENV_SAVE_LOCK();
+    FLASH_ENV_WRITE_LOCK();
+    /* the environment variables has no change after last saved */
+    if (env_cache_gen == env_saved_gen) {
+        FLASH_DEBUG("Environment variables has no change, skip saving.\n");
+        if (saved_gen) {
+            *saved_gen = env_saved_gen;
+        }
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_ENV_SAVE_UNLOCK();
+        return result;
+    }
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the changes will be saved by next saving when it's over budget */
+    if (!env_erase_budget_check(flash_get_env_used_size())) {
+        if (saved_gen) {
+            *saved_gen = env_saved_gen;
         }
-        case FLASH_ERASE_ERR: {
-            FLASH_INFO("Warning: Erased environment variables fault!\n");
+        FLASH_ENV_WRITE_UNLOCK();
+        FLASH_ENV_SAVE_UNLOCK();
+        return FLASH_ENV_SAVE_DEFERRED;
+    }
+    get_env_erase_budget(env_cache);
+#endif
+    data_size = flash_get_env_used_size();
+    memcpy(env_snapshot, env_cache, data_size);
+    snapshot_gen = env_cache_gen;
+#ifdef FLASH_ENV_USING_CRC_CHECK
+    crc_sum = env_crc_sum;
+#endif
+    FLASH_ENV_WRITE_UNLOCK();
+
+    /* the current using data section address and size are only changed in the save lock */
+    result = save_env_data(env_snapshot, data_size, crc_sum, &data_addr);
+
+    FLASH_ENV_WRITE_LOCK();
+    /* the sequence number and erase counters are updated in snapshot whether it success or not */
+    env_cache[ENV_PARAM_PART_INDEX_SEQ] = env_snapshot[ENV_PARAM_PART_INDEX_SEQ];
+    memcpy(&env_cache[ENV_PARAM_PART_INDEX_ERASE_CNT],
+            &env_snapshot[ENV_PARAM_PART_INDEX_ERASE_CNT], FLASH_ENV_WEAR_SECTOR_NUM * 4);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    /* the erase budget is only changed in the write lock, the erases of this saving have been
+     * charged to the snapshot */
+    memcpy(&env_cache[ENV_PARAM_PART_INDEX_ERASE_BUDGET],
+            &env_snapshot[ENV_PARAM_PART_INDEX_ERASE_BUDGET], ENV_ERASE_BUDGET_WORD_NUM * 4);
+    set_env_erase_budget(env_cache);
+#endif
+    if (result == FLASH_NO_ERR) {
+        set_cur_using_data_addr(data_addr);
+        cur_using_data_size = data_size;
+        env_saved_gen = snapshot_gen;
+        *written = TRUE;
+    }
+    if (saved_gen) {
+        *saved_gen = env_saved_gen;
+    }
+    FLASH_ENV_WRITE_UNLOCK();
+    FLASH_ENV_SAVE_UNLOCK();
+
+    return result;
+}
+#endif
+
+/**
+ * Save environment variables to the units behind the last saved ones in data section. It will move
+ * to the next unit when erasing or writing is failed.
+ *
+ * @param cache environment variables RAM cache or its snapshot, the sequence number, erase
+ *        counters, erase budget and CRC32 in its parameters part will be updated
+ * @param data_size environment variables used bytes size
+ * @param crc_sum the XOR of all environment variables CRC32
+ * @param data_addr the data section address which has been saved
+ *
+ * @return result
+ */
+static FlashErrCode save_env_data(uint32_t *cache, size_t data_size, uint32_t crc_sum,
+        uint32_t *data_addr) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t units_num, i;
+    uint32_t addr = get_next_data_addr(get_cur_using_data_addr(), cur_using_data_size);
+    bool_t sys_is_full = sys_section_is_full();
+
+    /* the erased value is used for not saved */
+    if (++cache[ENV_PARAM_PART_INDEX_SEQ] == 0xFFFFFFFF) {
+        cache[ENV_PARAM_PART_INDEX_SEQ] = 0;
+    }
+    /* the system section will be erased after the saving when it's full. Its erase counter is
+     * increased before writing, so the erase is recorded by this saving. */
+    if (sys_is_full) {
+        inc_env_erase_cnt(cache, get_env_start_addr(), 4);
+    }
+    /* the available units number for moving, the last saved units and saving units are excluded */
+    units_num = env_data_section_size / flash_erase_min_size
+            - (cur_using_data_size + flash_erase_min_size - 1) / flash_erase_min_size
+            - (data_size + flash_erase_min_size - 1) / flash_erase_min_size;
+    /* wear leveling process, automatic move environment variables to next available unit */
+    for (i = 0; i <= units_num; i++) {
+        /* erase environment variables */
+        result = erase_env_data(cache, addr, data_size);
+        if (result != FLASH_NO_ERR) {
+            FLASH_INFO("Warning: Erased environment variables at 0x%08X fault!\n", addr);
             FLASH_INFO("Moving environment variables to next available position.\n");
-            /* calculate move offset address */
-            move_offset_addr = (env_detail_size / flash_erase_min_size + 1) * flash_erase_min_size;
-            /* calculate and set next available data section address */
-            set_cur_using_data_addr(get_cur_using_data_addr() + move_offset_addr);
-            /* calculate and set next available environment variables detail part end address */
-            set_env_detail_end_addr(get_env_detail_end_addr() + move_offset_addr);
+            addr = get_next_data_addr(addr, flash_erase_min_size);
             continue;
         }
+        /* write environment variables detail part, then write parameters part for commit */
+        result = write_env_data(addr + ENV_PARAM_PART_BYTE_SIZE, cache + ENV_PARAM_PART_WORD_SIZE,
+                data_size - ENV_PARAM_PART_BYTE_SIZE);
+        if (result == FLASH_NO_ERR) {
+#ifdef FLASH_ENV_USING_CRC_CHECK
+            /* calculate and cache CRC32 code, the erase counters have been updated */
+            cache[ENV_PARAM_PART_INDEX_DATA_CRC] = calc_env_crc(cache, crc_sum);
+#endif
+            result = FLASH_WRITE(addr, cache, ENV_PARAM_PART_BYTE_SIZE);
         }
-        /* write environment variables to flash */
-        result = flash_write(get_cur_using_data_addr(), env_cache,
-                ENV_PARAM_PART_BYTE_SIZE + env_detail_size);
-        switch (result) {
-        case FLASH_NO_ERR: {
-            FLASH_INFO("Saved environment variables OK.\n");
-            break;
-        }
-        case FLASH_WRITE_ERR: {
-            FLASH_INFO("Warning: Saved environment variables fault!\n");
+        if (result != FLASH_NO_ERR) {
+            FLASH_INFO("Warning: Saved environment variables at 0x%08X fault!\n", addr);
             FLASH_INFO("Moving environment variables to next available position.\n");
-            /* calculate move offset address */
-            move_offset_addr = (env_detail_size / flash_erase_min_size + 1) * flash_erase_min_size;
-            /* calculate and set next available data section address */
-            set_cur_using_data_addr(get_cur_using_data_addr() + move_offset_addr);
-            /* calculate and set next available environment variables detail part end address */
-            set_env_detail_end_addr(get_env_detail_end_addr() + move_offset_addr);
+            addr = get_next_data_addr(addr, flash_erase_min_size);
             continue;
         }
-        }
         /* save environment variables success */
-        if (result == FLASH_NO_ERR) {
-            break;
-        }
+        break;
     }
 
-    if (get_cur_using_data_addr() + env_detail_size
-            < get_env_start_addr() + flash_get_env_total_size()) {
-        /* current using data section address has changed, save it */
-        if (get_cur_using_data_addr() != cur_data_addr_bak) {
-            save_cur_using_data_addr(get_cur_using_data_addr());
-        }
+    if (result == FLASH_NO_ERR) {
+        *data_addr = addr;
+        FLASH_INFO("Saved environment variables at 0x%08X OK.\n", addr);
+        /* the current using data section address has changed, save it */
+        save_cur_using_data_addr(addr, sys_is_full);
     } else {
         result = FLASH_ENV_FULL;
         FLASH_INFO("Error: The flash has no available space to save environment variables.\n");
-        /* clear current using data section address on flash */
-        save_cur_using_data_addr(0xFFFFFFFF);
     }
 
     return result;
 }
 
+/**
+ * Save environment variables to the units behind the last saved ones in data section. The
+ * parameters part will be written at last, so the last saved ones are still valid until the saving
+ * has been finished.
+ */
+FlashErrCode flash_save_env(void) {
+    return flash_save_env_gen(NULL, NULL);
+}
+
+/**
+ * Save environment variables to flash and get the generation which has been saved. The
+ * environment variables which are set by other threads in saving maybe not saved, so the saved
+ * generation can be less than the current generation. @see flash_save_env
+ *
+ * @param saved_gen the generation which has been saved to flash, it can be NULL
+ * @param written it's TRUE when this saving has written flash, FALSE when there is no change or
+ *        the saving is failed or deferred, it can be NULL
+ *
+ * @return result
+ */
+FlashErrCode flash_save_env_gen(uint32_t *saved_gen, bool_t *written) {
+    FlashErrCode result = FLASH_NO_ERR;
+#ifndef FLASH_ENV_USING_SNAPSHOT_SAVE
+    uint32_t last_saved_gen;
+#endif
+    bool_t is_written = FALSE;
+    FLASH_STATS_START();
+
+#ifdef FLASH_ENV_USING_SNAPSHOT_SAVE
+    result = save_env_snapshot(saved_gen, &is_written);
+#else
+    FLASH_ENV_WRITE_LOCK();
+    last_saved_gen = env_saved_gen;
+    result = save_env();
+    if (saved_gen) {
+        *saved_gen = env_saved_gen;
+    }
+    /* the saved generation is only changed by writing flash */
+    is_written = (env_saved_gen != last_saved_gen);
+    FLASH_ENV_WRITE_UNLOCK();
+#endif
+    if (written) {
+        *written = is_written;
+    }
+
+    FLASH_STATS_END(FLASH_STATS_API_SAVE_ENV);
+    return result;
+}
+
 #ifdef FLASH_ENV_USING_CRC_CHECK
 /**
  * Calculate the cached environment variables CRC32 value.
  *
+ * @param cache environment variables RAM cache or its snapshot
+ * @param crc_sum the XOR of all environment variables CRC32
+ *
  * @return CRC32 value
  */
-static uint32_t calc_env_crc(void) {
+static uint32_t calc_env_crc(const uint32_t *cache, uint32_t crc_sum) {
     uint32_t crc32 = 0;
 
     extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
-    /* Calculate the environment variables end address and all environment variables data CRC32.
-     * The 4 is environment variables end address bytes size. */
-    crc32 = calc_crc32(crc32, &env_cache[ENV_PARAM_PART_INDEX_END_ADDR], 4);
-    crc32 = calc_crc32(crc32, &env_cache[ENV_PARAM_PART_WORD_SIZE], get_env_detail_size());
+    /* Calculate the environment variables end address, erase counters, erase budget, sequence
+     * number and the XOR of all environment variables CRC32. Every environment variable is checked
+     * by its own CRC32. */
+    crc32 = calc_crc32(crc32, &cache[ENV_PARAM_PART_INDEX_END_ADDR], 4);
+    crc32 = calc_crc32(crc32, &cache[ENV_PARAM_PART_INDEX_ERASE_CNT],
+            FLASH_ENV_WEAR_SECTOR_NUM * 4);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    crc32 = calc_crc32(crc32, &cache[ENV_PARAM_PART_INDEX_ERASE_BUDGET],
+            ENV_ERASE_BUDGET_WORD_NUM * 4);
+#endif
+    crc32 = calc_crc32(crc32, &cache[ENV_PARAM_PART_INDEX_SEQ], 4);
+    crc32 = calc_crc32(crc32, &crc_sum, 4);
     FLASH_DEBUG("Calculate Env CRC32 number is 0x%08X.\n", crc32);
 
     return crc32;
@@ -658,42 +1171,453 @@ static uint32_t calc_env_crc(void) {
 
 #ifdef FLASH_ENV_USING_CRC_CHECK
 /**
- * Check the environment variables CRC32
+ * Check the environment variables CRC32. Every environment variable CRC32 is checked, then the XOR
+ * of them is recalculated for checking the system section CRC32.
  *
  * @return true is ok
  */
 static bool_t env_crc_is_ok(void) {
-    if (calc_env_crc() == env_cache[ENV_PARAM_PART_INDEX_DATA_CRC]) {
+    char *env = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE;
+    char *env_end = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size();
+    size_t env_len;
+
+    env_crc_sum = 0;
+    for (; env < env_end; env += env_len) {
+        env_len = check_env(env, env_end);
+        if (!env_len) {
+            return FALSE;
+        }
+        update_env_crc_sum(env);
+    }
+
+    if (calc_env_crc(env_cache, env_crc_sum) == env_cache[ENV_PARAM_PART_INDEX_DATA_CRC]) {
         FLASH_DEBUG("Verify Env CRC32 result is OK.\n");
         return TRUE;
     } else {
         return FALSE;
     }
 }
+
+/**
+ * Check the storage format and CRC32 of an environment variable in ram cache.
+ *
+ * @param env environment variable in ram cache
+ * @param env_end the end of environment variables in ram cache
+ *
+ * @return storage length, 0 is broken
+ */
+static size_t check_env(const char *env, const char *env_end) {
+    const char *str_end = memchr(env, '\0', env_end - env), *key_end = NULL;
+    size_t len, max_len = env_end - env;
+    uint32_t blob_header;
+
+    extern uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size);
+
+    /* storage model is key=value\0, the name must be not empty */
+    if (str_end) {
+        key_end = memchr(env, '=', str_end - env);
+    }
+    if (!key_end || key_end == env) {
+        return 0;
+    }
+    len = (str_end - env + 1 + 3) / 4 * 4;
+    /* the empty value is blob, storage model is key=\0 + blob header word + blob data */
+    if (key_end + 1 == str_end) {
+        if (len + 4 > max_len) {
+            return 0;
+        }
+        blob_header = *(uint32_t *) (env + len);
+        if ((blob_header & ENV_BLOB_FLAG_MASK) != ENV_BLOB_FLAG) {
+            return 0;
+        }
+        len += 4 + ((blob_header & ENV_BLOB_LEN_MASK) + 3) / 4 * 4;
+    }
+    if (len + ENV_CRC_BYTE_SIZE > max_len
+            || calc_crc32(0, env, len) != *(uint32_t *) (env + len)) {
+        return 0;
+    }
+    len += ENV_CRC_BYTE_SIZE;
+    /* the '\0' padding words are the reserved space */
+    while (len < max_len && *(uint32_t *) (env + len) == 0) {
+        len += 4;
+    }
+
+    return len;
+}
+
+/**
+ * Salvage the intact environment variables in ram cache when CRC32 check is failed. The broken data
+ * will be removed, so only the broken environment variables are lost.
+ */
+static void salvage_env(void) {
+    char *env = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE;
+    char *env_end = (char *) env_cache + ENV_PARAM_PART_BYTE_SIZE + get_env_detail_size();
+    char *dst = env;
+    size_t env_len, broken_size = 0;
+
+    env_crc_sum = 0;
+    while (env < env_end) {
+        env_len = check_env(env, env_end);
+        if (env_len) {
+            memmove(dst, env, env_len);
+            update_env_crc_sum(dst);
+            dst += env_len;
+            env += env_len;
+        } else {
+            /* skip a word, then try to find the next intact environment variable */
+            env += 4;
+            broken_size += 4;
+        }
+    }
+    set_env_detail_end_addr(get_env_detail_end_addr() - (env_end - dst));
+    FLASH_INFO("Warning: Environment variables CRC check failed. Removed %d bytes broken data.\n",
+            broken_size);
+}
 #endif
 
 /**
- * Save current using data section address to flash.
+ * Read the last written current using data section address in system section. The next erased
+ * word index for appending will be found too.
+ *
+ * @return current using data section address, 0xFFFFFFFF is not written
+ */
+static uint32_t read_cur_using_data_addr(void) {
+    uint32_t cur_data_addr = 0xFFFFFFFF;
+    size_t start = 0, end = flash_erase_min_size / 4, middle;
+
+    /* the written words are always in front of the erased words, so find it by binary search */
+    while (start < end) {
+        middle = start + (end - start) / 2;
+        FLASH_READ(get_env_start_addr() + middle * 4, &cur_data_addr, 4);
+        if (cur_data_addr == 0xFFFFFFFF) {
+            end = middle;
+        } else {
+            start = middle + 1;
+        }
+    }
+    cur_using_data_addr_index = start;
+
+    if (cur_using_data_addr_index) {
+        FLASH_READ(get_env_start_addr() + (cur_using_data_addr_index - 1) * 4, &cur_data_addr, 4);
+    } else {
+        cur_data_addr = 0xFFFFFFFF;
+    }
+
+    return cur_data_addr;
+}
+
+/**
+ * Check the system section is full, then it must be erased before saving current using data
+ * section address.
+ *
+ * @return true is full
+ */
+static bool_t sys_section_is_full(void) {
+    uint32_t word = 0;
+
+    /* the next word maybe not erased when power down in erasing, so check it before writing */
+    if (cur_using_data_addr_index < flash_erase_min_size / 4) {
+        FLASH_READ(get_env_start_addr() + cur_using_data_addr_index * 4, &word, 4);
+    }
+
+    return word != 0xFFFFFFFF;
+}
+
+/**
+ * Save current using data section address to flash. It will be appended to the next erased word in
+ * system section, so the system section is erased only when it's full.
  *
  * @param cur_data_addr current using data section address
+ * @param is_full the system section is full, its erase counter has been increased by the saving
  *
  * @return result
  */
-static FlashErrCode save_cur_using_data_addr(uint32_t cur_data_addr) {
+static FlashErrCode save_cur_using_data_addr(uint32_t cur_data_addr, bool_t is_full) {
     FlashErrCode result = FLASH_NO_ERR;
-    /* erase environment variables system section */
-    result = flash_erase(get_env_start_addr(), 4);
-    if (result == FLASH_NO_ERR) {
-        /* write current using data section address to flash */
-        result = flash_write(get_env_start_addr(), &cur_data_addr, 4);
-        if (result == FLASH_WRITE_ERR) {
-            FLASH_INFO("Error: Write system section fault!\n");
-            FLASH_INFO("Note: The environment variables can not be used.\n");
+
+    /* erase environment variables system section when it's full */
+    if (is_full) {
+        result = FLASH_ERASE(get_env_start_addr(), 4);
+        if (result != FLASH_NO_ERR) {
+            FLASH_INFO("Error: Erased system section fault!\n");
+            FLASH_INFO("Note: The environment variables will be found by scanning data section.\n");
+            return result;
+        }
+        cur_using_data_addr_index = 0;
+    }
+    /* append current using data section address to flash */
+    result = FLASH_WRITE(get_env_start_addr() + cur_using_data_addr_index * 4, &cur_data_addr, 4);
+    /* the word maybe written partly when failed, so it's not erased any more */
+    cur_using_data_addr_index++;
+    if (result != FLASH_NO_ERR) {
+        FLASH_INFO("Error: Write system section fault!\n");
+        FLASH_INFO("Note: The environment variables will be found by scanning data section.\n");
+    }
+    return result;
+}
+
+/**
+ * Get the next unit address behind the environment variables in data section. The data section
+ * is a ring, so it will go back to the data section start address at the end.
+ *
+ * @param data_addr environment variables data section address
+ * @param data_size environment variables size, 0 is the same unit
+ *
+ * @return the next unit address
+ */
+static uint32_t get_next_data_addr(uint32_t data_addr, size_t data_size) {
+    size_t units_size = (data_size + flash_erase_min_size - 1) / flash_erase_min_size
+            * flash_erase_min_size;
+
+    data_addr += units_size;
+    if (data_addr >= get_env_data_section_addr() + env_data_section_size) {
+        data_addr -= env_data_section_size;
+    }
+    return data_addr;
+}
+
+/**
+ * Read the environment variables parameters part in data section and check it.
+ *
+ * @param data_addr environment variables data section address, it must be a unit start address
+ * @param param the parameters part buffer
+ *
+ * @return true is the environment variables has been saved completely and the end address is valid
+ */
+static bool_t read_env_param(uint32_t data_addr, uint32_t *param) {
+    uint32_t env_end_addr;
+
+    if ((data_addr < get_env_data_section_addr())
+            || (data_addr >= get_env_data_section_addr() + env_data_section_size)
+            || ((data_addr - get_env_data_section_addr()) % flash_erase_min_size)) {
+        return FALSE;
+    }
+    FLASH_READ(data_addr, param, ENV_PARAM_PART_BYTE_SIZE);
+    /* the sequence number has not been written, so it is not saved completely */
+    if (param[ENV_PARAM_PART_INDEX_SEQ] == 0xFFFFFFFF) {
+        return FALSE;
+    }
+    env_end_addr = param[ENV_PARAM_PART_INDEX_END_ADDR];
+    if ((env_end_addr < get_env_detail_addr()) || (env_end_addr % 4)
+            || (env_end_addr > get_env_data_section_addr() + env_copy_size)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Scan all units in data section to find the newest saved environment variables by the sequence
+ * number. Only the parameters part of every unit will be read.
+ *
+ * @param param the found parameters part
+ * @param is_older only find the older ones than the sequence number
+ * @param seq the sequence number
+ *
+ * @return the found data section address, 0 is not found
+ */
+static uint32_t scan_env_data(uint32_t *param, bool_t is_older, uint32_t seq) {
+    uint32_t data_addr, found_addr = 0, unit_param[ENV_PARAM_PART_WORD_SIZE];
+
+    for (data_addr = get_env_data_section_addr();
+            data_addr < get_env_data_section_addr() + env_data_section_size;
+            data_addr += flash_erase_min_size) {
+        if (!read_env_param(data_addr, unit_param)) {
+            continue;
+        }
+        /* the sequence number maybe overflow, so compare it by difference */
+        if (is_older && (int32_t) (unit_param[ENV_PARAM_PART_INDEX_SEQ] - seq) >= 0) {
+            continue;
+        }
+        if (!found_addr || (int32_t) (unit_param[ENV_PARAM_PART_INDEX_SEQ]
+                - param[ENV_PARAM_PART_INDEX_SEQ]) > 0) {
+            found_addr = data_addr;
+            memcpy(param, unit_param, ENV_PARAM_PART_BYTE_SIZE);
+        }
+    }
+
+    return found_addr;
+}
+
+/**
+ * Follow the saved environment variables to find the newer ones, which are saved to the units
+ * behind them. It's the fast way to find the newest by the hint address.
+ *
+ * @param data_addr the saved environment variables data section address
+ * @param param the saved environment variables parameters part, it will be the newest one
+ *
+ * @return the newest data section address
+ */
+static uint32_t follow_env_data(uint32_t data_addr, uint32_t *param) {
+    uint32_t next_addr, next_param[ENV_PARAM_PART_WORD_SIZE];
+    size_t i;
+
+    for (i = 0; i < env_data_section_size / flash_erase_min_size; i++) {
+        next_addr = get_next_data_addr(data_addr,
+                param[ENV_PARAM_PART_INDEX_END_ADDR] - get_env_data_section_addr());
+        if (!read_env_param(next_addr, next_param)
+                || (int32_t) (next_param[ENV_PARAM_PART_INDEX_SEQ]
+                        - param[ENV_PARAM_PART_INDEX_SEQ]) <= 0) {
+            break;
+        }
+        data_addr = next_addr;
+        memcpy(param, next_param, ENV_PARAM_PART_BYTE_SIZE);
+    }
+
+    return data_addr;
+}
+
+/**
+ * Read data from data section. It will go back to the data section start address at the end.
+ *
+ * @param addr read start address in data section
+ * @param buf read buffer
+ * @param size read bytes size
+ */
+static void read_env_data(uint32_t addr, uint32_t *buf, size_t size) {
+    size_t head_size = get_env_data_section_addr() + env_data_section_size - addr;
+
+    if (size <= head_size) {
+        FLASH_READ(addr, buf, size);
+    } else {
+        FLASH_READ(addr, buf, head_size);
+        FLASH_READ(get_env_data_section_addr(), buf + head_size / 4, size - head_size);
+    }
+}
+
+/**
+ * Write data to data section. It will go back to the data section start address at the end.
+ *
+ * @param addr write start address in data section
+ * @param buf write buffer
+ * @param size write bytes size
+ *
+ * @return result
+ */
+static FlashErrCode write_env_data(uint32_t addr, const uint32_t *buf, size_t size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t head_size = get_env_data_section_addr() + env_data_section_size - addr;
+
+    if (size <= head_size) {
+        result = FLASH_WRITE(addr, buf, size);
+    } else {
+        result = FLASH_WRITE(addr, buf, head_size);
+        if (result == FLASH_NO_ERR) {
+            result = FLASH_WRITE(get_env_data_section_addr(), buf + head_size / 4,
+                    size - head_size);
         }
+    }
+
+    return result;
+}
+
+/**
+ * Erase data section. It will go back to the data section start address at the end.
+ *
+ * @param cache environment variables RAM cache or its snapshot, the erase counters will be updated
+ * @param addr erase start address in data section, it must be a unit start address
+ * @param size erase bytes size
+ *
+ * @return result
+ */
+static FlashErrCode erase_env_data(uint32_t *cache, uint32_t addr, size_t size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t head_size = get_env_data_section_addr() + env_data_section_size - addr;
+
+    if (size <= head_size) {
+        inc_env_erase_cnt(cache, addr, size);
+        result = FLASH_ERASE(addr, size);
     } else {
-        FLASH_INFO("Error: Erased system section fault!\n");
-        FLASH_INFO("Note: The environment variables can not be used\n");
+        inc_env_erase_cnt(cache, addr, head_size);
+        result = FLASH_ERASE(addr, head_size);
+        if (result == FLASH_NO_ERR) {
+            inc_env_erase_cnt(cache, get_env_data_section_addr(), size - head_size);
+            result = FLASH_ERASE(get_env_data_section_addr(), size - head_size);
+        }
     }
+
     return result;
 }
+
+/**
+ * Increase the erase counters of the erase units in environment variables area. The counters are
+ * cached in parameters part, so they will be saved in next saving. The erase budget in parameters
+ * part is charged too.
+ *
+ * @param cache environment variables RAM cache or its snapshot
+ * @param addr erase start address
+ * @param size erase bytes size
+ */
+static void inc_env_erase_cnt(uint32_t *cache, uint32_t addr, size_t size) {
+    size_t sector = (addr - env_start_addr) / flash_erase_min_size;
+
+    for (; size && sector < env_total_size / flash_erase_min_size; sector++) {
+        cache[ENV_PARAM_PART_INDEX_ERASE_CNT + sector]++;
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+        cache[ENV_PARAM_PART_INDEX_ERASE_BUDGET + sector] = flash_erase_budget_charge(
+                cache[ENV_PARAM_PART_INDEX_ERASE_BUDGET + sector]);
+#endif
+        size = size > flash_erase_min_size ? size - flash_erase_min_size : 0;
+    }
+}
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/**
+ * Check the erase budget of the units which will be erased by saving. They are the units behind the
+ * last saved ones in data section, and the system section when it's full. @see save_env_data
+ *
+ * @param data_size environment variables used bytes size
+ *
+ * @return TRUE: the saving can erase flash
+ */
+static bool_t env_erase_budget_check(size_t data_size) {
+    uint32_t addr = get_next_data_addr(get_cur_using_data_addr(), cur_using_data_size);
+    size_t units_num = (data_size + flash_erase_min_size - 1) / flash_erase_min_size;
+    size_t head_num = (get_env_data_section_addr() + env_data_section_size - addr)
+            / flash_erase_min_size;
+    size_t data_sector = (get_env_data_section_addr() - env_start_addr) / flash_erase_min_size;
+
+    /* the units go back to the data section start address at the end */
+    if (units_num <= head_num) {
+        head_num = units_num;
+    }
+    if (!flash_erase_budget_check((addr - env_start_addr) / flash_erase_min_size, head_num)
+            || !flash_erase_budget_check(data_sector, units_num - head_num)) {
+        return FALSE;
+    }
+    /* the system section is the first erase unit, it's erased when it's full */
+    if (sys_section_is_full()) {
+        return flash_erase_budget_check(0, 1);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Copy the erase budget of all erase units to parameters part, then the saving charges its erases
+ * to it. It must be called in the write lock.
+ *
+ * @param cache environment variables RAM cache
+ */
+static void get_env_erase_budget(uint32_t *cache) {
+    size_t sector;
+
+    for (sector = 0; sector < env_total_size / flash_erase_min_size; sector++) {
+        cache[ENV_PARAM_PART_INDEX_ERASE_BUDGET + sector] = flash_erase_budget_get(sector);
+    }
+}
+
+/**
+ * Set the erase budget of all erase units by parameters part. It restores the saved budget after
+ * loading, and updates the budget after saving. It must be called in the write lock.
+ *
+ * @param cache environment variables RAM cache
+ */
+static void set_env_erase_budget(const uint32_t *cache) {
+    size_t sector;
+
+    for (sector = 0; sector < env_total_size / flash_erase_min_size; sector++) {
+        flash_erase_budget_set(sector, cache[ENV_PARAM_PART_INDEX_ERASE_BUDGET + sector]);
+    }
+}
+#endif
 #endif
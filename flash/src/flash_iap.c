@@ -21,25 +21,74 @@
  */
 
 #include "flash.h"
+#include <string.h>
 
+/**
+ * IAP section has 2 parts
+ * 1. Backup area header
+ *    It storage the erase counters of backup area erase units. (Units: Word)
+ *    The first erase counter is the header itself. It's in the first erase unit of IAP section.
+ * 2. Backup application
+ *    It storage the downloaded application, it's behind the backup area header erase unit.
+ */
+
+/* backup area header index and size */
+enum {
+    /* backup area header magic index */
+    BAK_HEADER_INDEX_MAGIC = 0,
+    /* the erase units number which have erase counters */
+    BAK_HEADER_INDEX_SECTOR_NUM,
+    /* erase counters index, the number is FLASH_BAK_WEAR_SECTOR_NUM */
+    BAK_HEADER_INDEX_ERASE_CNT,
+
+    /* backup area header word size */
+    BAK_HEADER_WORD_SIZE = BAK_HEADER_INDEX_ERASE_CNT + FLASH_BAK_WEAR_SECTOR_NUM,
+    /* backup area header byte size */
+    BAK_HEADER_BYTE_SIZE = BAK_HEADER_WORD_SIZE * 4,
+};
+
+/* backup area header magic word */
+#define BAK_HEADER_MAGIC                         0x45464243
+
+/* IAP section backup area header address in flash */
+static uint32_t bak_header_addr = 0;
 /* IAP section backup application section start address in flash */
-static uint32_t bak_app_start_addr = NULL;
+static uint32_t bak_app_start_addr = 0;
+/* the minimum size of flash erasure */
+static size_t bak_erase_min_size = 0;
+/* backup area header RAM cache */
+static uint32_t bak_header[BAK_HEADER_WORD_SIZE];
 
 static uint32_t get_bak_app_start_addr(void);
+static FlashErrCode save_bak_erase_cnt(size_t app_size);
 
 /**
  * Flash IAP function initialize.
  *
- * @param start_addr IAP section backup application section start address in flash
+ * @param start_addr IAP section start address in flash
+ * @param erase_min_size the minimum size of flash erasure
  *
  * @return result
  */
-FlashErrCode flash_iap_init(uint32_t start_addr) {
+FlashErrCode flash_iap_init(uint32_t start_addr, size_t erase_min_size) {
     FlashErrCode result = FLASH_NO_ERR;
 
     FLASH_ASSERT(start_addr);
+    FLASH_ASSERT(erase_min_size);
+    /* backup area header must be in one erase unit */
+    FLASH_ASSERT(BAK_HEADER_BYTE_SIZE <= erase_min_size);
+
+    bak_header_addr = start_addr;
+    bak_app_start_addr = start_addr + erase_min_size;
+    bak_erase_min_size = erase_min_size;
+
+    /* read backup area header, the erase counters are zero when it's not initialize */
+    FLASH_READ(bak_header_addr, bak_header, BAK_HEADER_BYTE_SIZE);
+    if (bak_header[BAK_HEADER_INDEX_MAGIC] != BAK_HEADER_MAGIC
+            || bak_header[BAK_HEADER_INDEX_SECTOR_NUM] > FLASH_BAK_WEAR_SECTOR_NUM) {
+        memset(bak_header, 0, BAK_HEADER_BYTE_SIZE);
+    }
 
-    bak_app_start_addr = start_addr;
     return result;
 }
 
@@ -52,20 +101,30 @@ FlashErrCode flash_iap_init(uint32_t start_addr) {
  */
 FlashErrCode flash_erase_bak_app(size_t app_size) {
     FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
 
-    result = flash_erase(get_bak_app_start_addr(), app_size);
+    /* the erase counters are saved before erasing, so they will not be lost when power down */
+    result = save_bak_erase_cnt(app_size);
+    if (result != FLASH_NO_ERR) {
+        /* will return when the backup area header is fault */
+        FLASH_STATS_END(FLASH_STATS_API_ERASE_BAK_APP);
+        return result;
+    }
+    result = FLASH_ERASE(get_bak_app_start_addr(), app_size);
     switch (result) {
     case FLASH_NO_ERR: {
         FLASH_INFO("Erased backup area application OK.\n");
         break;
     }
-    case FLASH_ERASE_ERR: {
+    default: {
         FLASH_INFO("Warning: Erase backup area application fault!\n");
         /* will return when erase fault */
+        FLASH_STATS_END(FLASH_STATS_API_ERASE_BAK_APP);
         return result;
     }
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_ERASE_BAK_APP);
     return result;
 }
 
@@ -80,20 +139,23 @@ FlashErrCode flash_erase_bak_app(size_t app_size) {
  */
 FlashErrCode flash_erase_user_app(uint32_t user_app_addr, size_t app_size) {
     FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
 
-    result = flash_erase(user_app_addr, app_size);
+    result = FLASH_ERASE(user_app_addr, app_size);
     switch (result) {
     case FLASH_NO_ERR: {
         FLASH_INFO("Erased user application OK.\n");
         break;
     }
-    case FLASH_ERASE_ERR: {
+    default: {
         FLASH_INFO("Warning: Erase user application fault!\n");
         /* will return when erase fault */
+        FLASH_STATS_END(FLASH_STATS_API_ERASE_USER_APP);
         return result;
     }
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_ERASE_USER_APP);
     return result;
 }
 
@@ -107,20 +169,23 @@ FlashErrCode flash_erase_user_app(uint32_t user_app_addr, size_t app_size) {
  */
 FlashErrCode flash_erase_bl(uint32_t bl_addr, size_t bl_size) {
     FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
 
-    result = flash_erase(bl_addr, bl_size);
+    result = FLASH_ERASE(bl_addr, bl_size);
     switch (result) {
     case FLASH_NO_ERR: {
         FLASH_INFO("Erased bootloader OK.\n");
         break;
     }
-    case FLASH_ERASE_ERR: {
+    default: {
         FLASH_INFO("Warning: Erase bootloader fault!\n");
         /* will return when erase fault */
+        FLASH_STATS_END(FLASH_STATS_API_ERASE_BL);
         return result;
     }
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_ERASE_BL);
     return result;
 }
 
@@ -134,28 +199,30 @@ FlashErrCode flash_erase_bl(uint32_t bl_addr, size_t bl_size) {
  *
  * @return result
  */
-FlashErrCode flash_write_data_to_bak(uint8_t *data, size_t size, uint32_t *cur_size,
+FlashErrCode flash_write_data_to_bak(uint8_t *data, size_t size, size_t *cur_size,
         size_t total_size) {
     FlashErrCode result = FLASH_NO_ERR;
+    FLASH_STATS_START();
 
     /* make sure don't write excess data */
     if (*cur_size + size > total_size) {
         size = total_size - *cur_size;
     }
 
-    result = flash_write(get_bak_app_start_addr() + *cur_size, (uint32_t *) data, size);
+    result = FLASH_WRITE(get_bak_app_start_addr() + *cur_size, (uint32_t *) data, size);
     switch (result) {
     case FLASH_NO_ERR: {
         *cur_size += size;
         FLASH_INFO("Write data to backup area OK.\n");
         break;
     }
-    case FLASH_WRITE_ERR: {
+    default: {
         FLASH_INFO("Warning: Write data to backup area fault!\n");
         break;
     }
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_WRITE_DATA_TO_BAK);
     return result;
 }
 
@@ -173,13 +240,14 @@ FlashErrCode flash_copy_app_from_bak(uint32_t user_app_addr, size_t app_size) {
     FlashErrCode result = FLASH_NO_ERR;
     /* 32 words size buffer */
     uint32_t buff[32];
+    FLASH_STATS_START();
 
     /* cycle copy data */
     for (cur_size = 0; cur_size < app_size; cur_size += sizeof(buff) / 4) {
         app_cur_addr = user_app_addr + cur_size;
         bak_cur_addr = get_bak_app_start_addr() + cur_size;
-        flash_read(bak_cur_addr, buff, sizeof(buff) / 4);
-        result = flash_write(app_cur_addr, buff, sizeof(buff) / 4);
+        FLASH_READ(bak_cur_addr, buff, sizeof(buff) / 4);
+        result = FLASH_WRITE(app_cur_addr, buff, sizeof(buff) / 4);
         if (result != FLASH_NO_ERR) {
             break;
         }
@@ -190,12 +258,13 @@ FlashErrCode flash_copy_app_from_bak(uint32_t user_app_addr, size_t app_size) {
         FLASH_INFO("Write data to application entry OK.\n");
         break;
     }
-    case FLASH_WRITE_ERR: {
+    default: {
         FLASH_INFO("Warning: Write data to application entry fault!\n");
         break;
     }
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_COPY_APP_FROM_BAK);
     return result;
 }
 
@@ -213,13 +282,14 @@ FlashErrCode flash_copy_bl_from_bak(uint32_t bl_addr, size_t bl_size) {
     FlashErrCode result = FLASH_NO_ERR;
     /* 32bytes buffer */
     uint32_t buff[32];
+    FLASH_STATS_START();
 
     /* cycle copy data by 32bytes buffer */
     for (cur_size = 0; cur_size < bl_size; cur_size += 32) {
         bl_cur_addr = bl_addr + cur_size;
         bak_cur_addr = get_bak_app_start_addr() + cur_size;
-        flash_read(bak_cur_addr, buff, 32);
-        result = flash_write(bl_cur_addr, buff, 32);
+        FLASH_READ(bak_cur_addr, buff, 32);
+        result = FLASH_WRITE(bl_cur_addr, buff, 32);
         if (result != FLASH_NO_ERR) {
             break;
         }
@@ -230,15 +300,35 @@ FlashErrCode flash_copy_bl_from_bak(uint32_t bl_addr, size_t bl_size) {
         FLASH_INFO("Write data to bootloader entry OK.\n");
         break;
     }
-    case FLASH_WRITE_ERR: {
+    default: {
         FLASH_INFO("Warning: Write data to bootloader entry fault!\n");
         break;
     }
     }
 
+    FLASH_STATS_END(FLASH_STATS_API_COPY_BL_FROM_BAK);
     return result;
 }
 
+/**
+ * Get the erase counters of all erase units in backup area. The first one is the backup area
+ * header, the others are the backup application erase units.
+ *
+ * @param erase_cnt erase counters buffer
+ * @param num erase counters buffer number
+ *
+ * @return erase units number which have erase counters
+ */
+size_t flash_get_bak_erase_cnt(uint32_t *erase_cnt, size_t num) {
+    size_t i;
+
+    for (i = 0; i < num && i < bak_header[BAK_HEADER_INDEX_SECTOR_NUM]; i++) {
+        erase_cnt[i] = bak_header[BAK_HEADER_INDEX_ERASE_CNT + i];
+    }
+
+    return bak_header[BAK_HEADER_INDEX_SECTOR_NUM];
+}
+
 /**
  * Get IAP section start address in flash.
  *
@@ -248,3 +338,40 @@ static uint32_t get_bak_app_start_addr(void) {
     FLASH_ASSERT(bak_app_start_addr);
     return bak_app_start_addr;
 }
+
+/**
+ * Increase the erase counters of backup area header and the erase units which will be erased for
+ * application, then save them to backup area header.
+ *
+ * @param app_size application size
+ *
+ * @return result
+ */
+static FlashErrCode save_bak_erase_cnt(size_t app_size) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t sector_num = (app_size + bak_erase_min_size - 1) / bak_erase_min_size + 1, i;
+
+    FLASH_ASSERT(bak_header_addr);
+
+    /* the erase units which are out of erase counters are not counted */
+    if (sector_num > FLASH_BAK_WEAR_SECTOR_NUM) {
+        sector_num = FLASH_BAK_WEAR_SECTOR_NUM;
+    }
+    if (bak_header[BAK_HEADER_INDEX_SECTOR_NUM] < sector_num) {
+        bak_header[BAK_HEADER_INDEX_SECTOR_NUM] = sector_num;
+    }
+    for (i = 0; i < sector_num; i++) {
+        bak_header[BAK_HEADER_INDEX_ERASE_CNT + i]++;
+    }
+    bak_header[BAK_HEADER_INDEX_MAGIC] = BAK_HEADER_MAGIC;
+
+    result = FLASH_ERASE(bak_header_addr, BAK_HEADER_BYTE_SIZE);
+    if (result == FLASH_NO_ERR) {
+        result = FLASH_WRITE(bak_header_addr, bak_header, BAK_HEADER_BYTE_SIZE);
+    }
+    if (result != FLASH_NO_ERR) {
+        FLASH_INFO("Warning: Save backup area erase counters fault!\n");
+    }
+
+    return result;
+}
@@ -20,7 +20,22 @@
  * Created on: 2015-01-14
  */
 
-#include "types.h"
+#include "flash.h"
+#include <string.h>
+
+#if defined(FLASH_CRC32_USING_PCLMUL) && !(defined(__PCLMUL__) && defined(__SSE4_1__))
+#error "FLASH_CRC32_USING_PCLMUL needs a x86 compiler with PCLMUL and SSE4.1 (-mpclmul -msse4.1)"
+#endif
+
+#if defined(FLASH_CRC32_USING_SLICING) && (FLASH_CRC32_SLICING_SIZE != 4) \
+        && (FLASH_CRC32_SLICING_SIZE != 8)
+#error "FLASH_CRC32_SLICING_SIZE must be 4 or 8"
+#endif
+
+#ifdef FLASH_CRC32_USING_PCLMUL
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
 
 static const uint32_t crc32_table[] =
 {
@@ -69,8 +84,153 @@ static const uint32_t crc32_table[] =
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+#ifdef FLASH_CRC32_USING_SLICING
+/* the slicing tables for the 2nd to the last byte of every slice, they are made from crc32_table */
+static uint32_t crc32_slicing_table[FLASH_CRC32_SLICING_SIZE - 1][256];
+#endif
+
+/**
+ * Initialize the CRC32 calculation before any calculation, it's called by flash_init. The slicing
+ * tables are made here instead of the first calculation, so the calculation can be called by
+ * multiple threads. The table k is the CRC32 of a byte which followed by (k + 1) zero bytes.
+ */
+void calc_crc32_init(void) {
+#ifdef FLASH_CRC32_USING_SLICING
+    const uint32_t *prev_table = crc32_table;
+    size_t i, k;
+
+    for (k = 0; k < FLASH_CRC32_SLICING_SIZE - 1; k++) {
+        for (i = 0; i < 256; i++) {
+            crc32_slicing_table[k][i] = (prev_table[i] >> 8) ^ crc32_table[prev_table[i] & 0xFF];
+        }
+        prev_table = crc32_slicing_table[k];
+    }
+#endif
+}
+
+#ifdef FLASH_CRC32_USING_SLICING
+/**
+ * Read a little endian word from unaligned memory.
+ *
+ * @param p memory address
+ *
+ * @return word
+ */
+static uint32_t read_le32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+            | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Calculate the CRC32 value by slicing-by-4 or slicing-by-8. It processes a slice every time.
+ *
+ * @param crc the inverted CRC32 value
+ * @param p buffer
+ * @param size bytes in buffer, it must be multiple of FLASH_CRC32_SLICING_SIZE
+ *
+ * @return the inverted CRC32 value
+ */
+static uint32_t calc_crc32_slicing(uint32_t crc, const uint8_t *p, size_t size) {
+    /* the table k is used for the byte which has (k + 1) bytes behind it in the slice */
+    const uint32_t (*t)[256] = crc32_slicing_table;
+
+    for (; size; p += FLASH_CRC32_SLICING_SIZE, size -= FLASH_CRC32_SLICING_SIZE) {
+        crc ^= read_le32(p);
+#if FLASH_CRC32_SLICING_SIZE == 8
+        crc = t[6][crc & 0xFF] ^ t[5][(crc >> 8) & 0xFF] ^ t[4][(crc >> 16) & 0xFF]
+                ^ t[3][crc >> 24] ^ t[2][p[4]] ^ t[1][p[5]] ^ t[0][p[6]] ^ crc32_table[p[7]];
+#else
+        crc = t[2][crc & 0xFF] ^ t[1][(crc >> 8) & 0xFF] ^ t[0][(crc >> 16) & 0xFF]
+                ^ crc32_table[crc >> 24];
+#endif
+    }
+
+    return crc;
+}
+#endif
+
+#ifdef FLASH_CRC32_USING_PCLMUL
+/**
+ * Calculate the CRC32 value by PCLMULQDQ folding on x86. The constants are the bit-reflected
+ * k1 to k5, P(x) and u in Intel "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction".
+ *
+ * @param crc the inverted CRC32 value
+ * @param p buffer
+ * @param size bytes in buffer, it must be multiple of 16 and not less than 64
+ *
+ * @return the inverted CRC32 value
+ */
+static uint32_t calc_crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size) {
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+    const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+    const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    FLASH_ASSERT(size >= 64 && size % 16 == 0);
+
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), _mm_cvtsi32_si128(crc));
+    x2 = _mm_loadu_si128((const __m128i *) (p + 16));
+    x3 = _mm_loadu_si128((const __m128i *) (p + 32));
+    x4 = _mm_loadu_si128((const __m128i *) (p + 48));
+    p += 64;
+    size -= 64;
+
+    /* fold 4 blocks of 16 bytes in parallel */
+    for (; size >= 64; p += 64, size -= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) p));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (p + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (p + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (p + 48)));
+    }
+
+    /* fold 4 blocks into 1 block */
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+    /* fold the remaining blocks of 16 bytes */
+    for (; size >= 16; p += 16, size -= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) p));
+    }
+
+    /* fold 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    /* Barrett reduction to 32 bits */
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+#endif
+
 /**
  * Calculate the CRC32 value of a memory buffer.
+ * The calculation engine is selected by FLASH_CRC32_USING_XXX in flash.h. All engines have same
+ * result as the byte-at-a-time table.
  *
  * @param crc accumulated CRC32 value, must be 0 on first call
  * @param buf buffer to calculate CRC32 value for
@@ -82,12 +242,593 @@ uint32_t calc_crc32(uint32_t crc, const void *buf, size_t size)
 {
     const uint8_t *p;
 
+#ifdef FLASH_CRC32_USING_PORT
+    extern uint32_t flash_crc32(uint32_t crc, const void *buf, size_t size);
+    /* calculate it by hardware CRC unit */
+    return flash_crc32(crc, buf, size);
+#endif
+
     p = buf;
     crc = crc ^ ~0U;
 
+#ifdef FLASH_CRC32_USING_PCLMUL
+    if (size >= 64) {
+        crc = calc_crc32_pclmul(crc, p, size / 16 * 16);
+        p += size / 16 * 16;
+        size %= 16;
+    }
+#endif
+
+#ifdef FLASH_CRC32_USING_SLICING
+    crc = calc_crc32_slicing(crc, p, size / FLASH_CRC32_SLICING_SIZE * FLASH_CRC32_SLICING_SIZE);
+    p += size / FLASH_CRC32_SLICING_SIZE * FLASH_CRC32_SLICING_SIZE;
+    size %= FLASH_CRC32_SLICING_SIZE;
+#endif
+
     while (size--) {
         crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
     }
 
     return crc ^ ~0U;
 }
+
+/**
+ * Set an unsigned 32 bits environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_u32(const char *key, uint32_t value) {
+    return flash_set_env_typed(key, &value, sizeof(value), FLASH_ENV_TYPE_U32);
+}
+
+/**
+ * Get an unsigned 32 bits environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_get_env_u32(const char *key, uint32_t *value) {
+    return flash_get_env_typed(key, value, sizeof(*value), FLASH_ENV_TYPE_U32);
+}
+
+/**
+ * Set a signed 32 bits environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_i32(const char *key, int32_t value) {
+    return flash_set_env_typed(key, &value, sizeof(value), FLASH_ENV_TYPE_I32);
+}
+
+/**
+ * Get a signed 32 bits environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_get_env_i32(const char *key, int32_t *value) {
+    return flash_get_env_typed(key, value, sizeof(*value), FLASH_ENV_TYPE_I32);
+}
+
+/**
+ * Set an unsigned 64 bits environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_u64(const char *key, uint64_t value) {
+    return flash_set_env_typed(key, &value, sizeof(value), FLASH_ENV_TYPE_U64);
+}
+
+/**
+ * Get an unsigned 64 bits environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_get_env_u64(const char *key, uint64_t *value) {
+    return flash_get_env_typed(key, value, sizeof(*value), FLASH_ENV_TYPE_U64);
+}
+
+/**
+ * Set a float environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_set_env_float(const char *key, float value) {
+    return flash_set_env_typed(key, &value, sizeof(value), FLASH_ENV_TYPE_FLOAT);
+}
+
+/**
+ * Get a float environment variable.
+ *
+ * @param key environment variable name
+ * @param value environment variable value
+ *
+ * @return result
+ */
+FlashErrCode flash_get_env_float(const char *key, float *value) {
+    return flash_get_env_typed(key, value, sizeof(*value), FLASH_ENV_TYPE_FLOAT);
+}
+
+/**
+ * Calculate the wear statistics of erase units by their erase counters.
+ *
+ * @param erase_cnt erase counters
+ * @param num erase counters number
+ * @param stats wear statistics
+ */
+void flash_calc_wear_stats(const uint32_t *erase_cnt, size_t num, flash_wear_stats *stats) {
+    uint64_t sum = 0;
+    size_t i;
+
+    FLASH_ASSERT(stats);
+
+    memset(stats, 0, sizeof(flash_wear_stats));
+    stats->sector_num = num;
+    for (i = 0; i < num; i++) {
+        if (i == 0 || erase_cnt[i] < stats->min) {
+            stats->min = erase_cnt[i];
+        }
+        if (erase_cnt[i] > stats->max) {
+            stats->max = erase_cnt[i];
+        }
+        sum += erase_cnt[i];
+    }
+    if (num) {
+        stats->mean = (uint32_t) (sum / num);
+    }
+    /* the most worn erase unit will be failed first */
+    if (stats->max < FLASH_ERASE_ENDURANCE) {
+        stats->remain_life = FLASH_ERASE_ENDURANCE - stats->max;
+    }
+}
+
+/**
+ * Print the erase counters histogram and wear statistics of an area.
+ *
+ * @param name area name
+ * @param get_erase_cnt the erase counters getter of area
+ */
+static void print_area_wear_stats(const char *name, size_t (*get_erase_cnt)(uint32_t *, size_t)) {
+    /* the histogram bar max length */
+    const size_t bar_max_len = 40;
+    size_t num = get_erase_cnt(NULL, 0), i, bar_len;
+    uint32_t *erase_cnt;
+    flash_wear_stats stats;
+
+    flash_print("%s wear statistics:\n", name);
+    if (!num) {
+        flash_print("No erase unit has been erased.\n\n");
+        return;
+    }
+    erase_cnt = (uint32_t *) flash_malloc(sizeof(uint32_t) * num);
+    if (!erase_cnt) {
+        flash_print("Error: No memory for erase counters.\n\n");
+        return;
+    }
+    get_erase_cnt(erase_cnt, num);
+    flash_calc_wear_stats(erase_cnt, num, &stats);
+    for (i = 0; i < num; i++) {
+        flash_print("%4lu: %8lu |", (unsigned long) i, (unsigned long) erase_cnt[i]);
+        bar_len = stats.max ? (size_t) ((uint64_t) erase_cnt[i] * bar_max_len / stats.max) : 0;
+        for (; bar_len; bar_len--) {
+            flash_print("#");
+        }
+        flash_print("\n");
+    }
+    flash_print("min: %lu, max: %lu, mean: %lu, remaining life: %lu erase cycles (%lu%%).\n\n",
+            (unsigned long) stats.min, (unsigned long) stats.max, (unsigned long) stats.mean,
+            (unsigned long) stats.remain_life,
+            (unsigned long) ((uint64_t) stats.remain_life * 100 / FLASH_ERASE_ENDURANCE));
+    flash_free(erase_cnt);
+}
+
+/**
+ * Print the erase counters histogram and wear statistics of environment variables area and
+ * backup area.
+ */
+void flash_print_wear_stats(void) {
+    print_area_wear_stats("Environment variables area", flash_get_env_erase_cnt);
+    print_area_wear_stats("Backup area", flash_get_bak_erase_cnt);
+}
+
+#ifdef FLASH_ENV_USING_ASYNC_SAVE
+/* the callback after every asynchronous saving */
+static flash_env_save_cb env_save_cb = NULL;
+static void *env_save_cb_arg = NULL;
+
+/**
+ * Request to save environment variables asynchronously. It returns immediately, the saving thread
+ * in port will save all changes which are made before the end of debounce window by one saving.
+ * @note The environment variables are durable when the saved generation of callback is not less
+ *       than the returned generation. Call flash_save_env() to save them immediately.
+ *
+ * @return the environment variables generation which will be saved
+ */
+uint32_t flash_save_env_async(void) {
+    uint32_t gen = flash_get_env_gen();
+
+    flash_env_async_notify();
+
+    return gen;
+}
+
+/**
+ * Set the callback after every asynchronous saving.
+ * @note It should be set before the first asynchronous saving request.
+ *
+ * @param cb the callback, NULL is no callback
+ * @param arg the callback argument
+ */
+void flash_set_env_save_cb(flash_env_save_cb cb, void *arg) {
+    env_save_cb_arg = arg;
+    env_save_cb = cb;
+}
+
+/**
+ * Save environment variables for all asynchronous saving requests. It's called by the saving thread
+ * in port after the debounce window, the requests which are made during saving will be handled by
+ * the next call. The saving which is deferred by erase budget has no callback, the saving thread
+ * should wait for the returned seconds, then request it again by flash_env_async_notify().
+ *
+ * @return the seconds to wait before requesting the deferred saving again, 0 is not deferred
+ */
+uint32_t flash_save_env_async_handler(void) {
+    FlashErrCode result = FLASH_NO_ERR;
+    uint32_t saved_gen;
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    flash_erase_budget budget;
+#endif
+
+    result = flash_save_env_gen(&saved_gen, NULL);
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+    if (result == FLASH_ENV_SAVE_DEFERRED) {
+        /* try again after the erase budget is refilled, it waits 1 second at least */
+        flash_get_env_erase_budget(&budget);
+        return budget.wait_sec ? budget.wait_sec : 1;
+    }
+#endif
+    if (result != FLASH_NO_ERR) {
+        FLASH_INFO("Error: Asynchronous saving environment variables failed (%d).\n", result);
+    }
+    if (env_save_cb) {
+        env_save_cb(result, saved_gen, env_save_cb_arg);
+    }
+
+    return 0;
+}
+#endif
+
+#ifdef FLASH_ENV_USING_ERASE_BUDGET
+/* one erase of budget, the budget units is 1/FLASH_ENV_ERASE_BUDGET_PERIOD erase */
+#define ERASE_BUDGET_ONE                FLASH_ENV_ERASE_BUDGET_PERIOD
+/* the maximum budget of every erase unit, it's calculated by unsigned and must fit the budget */
+#define ERASE_BUDGET_MAX                ((int32_t) ((uint32_t) FLASH_ENV_ERASE_BUDGET_BURST \
+        * (uint32_t) ERASE_BUDGET_ONE))
+
+/* the erase budget of every erase unit, it's negative when a saving erases more than its budget */
+static int32_t *erase_budget = NULL;
+static size_t erase_budget_num = 0;
+/* the time (second) of last budget refilling */
+static uint32_t erase_budget_time = 0;
+/* the deferred savings count */
+static uint32_t erase_budget_deferred = 0;
+
+/**
+ * Initialize the erase budget of environment variables area. Every erase unit has the burst budget
+ * after initialized, then the saved budget will be restored by loading.
+ *
+ * @param sector_num erase units number of environment variables area
+ *
+ * @return result
+ */
+FlashErrCode flash_erase_budget_init(size_t sector_num) {
+    FlashErrCode result = FLASH_NO_ERR;
+    size_t i;
+
+    FLASH_ASSERT(sector_num);
+    FLASH_ASSERT(FLASH_ENV_ERASE_BUDGET_NUM);
+    FLASH_ASSERT(FLASH_ENV_ERASE_BUDGET_BURST);
+    /* the maximum budget is storage by signed, so the burst erases of the period must fit it */
+    FLASH_ASSERT((uint32_t) FLASH_ENV_ERASE_BUDGET_PERIOD <= 0x7FFFFFFF
+            / (uint32_t) FLASH_ENV_ERASE_BUDGET_BURST);
+    /* make true only be initialized once */
+    FLASH_ASSERT(!erase_budget);
+
+    erase_budget = (int32_t *) flash_malloc(sizeof(int32_t) * sector_num);
+    FLASH_ASSERT(erase_budget);
+    for (i = 0; i < sector_num; i++) {
+        erase_budget[i] = ERASE_BUDGET_MAX;
+    }
+    erase_budget_num = sector_num;
+    erase_budget_time = flash_get_time();
+
+    return result;
+}
+
+/**
+ * Calculate the refilled budget of an erase unit.
+ *
+ * @param budget the budget at last refilling
+ * @param elapsed the seconds after last refilling
+ *
+ * @return the refilled budget
+ */
+static int32_t refill_erase_budget(int32_t budget, uint32_t elapsed) {
+    int64_t refilled = (int64_t) budget + (int64_t) elapsed * FLASH_ENV_ERASE_BUDGET_NUM;
+
+    return refilled > ERASE_BUDGET_MAX ? ERASE_BUDGET_MAX : (int32_t) refilled;
+}
+
+/**
+ * Refill the erase budget and check whether every erase unit which will be erased by the saving has
+ * one erase at least. The saving should be deferred when it returns FALSE.
+ *
+ * @param sector the first erase unit index which will be erased
+ * @param num the erase units number, it goes back to the first erase unit at the end
+ *
+ * @return TRUE: the saving can erase flash
+ */
+bool_t flash_erase_budget_check(size_t sector, size_t num) {
+    uint32_t now = flash_get_time();
+    bool_t is_ok = TRUE;
+    size_t i;
+
+    FLASH_ASSERT(erase_budget);
+    FLASH_ASSERT(sector < erase_budget_num);
+    FLASH_ASSERT(num <= erase_budget_num);
+
+    for (i = 0; i < erase_budget_num; i++) {
+        erase_budget[i] = refill_erase_budget(erase_budget[i], now - erase_budget_time);
+    }
+    erase_budget_time = now;
+    for (i = 0; i < num; i++) {
+        if (erase_budget[(sector + i) % erase_budget_num] < ERASE_BUDGET_ONE) {
+            is_ok = FALSE;
+        }
+    }
+
+    if (!is_ok) {
+        erase_budget_deferred++;
+        FLASH_DEBUG("Erase budget is exhausted, defer saving.\n");
+    }
+
+    return is_ok;
+}
+
+/**
+ * Get the erase budget of an erase unit for saving it with the erase counters. It's refilled until
+ * the last checking.
+ *
+ * @param sector the erase unit index in environment variables area
+ *
+ * @return the budget word
+ */
+uint32_t flash_erase_budget_get(size_t sector) {
+    FLASH_ASSERT(erase_budget);
+    FLASH_ASSERT(sector < erase_budget_num);
+
+    return (uint32_t) erase_budget[sector];
+}
+
+/**
+ * Set the erase budget of an erase unit. It's used for restoring the saved budget after power on,
+ * the budget is not refilled during power down. It's also used for updating the budget after the
+ * saving has charged its erases.
+ *
+ * @param sector the erase unit index in environment variables area
+ * @param budget the budget word
+ */
+void flash_erase_budget_set(size_t sector, uint32_t budget) {
+    FLASH_ASSERT(erase_budget);
+
+    if (sector < erase_budget_num) {
+        erase_budget[sector] = (int32_t) budget > ERASE_BUDGET_MAX ? ERASE_BUDGET_MAX
+                : (int32_t) budget;
+    }
+}
+
+/**
+ * Charge one erase to an erase budget word.
+ *
+ * @param budget the budget word
+ *
+ * @return the charged budget word
+ */
+uint32_t flash_erase_budget_charge(uint32_t budget) {
+    return (uint32_t) ((int32_t) budget - ERASE_BUDGET_ONE);
+}
+
+/**
+ * Get the erase budget of environment variables area.
+ *
+ * @param budget the erase budget
+ */
+void flash_get_env_erase_budget(flash_erase_budget *budget) {
+    int32_t min = ERASE_BUDGET_MAX, refilled;
+    uint32_t elapsed;
+    size_t i;
+
+    FLASH_ASSERT(budget);
+    FLASH_ASSERT(erase_budget);
+
+    FLASH_ENV_READ_LOCK();
+    elapsed = flash_get_time() - erase_budget_time;
+    for (i = 0; i < erase_budget_num; i++) {
+        refilled = refill_erase_budget(erase_budget[i], elapsed);
+        if (refilled < min) {
+            min = refilled;
+        }
+    }
+    budget->deferred = erase_budget_deferred;
+    FLASH_ENV_READ_UNLOCK();
+
+    budget->remain = min > 0 ? min / ERASE_BUDGET_ONE : 0;
+    budget->wait_sec = min < ERASE_BUDGET_ONE ? (ERASE_BUDGET_ONE - min
+            + FLASH_ENV_ERASE_BUDGET_NUM - 1) / FLASH_ENV_ERASE_BUDGET_NUM : 0;
+}
+#endif
+
+#ifdef FLASH_USING_STATS
+/* port Flash operations counters and public API latency statistics. They are updated without lock
+ * for low overhead, so they are approximate when multiple threads call the library at the same
+ * time, and a snapshot may be taken in the middle of an update. */
+static flash_stats stats = { 0 };
+/* the public API names for print, it's same order as flash_stats_api */
+static const char * const stats_api_name[] = {
+    "flash_init",
+    "flash_load_env",
+    "flash_save_env",
+    "flash_set_env",
+    "flash_get_env",
+    "flash_set_env_batch",
+    "flash_get_env_batch",
+    "flash_iterate_env",
+    "flash_reserve_env",
+    "flash_set_env_blob",
+    "flash_get_env_blob",
+    "flash_set_env_typed",
+    "flash_get_env_typed",
+    "flash_erase_bak_app",
+    "flash_erase_user_app",
+    "flash_erase_bl",
+    "flash_write_data_to_bak",
+    "flash_copy_app_from_bak",
+    "flash_copy_bl_from_bak",
+};
+
+/**
+ * Read data from flash by port and count it.
+ *
+ * @param addr flash address
+ * @param buf buffer to store read data
+ * @param size read bytes size
+ *
+ * @return result
+ */
+FlashErrCode flash_stats_read(uint32_t addr, uint32_t *buf, size_t size) {
+    stats.read_cnt++;
+    stats.read_bytes += size;
+    return flash_read(addr, buf, size);
+}
+
+/**
+ * Erase data on flash by port and count it.
+ *
+ * @param addr flash address
+ * @param size erase bytes size
+ *
+ * @return result
+ */
+FlashErrCode flash_stats_erase(uint32_t addr, size_t size) {
+    stats.erase_cnt++;
+    stats.erase_bytes += size;
+    return flash_erase(addr, size);
+}
+
+/**
+ * Write data to flash by port and count it.
+ *
+ * @param addr flash address
+ * @param buf the write data buffer
+ * @param size write bytes size
+ *
+ * @return result
+ */
+FlashErrCode flash_stats_write(uint32_t addr, const uint32_t *buf, size_t size) {
+    stats.write_cnt++;
+    stats.write_bytes += size;
+    return flash_write(addr, buf, size);
+}
+
+/**
+ * Record a public API call latency to its log2 histogram.
+ *
+ * @param api public API
+ * @param cycles the call latency by flash_get_cycles()
+ */
+void flash_stats_record(flash_stats_api api, uint32_t cycles) {
+    flash_api_stats *api_stats;
+    size_t bucket = 0;
+
+    FLASH_ASSERT(api < FLASH_STATS_API_NUM);
+
+    api_stats = &stats.api[api];
+    api_stats->calls++;
+    if (cycles > api_stats->max_cycles) {
+        api_stats->max_cycles = cycles;
+    }
+    /* the bucket N counts the calls which take [2^N, 2^(N+1)) cycles */
+    while ((cycles >>= 1) && bucket < FLASH_STATS_HIST_SIZE - 1) {
+        bucket++;
+    }
+    api_stats->hist[bucket]++;
+}
+
+/**
+ * Get a snapshot of the operations counters and API latency statistics.
+ *
+ * @param snapshot the statistics snapshot
+ */
+void flash_get_stats(flash_stats *snapshot) {
+    FLASH_ASSERT(snapshot);
+
+    memcpy(snapshot, &stats, sizeof(flash_stats));
+}
+
+/**
+ * Clear the operations counters and API latency statistics.
+ */
+void flash_reset_stats(void) {
+    memset(&stats, 0, sizeof(flash_stats));
+}
+
+/**
+ * Print the operations counters and latency histogram of every called public API.
+ */
+void flash_print_stats(void) {
+    flash_stats snapshot;
+    flash_api_stats *api_stats;
+    size_t i, j;
+
+    flash_get_stats(&snapshot);
+    flash_print("Flash read: %lu times, %lu bytes\n", (unsigned long) snapshot.read_cnt,
+            (unsigned long) snapshot.read_bytes);
+    flash_print("Flash erase: %lu times, %lu bytes\n", (unsigned long) snapshot.erase_cnt,
+            (unsigned long) snapshot.erase_bytes);
+    flash_print("Flash write: %lu times, %lu bytes\n", (unsigned long) snapshot.write_cnt,
+            (unsigned long) snapshot.write_bytes);
+    for (i = 0; i < FLASH_STATS_API_NUM; i++) {
+        api_stats = &snapshot.api[i];
+        if (!api_stats->calls) {
+            continue;
+        }
+        flash_print("%s: %lu calls, max %lu cycles\n", stats_api_name[i],
+                (unsigned long) api_stats->calls, (unsigned long) api_stats->max_cycles);
+        for (j = 0; j < FLASH_STATS_HIST_SIZE; j++) {
+            if (api_stats->hist[j]) {
+                flash_print("  [2^%lu, 2^%lu): %lu\n", (unsigned long) j, (unsigned long) (j + 1),
+                        (unsigned long) api_stats->hist[j]);
+            }
+        }
+    }
+}
+#endif /* FLASH_USING_STATS */